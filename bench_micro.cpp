@@ -0,0 +1,1024 @@
+/**
+ * bench_micro.cpp
+ *
+ * Microbenchmarks for the hot paths: moveTowards vs advanceLeg, ParkingLot
+ * under contention, Vehicle::sendUpdate, visualizer message decoding, road
+ * network loading, road graph construction, routing, route repair, car
+ * following, spatial hashing, junction reservations, the light board, the
+ * spawn scheduler and the command protocol.
+ * Each kernel is warmed up, then timed over several repetitions; the
+ * report is one JSON object per kernel with per-op statistics.
+ *
+ * Usage: ./bench_micro [--reps N] [--filter SUBSTRING]
+ */
+
+#include "simulation_types.h"
+#include "parking.h"
+#include "vehicle.h"
+#include "visualizer_state.h"
+#include "roadnet.h"
+#include "routing.h"
+#include "lanes.h"
+#include "spatialhash.h"
+#include "reservation.h"
+#include "corridor.h"
+#include "signals.h"
+#include "spawner.h"
+#include "command.h"
+#include "demand.h"
+#include "rng.h"
+#include "migration.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Keeps results alive so the optimizer cannot drop the measured work
+volatile float benchSink;
+
+struct BenchStats {
+    double minNs;
+    double medianNs;
+    double meanNs;
+    double stddevNs;
+    double maxNs;
+};
+
+BenchStats computeStats(vector<double> samples) {
+    BenchStats s;
+    sort(samples.begin(), samples.end());
+    s.minNs = samples.front();
+    s.maxNs = samples.back();
+    s.medianNs = samples[samples.size() / 2];
+    double sum = 0;
+    for (double x : samples) sum += x;
+    s.meanNs = sum / samples.size();
+    double var = 0;
+    for (double x : samples) var += (x - s.meanNs) * (x - s.meanNs);
+    s.stddevNs = samples.size() > 1 ? sqrt(var / (samples.size() - 1)) : 0.0;
+    return s;
+}
+
+// A kernel runs `ops` operations and returns the elapsed nanoseconds
+typedef function<double(long ops)> Kernel;
+
+int repetitions = 15;
+string filter;
+bool firstReport = true;
+
+void runBenchmark(const string& name, long ops, Kernel kernel) {
+    if (!filter.empty() && name.find(filter) == string::npos) return;
+
+    // Warmup: one untimed pass to fault in memory and settle caches
+    kernel(ops);
+
+    vector<double> nsPerOp;
+    for (int r = 0; r < repetitions; ++r) {
+        nsPerOp.push_back(kernel(ops) / ops);
+    }
+    BenchStats s = computeStats(nsPerOp);
+
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"name\": \"%s\", \"ops\": %ld, \"reps\": %d, \"ns_per_op_min\": %.2f, "
+             "\"ns_per_op_median\": %.2f, \"ns_per_op_mean\": %.2f, \"ns_per_op_stddev\": %.2f, "
+             "\"ns_per_op_max\": %.2f, \"ops_per_sec\": %.0f}",
+             name.c_str(), ops, repetitions, s.minNs, s.medianNs, s.meanNs, s.stddevNs,
+             s.maxNs, 1e9 / s.medianNs);
+    cout << (firstReport ? "  " : ",\n  ") << buf;
+    cout.flush();
+    firstReport = false;
+}
+
+double elapsedNs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+}
+
+// ==========================================
+// moveTowards
+// ==========================================
+
+double benchMoveTowards(long ops) {
+    float x = 0, y = 400;
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < ops; ++i) {
+        if (moveTowards(x, y, 1200.0f, 320.0f, 2.0f)) {
+            x = 0;
+            y = 400;
+        }
+    }
+    double ns = elapsedNs(start);
+    benchSink = x + y;
+    return ns;
+}
+
+// One vehicle driving the f10_local road leg over and over on the graph
+double benchAdvanceLeg(long ops) {
+    TripPlan plan = tripPlanFor("f10_local");
+    Vehicle v(1, VehicleType::CAR, -1);
+    placeAtStart(&v, plan);
+    auto start = chrono::steady_clock::now();
+    for (long i = 0; i < ops; ++i) {
+        if (advanceLeg(&v, plan.endNode)) {
+            placeAtStart(&v, plan);
+        }
+    }
+    double ns = elapsedNs(start);
+    benchSink = v.x + v.y;
+    return ns;
+}
+
+// ==========================================
+// ParkingLot under contention
+// ==========================================
+
+struct ParkingBenchArgs {
+    ParkingLot* lot;
+    long cycles;
+    pthread_barrier_t* barrier;
+};
+
+// One cycle: try the queue, and if admitted take a spot and leave it again
+void* parkingWorker(void* arg) {
+    ParkingBenchArgs* a = (ParkingBenchArgs*)arg;
+    pthread_barrier_wait(a->barrier);
+    for (long i = 0; i < a->cycles; ++i) {
+        int queueIdx = a->lot->enterQueue();
+        if (queueIdx != -1) {
+            int spotIndex = a->lot->waitForSpot(queueIdx);
+            a->lot->leave(spotIndex);
+        }
+    }
+    return nullptr;
+}
+
+Kernel makeParkingKernel(int threads) {
+    return [threads](long ops) {
+        ParkingLot lot;
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, nullptr, threads + 1);
+
+        vector<pthread_t> tids(threads);
+        vector<ParkingBenchArgs> args(threads);
+        for (int t = 0; t < threads; ++t) {
+            args[t].lot = &lot;
+            args[t].cycles = ops / threads;
+            args[t].barrier = &barrier;
+            pthread_create(&tids[t], nullptr, parkingWorker, &args[t]);
+        }
+
+        pthread_barrier_wait(&barrier);
+        auto start = chrono::steady_clock::now();
+        for (auto tid : tids) pthread_join(tid, nullptr);
+        double ns = elapsedNs(start);
+
+        pthread_barrier_destroy(&barrier);
+        return ns;
+    };
+}
+
+// ==========================================
+// Vehicle::sendUpdate
+// ==========================================
+
+Kernel makeSendUpdateKernel(bool withLot) {
+    return [withLot](long ops) {
+        // /dev/null keeps the write syscall but removes reader scheduling noise
+        int fd = open("/dev/null", O_WRONLY);
+        ParkingLot lot;
+        Vehicle v(1, VehicleType::CAR, fd, withLot ? &lot : nullptr);
+        v.x = 100;
+        v.y = 400;
+
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            v.sendUpdate();
+        }
+        double ns = elapsedNs(start);
+        close(fd);
+        return ns;
+    };
+}
+
+// ==========================================
+// Visualizer message decoding
+// ==========================================
+
+// Power of two so the kernels can wrap with a mask
+const int MESSAGE_MIX_SIZE = 32768;
+
+vector<PipeMessage> makeMessageMix(int vehicleCount) {
+    vector<PipeMessage> msgs;
+    for (int i = 0; i < MESSAGE_MIX_SIZE; ++i) {
+        PipeMessage msg;
+        msg.magic = MSG_MAGIC;
+        msg.timestampNs = 0;
+        if (i % 16 == 0) {
+            msg.type = PipeMessage::LIGHT_UPDATE;
+            msg.data.light.intersectionId = (i % 32 == 0) ? 10 : 11;
+            for (int d = 0; d < DIRECTION_COUNT; ++d) msg.data.light.states[d] = TrafficLightState::GREEN;
+        } else if (i % 2 == 0) {
+            msg.type = PipeMessage::PARKING_UPDATE;
+            msg.data.parking.intersectionId = 10;
+            msg.data.parking.waitingCount = i % PARKING_QUEUE_SIZE;
+        } else {
+            Vehicle v(i % vehicleCount, (VehicleType)(i % 6), -1);
+            msg.type = PipeMessage::VEHICLE_UPDATE;
+            msg.data.vehicle.id = v.id;
+            msg.data.vehicle.x = (float)(i % 1200);
+            msg.data.vehicle.y = 400;
+            msg.data.vehicle.isActive = true;
+            msg.data.vehicle.isParked = false;
+            msg.data.vehicle.isInQueue = false;
+            msg.data.vehicle.queueIndex = -1;
+            msg.data.vehicle.isLeftParking = false;
+            msg.data.vehicle.type = v.type;
+            v.getColor(msg.data.vehicle.colorR, msg.data.vehicle.colorG, msg.data.vehicle.colorB);
+        }
+        msgs.push_back(msg);
+    }
+    return msgs;
+}
+
+Kernel makeParseKernel(int vehicleCount) {
+    vector<PipeMessage> msgs = makeMessageMix(vehicleCount);
+    return [msgs](long ops) {
+        VisualizerState state;
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            applyPipeMessage(state, msgs[i & (MESSAGE_MIX_SIZE - 1)], (uint64_t)i);
+            // The visualizer presents a frame every few thousand messages at most
+            if ((i & 4095) == 4095) state.pendingIngestNs.clear();
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)state.vehicles.size();
+        state.pendingIngestNs.clear();
+        return ns;
+    };
+}
+
+// Full path through a real pipe: write a batch, then drainPipe() it
+Kernel makePipeDrainKernel() {
+    vector<PipeMessage> msgs = makeMessageMix(64);
+    return [msgs](long ops) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("Pipe creation failed");
+            exit(1);
+        }
+        setNonBlocking(fds[0]);
+        VisualizerState state;
+
+        // Batches stay under the 64KB pipe buffer so writes never block
+        const long batch = 512;
+        auto start = chrono::steady_clock::now();
+        for (long done = 0; done < ops; done += batch) {
+            for (long i = 0; i < batch; ++i) {
+                write(fds[1], &msgs[(done + i) & (MESSAGE_MIX_SIZE - 1)], sizeof(PipeMessage));
+            }
+            drainPipe(fds[0], state);
+            markPresented(state, monotonicNs());
+        }
+        double ns = elapsedNs(start);
+        close(fds[0]);
+        close(fds[1]);
+        return ns;
+    };
+}
+
+// ==========================================
+// Road network loading
+// ==========================================
+
+// Synthetic network: a chain of `links` links with an intersection every
+// tenth node, in the same text format as road_network.txt
+string makeNetworkText(int links) {
+    string text = "# synthetic\n";
+    char line[160];
+    for (int i = 0; i <= links; i += 10) {
+        snprintf(line, sizeof(line), "intersection %d I%d %d 400 100 %d 320\n",
+                 i, i % 100000, i * 100, i * 100 - 40);
+        text += line;
+        snprintf(line, sizeof(line), "stopline %d W %d\nstopline %d E %d\n",
+                 i, i * 100 - 60, i, i * 100 + 60);
+        text += line;
+    }
+    for (int i = 0; i < links; ++i) {
+        snprintf(line, sizeof(line), "link %d %d.0 400.0 %d.0 400.0 100 2\n", i, i * 100, (i + 1) * 100);
+        text += line;
+    }
+    return text;
+}
+
+// CSR build of a side x side grid with two-way streets, as a stand-in for
+// a city-scale network
+Kernel makeGridGraphKernel(int side) {
+    return [side](long ops) {
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            RoadGraph g;
+            makeGridGraph(side, side, 100.0f, g);
+            benchSink = (float)g.edgeCount();
+        }
+        return elapsedNs(start);
+    };
+}
+
+// ==========================================
+// Car following
+// ==========================================
+
+// The synthetic chain with `junctions` signalled intersections after the
+// first, all on one eastbound corridor
+string makeCorridorText(int junctions) {
+    int links = junctions * 10;
+    string text = makeNetworkText(links);
+    string corridor = "corridor W";
+    char line[80];
+    for (int i = 10; i <= links; i += 10) {
+        snprintf(line, sizeof(line), "phase %d WE 2500 500 500\n", i);
+        text += line;
+        corridor += " " + to_string(i);
+    }
+    return text + corridor + "\n";
+}
+
+// One op recomputes every offset of a corridor of `junctions` junctions
+// from travel times that vary along it
+Kernel makeGreenWaveKernel(int junctions) {
+    string text = makeCorridorText(junctions);
+    shared_ptr<RoadNetwork> net = make_shared<RoadNetwork>();
+    string error;
+    if (!parseRoadNetwork(text.data(), text.size(), *net, error)) {
+        cerr << "Synthetic corridor rejected: " << error << endl;
+        exit(1);
+    }
+    shared_ptr<RoadGraph> g = make_shared<RoadGraph>();
+    buildNetworkGraph(*net, *g);
+    shared_ptr<TravelTimes> times = make_shared<TravelTimes>(*g, 2.0f);
+    times->alpha = 1.0f;
+    srand(13);
+    for (int e = 0; e < g->edgeCount(); ++e) {
+        times->record(e, times->freeFlow(e) * (1 + rand() % 3));
+    }
+    shared_ptr<GreenWave> wave = make_shared<GreenWave>(*net, *g);
+
+    long long clockMs = 0; // Runs on across repetitions
+    return [net, g, times, wave, clockMs](long ops) mutable {
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            clockMs += GREEN_WAVE_UPDATE_MS;
+            wave->maintain(clockMs, *times);
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)wave->offsetOf((int)net->intersections.size() - 1);
+        return ns;
+    };
+}
+
+// `lanes` lanes of `perLane` vehicles each, spaced out and moving. One op
+// updates every vehicle's speed, either with LaneTable::updateAll() or with
+// a follow() call per vehicle as the controller threads do.
+Kernel makeLaneKernel(int lanes, int perLane, bool batched) {
+    shared_ptr<RoadGraph> g = make_shared<RoadGraph>();
+    makeGridGraph(1, lanes + 1, perLane * 60.0f, *g);
+    shared_ptr<LaneTable> table = make_shared<LaneTable>(*g);
+    shared_ptr<vector<Vehicle>> vehicles = make_shared<vector<Vehicle>>();
+    vehicles->reserve(lanes * perLane);
+    for (int e = 0; e < lanes; ++e) {
+        int edge = g->findEdge(e, e + 1);
+        for (int i = 0; i < perLane; ++i) {
+            vehicles->push_back(Vehicle(e * perLane + i, VehicleType::CAR, -1));
+            Vehicle& v = vehicles->back();
+            v.edge = edge;
+            v.offset = (perLane - i) * 55.0f;
+            v.velocity = 1.0f + (i % 3) * 0.5f;
+            table->enter(&v, edge);
+        }
+    }
+
+    return [g, table, vehicles, batched](long ops) {
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            if (batched) {
+                table->updateAll();
+            } else {
+                for (Vehicle& v : *vehicles) table->follow(&v);
+            }
+        }
+        double ns = elapsedNs(start);
+        benchSink = (*vehicles)[0].velocity;
+        return ns;
+    };
+}
+
+// ==========================================
+// Spatial hash
+// ==========================================
+
+// `points` random points at the density of a busy 1200x800 window (about
+// 2000 vehicles). One op finds every pair closer than VEHICLE_LENGTH, either
+// by rebuilding a SpatialHash and walking adjacent cells or by comparing
+// all N^2 / 2 pairs.
+Kernel makeProximityKernel(int points, bool hashed) {
+    float side = sqrt(points * 1200.0f * 800.0f / 2000.0f);
+    shared_ptr<vector<float>> x = make_shared<vector<float>>(points);
+    shared_ptr<vector<float>> y = make_shared<vector<float>>(points);
+    srand(11);
+    for (int i = 0; i < points; ++i) {
+        (*x)[i] = side * rand() / RAND_MAX;
+        (*y)[i] = side * rand() / RAND_MAX;
+    }
+    shared_ptr<SpatialHash> hash = make_shared<SpatialHash>(0, 0, side, side, VEHICLE_LENGTH);
+
+    return [x, y, hash, points, hashed](long ops) {
+        const float* px = x->data();
+        const float* py = y->data();
+        long pairs = 0;
+        auto start = chrono::steady_clock::now();
+        for (long op = 0; op < ops; ++op) {
+            if (hashed) {
+                hash->rebuild(px, py, points);
+                hash->forEachPair(px, py, VEHICLE_LENGTH, [&](int, int) { pairs++; });
+            } else {
+                float r2 = VEHICLE_LENGTH * VEHICLE_LENGTH;
+                for (int i = 0; i < points; ++i) {
+                    for (int j = i + 1; j < points; ++j) {
+                        float dx = px[j] - px[i], dy = py[j] - py[i];
+                        if (dx * dx + dy * dy < r2) pairs++;
+                    }
+                }
+            }
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)pairs;
+        return ns;
+    };
+}
+
+// ==========================================
+// Junction reservations
+// ==========================================
+
+struct ReservationBenchArgs {
+    IntersectionManager* manager;
+    const vector<int>* path;
+    int junction;
+    int firstId;
+    long requests;
+    long granted;
+    pthread_barrier_t* barrier;
+};
+
+// Cross F10 from a standing start, one new vehicle per request, moving the
+// clock on every fourth request
+void* reservationWorker(void* arg) {
+    ReservationBenchArgs* a = (ReservationBenchArgs*)arg;
+    pthread_barrier_wait(a->barrier);
+    for (long i = 0; i < a->requests; ++i) {
+        if (a->manager->request(a->junction, a->firstId + (int)i, *a->path, 0, 2.0f)) { // A car
+            a->granted++;
+        }
+        if (i % 4 == 3) a->manager->advanceTo(a->manager->now() + 1);
+    }
+    return nullptr;
+}
+
+// `threads` threads requesting crossings of the same junction, alternately
+// from its west and east stop lines
+Kernel makeReservationKernel(int threads) {
+    TripPlan west = tripPlanFor("f10_local");
+    TripPlan east = tripPlanFor("f10_commuter");
+    shared_ptr<vector<int>> westPath = make_shared<vector<int>>();
+    shared_ptr<vector<int>> eastPath = make_shared<vector<int>>();
+    roadRouter().route(west.stopNode, west.endNode, *westPath);
+    roadRouter().route(east.stopNode, east.endNode, *eastPath);
+    int junction = west.junction;
+
+    return [threads, westPath, eastPath, junction](long ops) {
+        IntersectionManager manager(roadNetwork(), roadGraph());
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, nullptr, threads + 1);
+
+        vector<pthread_t> tids(threads);
+        vector<ReservationBenchArgs> args(threads);
+        for (int t = 0; t < threads; ++t) {
+            args[t].manager = &manager;
+            args[t].path = t % 2 == 0 ? westPath.get() : eastPath.get();
+            args[t].junction = junction;
+            args[t].requests = ops / threads;
+            args[t].firstId = t * (int)args[t].requests;
+            args[t].granted = 0;
+            args[t].barrier = &barrier;
+            pthread_create(&tids[t], nullptr, reservationWorker, &args[t]);
+        }
+
+        pthread_barrier_wait(&barrier);
+        auto start = chrono::steady_clock::now();
+        for (auto tid : tids) pthread_join(tid, nullptr);
+        double ns = elapsedNs(start);
+
+        long granted = 0;
+        for (auto& a : args) granted += a.granted;
+        benchSink = (float)granted;
+        pthread_barrier_destroy(&barrier);
+        return ns;
+    };
+}
+
+// ==========================================
+// Light board
+// ==========================================
+
+struct LightBenchArgs {
+    int junction;
+    long loads;
+    long green;
+    pthread_barrier_t* barrier;
+    atomic<int>* finished;
+};
+
+// A waiting vehicle polling its light, without the sleep
+void* lightReader(void* arg) {
+    LightBenchArgs* a = (LightBenchArgs*)arg;
+    pthread_barrier_wait(a->barrier);
+    for (long i = 0; i < a->loads; ++i) {
+        if (loadLight(a->junction, Direction::WEST_EAST) == TrafficLightState::GREEN) a->green++;
+    }
+    a->finished->fetch_add(1);
+    return nullptr;
+}
+
+// `threads` readers spread over the junctions while the main thread keeps
+// republishing every junction's lights, as a busy controller would
+Kernel makeLightKernel(int threads) {
+    return [threads](long ops) {
+        int junctions = max((int)roadNetwork().intersections.size(), 1);
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, nullptr, threads + 1);
+        atomic<int> finished(0);
+
+        vector<pthread_t> tids(threads);
+        vector<LightBenchArgs> args(threads);
+        for (int t = 0; t < threads; ++t) {
+            args[t].junction = t % junctions;
+            args[t].loads = ops / threads;
+            args[t].green = 0;
+            args[t].barrier = &barrier;
+            args[t].finished = &finished;
+            pthread_create(&tids[t], nullptr, lightReader, &args[t]);
+        }
+
+        TrafficLightState states[DIRECTION_COUNT] = {};
+        pthread_barrier_wait(&barrier);
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; finished.load() < threads; ++i) {
+            states[0] = i % 2 ? TrafficLightState::GREEN : TrafficLightState::RED;
+            storeLights((int)(i % junctions), states);
+        }
+        double ns = elapsedNs(start);
+        for (auto tid : tids) pthread_join(tid, nullptr);
+
+        long green = 0;
+        for (auto& a : args) green += a.green;
+        benchSink = (float)green;
+        pthread_barrier_destroy(&barrier);
+        return ns;
+    };
+}
+
+// ==========================================
+// Random numbers
+// ==========================================
+
+struct RandomBenchArgs {
+    bool philox; // Else libc rand()
+    int thread;
+    long draws;
+    uint64_t sum;
+    pthread_barrier_t* barrier;
+};
+
+void* randomDrawer(void* arg) {
+    RandomBenchArgs* a = (RandomBenchArgs*)arg;
+    pthread_barrier_wait(a->barrier);
+    uint64_t sum = 0;
+    if (a->philox) {
+        RandomStream stream({1, 0, RandomKind::VEHICLE, (uint32_t)a->thread});
+        for (long i = 0; i < a->draws; ++i) sum += stream.next();
+    } else {
+        for (long i = 0; i < a->draws; ++i) sum += rand();
+    }
+    a->sum = sum;
+    return nullptr;
+}
+
+// `threads` spawners drawing at once, from their own Philox streams or
+// from the shared rand(). An op is one draw.
+Kernel makeRandomKernel(int threads, bool philox) {
+    return [threads, philox](long ops) {
+        pthread_barrier_t barrier;
+        pthread_barrier_init(&barrier, nullptr, threads + 1);
+        vector<pthread_t> tids(threads);
+        vector<RandomBenchArgs> args(threads);
+        for (int t = 0; t < threads; ++t) {
+            args[t] = {philox, t, ops / threads, 0, &barrier};
+            pthread_create(&tids[t], nullptr, randomDrawer, &args[t]);
+        }
+
+        pthread_barrier_wait(&barrier);
+        auto start = chrono::steady_clock::now();
+        for (auto tid : tids) pthread_join(tid, nullptr);
+        double ns = elapsedNs(start);
+
+        uint64_t sum = 0;
+        for (auto& a : args) sum += a.sum;
+        benchSink = (float)sum;
+        pthread_barrier_destroy(&barrier);
+        return ns;
+    };
+}
+
+// ==========================================
+// Spawn scheduler
+// ==========================================
+
+// `commands` bulk injections of `vehicles` each, 1 ms apart, drained as a
+// controller would: up to SPAWN_DRAIN_MAX per pass of a 1 ms clock. An op
+// is one vehicle.
+Kernel makeSpawnKernel(int commands, int vehicles) {
+    vector<SpawnBatch> batches = {
+        {0, vehicles / 2, TypeMix::CAR, 0, 0},
+        {1, vehicles - vehicles / 2, TypeMix::NO_EMERGENCY, 1, 1},
+    };
+    return [commands, batches](long ops) {
+        long popped = 0;
+        auto start = chrono::steady_clock::now();
+        for (long done = 0; done < ops; done += popped) {
+            SpawnScheduler spawns(1, 0);
+            for (int c = 0; c < commands; ++c) spawns.inject(batches, (uint64_t)c * 1000000ull);
+            popped = 0;
+            SpawnEvent event;
+            for (uint64_t nowNs = 0; spawns.pending() > 0; nowNs += 1000000ull) {
+                for (int i = 0; i < SPAWN_DRAIN_MAX && spawns.pop(nowNs, event); ++i) popped++;
+            }
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)popped;
+        return ns;
+    };
+}
+
+// ==========================================
+// Demand
+// ==========================================
+
+// Arrivals from every spawn point's demand, scaled up so the network sees
+// about 50k a simulated second, popped 1 ms at a time. An op is one
+// arrival.
+Kernel makeDemandKernel(double scale) {
+    return [scale](long ops) {
+        const RoadNetwork& net = roadNetwork();
+        vector<int> spawns;
+        for (int i = 0; i < (int)net.spawns.size(); ++i) spawns.push_back(i);
+        DemandGenerator demand(net, spawns, 1, 0, scale);
+        if (!demand.hasDemand()) {
+            cerr << "No demand in the road network" << endl;
+            exit(1);
+        }
+        demand.start(0);
+        long popped = 0;
+        int types = 0;
+        Arrival arrival;
+        auto start = chrono::steady_clock::now();
+        for (uint64_t nowNs = 0; popped < ops; nowNs += 1000000ull) {
+            while (popped < ops && demand.pop(nowNs, arrival)) {
+                types += (int)arrival.type;
+                popped++;
+            }
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)types;
+        return ns;
+    };
+}
+
+// ==========================================
+// Command protocol
+// ==========================================
+
+// SPAWN commands through a non-blocking pipe: a burst of 32 written, then
+// read back and decoded. An op is one command.
+Kernel makeCommandKernel() {
+    return [](long ops) {
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("pipe");
+            exit(1);
+        }
+        setNonBlocking(fds[0]);
+        Command cmd = makeCommand(CommandType::SPAWN);
+        cmd.params.spawn.count = 1000;
+        CommandReader reader;
+        Command decoded;
+        long seen = 0;
+
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; i += 32) {
+            for (int k = 0; k < 32; ++k) sendCommand(fds[1], cmd);
+            reader.fill(fds[0]);
+            while (reader.next(decoded)) seen += decoded.params.spawn.count;
+        }
+        double ns = elapsedNs(start);
+
+        benchSink = (float)seen;
+        close(fds[0]);
+        close(fds[1]);
+        return ns;
+    };
+}
+
+// ==========================================
+// Migration mailbox
+// ==========================================
+
+struct MailboxBenchArgs {
+    MigrationMailbox* box;
+    long pushes;
+};
+
+static void* mailboxProducer(void* arg) {
+    MailboxBenchArgs* a = (MailboxBenchArgs*)arg;
+    MigrationRecord r = MigrationRecord();
+    for (long i = 0; i < a->pushes; ++i) {
+        r.id = (int32_t)i;
+        // Full: let the consumer run on a busy machine
+        while (!mailboxPush(*a->box, r)) sched_yield();
+    }
+    return nullptr;
+}
+
+// Vehicle records through one domain's mailbox. With no producer threads
+// this thread pushes bursts of 32 and drains them; otherwise `producers`
+// threads push while it drains, as other controllers do. An op is one
+// record.
+Kernel makeMailboxKernel(int producers) {
+    return [producers](long ops) {
+        MigrationMailbox* box = &roadMailboxes()[0];
+        MigrationRecord r = MigrationRecord();
+        long sum = 0;
+        long popped = 0;
+
+        if (producers == 0) {
+            auto start = chrono::steady_clock::now();
+            for (long i = 0; i < ops; i += 32) {
+                for (int k = 0; k < 32; ++k) {
+                    r.id = k;
+                    mailboxPush(*box, r);
+                }
+                while (mailboxPop(*box, r)) sum += r.id;
+            }
+            double ns = elapsedNs(start);
+            benchSink = (float)sum;
+            return ns;
+        }
+
+        vector<pthread_t> tids(producers);
+        vector<MailboxBenchArgs> args(producers);
+        auto start = chrono::steady_clock::now();
+        for (int t = 0; t < producers; ++t) {
+            args[t] = {box, ops / producers};
+            pthread_create(&tids[t], nullptr, mailboxProducer, &args[t]);
+        }
+        long expected = ops / producers * producers;
+        while (popped < expected) {
+            if (mailboxPop(*box, r)) {
+                sum += r.id;
+                popped++;
+            } else {
+                sched_yield();
+            }
+        }
+        double ns = elapsedNs(start);
+        for (auto tid : tids) pthread_join(tid, nullptr);
+        benchSink = (float)sum;
+        return ns;
+    };
+}
+
+// ==========================================
+// Routing
+// ==========================================
+
+// Random origin-destination pairs on a graph, fixed seed
+vector<pair<int, int>> makeOdPairs(const RoadGraph& g, int count) {
+    vector<pair<int, int>> pairs;
+    srand(7);
+    for (int i = 0; i < count; ++i) {
+        pairs.push_back(make_pair(rand() % g.nodeCount(), rand() % g.nodeCount()));
+    }
+    return pairs;
+}
+
+typedef bool (Router::*RouteQuery)(int, int, vector<int>&);
+
+Kernel makeRouteKernel(Router* router, const RoadGraph* g, RouteQuery query) {
+    vector<pair<int, int>> pairs = makeOdPairs(*g, 1024);
+    return [router, query, pairs](long ops) {
+        vector<int> edges;
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            const pair<int, int>& od = pairs[i & 1023];
+            (router->*query)(od.first, od.second, edges);
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)edges.size();
+        return ns;
+    };
+}
+
+Kernel makeChBuildKernel(int side) {
+    return [side](long ops) {
+        RoadGraph g;
+        makeGridGraph(side, side, 100.0f, g);
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            Router router(g);
+            router.buildContractionHierarchy();
+            benchSink = (float)router.getShortcutCount();
+        }
+        return elapsedNs(start);
+    };
+}
+
+// Incremental reroute of 1024 routes through a grid where a fifth of the
+// edges run at a tenth of free-flow speed. Each op repairs the first
+// REROUTE_HORIZON_EDGES edges of one route.
+Kernel makeRepairKernel(Router* router, const RoadGraph* g) {
+    shared_ptr<TravelTimes> times = make_shared<TravelTimes>(*g, 2.0f);
+    times->alpha = 1.0f;
+    srand(11);
+    for (int e = 0; e < g->edgeCount(); ++e) {
+        if (rand() % 5 == 0) times->record(e, times->freeFlow(e) * 10);
+    }
+
+    vector<vector<int>> routes;
+    for (const pair<int, int>& od : makeOdPairs(*g, 1024)) {
+        vector<int> edges;
+        router->bidirectionalDijkstra(od.first, od.second, edges);
+        if (edges.size() > 1) routes.push_back(edges);
+    }
+
+    return [router, times, routes](long ops) {
+        vector<int> route;
+        long changed = 0;
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            route = routes[i % routes.size()];
+            if (router->repairRoute(route, 0, REROUTE_HORIZON_EDGES, *times)) changed++;
+        }
+        double ns = elapsedNs(start);
+        benchSink = (float)changed;
+        return ns;
+    };
+}
+
+bool wantsAny(const vector<string>& names) {
+    if (filter.empty()) return true;
+    for (const string& name : names) {
+        if (name.find(filter) != string::npos) return true;
+    }
+    return false;
+}
+
+void runRoutingBenchmarks() {
+    runBenchmark("build_ch_grid_100x100", 1, makeChBuildKernel(100));
+
+    // ~100k nodes. The hierarchy is built once, outside the timings, and
+    // only when route_ch runs since it takes a while unoptimized.
+    if (!wantsAny({"route_bidirectional_dijkstra", "route_astar", "route_ch", "route_cached",
+                   "route_repair"})) {
+        return;
+    }
+    RoadGraph grid;
+    makeGridGraph(316, 316, 100.0f, grid);
+    Router router(grid);
+    if (wantsAny({"route_ch"})) {
+        auto start = chrono::steady_clock::now();
+        router.buildContractionHierarchy();
+        cerr << "contraction hierarchy on " << grid.nodeCount() << " nodes: "
+             << elapsedNs(start) / 1e9 << " s, " << router.getShortcutCount() << " shortcuts" << endl;
+    }
+
+    runBenchmark("route_bidirectional_dijkstra_100k_nodes", 64,
+                 makeRouteKernel(&router, &grid, &Router::bidirectionalDijkstra));
+    runBenchmark("route_astar_100k_nodes", 64, makeRouteKernel(&router, &grid, &Router::aStar));
+    runBenchmark("route_ch_100k_nodes", 4096, makeRouteKernel(&router, &grid, &Router::chQuery));
+    // 1024 OD pairs fit the cache, so after warmup every lookup is a hit
+    runBenchmark("route_cached_100k_nodes", 100000, makeRouteKernel(&router, &grid, &Router::route));
+    runBenchmark("route_repair_100k_nodes", 1000, makeRepairKernel(&router, &grid));
+}
+
+Kernel makeNetworkLoadKernel(int links) {
+    string text = makeNetworkText(links);
+    return [text](long ops) {
+        auto start = chrono::steady_clock::now();
+        for (long i = 0; i < ops; ++i) {
+            RoadNetwork net;
+            string error;
+            if (!parseRoadNetwork(text.data(), text.size(), net, error)) {
+                cerr << "Synthetic network rejected: " << error << endl;
+                exit(1);
+            }
+            benchSink = (float)net.links.size();
+        }
+        return elapsedNs(start);
+    };
+}
+
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--reps" && i + 1 < argc) {
+            repetitions = max(1, atoi(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            cerr << "Usage: " << argv[0] << " [--reps N] [--filter SUBSTRING]" << endl;
+            return 1;
+        }
+    }
+
+    cout << "[" << endl;
+
+    runBenchmark("moveTowards", 10000000, benchMoveTowards);
+    runBenchmark("advanceLeg", 10000000, benchAdvanceLeg);
+
+    for (int threads = 1; threads <= 64; threads *= 2) {
+        runBenchmark("parking_cycle_threads_" + to_string(threads), 200000,
+                     makeParkingKernel(threads));
+    }
+
+    runBenchmark("sendUpdate", 200000, makeSendUpdateKernel(false));
+    runBenchmark("sendUpdate_with_parking", 200000, makeSendUpdateKernel(true));
+
+    runBenchmark("parse_message_64_vehicles", 5000000, makeParseKernel(64));
+    runBenchmark("parse_message_10000_vehicles", 5000000, makeParseKernel(10000));
+    runBenchmark("pipe_write_and_drain", 200000, makePipeDrainKernel());
+
+    runBenchmark("load_network_10000_links", 1, makeNetworkLoadKernel(10000));
+    runBenchmark("build_graph_grid_500x500", 1, makeGridGraphKernel(500));
+
+    for (int junctions = 8; junctions <= 128; junctions *= 4) {
+        runBenchmark("green_wave_update_" + to_string(junctions), 10000, makeGreenWaveKernel(junctions));
+    }
+
+    runBenchmark("lane_update_all_100x100", 1000, makeLaneKernel(100, 100, true));
+    runBenchmark("lane_follow_each_100x100", 1000, makeLaneKernel(100, 100, false));
+
+    runBenchmark("proximity_hash_2000", 100, makeProximityKernel(2000, true));
+    runBenchmark("proximity_all_pairs_2000", 10, makeProximityKernel(2000, false));
+    runBenchmark("proximity_hash_20000", 10, makeProximityKernel(20000, true));
+
+    for (int threads = 1; threads <= 16; threads *= 4) {
+        runBenchmark("reservation_request_threads_" + to_string(threads), 20000,
+                     makeReservationKernel(threads));
+    }
+
+    for (int threads = 1; threads <= 16; threads *= 4) {
+        runBenchmark("light_load_threads_" + to_string(threads), 10000000, makeLightKernel(threads));
+    }
+
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        runBenchmark("random_rand_threads_" + to_string(threads), 1000000,
+                     makeRandomKernel(threads, false));
+        runBenchmark("random_philox_threads_" + to_string(threads), 1000000,
+                     makeRandomKernel(threads, true));
+    }
+
+    runBenchmark("spawn_bulk_1x10000", 100000, makeSpawnKernel(1, 10000));
+    runBenchmark("spawn_bulk_100x100", 100000, makeSpawnKernel(100, 100));
+    runBenchmark("demand_arrivals_50k_per_s", 1000000, makeDemandKernel(100000));
+    runBenchmark("command_pipe_roundtrip", 100000, makeCommandKernel());
+    runBenchmark("mailbox_push_pop", 1000000, makeMailboxKernel(0));
+    runBenchmark("mailbox_producers_4", 1000000, makeMailboxKernel(4));
+
+    runRoutingBenchmarks();
+
+    cout << endl << "]" << endl;
+    return 0;
+}
@@ -0,0 +1,237 @@
+/**
+ * bench_regions.cpp
+ *
+ * Strong-scaling benchmark: writes a synthetic grid city, then drives the
+ * same traffic on it as 1, 2, 4, ... region workers (region.h), each run
+ * in its own process, and prints one JSON object per region count.
+ *
+ * Usage: ./bench_regions [--grid N] [--ticks T] [--warmup T] [--max-regions K]
+ *                        [--demand-scale X]
+ */
+
+#include "region.h"
+#include "partition.h"
+#include "roadnet.h"
+#include "roadgraph.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+const int BLOCK = 400;         // Pixels between neighbouring junctions
+const int SPAWN_UPSTREAM = 180; // A spawn's start, short of its junction's centre
+const int TRIP_BLOCKS = 2;     // Junctions a trip drives past its own
+const int SPAWN_VPH = 120;     // Arrivals an hour at every approach
+
+struct ScalingResult {
+    int regions;
+    int boundaryLanes;
+    double imbalance;    // Heaviest region over the mean
+    double wallMs;       // Slowest worker's measured ticks
+    long long spawned;
+    long long completed;
+    long long handedOff;
+    long long active;
+    long long vehicleSteps;
+};
+
+// Write a grid x grid city of two-lane two-way streets to `path`: a light
+// at every crossing with a WE and an NS phase, and a spawn on each of its
+// four approaches that drives TRIP_BLOCKS junctions on, or off the edge
+void writeGridCity(const string& path, int grid) {
+    ofstream out(path);
+    if (!out) {
+        cerr << "Can't write " << path << endl;
+        exit(1);
+    }
+    auto id = [grid](int r, int c) { return r * grid + c + 1; };
+    auto centre = [](int i) { return (i + 1) * BLOCK; };
+    int edgeLo = BLOCK / 2, edgeHi = grid * BLOCK + BLOCK / 2;
+
+    out << "# Synthetic " << grid << "x" << grid << " grid city (bench_regions)\n";
+    for (int r = 0; r < grid; ++r) {
+        for (int c = 0; c < grid; ++c) {
+            out << "intersection " << id(r, c) << " G" << r << "_" << c << " " << centre(c) << " "
+                << centre(r) << " 100 " << centre(c) - 40 << " " << centre(r) - 80 << "\n";
+        }
+    }
+    // Block by block, so the streets cross at the junction centres
+    int link = 0;
+    for (int r = 0; r < grid; ++r) {
+        for (int c = 0; c <= grid; ++c) {
+            int x0 = c == 0 ? edgeLo : centre(c - 1), x1 = c == grid ? edgeHi : centre(c);
+            out << "link " << link++ << " " << x0 << " " << centre(r) << " " << x1 << " " << centre(r)
+                << " 100 2\n";
+        }
+    }
+    for (int c = 0; c < grid; ++c) {
+        for (int r = 0; r <= grid; ++r) {
+            int y0 = r == 0 ? edgeLo : centre(r - 1), y1 = r == grid ? edgeHi : centre(r);
+            out << "link " << link++ << " " << centre(c) << " " << y0 << " " << centre(c) << " " << y1
+                << " 100 2\n";
+        }
+    }
+    for (int r = 0; r < grid; ++r) {
+        for (int c = 0; c < grid; ++c) {
+            int j = id(r, c), cx = centre(c), cy = centre(r);
+            out << "stopline " << j << " W " << cx - 60 << "\nstopline " << j << " E " << cx + 60 << "\n"
+                << "stopline " << j << " N " << cy - 60 << "\nstopline " << j << " S " << cy + 60 << "\n"
+                << "phase " << j << " WE 2500 500 500\nphase " << j << " NS 2500 500 500\n";
+        }
+    }
+    for (int r = 0; r < grid; ++r) {
+        for (int c = 0; c < grid; ++c) {
+            int j = id(r, c), cx = centre(c), cy = centre(r);
+            int east = c + TRIP_BLOCKS < grid ? centre(c + TRIP_BLOCKS) + SPAWN_UPSTREAM - BLOCK : edgeHi;
+            int west = c - TRIP_BLOCKS >= 0 ? centre(c - TRIP_BLOCKS) - SPAWN_UPSTREAM + BLOCK : edgeLo;
+            int south = r + TRIP_BLOCKS < grid ? centre(r + TRIP_BLOCKS) + SPAWN_UPSTREAM - BLOCK : edgeHi;
+            int north = r - TRIP_BLOCKS >= 0 ? centre(r - TRIP_BLOCKS) - SPAWN_UPSTREAM + BLOCK : edgeLo;
+            string name = "g" + to_string(j);
+            out << "spawn " << name << "w " << j << " " << cx - SPAWN_UPSTREAM << " " << cy << " " << east
+                << " " << cy << " W - 0\n"
+                << "spawn " << name << "e " << j << " " << cx + SPAWN_UPSTREAM << " " << cy << " " << west
+                << " " << cy << " E - 0\n"
+                << "spawn " << name << "n " << j << " " << cx << " " << cy - SPAWN_UPSTREAM << " " << cx
+                << " " << south << " N - 0\n"
+                << "spawn " << name << "s " << j << " " << cx << " " << cy + SPAWN_UPSTREAM << " " << cx
+                << " " << north << " S - 0\n";
+            for (const char* side : {"w", "e", "n", "s"}) {
+                out << "demand " << name << side << " 0 0,0,5,80,15,0 0:" << SPAWN_VPH << "\n";
+            }
+        }
+    }
+}
+
+ScalingResult runScaling(int regions, long long ticks, long long warmup, double demandScale) {
+    // Read by roadPartition() in this fresh process
+    setenv("TRAFFIC_REGIONS", to_string(regions).c_str(), 1);
+    const Partition& p = roadPartition();
+    vector<RegionStats> stats = runRegions(ticks, warmup, demandScale);
+
+    ScalingResult r = ScalingResult();
+    r.regions = regions;
+    r.boundaryLanes = p.boundaryLanes;
+    double heaviest = *max_element(p.regionWeight.begin(), p.regionWeight.end());
+    double total = 0;
+    for (double w : p.regionWeight) total += w;
+    r.imbalance = total > 0 ? heaviest * regions / total : 1.0;
+    for (const RegionStats& s : stats) {
+        r.wallMs = max(r.wallMs, s.loopMs);
+        r.spawned += s.spawned;
+        r.completed += s.completed;
+        r.handedOff += s.handedOff;
+        r.active += s.active;
+        r.vehicleSteps += s.vehicleSteps;
+    }
+    return r;
+}
+
+int main(int argc, char** argv) {
+    int grid = 16;
+    long long ticks = 1200;
+    long long warmup = 200;
+    int maxRegions = 32;
+    double demandScale = 1.0;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--grid" && i + 1 < argc) {
+            grid = atoi(argv[++i]);
+        } else if (arg == "--ticks" && i + 1 < argc) {
+            ticks = atoll(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = atoll(argv[++i]);
+        } else if (arg == "--max-regions" && i + 1 < argc) {
+            maxRegions = atoi(argv[++i]);
+        } else if (arg == "--demand-scale" && i + 1 < argc) {
+            demandScale = atof(argv[++i]);
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--grid N] [--ticks T] [--warmup T] [--max-regions K] [--demand-scale X]" << endl;
+            return 1;
+        }
+    }
+    if (grid < 1 || warmup < 0 || ticks <= warmup || maxRegions < 1 || maxRegions > grid * grid) {
+        cerr << "Need a grid of at least 1, ticks past the warm-up and 1 to grid^2 regions" << endl;
+        return 1;
+    }
+
+    char path[] = "/tmp/bench_regions_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp failed");
+        return 1;
+    }
+    close(fd);
+    writeGridCity(path, grid);
+    // Set before forking so every run loads it
+    setenv("TRAFFIC_NETWORK", path, 1);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    double baseMs = 0; // One region's, if that run came back
+    bool printedAny = false;
+    printf("[\n");
+    for (int regions = 1; regions <= maxRegions; regions *= 2) {
+        int resultPipe[2];
+        if (pipe(resultPipe) == -1) {
+            perror("Pipe creation failed");
+            return 1;
+        }
+
+        // Each region count gets its own process: the partition and every
+        // shared mapping are made once per process
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(resultPipe[0]);
+            ScalingResult r = runScaling(regions, ticks, warmup, demandScale);
+            write(resultPipe[1], &r, sizeof(r));
+            close(resultPipe[1]);
+            _exit(0);
+        }
+
+        close(resultPipe[1]);
+        ScalingResult r;
+        ssize_t got = read(resultPipe[0], &r, sizeof(r));
+        close(resultPipe[0]);
+        waitpid(pid, nullptr, 0);
+        if (got != (ssize_t)sizeof(r)) {
+            cerr << "Run with " << regions << " regions failed" << endl;
+            continue;
+        }
+
+        double wallSeconds = r.wallMs > 0 ? r.wallMs / 1000 : 1e-9;
+        if (regions == 1) baseMs = r.wallMs;
+        // Against one region only; without that run there is nothing to
+        // scale against
+        char scaling[64];
+        if (baseMs > 0) {
+            double speedup = baseMs / 1000 / wallSeconds;
+            snprintf(scaling, sizeof(scaling), "%.2f, \"efficiency\": %.2f", speedup, speedup / r.regions);
+        } else {
+            snprintf(scaling, sizeof(scaling), "null, \"efficiency\": null");
+        }
+        long long measured = ticks - warmup;
+        printf("%s  {\"grid\": %d, \"regions\": %d, \"cores_online\": %ld, \"boundary_lanes\": %d, "
+               "\"weight_imbalance\": %.3f, \"ticks\": %lld, \"wall_ms\": %.1f, \"ticks_per_sec\": %.0f, "
+               "\"vehicle_steps\": %lld, \"vehicle_steps_per_sec\": %.0f, \"spawned\": %lld, "
+               "\"completed\": %lld, \"handed_off\": %lld, \"still_driving\": %lld, "
+               "\"speedup\": %s}",
+               printedAny ? ",\n" : "", grid, r.regions, cores, r.boundaryLanes, r.imbalance, measured,
+               r.wallMs, measured / wallSeconds, r.vehicleSteps, r.vehicleSteps / wallSeconds, r.spawned,
+               r.completed, r.handedOff, r.active, scaling);
+        printedAny = true;
+        fflush(stdout);
+    }
+    printf("\n]\n");
+
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,421 @@
+/**
+ * bench_scenarios.cpp
+ *
+ * Macro benchmark: runs the GREEN_WAVE, PARKING_FULL and GRIDLOCK scenarios
+ * headlessly on SimEngine at several vehicle counts and prints one JSON
+ * object per run.
+ *
+ * Usage: ./bench_scenarios [--scenario NAME|all] [--vehicles N[,N...]] [--seconds S]
+ *                          [--reroute-threshold MS] [--control lights|reservation]
+ *                          [--policy fixed|actuated|max-pressure|all]
+ */
+
+#include "simulation_types.h"
+#include "engine.h"
+#include "trace.h"
+#include "histogram.h"
+#include "routing.h"
+#include "reservation.h"
+#include "signals.h"
+#include "metrics.h"
+#include "spawner.h"
+#include "rng.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+// All vehicles of a run are injected over this many ticks
+const int SPAWN_TICKS = 100;
+// Junctions crossed by reservation rather than by the light (--control)
+bool reservationControl = false;
+// How the lights time their greens (--policy), for the run in progress
+SignalPolicy signalPolicy = SignalPolicy::FIXED;
+
+struct BenchResult {
+    long long ticks;
+    long long completed;
+    long long vehicleSteps;
+    long long collisionYields;
+    long long stopLineWaitMs;
+    double arrivalsOnGreenPct; // Of all stop line arrivals
+    double platoonTravelMs;    // Mean drive from an upstream light to the next stop line
+    long long messages;
+    double wallSeconds;
+    long peakRssKb;
+    int threads;
+    double tickP50Us;
+    double tickP99Us;
+    std::string latencyJson;
+    std::string preemptJson; // Request-to-green latency per hop
+};
+
+struct DrainArgs {
+    int fd;
+    long long bytes;
+    LatencyHistogram producerToIngest;
+};
+
+// Plays the visualizer's role: empties the telemetry pipe, counts bytes and
+// records how old each message is when it is read
+void* drainThreadFunc(void* arg) {
+    DrainArgs* d = (DrainArgs*)arg;
+    char buf[sizeof(PipeMessage) * 1024];
+    size_t held = 0; // Bytes of a partial message carried over
+    ssize_t n;
+    while ((n = read(d->fd, buf + held, sizeof(buf) - held)) > 0) {
+        uint64_t ingestNs = monotonicNs();
+        d->bytes += n;
+        held += n;
+
+        size_t whole = held - held % sizeof(PipeMessage);
+        for (size_t off = 0; off < whole; off += sizeof(PipeMessage)) {
+            PipeMessage msg;
+            memcpy(&msg, buf + off, sizeof(msg));
+            if (msg.magic == MSG_MAGIC && ingestNs > msg.timestampNs) {
+                d->producerToIngest.record(ingestNs - msg.timestampNs);
+            }
+        }
+        memmove(buf, buf + whole, held - whole);
+        held -= whole;
+    }
+    return nullptr;
+}
+
+int readThreadCount() {
+    ifstream status("/proc/self/status");
+    string line;
+    while (getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return atoi(line.c_str() + 8);
+        }
+    }
+    return -1;
+}
+
+double percentile(vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0.0;
+    size_t idx = (size_t)(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+// Trip plans of the six spawn points, compiled once from the road network
+struct ScenarioPlans {
+    TripPlan f10Local, f10Commuter, f10South, f11, f11Local, f11South;
+};
+
+// Type of vehicle number `i` of a run from `mix`, drawn as a controller
+// would with seed 1, so every run sees the same vehicles
+VehicleType scenarioType(TypeMix mix, int controller, int i) {
+    RandomKey key = {1, (uint32_t)controller, RandomKind::VEHICLE, (uint32_t)i};
+    return pickType(mix, randomBits(key, 0));
+}
+
+// Inject vehicle number `i` of a run, mirroring the controllers' spawn batches
+void spawnScenarioVehicle(ScenarioCommand scenario, int i, const ScenarioPlans& plans,
+                          SimEngine& f10, SimEngine& f11) {
+    switch (scenario) {
+        case ScenarioCommand::PARKING_FULL:
+            if (i % 2 == 0) {
+                f10.spawn(VehicleType::CAR, plans.f10Local, false);
+            } else {
+                f11.spawn(VehicleType::CAR, plans.f11, true);
+            }
+            break;
+        case ScenarioCommand::GRIDLOCK:
+            switch (i % 6) {
+                case 0:
+                    f10.spawn(scenarioType(TypeMix::NO_EMERGENCY, 10, i), plans.f10Local, false);
+                    break;
+                case 1:
+                    f10.spawn(scenarioType(TypeMix::CAR_OR_BIKE, 10, i), plans.f10Commuter, false);
+                    break;
+                case 2:
+                    f10.spawn(scenarioType(TypeMix::NO_EMERGENCY, 10, i), plans.f10South, false);
+                    break;
+                case 3:
+                    f11.spawn(scenarioType(TypeMix::NO_EMERGENCY, 11, i), plans.f11, true);
+                    break;
+                case 4:
+                    f11.spawn(scenarioType(TypeMix::NO_EMERGENCY, 11, i), plans.f11South, true);
+                    break;
+                default:
+                    f11.spawn(scenarioType(TypeMix::NO_EMERGENCY, 11, i), plans.f11Local, true);
+                    break;
+            }
+            break;
+        case ScenarioCommand::GREEN_WAVE:
+            if (i % 10 == 0) {
+                // Preempts F10, then F11 one hop on
+                f10.spawn(VehicleType::AMBULANCE, plans.f10Local, false);
+            } else if (i % 2 == 0) {
+                f10.spawn(scenarioType(TypeMix::ANY, 10, i), plans.f10Local, false);
+            } else {
+                f11.spawn(scenarioType(TypeMix::ANY, 11, i), plans.f11, true);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+BenchResult runScenario(ScenarioCommand scenario, int vehicleCount, double maxSeconds) {
+    BenchResult r = BenchResult();
+
+    int telemetryPipe[2];
+    if (pipe(telemetryPipe) == -1) {
+        perror("Pipe creation failed");
+        exit(1);
+    }
+
+    DrainArgs* drainArgs = new DrainArgs();
+    DrainArgs& drain = *drainArgs;
+    drain.fd = telemetryPipe[0];
+    drain.bytes = 0;
+    pthread_t drainTid;
+    pthread_create(&drainTid, nullptr, drainThreadFunc, &drain);
+
+    ScenarioPlans plans;
+    plans.f10Local = tripPlanFor("f10_local");
+    plans.f10Commuter = tripPlanFor("f10_commuter");
+    plans.f10South = tripPlanFor("f10_south");
+    plans.f11 = tripPlanFor("f11");
+    plans.f11Local = tripPlanFor("f11_local");
+    plans.f11South = tripPlanFor("f11_south");
+
+    LatencyHistogram* preemptLatency = new LatencyHistogram[PREEMPT_MAX_HOPS];
+
+    int spawnPerTick = (vehicleCount + SPAWN_TICKS - 1) / SPAWN_TICKS;
+    int spawned = 0;
+    vector<double> tickUs;
+
+    {
+        SimEngine f10(10, telemetryPipe[1], 0);
+        SimEngine f11(11, telemetryPipe[1], vehicleCount);
+        if (reservationControl) {
+            f10.useReservations(&roadReservations());
+            f11.useReservations(&roadReservations());
+        }
+        f10.useSignalPolicy(signalPolicy);
+        f11.useSignalPolicy(signalPolicy);
+        f10.linkNeighbour(&f11);
+        f11.linkNeighbour(&f10);
+        f10.measurePreemption(preemptLatency);
+        f11.measurePreemption(preemptLatency);
+        SimWorld world;
+        world.add(&f10);
+        world.add(&f11);
+
+        auto start = chrono::steady_clock::now();
+        while (true) {
+            auto tickStart = chrono::steady_clock::now();
+
+            for (int i = 0; i < spawnPerTick && spawned < vehicleCount; ++i) {
+                spawnScenarioVehicle(scenario, spawned++, plans, f10, f11);
+            }
+            world.tick();
+
+            auto tickEnd = chrono::steady_clock::now();
+            tickUs.push_back(chrono::duration<double, micro>(tickEnd - tickStart).count());
+
+            r.wallSeconds = chrono::duration<double>(tickEnd - start).count();
+            bool drained = spawned == vehicleCount &&
+                           f10.getActiveCount() == 0 && f11.getActiveCount() == 0;
+            if (drained || r.wallSeconds >= maxSeconds) break;
+        }
+
+        r.ticks = world.getTickCount();
+        r.completed = f10.getCompletedCount() + f11.getCompletedCount();
+        r.vehicleSteps = f10.getVehicleSteps() + f11.getVehicleSteps();
+        r.collisionYields = f10.getCollisionYields() + f11.getCollisionYields();
+        r.stopLineWaitMs = f10.getStopLineWaitMs() + f11.getStopLineWaitMs();
+        int64_t arrivals = metricValue(Metric::STOP_LINE_ARRIVALS);
+        int64_t platoons = metricValue(Metric::PLATOON_TRIPS);
+        r.arrivalsOnGreenPct = arrivals > 0 ? 100.0 * metricValue(Metric::ARRIVALS_ON_GREEN) / arrivals : 0;
+        r.platoonTravelMs = platoons > 0 ? (double)metricValue(Metric::PLATOON_TRAVEL_MS) / platoons : 0;
+        r.threads = readThreadCount();
+    }
+
+    close(telemetryPipe[1]);
+    pthread_join(drainTid, nullptr);
+    close(telemetryPipe[0]);
+    r.messages = drain.bytes / (long long)sizeof(PipeMessage);
+    r.latencyJson = histogramSummaryJson(drain.producerToIngest);
+    delete drainArgs;
+
+    r.preemptJson = "[";
+    for (int hop = 0; hop < PREEMPT_MAX_HOPS && preemptLatency[hop].getCount() > 0; ++hop) {
+        r.preemptJson += (hop > 0 ? ", " : "") + histogramSummaryJson(preemptLatency[hop]);
+    }
+    r.preemptJson += "]";
+    delete[] preemptLatency;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    r.peakRssKb = usage.ru_maxrss;
+
+    sort(tickUs.begin(), tickUs.end());
+    r.tickP50Us = percentile(tickUs, 0.50);
+    r.tickP99Us = percentile(tickUs, 0.99);
+    return r;
+}
+
+const char* scenarioName(ScenarioCommand scenario) {
+    switch (scenario) {
+        case ScenarioCommand::GREEN_WAVE: return "GREEN_WAVE";
+        case ScenarioCommand::PARKING_FULL: return "PARKING_FULL";
+        case ScenarioCommand::GRIDLOCK: return "GRIDLOCK";
+        default: return "NONE";
+    }
+}
+
+string formatResult(ScenarioCommand scenario, int vehicleCount, const BenchResult& r) {
+    double wall = r.wallSeconds > 0 ? r.wallSeconds : 1e-9;
+    // Completed trips per simulated hour: with car following the road's
+    // capacity, not the step rate, bounds this
+    double simHours = r.ticks * VEHICLE_SPEED_MS / 3600000.0;
+    double vehiclesPerHour = simHours > 0 ? r.completed / simHours : 0;
+    char buf[4096];
+    snprintf(buf, sizeof(buf),
+             "{\"scenario\": \"%s\", \"control\": \"%s\", \"policy\": \"%s\", \"vehicles\": %d, \"ticks\": %lld, "
+             "\"completed\": %lld, \"stop_delay_ms_per_trip\": %.0f, \"throughput_veh_per_hour\": %.0f, "
+             "\"arrivals_on_green_pct\": %.1f, \"platoon_travel_ms\": %.0f, "
+             "\"wall_seconds\": %.3f, \"vehicle_steps\": %lld, \"vehicle_steps_per_sec\": %.0f, "
+             "\"collision_yields\": %lld, \"messages\": %lld, \"messages_per_sec\": %.0f, \"peak_rss_kb\": %ld, "
+             "\"threads\": %d, \"tick_p50_us\": %.2f, \"tick_p99_us\": %.2f, "
+             "\"producer_to_ingest\": %s, \"preempt_request_to_green_by_hop\": %s}",
+             scenarioName(scenario), reservationControl ? "reservation" : "lights",
+             signalPolicyName(signalPolicy), vehicleCount,
+             r.ticks, r.completed, r.completed > 0 ? (double)r.stopLineWaitMs / r.completed : 0.0,
+             vehiclesPerHour, r.arrivalsOnGreenPct, r.platoonTravelMs, r.wallSeconds, r.vehicleSteps, r.vehicleSteps / wall,
+             r.collisionYields, r.messages, r.messages / wall, r.peakRssKb,
+             r.threads, r.tickP50Us, r.tickP99Us, r.latencyJson.c_str(), r.preemptJson.c_str());
+    return buf;
+}
+
+int main(int argc, char** argv) {
+    vector<ScenarioCommand> scenarios = {
+        ScenarioCommand::GREEN_WAVE, ScenarioCommand::PARKING_FULL, ScenarioCommand::GRIDLOCK
+    };
+    vector<int> counts = {100, 1000, 10000, 100000};
+    vector<SignalPolicy> policies = {SignalPolicy::FIXED};
+    double maxSeconds = 5.0;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--scenario" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name != "all") {
+                scenarios.clear();
+                if (name == "GREEN_WAVE") scenarios.push_back(ScenarioCommand::GREEN_WAVE);
+                else if (name == "PARKING_FULL") scenarios.push_back(ScenarioCommand::PARKING_FULL);
+                else if (name == "GRIDLOCK") scenarios.push_back(ScenarioCommand::GRIDLOCK);
+                else {
+                    cerr << "Unknown scenario: " << name << endl;
+                    return 1;
+                }
+            }
+        } else if (arg == "--vehicles" && i + 1 < argc) {
+            counts.clear();
+            string list = argv[++i];
+            size_t pos = 0;
+            while (pos <= list.size()) {
+                size_t comma = list.find(',', pos);
+                if (comma == string::npos) comma = list.size();
+                counts.push_back(atoi(list.substr(pos, comma - pos).c_str()));
+                pos = comma + 1;
+            }
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            maxSeconds = atof(argv[++i]);
+        } else if (arg == "--reroute-threshold" && i + 1 < argc) {
+            // Set before forking so every run inherits it
+            roadTravelTimes().rerouteThresholdMs = atof(argv[++i]);
+        } else if (arg == "--control" && i + 1 < argc) {
+            string control = argv[++i];
+            if (control != "lights" && control != "reservation") {
+                cerr << "Unknown control: " << control << endl;
+                return 1;
+            }
+            reservationControl = control == "reservation";
+        } else if (arg == "--policy" && i + 1 < argc) {
+            string name = argv[++i];
+            policies.clear();
+            if (name == "all") {
+                policies = {SignalPolicy::FIXED, SignalPolicy::ACTUATED, SignalPolicy::MAX_PRESSURE};
+            } else {
+                SignalPolicy policy;
+                if (!parseSignalPolicy(name.c_str(), policy)) {
+                    cerr << "Unknown policy: " << name << endl;
+                    return 1;
+                }
+                policies.push_back(policy);
+            }
+        } else {
+            cerr << "Usage: " << argv[0]
+                 << " [--scenario NAME|all] [--vehicles N[,N...]] [--seconds S]"
+                 << " [--reroute-threshold MS] [--control lights|reservation]"
+                 << " [--policy fixed|actuated|max-pressure|all]" << endl;
+            return 1;
+        }
+    }
+
+    // Each run gets its own process so peak RSS is not inherited from earlier runs
+    cout << "[" << endl;
+    bool first = true;
+    for (ScenarioCommand scenario : scenarios) {
+        for (SignalPolicy policy : policies) {
+            signalPolicy = policy;
+            for (int count : counts) {
+                int resultPipe[2];
+                if (pipe(resultPipe) == -1) {
+                    perror("Pipe creation failed");
+                    return 1;
+                }
+
+                pid_t pid = fork();
+                if (pid == 0) {
+                    close(resultPipe[0]);
+                    string role = string("bench_") + scenarioName(scenario) + "_" +
+                                  signalPolicyName(policy) + "_" + to_string(count);
+                    traceInit(role.c_str());
+                    BenchResult r = runScenario(scenario, count, maxSeconds);
+                    traceShutdown();
+                    string line = formatResult(scenario, count, r);
+                    write(resultPipe[1], line.data(), line.size());
+                    close(resultPipe[1]);
+                    _exit(0);
+                }
+
+                close(resultPipe[1]);
+                string line;
+                char buf[1024];
+                ssize_t n;
+                while ((n = read(resultPipe[0], buf, sizeof(buf))) > 0) {
+                    line.append(buf, n);
+                }
+                close(resultPipe[0]);
+                waitpid(pid, nullptr, 0);
+
+                if (line.empty()) continue;
+                cout << (first ? "  " : ",\n  ") << line;
+                cout.flush();
+                first = false;
+            }
+        }
+    }
+    cout << endl << "]" << endl;
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * command.cpp
+ *
+ * Command frames: building, writing and reassembling them.
+ */
+
+#include "command.h"
+#include "metrics.h"
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+// Parameter bytes of each CommandType this build knows, 0 if unknown
+static uint32_t payloadSize(uint16_t type) {
+    switch ((CommandType)type) {
+        case CommandType::SCENARIO:             return sizeof(ScenarioParams);
+        case CommandType::SPAWN:                return sizeof(SpawnParams);
+        case CommandType::SET_SIGNAL_TIMING:    return sizeof(SignalTimingParams);
+        case CommandType::SET_PARKING_CAPACITY: return sizeof(ParkingCapacityParams);
+        case CommandType::PAUSE:                return 0;
+        case CommandType::STEP:                 return sizeof(StepParams);
+        case CommandType::RESUME:               return 0;
+        case CommandType::SET_SPEED:            return sizeof(SpeedParams);
+    }
+    return 0;
+}
+
+static bool knownType(uint16_t type) {
+    return type >= (uint16_t)CommandType::SCENARIO && type <= (uint16_t)CommandType::SET_SPEED;
+}
+
+Command makeCommand(CommandType type, int targetId) {
+    Command cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.header.magic = CMD_MAGIC;
+    cmd.header.version = CMD_PROTOCOL_VERSION;
+    cmd.header.type = (uint16_t)type;
+    cmd.header.targetId = targetId;
+    cmd.header.length = payloadSize((uint16_t)type);
+    return cmd;
+}
+
+size_t encodeCommand(const Command& cmd, char* out) {
+    uint32_t length = cmd.header.length < CMD_MAX_PAYLOAD ? cmd.header.length : CMD_MAX_PAYLOAD;
+    CommandHeader header = cmd.header;
+    header.length = length;
+    memcpy(out, &header, sizeof(header));
+    memcpy(out + sizeof(header), cmd.params.bytes, length);
+    return sizeof(header) + length;
+}
+
+bool sendCommand(int fd, const Command& cmd) {
+    char frame[CMD_MAX_FRAME];
+    size_t size = encodeCommand(cmd, frame);
+    return write(fd, frame, size) == (ssize_t)size;
+}
+
+CommandReader::CommandReader() : used(0), rejected(0) {}
+
+bool CommandReader::fill(int fd) {
+    while (used < BUFFER_SIZE) {
+        ssize_t n = read(fd, buffer + used, BUFFER_SIZE - used);
+        if (n > 0) {
+            used += n;
+        } else if (n == 0) {
+            return false;
+        } else {
+            if (errno == EINTR) continue;
+            break; // EAGAIN: nothing more for now
+        }
+    }
+    return true;
+}
+
+bool CommandReader::next(Command& cmd) {
+    while (used >= sizeof(CommandHeader)) {
+        CommandHeader header;
+        memcpy(&header, buffer, sizeof(header));
+        if (header.magic != CMD_MAGIC || header.length > CMD_MAX_PAYLOAD) {
+            // Out of step with the writer: nothing buffered can be trusted
+            rejected++;
+            metricAdd(Metric::COMMANDS_REJECTED);
+            used = 0;
+            return false;
+        }
+        size_t frame = sizeof(header) + header.length;
+        if (used < frame) return false;
+
+        bool usable = header.version >= 2 && header.version <= CMD_PROTOCOL_VERSION &&
+                      knownType(header.type);
+        if (usable) {
+            memset(&cmd, 0, sizeof(cmd));
+            cmd.header = header;
+            uint32_t known = payloadSize(header.type);
+            memcpy(cmd.params.bytes, buffer + sizeof(header), header.length < known ? header.length : known);
+        } else {
+            rejected++;
+            metricAdd(Metric::COMMANDS_REJECTED);
+        }
+        memmove(buffer, buffer + frame, used - frame);
+        used -= frame;
+        if (usable) return true;
+    }
+    return false;
+}
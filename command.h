@@ -0,0 +1,49 @@
+/**
+ * command.h
+ *
+ * Encoding and decoding of controller commands (protocol v2, see
+ * CommandHeader). A frame is at most sizeof(CommandHeader) +
+ * CMD_MAX_PAYLOAD bytes, well under PIPE_BUF, so one write() puts it on a
+ * pipe whole; the reader still copes with frames split across reads.
+ */
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include "simulation_types.h"
+#include <cstddef>
+
+const size_t CMD_MAX_FRAME = sizeof(CommandHeader) + CMD_MAX_PAYLOAD;
+
+// A command of `type` for `targetId`, with zeroed parameters of the size
+// its type has
+Command makeCommand(CommandType type, int targetId = CMD_ALL_INTERSECTIONS);
+
+// Serialize `cmd` into `out` (CMD_MAX_FRAME bytes); returns the frame size
+size_t encodeCommand(const Command& cmd, char* out);
+
+// Write `cmd` to `fd` in one write(); false if it didn't go out whole
+bool sendCommand(int fd, const Command& cmd);
+
+// Splits the bytes read from a non-blocking fd into commands. Frames with
+// a newer version or an unknown type are skipped whole; bad magic or an
+// oversized length means the stream is lost, and what is buffered goes.
+class CommandReader {
+private:
+    static const size_t BUFFER_SIZE = 4096;
+    char buffer[BUFFER_SIZE];
+    size_t used;
+
+public:
+    CommandReader();
+
+    // Append whatever `fd` has ready; false once it reached end of file
+    bool fill(int fd);
+
+    // The next whole command; false when none is buffered
+    bool next(Command& cmd);
+
+    long long rejected; // Frames skipped or dropped
+};
+
+#endif // COMMAND_H
@@ -1,370 +1,573 @@
 /**
  * controller.cpp
- * 
- * Implementation of traffic controllers for F10 and F11 intersections.
+ *
+ * Implementation of the data-driven IntersectionController.
  */
 
 #include "controller.h"
 #include "simulation_types.h"
 #include "parking.h"
 #include "vehicle.h"
+#include "trace.h"
+#include "metrics.h"
+#include "roadnet.h"
+#include "routing.h"
+#include "lanes.h"
+#include "corridor.h"
+#include "simclock.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <unistd.h>
+#include <poll.h>
 #include <cstdlib>
 
 using namespace std;
 
-void trafficControllerF10(int writePipeFd, int readCoordFd, int writeCoordFd, int cmdPipeFd) {
-    ParkingLot parkingLot;
-    TrafficLightState lightState = TrafficLightState::RED;
-    pthread_mutex_t lightMutex = PTHREAD_MUTEX_INITIALIZER;
+// Signal intervals are slept in slices so commands are picked up promptly
+const int LIGHT_SLICE_MS = 500;
 
-    std::vector<pthread_t> threads;
-    std::vector<Vehicle*> vehicles;
-
-    setNonBlocking(cmdPipeFd);
+static const char* scenarioLabel(int command) {
+    switch ((ScenarioCommand)command) {
+        case ScenarioCommand::GREEN_WAVE:   return "Scenario A: Green Wave";
+        case ScenarioCommand::PARKING_FULL: return "Scenario B: Parking Saturation";
+        case ScenarioCommand::GRIDLOCK:     return "Scenario C: Gridlock";
+        default:                            return "No scenario";
+    }
+}
 
-    int vehicleIdCounter = 0;
-    int commuterIdCounter = 50;
+// Road network spawn of each of `config`'s spawn points
+static vector<int> networkSpawns(const IntersectionConfig& config) {
+    vector<int> spawns;
+    for (const SpawnPoint& sp : config.spawnPoints) spawns.push_back(sp.spawn);
+    return spawns;
+}
 
-    // Helper lambda to spawn a local vehicle
-    auto spawnLocalVehicle = [&](VehicleType type, bool goToParking = true) {
-        Vehicle* v = new Vehicle(vehicleIdCounter++, type, writePipeFd, &parkingLot);
-        v->x = 0;
-        v->y = 400;
-        v->endX = 1200;
-        v->endY = 400;
+IntersectionController::IntersectionController(const IntersectionConfig& config,
+                                               const IntersectionPipes& pipes)
+    : config(config), pipes(pipes), junction(roadNetwork().intersectionIndex[config.id]),
+      domain(roadPartition().junctionRegion[junction]),
+      signals(signalPlanFor(config.id)), seed(simSeed()), spawns(seed, config.id),
+      demand(roadNetwork(), networkSpawns(config), seed, config.id, demandScale()),
+      rerouteGrantNs(0), lockstep(nullptr), tick(0), stepTicks(0), digest(DIGEST_START) {
+    const SignalInterval& now = signals.now();
+    lightName = now.name;
+    for (const SpawnPoint& sp : config.spawnPoints) {
+        nextVehicleIds.push_back(sp.firstVehicleId);
+    }
+}
 
-        vehicles.push_back(v);
+IntersectionController::~IntersectionController() {
+    for (SteppedVehicle& sv : stepped) {
+        roadLanes().leave(sv.args->vehicle);
+        delete sv.args->vehicle;
+        delete sv.args;
+    }
+}
 
-        ThreadArgs* args = new ThreadArgs();
-        args->vehicle = v;
-        args->lightMutex = &lightMutex;
-        args->lightState = &lightState;
-        args->stopLineX = 240.0f;
-        args->isCommuter = false;
+// Put the signal plan's current lights on the light board, recording
+// the change for tracing and metrics, and tell the visualizer
+void IntersectionController::publishLights() {
+    const SignalInterval& now = signals.now();
+    traceLightChange(config.id, lightName, now.name);
+    lightName = now.name;
+    metricAdd(Metric::LIGHT_PHASE_CHANGES);
+
+    storeLights(junction, now.states);
+    // The new lights and the tick they came on, so runs that differ only
+    // in signal timing differ in their digest
+    uint64_t lights = 0;
+    for (int d = 0; d < DIRECTION_COUNT; ++d) lights = lights << 8 | (uint8_t)now.states[d];
+    digest = digestMix(digest, (uint64_t)(uint32_t)tick << 32 | lights);
+
+    PipeMessage msg;
+    msg.magic = MSG_MAGIC;
+    msg.type = PipeMessage::LIGHT_UPDATE;
+    msg.data.light.intersectionId = config.id;
+    copy(now.states, now.states + DIRECTION_COUNT, msg.data.light.states);
+    sendPipeMessage(pipes.writePipeFd, msg);
+}
 
-        pthread_t tid;
-        pthread_create(&tid, nullptr, vehicleThreadFunc, args);
-        threads.push_back(tid);
-    };
+void IntersectionController::sendParkingUpdate() {
+    PipeMessage pMsg;
+    pMsg.magic = MSG_MAGIC;
+    pMsg.type = PipeMessage::PARKING_UPDATE;
+    pMsg.data.parking.intersectionId = config.id;
+    pMsg.data.parking.waitingCount = parkingLot.getWaitingCount();
+    sendPipeMessage(pipes.writePipeFd, pMsg);
+}
 
-    // Helper lambda to spawn commuter vehicle
-    auto spawnCommuterVehicle = [&](VehicleType type) {
-        Vehicle* v = new Vehicle(commuterIdCounter++, type, writePipeFd, &parkingLot);
-        v->x = 1200;
-        v->y = 400;
-        v->endX = 0;
-        v->endY = 400;
-
-        vehicles.push_back(v);
-
-        ThreadArgs* args = new ThreadArgs();
-        args->vehicle = v;
-        args->lightMutex = &lightMutex;
-        args->lightState = &lightState;
-        args->stopLineX = 360.0f;
-        args->isCommuter = true;
-
-        pthread_t tid;
-        pthread_create(&tid, nullptr, commuterThreadFunc, args);
-        threads.push_back(tid);
-    };
+void IntersectionController::spawnVehicle(int spawnPoint, VehicleType type) {
+    const SpawnPoint& sp = config.spawnPoints[spawnPoint];
+    Vehicle* v = new Vehicle(nextVehicleIds[spawnPoint], type, pipes.writePipeFd, &parkingLot);
+    nextVehicleIds[spawnPoint] += VEHICLE_ID_STRIDE;
+    placeAtStart(v, sp.plan);
+    v->isLeftParking = config.leftParking;
+    v->intersectionId = config.id;
+
+    ThreadArgs* args = new ThreadArgs();
+    args->vehicle = v;
+    args->plan = sp.plan;
+    args->domain = domain;
+    if (isEmergency(type)) announceEmergency(sp.plan, v);
+    metricAdd(Metric::VEHICLES_SPAWNED);
+    startVehicle(args);
+}
 
-    // Spawn initial vehicles - 3 local + 2 commuters
-    for (int i = 0; i < 3; ++i) {
-        VehicleType type = (VehicleType)(rand() % 6);
-        spawnLocalVehicle(type);
-        usleep(rand() % 1000000 + 500000);
+void IntersectionController::startVehicle(ThreadArgs* args) {
+    if (lockstep != nullptr) {
+        traceAsyncBegin(phaseSpanName(args->vehicle->phase), "vehicle", args->vehicle->id);
+        metricAdd(Metric::VEHICLES_ACTIVE);
+        stepped.push_back({args, tick});
+        return;
+    }
+    // Detached: the thread frees its own stack once the trip is over, as
+    // nothing ever joins it under continuous demand
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t tid;
+    int err = pthread_create(&tid, &attr, vehicleThreadFunc, args);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        cerr << "[" << config.name << "] Vehicle " << args->vehicle->id
+             << " dropped, thread creation failed: " << strerror(err) << endl;
+        roadLanes().leave(args->vehicle);
+        delete args->vehicle;
+        delete args;
     }
+}
+
+VehicleType IntersectionController::nextType(int spawnPoint, TypeMix mix) const {
+    RandomKey key = {seed, (uint32_t)config.id, RandomKind::VEHICLE,
+                     (uint32_t)nextVehicleIds[spawnPoint]};
+    return pickType(mix, randomBits(key, 0));
+}
 
-    for (int i = 0; i < 2; ++i) {
-        VehicleType type = (rand() % 2 == 0) ? VehicleType::CAR : VehicleType::BIKE;
-        spawnCommuterVehicle(type);
-        usleep(rand() % 1000000 + 500000);
+void IntersectionController::spawnDue() {
+    uint64_t nowNs = simClock().nowNs();
+    SpawnEvent event;
+    Arrival arrival;
+    int started = 0;
+    for (; started < SPAWN_DRAIN_MAX && spawns.pop(nowNs, event); ++started) {
+        spawnVehicle(event.spawnPoint, nextType(event.spawnPoint, event.mix));
     }
+    for (; started < SPAWN_DRAIN_MAX && demand.pop(nowNs, arrival); ++started) {
+        spawnVehicle(arrival.origin, arrival.type);
+    }
+}
 
-    // Traffic Light Cycle with command checking
-    while (true) {
-        // Check for commands (non-blocking)
-        CommandMessage cmdMsg;
-        if (read(cmdPipeFd, &cmdMsg, sizeof(cmdMsg)) == sizeof(cmdMsg) && cmdMsg.magic == CMD_MAGIC) {
-            switch (cmdMsg.command) {
-                case ScenarioCommand::GREEN_WAVE: {
-                    cout << "[F10] Scenario A: Green Wave - Spawning Ambulance" << endl;
-                    spawnLocalVehicle(VehicleType::AMBULANCE);
-
-                    CoordinationMessage coordMsg;
-                    coordMsg.type = CoordinationMessage::EMERGENCY_APPROACHING;
-                    coordMsg.sourceIntersection = 10;
-                    write(writeCoordFd, &coordMsg, sizeof(coordMsg));
-                    break;
-                }
-                case ScenarioCommand::PARKING_FULL: {
-                    cout << "[F10] Scenario B: Parking Saturation - Spawning 16 Cars" << endl;
-                    for (int i = 0; i < 16; ++i) {
-                        spawnLocalVehicle(VehicleType::CAR);
-                        usleep(200000);
-                    }
-                    break;
-                }
-                case ScenarioCommand::GRIDLOCK: {
-                    cout << "[F10] Scenario C: Gridlock - Spawning from all directions" << endl;
-                    for (int i = 0; i < 5; ++i) {
-                        VehicleType type = (VehicleType)(rand() % 4 + 2);
-                        spawnLocalVehicle(type);
-                        usleep(100000);
-                    }
-                    for (int i = 0; i < 5; ++i) {
-                        VehicleType type = (rand() % 2 == 0) ? VehicleType::CAR : VehicleType::BIKE;
-                        spawnCommuterVehicle(type);
-                        usleep(100000);
-                    }
-                    break;
-                }
-                default:
-                    break;
-            }
-        }
+void IntersectionController::announceEmergency(const TripPlan& plan, const Vehicle* v) {
+    CoordinationMessage coordMsg;
+    if (!makePreemptRequest(plan, v->id, v->speed, config.id, simClock().nowNs(), coordMsg)) return;
+    traceInstant("emergency_signal", "light", config.id);
+    relayPreemption(coordMsg);
+}
 
-        // Red phase
-        pthread_mutex_lock(&lightMutex);
-        lightState = TrafficLightState::RED;
-        pthread_mutex_unlock(&lightMutex);
-
-        PipeMessage msg;
-        msg.magic = MSG_MAGIC;
-        msg.type = PipeMessage::LIGHT_UPDATE;
-        msg.data.light.intersectionId = 10;
-        msg.data.light.state = TrafficLightState::RED;
-        write(writePipeFd, &msg, sizeof(msg));
-
-        // Split sleep to check commands more frequently
-        for (int i = 0; i < 6; ++i) {
-            usleep(500000);
-            if (read(cmdPipeFd, &cmdMsg, sizeof(cmdMsg)) == sizeof(cmdMsg) && cmdMsg.magic == CMD_MAGIC) {
-                if (cmdMsg.command == ScenarioCommand::GREEN_WAVE) {
-                    spawnLocalVehicle(VehicleType::AMBULANCE);
-                    CoordinationMessage coordMsg;
-                    coordMsg.type = CoordinationMessage::EMERGENCY_APPROACHING;
-                    coordMsg.sourceIntersection = 10;
-                    write(writeCoordFd, &coordMsg, sizeof(coordMsg));
-                } else if (cmdMsg.command == ScenarioCommand::PARKING_FULL) {
-                    for (int j = 0; j < 16; ++j) {
-                        spawnLocalVehicle(VehicleType::CAR);
-                        usleep(200000);
-                    }
-                } else if (cmdMsg.command == ScenarioCommand::GRIDLOCK) {
-                    for (int j = 0; j < 5; ++j) {
-                        spawnLocalVehicle((VehicleType)(rand() % 4 + 2));
-                        spawnCommuterVehicle((rand() % 2 == 0) ? VehicleType::CAR : VehicleType::BIKE);
-                        usleep(100000);
-                    }
-                }
-            }
+void IntersectionController::relayPreemption(CoordinationMessage msg) {
+    while (msg.hop < msg.hopCount && msg.hops[msg.hop].intersectionId == config.id) {
+        preemptor.accept(msg);
+        msg.hop++;
+    }
+    if (msg.hop == msg.hopCount) return;
+
+    int next = msg.hops[msg.hop].intersectionId;
+    msg.sourceIntersection = config.id;
+    for (const auto& neighbour : pipes.coordWriteFds) {
+        if (neighbour.first == next) {
+            if (lockstep != nullptr) outbox.push_back(make_pair(neighbour.second, msg));
+            else write(neighbour.second, &msg, sizeof(msg));
+            return;
         }
+    }
+    cout << "[" << config.name << "] No coordination pipe to " << next
+         << "; emergency preemption stops here" << endl;
+}
 
-        // Green phase
-        pthread_mutex_lock(&lightMutex);
-        lightState = TrafficLightState::GREEN;
-        pthread_mutex_unlock(&lightMutex);
+void IntersectionController::waitForInput(int timeoutMs) {
+    vector<pollfd> fds;
+    fds.push_back({pipes.cmdPipeFd, POLLIN, 0});
+    for (int fd : pipes.coordReadFds) fds.push_back({fd, POLLIN, 0});
+    fds.push_back({roadMailboxes()[domain].doorbellRead, POLLIN, 0});
+    poll(fds.data(), fds.size(), max(0, timeoutMs));
+}
 
-        msg.data.light.state = TrafficLightState::GREEN;
-        write(writePipeFd, &msg, sizeof(msg));
+void IntersectionController::pollInputs() {
+    // Route repairs the vehicle threads may make until the next grant:
+    // REROUTE_BUDGET_PER_TICK for each whole VEHICLE_SPEED_MS of simulated
+    // time since the last one, however often commands and messages wake
+    // the loop, and at most a slice's worth after a STEP
+    const uint64_t stepNs = VEHICLE_SPEED_MS * 1000000ull;
+    uint64_t steps = (simClock().nowNs() - rerouteGrantNs) / stepNs;
+    if (steps > 0) {
+        uint64_t grant = min(steps, (uint64_t)(LIGHT_SLICE_MS / VEHICLE_SPEED_MS));
+        roadTravelTimes().grantReroutes((int)grant * REROUTE_BUDGET_PER_TICK);
+        rerouteGrantNs += steps * stepNs;
+    }
+    readCoordination();
+    readMigrations();
+    readCommands();
+}
 
-        for (int i = 0; i < 6; ++i) {
-            usleep(500000);
+void IntersectionController::readCoordination() {
+    CoordinationMessage coordMsg;
+    for (int fd : pipes.coordReadFds) {
+        while (read(fd, &coordMsg, sizeof(coordMsg)) == sizeof(coordMsg)) {
+            if (coordMsg.type == CoordinationMessage::EMERGENCY_APPROACHING &&
+                coordMsg.hop >= 0 && coordMsg.hop < coordMsg.hopCount &&
+                coordMsg.hopCount <= PREEMPT_MAX_HOPS) {
+                relayPreemption(coordMsg);
+            }
         }
+    }
+}
 
-        // Send Parking Queue Update
-        PipeMessage pMsg;
-        pMsg.magic = MSG_MAGIC;
-        pMsg.type = PipeMessage::PARKING_UPDATE;
-        pMsg.data.parking.intersectionId = 10;
-        pMsg.data.parking.waitingCount = parkingLot.getWaitingCount();
-        write(writePipeFd, &pMsg, sizeof(pMsg));
+void IntersectionController::readMigrations() {
+    MigrationMailbox& box = roadMailboxes()[domain];
+    if (box.rung.exchange(false)) {
+        char bells[64];
+        while (read(box.doorbellRead, bells, sizeof(bells)) > 0) {}
     }
+    MigrationRecord record;
+    arrivals.clear();
+    while (mailboxPop(box, record)) arrivals.push_back(record);
+    // Senders' pushes interleave in any order; adopt by id, so lockstep
+    // runs don't depend on it
+    sort(arrivals.begin(), arrivals.end(),
+         [](const MigrationRecord& a, const MigrationRecord& b) { return a.id < b.id; });
+    for (const MigrationRecord& r : arrivals) {
+        startVehicle(adoptVehicle(r, domain, pipes.writePipeFd, &parkingLot));
+    }
+}
 
-    for (auto tid : threads) {
-        pthread_join(tid, nullptr);
+void IntersectionController::readCommands() {
+    // Once the visualizer is gone, stop waiting on its pipe
+    if (pipes.cmdPipeFd != -1 && !commands.fill(pipes.cmdPipeFd)) {
+        close(pipes.cmdPipeFd);
+        pipes.cmdPipeFd = -1;
+    }
+    Command cmd;
+    while (commands.next(cmd)) {
+        if (cmd.header.targetId != CMD_ALL_INTERSECTIONS && cmd.header.targetId != config.id) continue;
+        bool ok = handleCommand(cmd);
+        metricAdd(ok ? Metric::COMMANDS_HANDLED : Metric::COMMANDS_REJECTED);
+        if (!ok) {
+            cerr << "[" << config.name << "] Rejected command of type " << cmd.header.type << endl;
+        }
     }
 }
 
-void trafficControllerF11(int writePipeFd, int readCoordFd, int writeCoordFd, int cmdPipeFd) {
-    ParkingLot parkingLot; // Left-side parking lot for F11
-    TrafficLightState lightState = TrafficLightState::RED;
-    pthread_mutex_t lightMutex = PTHREAD_MUTEX_INITIALIZER;
-
-    std::vector<pthread_t> threads;
-    std::vector<Vehicle*> vehicles;
-
-    setNonBlocking(cmdPipeFd);
-    setNonBlocking(readCoordFd);
-
-    int vehicleIdCounter = 100;
-    int localIdCounter = 150; // For vehicles spawning from left side at F11
-    bool emergencyMode = false;
-
-    // Helper lambda to spawn vehicle from right (going left) - can use left parking
-    auto spawnVehicle = [&](VehicleType type, float yPos = 400.0f) {
-        Vehicle* v = new Vehicle(vehicleIdCounter++, type, writePipeFd, &parkingLot);
-        v->x = 1200;
-        v->y = yPos;
-        v->endX = 0;
-        v->endY = yPos;
-        v->isLeftParking = true; // Will use left parking lot
-
-        vehicles.push_back(v);
-
-        ThreadArgs* args = new ThreadArgs();
-        args->vehicle = v;
-        args->lightMutex = &lightMutex;
-        args->lightState = &lightState;
-        args->stopLineX = 960.0f;
-        args->isCommuter = false;
-
-        pthread_t tid;
-        pthread_create(&tid, nullptr, f11VehicleThreadFunc, args);
-        threads.push_back(tid);
-    };
+bool IntersectionController::handleCommand(const Command& cmd) {
+    bool ok = true;
+    switch ((CommandType)cmd.header.type) {
+        case CommandType::SCENARIO: {
+            int scenario = cmd.params.scenario.scenario;
+            if (scenario <= 0 || scenario >= SCENARIO_COUNT) {
+                ok = false;
+            } else if (!config.scenarioSpawns[scenario].empty()) {
+                int total = 0;
+                for (const SpawnBatch& batch : config.scenarioSpawns[scenario]) total += batch.count;
+                cout << "[" << config.name << "] " << scenarioLabel(scenario)
+                     << " - Spawning " << total << " vehicles" << endl;
+                spawns.inject(config.scenarioSpawns[scenario], simClock().nowNs());
+            }
+            break;
+        }
+        case CommandType::SPAWN: {
+            const SpawnParams& p = cmd.params.spawn;
+            int points = (int)config.spawnPoints.size();
+            bool broadcast = cmd.header.targetId == CMD_ALL_INTERSECTIONS;
+            // Spawn point indices are per controller, so a broadcast can't
+            // name one
+            if (p.count == 0 || p.count > INT32_MAX || p.spawnPoint < -1 || p.spawnPoint >= points || p.mix < 0 ||
+                p.mix > (int)TypeMix::AMBULANCE || !(p.ratePerSecond >= 0) || points == 0 ||
+                (broadcast && p.spawnPoint != -1)) {
+                ok = false;
+                break;
+            }
+            // A broadcast is split between the controllers, each with its
+            // share of the rate, so COUNT is the total
+            uint32_t total = p.count;
+            float rate = p.ratePerSecond;
+            if (broadcast) {
+                uint32_t peers = (uint32_t)config.peerCount;
+                total = p.count / peers + ((uint32_t)config.peerIndex < p.count % peers ? 1 : 0);
+                rate = p.ratePerSecond * total / p.count;
+                if (total == 0) break;
+            }
+            // Spread over every spawn point, each its share of the rate
+            int first = p.spawnPoint == -1 ? 0 : p.spawnPoint;
+            int used = p.spawnPoint == -1 ? points : 1;
+            int intervalMs = rate > 0 ? (int)(1000.0f * used / rate) : 0;
+            uint64_t nowNs = simClock().nowNs();
+            for (int k = 0; k < used; ++k) {
+                int count = (int)(total / used + (k < (int)(total % used) ? 1 : 0));
+                spawns.inject({{first + k, count, (TypeMix)p.mix, intervalMs, 0}}, nowNs);
+            }
+            cout << "[" << config.name << "] Spawning " << total << " vehicles, "
+                 << spawns.pending() << " queued" << endl;
+            break;
+        }
+        case CommandType::SET_SIGNAL_TIMING: {
+            const SignalTimingParams& p = cmd.params.timing;
+            ok = signals.setTiming(p.phase, p.greenMs, p.yellowMs, p.allRedMs);
+            if (ok) {
+                cout << "[" << config.name << "] Phase " << p.phase << " timing set, cycle "
+                     << signals.getCycleMs() << " ms" << endl;
+            }
+            break;
+        }
+        case CommandType::SET_PARKING_CAPACITY:
+            // setCapacity() would clamp it; a value out of range is a mistake
+            ok = cmd.params.parking.capacity >= 0 && cmd.params.parking.capacity <= PARKING_CAPACITY;
+            if (ok) {
+                parkingLot.setCapacity(cmd.params.parking.capacity);
+                cout << "[" << config.name << "] Parking capacity " << parkingLot.getCapacity() << endl;
+            }
+            break;
+        case CommandType::PAUSE:
+            simClock().pause();
+            break;
+        case CommandType::STEP:
+            if (lockstep != nullptr) {
+                // Whole ticks, which the lockstep loop runs before holding again
+                ok = simClock().isPaused() && cmd.params.step.ms > 0;
+                if (ok) stepTicks += (cmd.params.step.ms + VEHICLE_SPEED_MS - 1) / VEHICLE_SPEED_MS;
+            } else {
+                ok = simClock().step(cmd.params.step.ms);
+            }
+            break;
+        case CommandType::RESUME:
+            simClock().resume();
+            stepTicks = 0;
+            break;
+        case CommandType::SET_SPEED:
+            // Lockstep has no speed: it runs as fast as the slowest controller
+            ok = cmd.params.speed.factor > 0 && lockstep == nullptr;
+            if (ok) simClock().setSpeed(cmd.params.speed.factor);
+            break;
+    }
+    return ok;
+}
 
-    // Helper lambda to spawn vehicle from left (going right) at F11 - can use left parking
-    auto spawnLocalVehicle = [&](VehicleType type) {
-        Vehicle* v = new Vehicle(localIdCounter++, type, writePipeFd, &parkingLot);
-        v->x = 0;
-        v->y = 400;
-        v->endX = 1200;
-        v->endY = 400;
-        v->isLeftParking = true; // Will use left parking lot
-
-        vehicles.push_back(v);
-
-        ThreadArgs* args = new ThreadArgs();
-        args->vehicle = v;
-        args->lightMutex = &lightMutex;
-        args->lightState = &lightState;
-        args->stopLineX = 840.0f;
-        args->isCommuter = false;
-
-        pthread_t tid;
-        pthread_create(&tid, nullptr, f11LocalVehicleThreadFunc, args);
-        threads.push_back(tid);
-    };
+void IntersectionController::run() {
+    setNonBlocking(pipes.cmdPipeFd);
+    for (int fd : pipes.coordReadFds) {
+        setNonBlocking(fd);
+    }
+    traceAsyncBegin(lightName, "light", config.id);
+    roadMailboxes()[domain].open.store(true, memory_order_release);
+
+    publishLights();
+    rerouteGrantNs = simClock().nowNs();
+    demand.start(simClock().nowNs());
+    // The simulated clock reads the same in every controller process, so
+    // it is the corridors' shared cycle clock
+    signals.advanceTo(simClock().nowNs() / 1000000);
+
+    while (true) {
+        // Sleep to the end of the interval, the next preemption event, the
+        // next spawn or arrival, or the next poll, whichever is first; a
+        // request from a neighbour wakes the loop at once. A preemption
+        // stops the plan's clock while it runs.
+        int sliceMs = min(LIGHT_SLICE_MS, signals.getRemainingMs());
+        uint64_t nowNs = simClock().nowNs();
+        uint64_t nextNs = min({preemptor.nextEventNs(), spawns.nextEventNs(), demand.nextEventNs()});
+        if (nextNs != UINT64_MAX) {
+            sliceMs = min(sliceMs, nextNs > nowNs ? (int)((nextNs - nowNs + 999999) / 1000000) : 0);
+        }
+        waitForInput(simClock().realMsFor(sliceMs, LIGHT_SLICE_MS));
+        pollInputs();
+        spawnDue();
+        advanceSignals(simClock().nowNs());
+    }
+}
 
-    // Spawn initial vehicles - some from right, some from left
-    for (int i = 0; i < 3; ++i) {
-        VehicleType type = (VehicleType)(rand() % 6);
-        spawnVehicle(type);
-        usleep(rand() % 1500000 + 500000);
+void IntersectionController::advanceSignals(uint64_t nowNs) {
+    long long startedBefore = preemptor.startedCount;
+    bool wasForced = preemptor.isForced();
+    bool changed = preemptor.update(nowNs, signals);
+    if (preemptor.startedCount != startedBefore) {
+        cout << "[" << config.name << "] Emergency preemption (hop " << preemptor.lastHop
+             << "): GREEN " << preemptor.lastLatencyNs / 1000000 << " ms after the request" << endl;
     }
-    for (int i = 0; i < 2; ++i) {
-        VehicleType type = (VehicleType)(rand() % 6);
-        spawnLocalVehicle(type);
-        usleep(rand() % 1500000 + 500000);
+    if (preemptor.isForced() != wasForced) {
+        if (wasForced) traceAsyncEnd("emergency_preempt", "light", config.id);
+        else traceAsyncBegin("emergency_preempt", "light", config.id);
     }
 
-    while (true) {
-        // Check for emergency signal from F10
-        CoordinationMessage coordMsg;
-        if (read(readCoordFd, &coordMsg, sizeof(coordMsg)) == sizeof(coordMsg)) {
-            if (coordMsg.type == CoordinationMessage::EMERGENCY_APPROACHING) {
-                cout << "[F11] Emergency signal received! Switching to GREEN" << endl;
-                emergencyMode = true;
-
-                pthread_mutex_lock(&lightMutex);
-                lightState = TrafficLightState::GREEN;
-                pthread_mutex_unlock(&lightMutex);
-
-                PipeMessage msg;
-                msg.magic = MSG_MAGIC;
-                msg.type = PipeMessage::LIGHT_UPDATE;
-                msg.data.light.intersectionId = 11;
-                msg.data.light.state = TrafficLightState::GREEN;
-                write(writePipeFd, &msg, sizeof(msg));
-
-                sleep(5);
-                emergencyMode = false;
-            }
+    long long clockMs = nowNs / 1000000;
+    roadGreenWave().maintain(clockMs, roadTravelTimes());
+    signals.setOffset(roadGreenWave().offsetOf(junction));
+    if (signals.advanceTo(clockMs)) changed = true;
+    if (changed) {
+        publishLights();
+        if (signals.inGreen()) {
+            sendParkingUpdate();
+            traceFlush();
         }
+    }
+}
 
-        // Check for commands from parent
-        CommandMessage cmdMsg;
-        if (read(cmdPipeFd, &cmdMsg, sizeof(cmdMsg)) == sizeof(cmdMsg) && cmdMsg.magic == CMD_MAGIC) {
-            if (cmdMsg.command == ScenarioCommand::PARKING_FULL) {
-                cout << "[F11] Scenario B: Parking Saturation - Spawning 16 Cars" << endl;
-                for (int i = 0; i < 16; ++i) {
-                    spawnVehicle(VehicleType::CAR);
-                    usleep(200000);
-                }
-            } else if (cmdMsg.command == ScenarioCommand::GRIDLOCK) {
-                cout << "[F11] Scenario C: Gridlock - Spawning vehicles" << endl;
-                for (int i = 0; i < 5; ++i) {
-                    VehicleType type = (VehicleType)(rand() % 4 + 2);
-                    spawnVehicle(type, 400.0f);
-                    usleep(100000);
-                }
-                for (int i = 0; i < 3; ++i) {
-                    VehicleType type = (VehicleType)(rand() % 4 + 2);
-                    spawnLocalVehicle(type);
-                    usleep(100000);
-                }
-            }
+static uint32_t floatBits(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+void IntersectionController::stepVehicles() {
+    roadTravelTimes().grantReroutes(REROUTE_BUDGET_PER_TICK);
+    // Car following for everyone before anyone moves, as in SimEngine
+    roadLanes().updateAll();
+
+    for (size_t i = 0; i < stepped.size();) {
+        SteppedVehicle& sv = stepped[i];
+        if (sv.nextTick > tick) {
+            ++i;
+            continue;
         }
 
-        if (!emergencyMode) {
-            // Red phase
-            pthread_mutex_lock(&lightMutex);
-            lightState = TrafficLightState::RED;
-            pthread_mutex_unlock(&lightMutex);
-
-            PipeMessage msg;
-            msg.magic = MSG_MAGIC;
-            msg.type = PipeMessage::LIGHT_UPDATE;
-            msg.data.light.intersectionId = 11;
-            msg.data.light.state = TrafficLightState::RED;
-            write(writePipeFd, &msg, sizeof(msg));
-
-            for (int i = 0; i < 6; ++i) {
-                usleep(500000);
-                if (read(readCoordFd, &coordMsg, sizeof(coordMsg)) == sizeof(coordMsg)) {
-                    if (coordMsg.type == CoordinationMessage::EMERGENCY_APPROACHING) {
-                        cout << "[F11] Emergency during RED! Switching to GREEN" << endl;
-                        pthread_mutex_lock(&lightMutex);
-                        lightState = TrafficLightState::GREEN;
-                        pthread_mutex_unlock(&lightMutex);
-
-                        msg.data.light.state = TrafficLightState::GREEN;
-                        write(writePipeFd, &msg, sizeof(msg));
-                        sleep(5);
-                        break;
-                    }
-                }
-            }
+        // Pushed in phase B, adopted in the next phase A: a handed-off
+        // vehicle misses no tick
+        Vehicle* v = sv.args->vehicle;
+        int waitMs = 0;
+        bool gone = handOffVehicle(sv.args);
+        if (!gone) {
+            waitMs = stepVehicle(sv.args, false);
+            digest = digestMix(digest, (uint64_t)(uint32_t)v->id << 32 | (uint32_t)tick);
+            digest = digestMix(digest, (uint64_t)floatBits(v->x) << 32 | floatBits(v->y));
+            if (waitMs < 0) metricAdd(Metric::VEHICLES_COMPLETED);
+            else gone = handOffVehicle(sv.args);
+        }
 
-            // Green phase
-            pthread_mutex_lock(&lightMutex);
-            lightState = TrafficLightState::GREEN;
-            pthread_mutex_unlock(&lightMutex);
+        if (gone || waitMs < 0) {
+            // Trip over or driven elsewhere: swap-remove, which keeps the
+            // order deterministic
+            delete v;
+            delete sv.args;
+            stepped[i] = stepped.back();
+            stepped.pop_back();
+            metricAdd(Metric::VEHICLES_ACTIVE, -1);
+            continue;
+        }
+        sv.nextTick = tick + (waitMs + VEHICLE_SPEED_MS - 1) / VEHICLE_SPEED_MS;
+        ++i;
+    }
+}
 
-            msg.data.light.state = TrafficLightState::GREEN;
-            write(writePipeFd, &msg, sizeof(msg));
+void IntersectionController::runLockstep(Lockstep* board, long long ticks) {
+    lockstep = board;
+    roadLanes().batched = true;
+    simClock().drive(0);
+    setNonBlocking(pipes.cmdPipeFd);
+    for (int fd : pipes.coordReadFds) {
+        setNonBlocking(fd);
+    }
+    traceAsyncBegin(lightName, "light", config.id);
+    // Before the first barrier, so every controller sees it open by the
+    // time it first hands off
+    roadMailboxes()[domain].open.store(true, memory_order_release);
 
-            for (int i = 0; i < 6; ++i) {
-                usleep(500000);
-            }
+    publishLights();
+    demand.start(0);
+    signals.advanceTo(0);
 
-            // Send Parking Queue Update for F11
-            PipeMessage pMsg;
-            pMsg.magic = MSG_MAGIC;
-            pMsg.type = PipeMessage::PARKING_UPDATE;
-            pMsg.data.parking.intersectionId = 11;
-            pMsg.data.parking.waitingCount = parkingLot.getWaitingCount();
-            write(writePipeFd, &pMsg, sizeof(pMsg));
+    while (true) {
+        // A pause holds us here, but for the ticks a STEP asks for, and
+        // the other controllers at the barrier
+        while (simClock().isPaused() && stepTicks == 0 && pipes.cmdPipeFd != -1) {
+            pollfd fd = {pipes.cmdPipeFd, POLLIN, 0};
+            poll(&fd, 1, LIGHT_SLICE_MS);
+            readCommands();
         }
+        if (stepTicks > 0) stepTicks--;
+
+        // Phase A: messages sent last tick, spawns and the lights
+        lockstepWait(board, false);
+        tick = board->tick.load(memory_order_acquire);
+        if (tick >= ticks) break;
+        uint64_t nowNs = (uint64_t)tick * VEHICLE_SPEED_MS * 1000000ull;
+        simClock().drive(nowNs);
+        readCoordination();
+        readMigrations();
+        readCommands();
+        spawnDue();
+        advanceSignals(nowNs);
+
+        // Phase B: this tick's messages, for the next one, and the vehicles
+        lockstepWait(board, true);
+        for (const auto& out : outbox) write(out.first, &out.second, sizeof(out.second));
+        outbox.clear();
+        stepVehicles();
     }
 
-    for (auto tid : threads) {
-        pthread_join(tid, nullptr);
+    char hexDigest[17];
+    snprintf(hexDigest, sizeof(hexDigest), "%016llx", (unsigned long long)digest);
+    cout << "[" << config.name << "] Lockstep: " << ticks << " ticks, " << stepped.size()
+         << " vehicles still driving, trajectory digest " << hexDigest << endl;
+}
+
+// Spawn point at the named spawn record of the road network
+static SpawnPoint spawnPointFor(const char* name, int firstVehicleId) {
+    const RoadNetwork& net = roadNetwork();
+    TripPlan plan = tripPlanFor(name);
+    return {plan, (int)(net.findSpawn(name) - net.spawns.data()), firstVehicleId};
+}
+
+vector<IntersectionConfig> defaultIntersections() {
+    vector<IntersectionConfig> configs(2);
+
+    // F10: local traffic from the left, commuters from the right that
+    // pass F11 first, and the side street from the south; owns the right
+    // parking lot
+    IntersectionConfig& f10 = configs[0];
+    f10.id = 10;
+    f10.name = "F10";
+    f10.leftParking = false;
+    f10.spawnPoints = {
+        spawnPointFor("f10_local", 0),
+        spawnPointFor("f10_commuter", 50),
+        spawnPointFor("f10_south", 200),
+    };
+    f10.scenarioSpawns[(int)ScenarioCommand::GREEN_WAVE] = {
+        {0, 1, TypeMix::AMBULANCE, 0, 0},
+    };
+    f10.scenarioSpawns[(int)ScenarioCommand::PARKING_FULL] = {
+        {0, 16, TypeMix::CAR, 200, 0},
+    };
+    f10.scenarioSpawns[(int)ScenarioCommand::GRIDLOCK] = {
+        {0, 5, TypeMix::NO_EMERGENCY, 100, 0},
+        {1, 5, TypeMix::CAR_OR_BIKE, 100, 0},
+        {2, 4, TypeMix::NO_EMERGENCY, 100, 0},
+    };
+    f10.emergencyNeighbours = {11};
+
+    // F11: traffic from both ends and from the south using the left
+    // parking lot
+    IntersectionConfig& f11 = configs[1];
+    f11.id = 11;
+    f11.name = "F11";
+    f11.leftParking = true;
+    f11.spawnPoints = {
+        spawnPointFor("f11", 100),
+        spawnPointFor("f11_local", 150),
+        spawnPointFor("f11_south", 250),
+    };
+    f11.scenarioSpawns[(int)ScenarioCommand::PARKING_FULL] = {
+        {0, 16, TypeMix::CAR, 200, 0},
+    };
+    f11.scenarioSpawns[(int)ScenarioCommand::GRIDLOCK] = {
+        {0, 5, TypeMix::NO_EMERGENCY, 100, 0},
+        {1, 3, TypeMix::NO_EMERGENCY, 100, 0},
+        {2, 4, TypeMix::NO_EMERGENCY, 100, 0},
+    };
+    f11.emergencyNeighbours = {10};
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+        configs[i].peerIndex = (int)i;
+        configs[i].peerCount = (int)configs.size();
     }
+    return configs;
 }
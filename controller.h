@@ -1,16 +1,132 @@
 /**
  * controller.h
  * 
- * Traffic controller function declarations for F10 and F11.
+ * Data-driven traffic controller: one IntersectionController per
+ * intersection, configured with its spawn points, scenarios and neighbours.
+ * Its signal plan comes from the road network.
  */
 
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
-// F10 Controller - Manages intersection F10 and parking lot
-void trafficControllerF10(int writePipeFd, int readCoordFd, int writeCoordFd, int cmdPipeFd);
+#include "simulation_types.h"
+#include "parking.h"
+#include "vehicle.h"
+#include "signals.h"
+#include "preemption.h"
+#include "spawner.h"
+#include "command.h"
+#include "demand.h"
+#include "lockstep.h"
+#include "migration.h"
+#include <pthread.h>
+#include <utility>
+#include <vector>
 
-// F11 Controller - Manages intersection F11 and emergency handling
-void trafficControllerF11(int writePipeFd, int readCoordFd, int writeCoordFd, int cmdPipeFd);
+// Vehicle ids of a spawn point are its firstVehicleId, then every
+// VEHICLE_ID_STRIDE after it, so the points' sequences never meet
+const int VEHICLE_ID_STRIDE = 1000;
+
+// Where vehicles enter an intersection's domain and the trip they follow
+struct SpawnPoint {
+    TripPlan plan;
+    int spawn;          // Index into roadNetwork().spawns, for its demand
+    int firstVehicleId; // Below VEHICLE_ID_STRIDE
+};
+
+struct IntersectionConfig {
+    int id;                 // Id used in messages (10 for F10, 11 for F11)
+    const char* name;       // Log prefix, e.g. "F10"
+    bool leftParking;       // Vehicles use the left (mirrored) parking lot
+    std::vector<SpawnPoint> spawnPoints; // Their traffic is the road network's demand
+    std::vector<SpawnBatch> scenarioSpawns[SCENARIO_COUNT]; // Indexed by ScenarioCommand
+    std::vector<int> emergencyNeighbours; // Intersection ids preemption requests are relayed to
+    // Place among the controllers a broadcast command reaches, which
+    // split a broadcast SPAWN between them
+    int peerIndex;
+    int peerCount;
+};
+
+// Pipe ends owned by one controller process
+struct IntersectionPipes {
+    int writePipeFd;                                // Telemetry to the visualizer
+    int cmdPipeFd;                                  // Commands from the visualizer (command.h)
+    std::vector<int> coordReadFds;                  // Coordination from neighbours
+    std::vector<std::pair<int, int>> coordWriteFds; // (neighbour id, fd)
+};
+
+class IntersectionController {
+private:
+    IntersectionConfig config;
+    IntersectionPipes pipes;
+    ParkingLot parkingLot;
+    int junction;           // Index of config.id, on the light board
+    int domain;             // Road graph domain this controller drives (migration.h)
+    SignalPlan signals;     // From the road network's phases
+    EmergencyPreemptor preemptor;
+    const char* lightName;
+    uint64_t seed;                   // simSeed(), keying every random draw
+    std::vector<int> nextVehicleIds; // Per spawn point
+    SpawnScheduler spawns;  // Scenario and command batches
+    DemandGenerator demand; // Everyday traffic
+    CommandReader commands;
+    uint64_t rerouteGrantNs; // Simulated time the reroute budget is granted up to
+
+    // Lockstep only (see lockstep.h): the loop steps the vehicles itself
+    struct SteppedVehicle {
+        ThreadArgs* args;
+        long long nextTick; // Tick at which it steps again
+    };
+    Lockstep* lockstep;  // nullptr when running free
+    long long tick;
+    long long stepTicks; // Ticks a STEP command lets run while paused
+    std::vector<SteppedVehicle> stepped;
+    std::vector<std::pair<int, CoordinationMessage>> outbox; // Written after barrier B
+    std::vector<MigrationRecord> arrivals; // Reused by readMigrations()
+    uint64_t digest;     // Of every vehicle step and light change
+
+    void publishLights();
+    void sendParkingUpdate();
+    void spawnVehicle(int spawnPoint, VehicleType type);
+    // Type of the next vehicle from `spawnPoint`: draw 0 of its id's stream
+    VehicleType nextType(int spawnPoint, TypeMix mix) const;
+    // Start the vehicles and arrivals due now, at most SPAWN_DRAIN_MAX of them
+    void spawnDue();
+    // Send a preemption request ahead of emergency vehicle `v` on `plan`
+    void announceEmergency(const TripPlan& plan, const Vehicle* v);
+    // Take our hops of a preemption request and pass it on to the next
+    // junction on the route
+    void relayPreemption(CoordinationMessage msg);
+    // Sleep up to `timeoutMs`, waking early for a command or coordination
+    void waitForInput(int timeoutMs);
+    // Handle pending commands and coordination
+    void pollInputs();
+    void readCoordination();
+    void readCommands();
+    // Take over the vehicles other controllers handed to our domain
+    void readMigrations();
+    // Drive `args`'s vehicle: on a thread, or in the lockstep loop
+    void startVehicle(ThreadArgs* args);
+    // Carry out one command addressed to us; false if it can't be
+    bool handleCommand(const Command& cmd);
+    // Run preemption and the signal plan up to `nowNs`, publishing any
+    // change of lights
+    void advanceSignals(uint64_t nowNs);
+    // Lockstep: step every vehicle due this tick
+    void stepVehicles();
+public:
+    IntersectionController(const IntersectionConfig& config, const IntersectionPipes& pipes);
+    ~IntersectionController();
+
+    // Controller main loop; never returns
+    void run();
+
+    // Lockstep loop: `ticks` ticks in step with the other controllers on
+    // `board`, then report the trajectory digest and return
+    void runLockstep(Lockstep* board, long long ticks);
+};
+
+// The two-intersection layout: F10 (with the right lot) and F11 (left lot)
+std::vector<IntersectionConfig> defaultIntersections();
 
 #endif // CONTROLLER_H
@@ -0,0 +1,84 @@
+/**
+ * corridor.cpp
+ *
+ * Legs of each corridor in the road graph and the offsets derived from
+ * their travel times.
+ */
+
+#include "corridor.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+// Edges from one stop line straight on to the next in `direction`, or
+// false if the road turns away or ends first
+static bool findLeg(const RoadGraph& graph, int from, int to, Direction direction, vector<int>& edges) {
+    int node = from;
+    for (int steps = 0; node != to && steps < graph.edgeCount(); ++steps) {
+        int next = -1;
+        for (int e = graph.rowStart[node]; e < graph.rowStart[node + 1]; ++e) {
+            if (graph.edgeLink[e] >= 0 && alongDirection(graph, e, direction) > 0.5f) next = e;
+        }
+        if (next == -1) return false;
+        edges.push_back(next);
+        node = graph.edgeTo[next];
+    }
+    return node == to;
+}
+
+GreenWave::GreenWave(const RoadNetwork& net, const RoadGraph& graph)
+    : net(net), offsets(net.intersections.size(), -1), updatedMs(-1) {
+    legStart.assign(net.corridorJunctions.size() + 1, 0);
+    for (const NetCorridor& corridor : net.corridors) {
+        int previous = -1;
+        for (int k = 0; k < corridor.junctionCount; ++k) {
+            int j = corridor.firstJunction + k;
+            const NetIntersection& in = net.intersections[net.corridorJunctions[j]];
+            float x, y;
+            stopLinePoint(in, corridor.direction, x, y);
+            int stop = graph.findNode(x, y);
+            legStart[j] = (int)legEdges.size();
+            if (k > 0 && (stop == -1 || previous == -1 ||
+                          !findLeg(graph, previous, stop, corridor.direction, legEdges))) {
+                cerr << "Corridor has no straight road to intersection " << in.id << endl;
+                exit(1);
+            }
+            previous = stop;
+        }
+    }
+    legStart.back() = (int)legEdges.size();
+}
+
+bool GreenWave::maintain(long long clockMs, const TravelTimes& times) {
+    if (updatedMs >= 0 && clockMs - updatedMs < GREEN_WAVE_UPDATE_MS) return false;
+    updatedMs = clockMs;
+
+    bool moved = false;
+    for (const NetCorridor& corridor : net.corridors) {
+        float arrivalMs = 0;
+        for (int j = corridor.firstJunction; j < corridor.firstJunction + corridor.junctionCount; ++j) {
+            // Waiting at the next stop line is what the offsets should
+            // remove, so the leg's last edge counts at free flow
+            for (int i = legStart[j]; i < legStart[j + 1]; ++i) {
+                int e = legEdges[i];
+                arrivalMs += i + 1 < legStart[j + 1] ? times.estimate(e) : times.freeFlow(e);
+            }
+            int offset = (int)((long long)arrivalMs % corridor.cycleMs);
+            int& current = offsets[net.corridorJunctions[j]];
+            int change = abs(offset - current);
+            change = min(change, corridor.cycleMs - change);
+            if (current == -1 || change > GREEN_WAVE_DEADBAND_MS) {
+                current = offset;
+                moved = true;
+            }
+        }
+    }
+    return moved;
+}
+
+GreenWave& roadGreenWave() {
+    static GreenWave wave(roadNetwork(), roadGraph());
+    return wave;
+}
@@ -0,0 +1,52 @@
+/**
+ * corridor.h
+ *
+ * Green-wave coordination of the road network's corridors. Each junction
+ * on a corridor gets an offset into the shared signal cycle: the one
+ * before it plus how long traffic currently takes between their stop
+ * lines, so that a platoon released by one green reaches the next light
+ * as it turns green. Offsets follow the travel time estimates as they
+ * change, in O(corridor edges) per update.
+ */
+
+#ifndef CORRIDOR_H
+#define CORRIDOR_H
+
+#include "roadnet.h"
+#include "roadgraph.h"
+#include "routing.h"
+#include <vector>
+
+const int GREEN_WAVE_UPDATE_MS = 5000; // Offsets are recomputed this often
+const int GREEN_WAVE_DEADBAND_MS = 200; // Smaller moves are ignored
+
+class GreenWave {
+private:
+    const RoadNetwork& net;
+    // Edges between consecutive stop lines: those leading to
+    // corridorJunctions[j] are legEdges[legStart[j] .. legStart[j + 1] - 1]
+    // (none for a corridor's first junction)
+    std::vector<int> legStart, legEdges;
+    std::vector<int> offsets; // Per junction, -1 off every corridor
+    long long updatedMs;
+
+public:
+    // Exits if a corridor's junctions are not joined by straight road in
+    // its direction
+    GreenWave(const RoadNetwork& net, const RoadGraph& graph);
+
+    // Recompute the offsets from `times` if GREEN_WAVE_UPDATE_MS have
+    // passed on the shared clock since the last time. Returns true if any
+    // moved.
+    bool maintain(long long clockMs, const TravelTimes& times);
+
+    // Offset of a junction (index into net.intersections) in its
+    // corridor's cycle, or -1 if it is not coordinated
+    int offsetOf(int junction) const { return offsets[junction]; }
+};
+
+// The process-wide coordination of roadNetwork()'s corridors over
+// roadGraph()
+GreenWave& roadGreenWave();
+
+#endif // CORRIDOR_H
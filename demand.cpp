@@ -0,0 +1,135 @@
+/**
+ * demand.cpp
+ *
+ * Sampling the demand profiles into batches of arrivals.
+ */
+
+#include "demand.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+DemandGenerator::DemandGenerator(const RoadNetwork& net, const vector<int>& spawns, uint64_t seed,
+                                 int controller, double scale)
+    : net(net), cursor(0), startNs(0), sampledToNs(0), scale(scale) {
+    for (const NetDemand& d : net.demands) {
+        for (int i = 0; i < (int)spawns.size(); ++i) {
+            if (spawns[i] != d.spawn) continue;
+            Origin o = {&d, i, RandomStream({seed, (uint32_t)controller, RandomKind::DEMAND,
+                                             (uint32_t)d.spawn})};
+            o.nextNs = UINT64_MAX;
+            float sum = 0;
+            for (int t = 0; t < VEHICLE_TYPE_COUNT; ++t) {
+                sum += d.typeWeights[t];
+                o.cumulativeWeights[t] = sum;
+            }
+            o.periodMass = 0;
+            for (int k = 0; k < d.stepCount && d.periodMs > 0; ++k) {
+                int from = net.demandStepMs[d.firstStep + k];
+                int to = k + 1 < d.stepCount ? net.demandStepMs[d.firstStep + k + 1] : d.periodMs;
+                o.periodMass += net.demandStepRate[d.firstStep + k] * scale * (to - from) / 1000.0;
+            }
+            origins.push_back(o);
+        }
+    }
+}
+
+uint64_t DemandGenerator::sampleNext(Origin& o, uint64_t fromNs) const {
+    const NetDemand& d = *o.demand;
+    // Arrivals expected between here and the next one: spend them against
+    // the rate, step by step
+    double left = -log(o.rng.uniform());
+    double t = (fromNs - startNs) / 1e6; // Into the profile, ms
+
+    if (d.periodMs > 0) {
+        if (o.periodMass <= 0) return UINT64_MAX;
+        double periods = floor(left / o.periodMass);
+        left -= periods * o.periodMass;
+        t += periods * d.periodMs;
+    }
+
+    while (true) {
+        double base = d.periodMs > 0 ? floor(t / d.periodMs) * d.periodMs : 0;
+        double at = t - base;
+        int k = d.stepCount - 1;
+        while (k > 0 && net.demandStepMs[d.firstStep + k] > at) k--;
+        double rate = net.demandStepRate[d.firstStep + k] * scale / 1000.0; // Per ms
+        bool last = k + 1 == d.stepCount;
+        if (last && d.periodMs == 0) {
+            if (rate <= 0) return UINT64_MAX;
+            t += left / rate;
+            break;
+        }
+        double end = last ? d.periodMs : net.demandStepMs[d.firstStep + k + 1];
+        double mass = rate * (end - at);
+        if (rate > 0 && mass >= left) {
+            t += left / rate;
+            break;
+        }
+        left -= mass;
+        t = base + end;
+    }
+    return startNs + (uint64_t)(t * 1e6);
+}
+
+VehicleType DemandGenerator::sampleType(Origin& o) const {
+    double pick = o.rng.uniform() * o.cumulativeWeights[VEHICLE_TYPE_COUNT - 1];
+    int t = 0;
+    while (t + 1 < VEHICLE_TYPE_COUNT && o.cumulativeWeights[t] < pick) t++;
+    return (VehicleType)t;
+}
+
+void DemandGenerator::start(uint64_t nowNs) {
+    startNs = nowNs;
+    sampledToNs = nowNs;
+    batch.clear();
+    cursor = 0;
+    for (Origin& o : origins) o.nextNs = sampleNext(o, nowNs);
+}
+
+void DemandGenerator::refill() {
+    batch.clear();
+    cursor = 0;
+    uint64_t endNs = sampledToNs + (uint64_t)DEMAND_BATCH_MS * 1000000ull;
+    for (Origin& o : origins) {
+        while (o.nextNs < endNs) {
+            batch.push_back({o.nextNs, o.index, sampleType(o)});
+            o.nextNs = sampleNext(o, o.nextNs);
+        }
+    }
+    sort(batch.begin(), batch.end(), [](const Arrival& a, const Arrival& b) {
+        return a.timeNs != b.timeNs ? a.timeNs < b.timeNs : a.origin < b.origin;
+    });
+    sampledToNs = endNs;
+}
+
+bool DemandGenerator::pop(uint64_t nowNs, Arrival& arrival) {
+    while (cursor == batch.size()) {
+        if (origins.empty() || sampledToNs > nowNs) return false;
+        refill();
+    }
+    if (batch[cursor].timeNs > nowNs) return false;
+    arrival = batch[cursor++];
+    return true;
+}
+
+uint64_t DemandGenerator::nextEventNs() {
+    if (origins.empty()) return UINT64_MAX;
+    if (cursor == batch.size()) refill();
+    return cursor < batch.size() ? batch[cursor].timeNs : sampledToNs;
+}
+
+double demandScale() {
+    const char* text = getenv("TRAFFIC_DEMAND_SCALE");
+    if (text == nullptr) return 1.0;
+    char* end;
+    double scale = strtod(text, &end);
+    if (end == text || *end != '\0' || !(scale >= 0)) {
+        cerr << "Bad TRAFFIC_DEMAND_SCALE '" << text << "'" << endl;
+        exit(1);
+    }
+    return scale;
+}
@@ -0,0 +1,79 @@
+/**
+ * demand.h
+ *
+ * Vehicle arrivals from the road network's demand records. Each origin is
+ * a Poisson process whose rate follows its time-of-day profile; arrival
+ * gaps are drawn exactly, by spending an exponential draw against the
+ * profile's rate step by step. Arrivals are sampled ahead a
+ * DEMAND_BATCH_MS window at a time into one sorted buffer that is reused,
+ * so a steady stream allocates nothing once the buffer has grown to a
+ * window's worth.
+ */
+
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#include "simulation_types.h"
+#include "roadnet.h"
+#include "rng.h"
+#include <cstdint>
+#include <vector>
+
+const int DEMAND_BATCH_MS = 1000; // Simulated time sampled per batch
+
+struct Arrival {
+    uint64_t timeNs;
+    int origin;       // Index into the spawns the generator was built for
+    VehicleType type;
+};
+
+class DemandGenerator {
+private:
+    struct Origin {
+        const NetDemand* demand;
+        int index;          // In the caller's spawn list
+        RandomStream rng;   // Keyed by the network spawn index
+        uint64_t nextNs;    // Next arrival, not yet in a batch; UINT64_MAX: none
+        float cumulativeWeights[VEHICLE_TYPE_COUNT];
+        double periodMass;  // Expected arrivals per period (0: none ever)
+    };
+
+    const RoadNetwork& net;
+    std::vector<Origin> origins;
+    std::vector<Arrival> batch; // Sorted by time
+    size_t cursor;
+    uint64_t startNs;           // Profile time 0
+    uint64_t sampledToNs;       // Every arrival before this is in a batch
+    double scale;
+
+    // First arrival after `fromNs`, or UINT64_MAX
+    uint64_t sampleNext(Origin& o, uint64_t fromNs) const;
+    VehicleType sampleType(Origin& o) const;
+    // Sample the next window into the batch
+    void refill();
+
+public:
+    // Arrivals at `spawns` (indices into net.spawns; those without demand
+    // get none) of controller `controller`, with every rate multiplied by
+    // `scale`
+    DemandGenerator(const RoadNetwork& net, const std::vector<int>& spawns, uint64_t seed,
+                    int controller, double scale = 1.0);
+
+    // Put profile time 0 at `nowNs` and draw each origin's first arrival
+    void start(uint64_t nowNs);
+
+    // The earliest arrival due at `nowNs`; false if none is
+    bool pop(uint64_t nowNs, Arrival& arrival);
+
+    // When the next arrival is due, or the end of the sampled window if it
+    // holds none
+    uint64_t nextEventNs();
+
+    bool hasDemand() const { return !origins.empty(); }
+};
+
+// Multiplier for every demand rate, from $TRAFFIC_DEMAND_SCALE (default 1,
+// 0 turns demand off). Exits if it isn't a number of 0 or more.
+double demandScale();
+
+#endif // DEMAND_H
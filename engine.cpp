@@ -0,0 +1,310 @@
+/**
+ * engine.cpp
+ * 
+ * Implementation of the headless tick-driven SimEngine.
+ */
+
+#include "engine.h"
+#include "trace.h"
+#include "metrics.h"
+#include "routing.h"
+#include "lanes.h"
+#include "corridor.h"
+#include <algorithm>
+#include <cmath>
+#include <unistd.h>
+
+using namespace std;
+
+// Vehicles closer than this are checked for a collision
+const float COLLISION_RADIUS = VEHICLE_LENGTH;
+// A vehicle kept waiting this long squeezes past, so that a cycle of
+// vehicles yielding to each other cannot deadlock (1 second)
+const int COLLISION_PATIENCE_TICKS = 1000 / VEHICLE_SPEED_MS;
+
+// Whether a vehicle (dx, dy) away stands in the way of one driving along
+// `edge`: in front of it and within a vehicle width of its line
+static bool inPath(const RoadGraph& g, int edge, float dx, float dy) {
+    float along = dx * g.edgeDirX[edge] + dy * g.edgeDirY[edge];
+    float across = dx * g.edgeDirY[edge] - dy * g.edgeDirX[edge];
+    return along > 0 && fabs(across) < VEHICLE_WIDTH;
+}
+
+// Hash grid covering the road graph, one vehicle length per cell
+static SpatialHash graphHash(const RoadGraph& g) {
+    float minX = 0, minY = 0, maxX = 1, maxY = 1;
+    if (g.nodeCount() > 0) {
+        minX = *min_element(g.nodeX.begin(), g.nodeX.end());
+        maxX = *max_element(g.nodeX.begin(), g.nodeX.end());
+        minY = *min_element(g.nodeY.begin(), g.nodeY.end());
+        maxY = *max_element(g.nodeY.begin(), g.nodeY.end());
+    }
+    return SpatialHash(minX, minY, maxX, maxY, COLLISION_RADIUS);
+}
+
+SimEngine::SimEngine(int intersectionId, int writePipeFd, int firstVehicleId)
+    : intersectionId(intersectionId), junction(roadNetwork().intersectionIndex[intersectionId]),
+      writePipeFd(writePipeFd),
+      nextVehicleId(firstVehicleId), signals(signalPlanFor(intersectionId)),
+      tickCount(0), vehicleSteps(0), completedCount(0),
+      vehicleHash(graphHash(roadGraph())), collisionYields(0),
+      reservations(nullptr), stopLineWaitMs(0) {
+    const SignalInterval& now = signals.now();
+    storeLights(junction, now.states);
+    lightName = now.name;
+    traceAsyncBegin(lightName, "light", intersectionId);
+}
+
+SimEngine::~SimEngine() {
+    for (auto& ev : vehicles) {
+        roadLanes().leave(ev.args.vehicle);
+        delete ev.args.vehicle;
+    }
+}
+
+void SimEngine::spawn(VehicleType type, const TripPlan& plan, bool leftParking) {
+    Vehicle* v = new Vehicle(nextVehicleId++, type, writePipeFd, &parkingLot);
+    placeAtStart(v, plan);
+    v->isLeftParking = leftParking;
+    v->intersectionId = intersectionId;
+
+    EngineVehicle ev;
+    ev.args.vehicle = v;
+    ev.args.plan = plan;
+    ev.args.reservations = reservations;
+    ev.args.domain = -1; // One process drives the whole network
+    ev.nextTick = tickCount;
+    ev.yieldTicks = 0;
+    vehicles.push_back(ev);
+    traceAsyncBegin(phaseSpanName(v->phase), "vehicle", v->id);
+    metricAdd(Metric::VEHICLES_SPAWNED);
+
+    CoordinationMessage msg;
+    uint64_t nowNs = (uint64_t)tickCount * VEHICLE_SPEED_MS * 1000000ull;
+    if (isEmergency(type) && makePreemptRequest(plan, v->id, v->speed, intersectionId, nowNs, msg)) {
+        traceInstant("emergency_signal", "light", intersectionId);
+        relayPreemption(msg);
+    }
+    metricAdd(Metric::VEHICLES_ACTIVE);
+}
+
+void SimEngine::useReservations(IntersectionManager* manager) {
+    reservations = manager;
+    for (auto& ev : vehicles) ev.args.reservations = manager;
+}
+
+void SimEngine::useSignalPolicy(SignalPolicy policy) {
+    signals.setPolicy(policy);
+}
+
+void SimEngine::linkNeighbour(SimEngine* other) {
+    neighbours.push_back(other);
+}
+
+void SimEngine::relayPreemption(CoordinationMessage msg) {
+    while (msg.hop < msg.hopCount && msg.hops[msg.hop].intersectionId == intersectionId) {
+        preemptor.accept(msg);
+        msg.hop++;
+    }
+    if (msg.hop == msg.hopCount) return;
+
+    msg.sourceIntersection = intersectionId;
+    for (SimEngine* other : neighbours) {
+        if (other->intersectionId == msg.hops[msg.hop].intersectionId) {
+            other->relayPreemption(msg);
+            return;
+        }
+    }
+}
+
+void SimEngine::measurePreemption(LatencyHistogram* byHop) {
+    preemptor = EmergencyPreemptor(byHop);
+}
+
+void SimEngine::publishLights() {
+    const SignalInterval& now = signals.now();
+    traceLightChange(intersectionId, lightName, now.name);
+    lightName = now.name;
+    metricAdd(Metric::LIGHT_PHASE_CHANGES);
+
+    storeLights(junction, now.states);
+
+    PipeMessage msg;
+    msg.magic = MSG_MAGIC;
+    msg.type = PipeMessage::LIGHT_UPDATE;
+    msg.data.light.intersectionId = intersectionId;
+    copy(now.states, now.states + DIRECTION_COUNT, msg.data.light.states);
+    sendPipeMessage(writePipeFd, msg);
+}
+
+void SimEngine::advanceSignals() {
+    // Signal plan, standing still while an emergency preemption is running
+    long long clockMs = tickCount * VEHICLE_SPEED_MS;
+    bool wasForced = preemptor.isForced();
+    bool changed = preemptor.update((uint64_t)clockMs * 1000000ull, signals);
+    if (preemptor.isForced() != wasForced) {
+        if (wasForced) traceAsyncEnd("emergency_preempt", "light", intersectionId);
+        else traceAsyncBegin("emergency_preempt", "light", intersectionId);
+    }
+    signals.setOffset(roadGreenWave().offsetOf(junction));
+    if (signals.advanceTo(clockMs)) changed = true;
+    if (changed) {
+        publishLights();
+        if (signals.inGreen()) {
+            PipeMessage pMsg;
+            pMsg.magic = MSG_MAGIC;
+            pMsg.type = PipeMessage::PARKING_UPDATE;
+            pMsg.data.parking.intersectionId = intersectionId;
+            pMsg.data.parking.waitingCount = parkingLot.getWaitingCount();
+            sendPipeMessage(writePipeFd, pMsg);
+        }
+    }
+
+    if (reservations != nullptr) reservations->advanceTo(tickCount);
+}
+
+void SimEngine::stepVehicles() {
+    avoidCollisions();
+
+    for (size_t i = 0; i < vehicles.size();) {
+        EngineVehicle& ev = vehicles[i];
+        if (ev.nextTick > tickCount) {
+            ++i;
+            continue;
+        }
+
+        int waitMs = stepVehicle(&ev.args, false);
+        vehicleSteps++;
+
+        if (waitMs < 0) {
+            // Trip over: swap-remove so the active list stays dense
+            delete ev.args.vehicle;
+            vehicles[i] = vehicles.back();
+            vehicles.pop_back();
+            completedCount++;
+            metricAdd(Metric::VEHICLES_ACTIVE, -1);
+            metricAdd(Metric::VEHICLES_COMPLETED);
+            continue;
+        }
+
+        VehiclePhase phase = ev.args.vehicle->phase;
+        if (phase == VehiclePhase::WAIT_LIGHT || phase == VehiclePhase::HOLD) stopLineWaitMs += waitMs;
+        ev.nextTick = tickCount + (waitMs + VEHICLE_SPEED_MS - 1) / VEHICLE_SPEED_MS;
+        ++i;
+    }
+
+    tickCount++;
+}
+
+void SimEngine::avoidCollisions() {
+    // Only vehicles on an edge can move into each other; those waiting at
+    // a node (often many at a spawn point) stay out of the hash
+    const RoadGraph& g = roadGraph();
+    onEdge.clear();
+    posX.clear();
+    posY.clear();
+    for (int i = 0; i < (int)vehicles.size(); ++i) {
+        Vehicle* v = vehicles[i].args.vehicle;
+        if (v->edge == -1) continue;
+        onEdge.push_back(i);
+        posX.push_back(v->x);
+        posY.push_back(v->y);
+    }
+    vehicleHash.rebuild(posX.data(), posY.data(), (int)onEdge.size());
+    yielding.assign(vehicles.size(), 0);
+
+    // Lanes already keep their own vehicles apart, and the two directions
+    // of a road share its centre line, so only a vehicle manoeuvring in a
+    // lot can run into another. The few of them look around themselves;
+    // the queues on the roads are never scanned pair by pair.
+    float r2 = COLLISION_RADIUS * COLLISION_RADIUS;
+    for (int p = 0; p < (int)onEdge.size(); ++p) {
+        Vehicle* a = vehicles[onEdge[p]].args.vehicle;
+        if (g.edgeLink[a->edge] >= 0) continue;
+        vehicleHash.forEachNear(posX[p], posY[p], COLLISION_RADIUS, [&](int q) {
+            Vehicle* b = vehicles[onEdge[q]].args.vehicle;
+            // A pair of lot vehicles is looked at from its first one only
+            if (q == p || a->lane == b->lane || (g.edgeLink[b->edge] < 0 && q < p)) return;
+            float dx = posX[q] - posX[p], dy = posY[q] - posY[p];
+            if (dx * dx + dy * dy >= r2) return;
+
+            bool bAhead = inPath(g, a->edge, dx, dy);
+            bool aAhead = inPath(g, b->edge, -dx, -dy);
+            int yielder = -1;
+            if (bAhead && aAhead) yielder = a->id > b->id ? onEdge[p] : onEdge[q]; // Head on: the newer one waits
+            else if (bAhead) yielder = onEdge[p];
+            else if (aAhead) yielder = onEdge[q];
+            if (yielder == -1) return;
+            // Once out of patience it keeps going until the conflict clears
+            yielding[yielder] = 1;
+            Vehicle* v = vehicles[yielder].args.vehicle;
+            if (vehicles[yielder].yieldTicks < COLLISION_PATIENCE_TICKS && v->velocity > 0) {
+                v->velocity = 0;
+                collisionYields++;
+            }
+        });
+    }
+
+    for (size_t i = 0; i < vehicles.size(); ++i) {
+        vehicles[i].yieldTicks = yielding[i] ? vehicles[i].yieldTicks + 1 : 0;
+    }
+}
+
+int SimEngine::getActiveCount() {
+    return (int)vehicles.size();
+}
+
+const Vehicle* SimEngine::getVehicle(int i) {
+    return vehicles[i].args.vehicle;
+}
+
+long long SimEngine::getCompletedCount() {
+    return completedCount;
+}
+
+long long SimEngine::getTickCount() {
+    return tickCount;
+}
+
+long long SimEngine::getVehicleSteps() {
+    return vehicleSteps;
+}
+
+long long SimEngine::getCollisionYields() {
+    return collisionYields;
+}
+
+long long SimEngine::getStopLineWaitMs() {
+    return stopLineWaitMs;
+}
+
+SimWorld::SimWorld() : tickCount(0) {
+    // The world steps its vehicles from one thread while it lives; only
+    // then may the lanes skip the per-vehicle follow() and its lock
+    roadLanes().batched = true;
+}
+
+SimWorld::~SimWorld() {
+    roadLanes().batched = false;
+}
+
+void SimWorld::add(SimEngine* engine) {
+    engines.push_back(engine);
+}
+
+void SimWorld::tick() {
+    // Route repairs the vehicles may make this tick, and corridor offsets
+    // following the travel times
+    roadTravelTimes().grantReroutes(REROUTE_BUDGET_PER_TICK);
+    roadGreenWave().maintain(tickCount * VEHICLE_SPEED_MS, roadTravelTimes());
+    for (SimEngine* engine : engines) engine->advanceSignals();
+
+    // Car following for everyone before anyone moves
+    roadLanes().updateAll();
+    for (SimEngine* engine : engines) engine->stepVehicles();
+    tickCount++;
+}
+
+long long SimWorld::getTickCount() {
+    return tickCount;
+}
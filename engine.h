@@ -0,0 +1,126 @@
+/**
+ * engine.h
+ * 
+ * Headless tick-driven engine that steps vehicles without a thread each.
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "simulation_types.h"
+#include "parking.h"
+#include "vehicle.h"
+#include "spatialhash.h"
+#include "reservation.h"
+#include "signals.h"
+#include "preemption.h"
+#include "histogram.h"
+#include <pthread.h>
+#include <vector>
+
+// One intersection (light + parking lot) whose vehicles are advanced by
+// SimWorld::tick() instead of by their own threads. A tick is VEHICLE_SPEED_MS of
+// simulated time, so trips play out exactly as with vehicleThreadFunc.
+class SimEngine {
+private:
+    struct EngineVehicle {
+        ThreadArgs args;
+        long long nextTick; // Tick at which the vehicle steps again
+        int yieldTicks;     // Consecutive ticks in a conflict it must yield
+    };
+
+    int intersectionId;
+    int junction; // Its index, on the light board
+    int writePipeFd;
+    int nextVehicleId;
+    ParkingLot parkingLot;
+    SignalPlan signals;
+    EmergencyPreemptor preemptor;
+    std::vector<SimEngine*> neighbours; // Preemption requests are relayed to these
+    const char* lightName;
+    std::vector<EngineVehicle> vehicles; // Active vehicles only
+    long long tickCount;
+    long long vehicleSteps;
+    long long completedCount;
+
+    // Positions of the vehicles on an edge (indices into `vehicles` in
+    // onEdge), hashed once per tick
+    SpatialHash vehicleHash;
+    std::vector<int> onEdge;
+    std::vector<float> posX, posY;
+    std::vector<char> yielding; // Indexed like `vehicles`
+    long long collisionYields;
+
+    IntersectionManager* reservations;
+    long long stopLineWaitMs; // Summed over vehicles held at the stop line
+
+    // Publish the signal plan's current lights on the light board and to
+    // the visualizer
+    void publishLights();
+    // Stop for this tick any vehicle about to run into another off its own
+    // lane (lot manoeuvres cross the road and each other)
+    void avoidCollisions();
+
+public:
+    SimEngine(int intersectionId, int writePipeFd, int firstVehicleId);
+    ~SimEngine();
+
+    // Add a vehicle at the start of `plan`
+    void spawn(VehicleType type, const TripPlan& plan, bool leftParking);
+
+    // Let vehicles cross by reservation from `manager` instead of by the
+    // light (nullptr: back to the light). The engine advances its clock.
+    void useReservations(IntersectionManager* manager);
+
+    // How the signal plan times its greens (the plan's own is FIXED)
+    void useSignalPolicy(SignalPolicy policy);
+
+    // Relay emergency preemption requests to `other` (one way)
+    void linkNeighbour(SimEngine* other);
+    // Take our hops of a preemption request and pass it on to the neighbour
+    // that is next on the route
+    void relayPreemption(CoordinationMessage msg);
+    // Record request-to-green latencies into byHop[hop] (PREEMPT_MAX_HOPS
+    // histograms, simulated time)
+    void measurePreemption(LatencyHistogram* byHop);
+
+    // The two halves of a tick, run by SimWorld::tick() for every engine:
+    // the signal plan (the shared signal clock is the tick count in
+    // simulated milliseconds), then every due vehicle
+    void advanceSignals();
+    void stepVehicles();
+
+    // Getters
+    int getActiveCount();
+    const Vehicle* getVehicle(int i); // i < getActiveCount()
+    long long getCompletedCount();
+    long long getTickCount();
+    long long getVehicleSteps();
+    long long getCollisionYields();
+    long long getStopLineWaitMs();
+};
+
+// The engines of one process, stepped together. What is process-wide (the
+// lanes' car following, the reroute budget, the corridor offsets) runs
+// once a tick here rather than once per engine. The lanes are batched
+// (lanes.h) from construction to destruction, so create the world before
+// spawning into its engines.
+class SimWorld {
+private:
+    std::vector<SimEngine*> engines;
+    long long tickCount;
+
+public:
+    SimWorld();
+    ~SimWorld();
+
+    void add(SimEngine* engine);
+
+    // One tick: the signals of every engine, car following for every
+    // vehicle, then every engine's due vehicles
+    void tick();
+
+    long long getTickCount();
+};
+
+#endif // ENGINE_H
@@ -0,0 +1,98 @@
+/**
+ * histogram.cpp
+ * 
+ * Implementation of LatencyHistogram.
+ */
+
+#include "histogram.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < (uint64_t)SUB_BUCKETS) {
+        return (int)value; // Small values are exact
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - SUB_BUCKET_BITS;
+    uint64_t mantissa = value >> shift; // In [SUB_BUCKETS, 2 * SUB_BUCKETS)
+    return (shift + 1) * SUB_BUCKETS + (int)(mantissa - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucketMidpoint(int index) {
+    if (index < SUB_BUCKETS) {
+        return (uint64_t)index;
+    }
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t mantissa = (uint64_t)(index % SUB_BUCKETS + SUB_BUCKETS);
+    uint64_t lower = mantissa << shift;
+    return lower + ((1ull << shift) >> 1);
+}
+
+void LatencyHistogram::record(uint64_t valueNs) {
+    counts[bucketIndex(valueNs)]++;
+    totalCount++;
+    sum += (double)valueNs;
+    if (valueNs > maxValue) maxValue = valueNs;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        counts[i] += other.counts[i];
+    }
+    totalCount += other.totalCount;
+    sum += other.sum;
+    if (other.maxValue > maxValue) maxValue = other.maxValue;
+}
+
+void LatencyHistogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    totalCount = 0;
+    maxValue = 0;
+    sum = 0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+    if (totalCount == 0) return 0;
+    uint64_t rank = (uint64_t)(p * (double)totalCount);
+    if (rank >= totalCount) rank = totalCount - 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; i++) {
+        seen += counts[i];
+        if (seen > rank) {
+            uint64_t value = bucketMidpoint(i);
+            return value < maxValue ? value : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return totalCount;
+}
+
+uint64_t LatencyHistogram::getMax() const {
+    return maxValue;
+}
+
+double LatencyHistogram::getMean() const {
+    return totalCount > 0 ? sum / (double)totalCount : 0.0;
+}
+
+string histogramSummaryJson(const LatencyHistogram& h) {
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"count\": %llu, \"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+             "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}",
+             (unsigned long long)h.getCount(), h.getMean() / 1000.0,
+             h.percentile(0.50) / 1000.0, h.percentile(0.90) / 1000.0,
+             h.percentile(0.99) / 1000.0, h.percentile(0.999) / 1000.0,
+             h.getMax() / 1000.0);
+    return buf;
+}
@@ -0,0 +1,49 @@
+/**
+ * histogram.h
+ * 
+ * HDR-style latency histogram: log-linear buckets with a fixed relative
+ * error, constant-time record() and no allocation after construction.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+#include <string>
+
+class LatencyHistogram {
+private:
+    // Each power of two is split into 2^SUB_BUCKET_BITS linear buckets,
+    // so a recorded value is off by at most 1/64 (~1.6%)
+    static const int SUB_BUCKET_BITS = 6;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t totalCount;
+    uint64_t maxValue;
+    double sum;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketMidpoint(int index);
+
+public:
+    LatencyHistogram();
+
+    void record(uint64_t valueNs);
+    void merge(const LatencyHistogram& other);
+    void reset();
+
+    // Value at quantile p (0..1), accurate to the bucket resolution
+    uint64_t percentile(double p) const;
+
+    // Getters
+    uint64_t getCount() const;
+    uint64_t getMax() const;
+    double getMean() const;
+};
+
+// {"count": N, "mean_us": .., "p50_us": .., "p90_us": .., "p99_us": .., "p999_us": .., "max_us": ..}
+std::string histogramSummaryJson(const LatencyHistogram& h);
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,226 @@
+/**
+ * lanes.cpp
+ *
+ * Implementation of the lane table and the IDM speed updates.
+ */
+
+#include "lanes.h"
+#include "vehicle.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// IDM acceleration exponent is 4; the braking term's dv / (2 sqrt(ab))
+static const float IDM_DV_SCALE = 0.5f / sqrt(IDM_MAX_ACCEL * IDM_COMFORT_DECEL);
+// Keeps (s* / gap)^2 finite when vehicles touch
+static const float IDM_GAP_FLOOR = 0.01f;
+
+float idmFreeVelocity(float velocity, float desired) {
+    float r = velocity / desired;
+    r *= r;
+    return min(max(velocity + IDM_MAX_ACCEL * (1.0f - r * r), 0.0f), desired);
+}
+
+float idmVelocity(float velocity, float desired, float gap, float leaderVelocity) {
+    float dv = velocity - leaderVelocity;
+    float sStar = IDM_MIN_GAP + max(0.0f, velocity * IDM_HEADWAY_STEPS + velocity * dv * IDM_DV_SCALE);
+    float s = sStar / max(gap, IDM_GAP_FLOOR);
+    float r = velocity / desired;
+    r *= r;
+    float next = velocity + IDM_MAX_ACCEL * (1.0f - r * r - s * s);
+    return min(max(next, 0.0f), max(gap - IDM_MIN_GAP, 0.0f));
+}
+
+LaneTable::LaneTable(const RoadGraph& graph)
+    : graph(graph), lanes(graph.edgeCount()), batched(false) {
+    pthread_mutex_init(&mutex, nullptr);
+}
+
+LaneTable::~LaneTable() {
+    pthread_mutex_destroy(&mutex);
+}
+
+void LaneTable::removeLocked(Vehicle* v) {
+    if (v->lane == -1) return;
+    Lane& l = lanes[v->lane];
+    int i = v->laneIndex;
+    l.vehicles.erase(l.vehicles.begin() + i);
+    l.position.erase(l.position.begin() + i);
+    l.velocity.erase(l.velocity.begin() + i);
+    l.desired.erase(l.desired.begin() + i);
+    // Almost always the front vehicle leaving, so this is the whole lane
+    for (size_t j = i; j < l.vehicles.size(); ++j) l.vehicles[j]->laneIndex = (int)j;
+    v->lane = -1;
+    v->laneIndex = -1;
+}
+
+void LaneTable::enter(Vehicle* v, int edge) {
+    pthread_mutex_lock(&mutex);
+    removeLocked(v);
+    Lane& l = lanes[edge];
+    v->lane = edge;
+    v->laneIndex = (int)l.vehicles.size();
+    l.vehicles.push_back(v);
+    l.position.push_back(v->offset);
+    l.velocity.push_back(v->velocity);
+    l.desired.push_back(v->speed);
+    pthread_mutex_unlock(&mutex);
+}
+
+void LaneTable::leave(Vehicle* v) {
+    pthread_mutex_lock(&mutex);
+    removeLocked(v);
+    pthread_mutex_unlock(&mutex);
+}
+
+void LaneTable::update(Vehicle* v) {
+    if (v->lane == -1) return;
+    pthread_mutex_lock(&mutex);
+    Lane& l = lanes[v->lane];
+    // Waiting at the end node still holds the lane, at its far end
+    l.position[v->laneIndex] = v->edge == -1 ? graph.edgeLength[v->lane] : v->offset;
+    l.velocity[v->laneIndex] = v->velocity;
+    pthread_mutex_unlock(&mutex);
+}
+
+bool LaneTable::leaderGap(const Vehicle* v, float& gap, float& leaderVelocity) {
+    const Lane& l = lanes[v->lane];
+    int i = v->laneIndex;
+    if (i > 0) {
+        gap = l.position[i - 1] - l.position[i] - VEHICLE_LENGTH;
+        leaderVelocity = l.velocity[i - 1];
+        return true;
+    }
+    if (v->edge == -1 || v->routePos + 1 >= (int)v->route.size()) return false;
+    const Lane& next = lanes[v->route[v->routePos + 1]];
+    if (next.vehicles.empty()) {
+        if (next.ghostPosition < 0) return false;
+        gap = graph.edgeLength[v->lane] - l.position[0] + next.ghostPosition - VEHICLE_LENGTH;
+        leaderVelocity = next.ghostVelocity;
+        return true;
+    }
+    gap = graph.edgeLength[v->lane] - l.position[0] + next.position.back() - VEHICLE_LENGTH;
+    leaderVelocity = next.velocity.back();
+    return true;
+}
+
+void LaneTable::follow(Vehicle* v) {
+    if (v->lane == -1) {
+        v->velocity = idmFreeVelocity(v->velocity, v->speed);
+        return;
+    }
+    pthread_mutex_lock(&mutex);
+    float gap, leaderVelocity;
+    if (leaderGap(v, gap, leaderVelocity)) {
+        v->velocity = idmVelocity(v->velocity, v->speed, gap, leaderVelocity);
+    } else {
+        v->velocity = idmFreeVelocity(v->velocity, v->speed);
+    }
+    lanes[v->lane].velocity[v->laneIndex] = v->velocity;
+    pthread_mutex_unlock(&mutex);
+}
+
+float LaneTable::maxOffset(const Vehicle* v) {
+    if (v->lane == -1) return graph.edgeLength[v->edge];
+    // Batched, one thread steps every vehicle, so nothing moves v in its
+    // lane meanwhile and the front of a lane without a ghost needs no
+    // lock. Vehicle threads reorder lanes under the lock.
+    if (batched && v->laneIndex == 0 && lanes[v->lane].ghostPosition < 0) {
+        return graph.edgeLength[v->edge];
+    }
+    pthread_mutex_lock(&mutex);
+    const Lane& l = lanes[v->lane];
+    float limit = graph.edgeLength[v->edge];
+    if (v->laneIndex > 0) {
+        limit = l.position[v->laneIndex - 1] - VEHICLE_LENGTH - IDM_MIN_GAP;
+    } else if (l.ghostPosition >= 0) {
+        limit = l.ghostPosition - VEHICLE_LENGTH - IDM_MIN_GAP;
+    }
+    pthread_mutex_unlock(&mutex);
+    return limit;
+}
+
+void LaneTable::updateAll() {
+    pthread_mutex_lock(&mutex);
+    for (Lane& l : lanes) {
+        int n = (int)l.vehicles.size();
+        if (n == 0) continue;
+        if ((int)nextVelocity.size() < n) nextVelocity.resize(n);
+
+        // Followers: the IDM over the arrays, no branches, no pointer chasing
+        const float* pos = l.position.data();
+        const float* vel = l.velocity.data();
+        const float* want = l.desired.data();
+        float* out = nextVelocity.data();
+        for (int i = 1; i < n; ++i) {
+            float gap = pos[i - 1] - pos[i] - VEHICLE_LENGTH;
+            float dv = vel[i] - vel[i - 1];
+            float sStar = IDM_MIN_GAP + max(0.0f, vel[i] * IDM_HEADWAY_STEPS + vel[i] * dv * IDM_DV_SCALE);
+            float s = sStar / max(gap, IDM_GAP_FLOOR);
+            float r = vel[i] / want[i];
+            r *= r;
+            float next = vel[i] + IDM_MAX_ACCEL * (1.0f - r * r - s * s);
+            out[i] = min(max(next, 0.0f), max(gap - IDM_MIN_GAP, 0.0f));
+        }
+
+        // Front: leader in the next lane, if any. A front vehicle waiting at
+        // the end node keeps its speed until it sets off.
+        Vehicle* front = l.vehicles[0];
+        out[0] = vel[0];
+        if (front->edge != -1) {
+            float gap, leaderVelocity;
+            out[0] = leaderGap(front, gap, leaderVelocity)
+                         ? idmVelocity(vel[0], want[0], gap, leaderVelocity)
+                         : idmFreeVelocity(vel[0], want[0]);
+        }
+
+        for (int i = 0; i < n; ++i) {
+            l.velocity[i] = out[i];
+            l.vehicles[i]->velocity = out[i];
+        }
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+bool LaneTable::tail(int edge, float& position, float& velocity) {
+    pthread_mutex_lock(&mutex);
+    const Lane& l = lanes[edge];
+    bool any = !l.vehicles.empty();
+    if (any) {
+        position = l.position.back();
+        velocity = l.velocity.back();
+    }
+    pthread_mutex_unlock(&mutex);
+    return any;
+}
+
+void LaneTable::setGhost(int edge, float position, float velocity) {
+    pthread_mutex_lock(&mutex);
+    lanes[edge].ghostPosition = position;
+    lanes[edge].ghostVelocity = velocity;
+    pthread_mutex_unlock(&mutex);
+}
+
+int LaneTable::getLaneSize(int edge) {
+    pthread_mutex_lock(&mutex);
+    int size = (int)lanes[edge].vehicles.size();
+    pthread_mutex_unlock(&mutex);
+    return size;
+}
+
+int LaneTable::countNearEnd(int edge, float distance) {
+    pthread_mutex_lock(&mutex);
+    // Front first, so the count stops at the first vehicle short of the zone
+    const Lane& l = lanes[edge];
+    float from = graph.edgeLength[edge] - distance;
+    int count = 0;
+    while (count < (int)l.position.size() && l.position[count] >= from) count++;
+    pthread_mutex_unlock(&mutex);
+    return count;
+}
+
+LaneTable& roadLanes() {
+    static LaneTable lanes(roadGraph());
+    return lanes;
+}
@@ -0,0 +1,102 @@
+/**
+ * lanes.h
+ *
+ * Lane-level car following. Every road graph edge is a lane holding its
+ * vehicles in driving order, so a vehicle's leader is the entry in front
+ * of it. Speeds follow the Intelligent Driver Model (IDM), in pixels and
+ * VEHICLE_SPEED_MS steps.
+ */
+
+#ifndef LANES_H
+#define LANES_H
+
+#include "roadgraph.h"
+#include <pthread.h>
+#include <vector>
+
+class Vehicle;
+
+const float VEHICLE_LENGTH = 40.0f;     // As drawn by the visualizer
+const float VEHICLE_WIDTH = 20.0f;
+const float IDM_MIN_GAP = 5.0f;         // Bumper-to-bumper gap when stopped
+const float IDM_HEADWAY_STEPS = 10.0f;  // Desired time gap (500 ms)
+const float IDM_MAX_ACCEL = 0.25f;      // Pixels per step per step
+const float IDM_COMFORT_DECEL = 0.5f;
+
+// New speed of a vehicle at `velocity` wanting `desired`, with `gap` free
+// pixels to a leader moving at `leaderVelocity`. Never lets it close the
+// gap below IDM_MIN_GAP within one step.
+float idmVelocity(float velocity, float desired, float gap, float leaderVelocity);
+// Same, on an empty road
+float idmFreeVelocity(float velocity, float desired);
+
+// One lane's vehicles as parallel arrays, front (furthest along) first
+struct Lane {
+    std::vector<Vehicle*> vehicles;
+    std::vector<float> position; // Offset along the edge
+    std::vector<float> velocity; // Pixels per step
+    std::vector<float> desired;
+    // The lane's last vehicle as its owner in another process published it
+    // (a ghost zone, see region.h), for the vehicles about to enter the
+    // lane to follow; ghostPosition < 0 when it has none
+    float ghostPosition = -1;
+    float ghostVelocity = 0;
+};
+
+class LaneTable {
+private:
+    const RoadGraph& graph;
+    std::vector<Lane> lanes; // Indexed by edge
+    pthread_mutex_t mutex;
+    std::vector<float> nextVelocity;
+
+    void removeLocked(Vehicle* v);
+    // Free distance ahead of v and its leader's speed, looking into the
+    // next lane of its route if it is at the front. False if the road is
+    // clear.
+    bool leaderGap(const Vehicle* v, float& gap, float& leaderVelocity);
+
+public:
+    // Set where one thread steps every vehicle (a SimWorld, lockstep
+    // controllers, region workers) and calls updateAll() once per tick.
+    // Otherwise every advanceLeg() updates its own vehicle with follow(),
+    // on the vehicle's own thread.
+    bool batched;
+
+    explicit LaneTable(const RoadGraph& graph);
+    ~LaneTable();
+
+    // Move v to the tail of `edge`'s lane, leaving its previous one
+    void enter(Vehicle* v, int edge);
+    void leave(Vehicle* v);
+
+    // Store v's position and speed after it moved (or stopped)
+    void update(Vehicle* v);
+
+    // Set v->velocity from its leader
+    void follow(Vehicle* v);
+
+    // Furthest offset v may take on its lane without closing on its leader
+    // (who may have joined the lane after v's speed was set)
+    float maxOffset(const Vehicle* v);
+
+    // Set every vehicle's velocity: one branch-free pass over each lane's
+    // arrays for the followers, the front vehicle from the next lane
+    void updateAll();
+
+    // Ghost zones: the last vehicle on `edge`'s lane, false if it is empty
+    bool tail(int edge, float& position, float& velocity);
+    // Show `edge`'s lane, driven by another process, as ending in a vehicle
+    // at `position` (< 0: empty)
+    void setGhost(int edge, float position, float velocity);
+
+    int getLaneSize(int edge);
+    // Vehicles within `distance` of the end of `edge`'s lane (a detector
+    // at its stop line)
+    int countNearEnd(int edge, float distance);
+};
+
+// The process-wide lanes of roadGraph()
+LaneTable& roadLanes();
+
+#endif // LANES_H
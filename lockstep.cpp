@@ -0,0 +1,54 @@
+/**
+ * lockstep.cpp
+ *
+ * The shared lockstep board and its barrier.
+ */
+
+#include "lockstep.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+
+using namespace std;
+
+Lockstep* mapLockstep(int parties) {
+    void* p = mmap(nullptr, sizeof(Lockstep), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                   -1, 0);
+    if (p == MAP_FAILED) {
+        perror("Lockstep board mmap failed");
+        exit(1);
+    }
+    Lockstep* board = (Lockstep*)p;
+    pthread_barrierattr_t attr;
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    if (pthread_barrier_init(&board->barrier, &attr, parties) != 0) {
+        cerr << "Lockstep barrier for " << parties << " controllers failed" << endl;
+        exit(1);
+    }
+    pthread_barrierattr_destroy(&attr);
+    new (&board->tick) atomic<long long>(0);
+    return board;
+}
+
+void lockstepWait(Lockstep* board, bool endOfTick) {
+    // Everyone reads the tick between barriers A and B, so counting it
+    // after B cannot race with a reader
+    if (pthread_barrier_wait(&board->barrier) == PTHREAD_BARRIER_SERIAL_THREAD && endOfTick) {
+        board->tick.fetch_add(1, memory_order_release);
+    }
+}
+
+long long lockstepTicks() {
+    const char* text = getenv("TRAFFIC_LOCKSTEP");
+    if (text == nullptr) return 0;
+    char* end;
+    long long ticks = strtoll(text, &end, 10);
+    if (end == text || *end != '\0' || ticks <= 0) {
+        cerr << "Bad TRAFFIC_LOCKSTEP '" << text << "' (want a tick count)" << endl;
+        exit(1);
+    }
+    return ticks;
+}
@@ -0,0 +1,53 @@
+/**
+ * lockstep.h
+ *
+ * Deterministic lockstep across the controller processes. With
+ * $TRAFFIC_LOCKSTEP set, every controller steps its own vehicles tick by
+ * tick instead of giving each a thread, and all of them pass a barrier in
+ * shared memory twice a tick:
+ *
+ *   barrier A  read the coordination messages of the last tick, spawn,
+ *              run the signal plan and publish the lights
+ *   barrier B  send this tick's coordination messages, step the vehicles
+ *              (which read every junction's lights)
+ *
+ * Nothing one process writes is read by another in the same phase, so a
+ * run depends only on the seed and the commands, not on scheduling, and
+ * runs as fast as the slowest controller.
+ */
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+struct Lockstep {
+    pthread_barrier_t barrier;   // Process-shared, one party per controller
+    std::atomic<long long> tick; // Ticks every controller has finished
+};
+
+// Map a board for `parties` controller processes; call before forking
+Lockstep* mapLockstep(int parties);
+
+// Wait at the barrier; the last process to arrive after phase B counts
+// the tick
+void lockstepWait(Lockstep* board, bool endOfTick);
+
+// Ticks a lockstep run lasts, from $TRAFFIC_LOCKSTEP (0 when unset: run
+// free on the wall clock). Exits if it isn't a positive number.
+long long lockstepTicks();
+
+// Fold `value` into a running trajectory digest (FNV-1a over its bytes)
+inline uint64_t digestMix(uint64_t digest, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        digest ^= (value >> (i * 8)) & 0xFF;
+        digest *= 0x100000001B3ull;
+    }
+    return digest;
+}
+
+const uint64_t DIGEST_START = 0xCBF29CE484222325ull;
+
+#endif // LOCKSTEP_H
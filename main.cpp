@@ -9,42 +9,110 @@
  * - Visualization (SFML)
  * 
  * Architecture:
+ * - Road geometry comes from road_network.txt (or $TRAFFIC_NETWORK)
  * - Parent Process: Visualizer & Director (sends commands via pipes)
- * - Child Process A: F10 Controller (manages F10 intersection + parking)
- * - Child Process B: F11 Controller (manages F11 intersection + parking)
+ * - One child process per intersection, each running an
+ *   IntersectionController built from defaultIntersections()
+ *   (F10 with the right parking lot, F11 with the left one)
  * 
- * Pipes (5 total):
- * - Pipe 1: F10 -> Parent (vehicle/light data)
- * - Pipe 2: F11 -> Parent (vehicle/light data)
- * - Pipe 3: F10 -> F11 (emergency coordination)
- * - Pipe 4: Parent -> F10 (scenario commands)
- * - Pipe 5: Parent -> F11 (scenario commands)
+ * Pipes, per intersection:
+ * - Data pipe: controller -> Parent (vehicle/light data)
+ * - Command pipe: Parent -> controller (commands, see command.h)
+ * - One coordination pipe to each emergency neighbour (F10 <-> F11),
+ *   carrying preemption requests along emergency vehicles' routes
+ *
+ * Each controller drives the vehicles in its own part of the road graph;
+ * one crossing into another's is handed over through that controller's
+ * shared-memory mailbox (see migration.h).
+ *
+ * With $TRAFFIC_LOCKSTEP=<ticks> the controllers run that many ticks in
+ * lockstep through a shared-memory barrier (see lockstep.h) and report a
+ * digest of their vehicles' trajectories, controller i pinned to core i.
  */
 
 #include "simulation_types.h"
 #include "controller.h"
 #include "visualizer.h"
+#include "trace.h"
+#include "metrics.h"
+#include "roadnet.h"
+#include "signals.h"
+#include "lockstep.h"
+#include "migration.h"
+#include "partition.h"
+#include "region.h"
 
+#include <cctype>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <unistd.h>
 #include <sys/wait.h>
 
 using namespace std;
 
+// Close every pipe end in `fds` except those listed in `keep`
+static void closeAllExcept(const vector<int>& fds, const vector<int>& keep) {
+    for (int fd : fds) {
+        bool kept = false;
+        for (int k : keep) {
+            if (fd == k) kept = true;
+        }
+        if (!kept) close(fd);
+    }
+}
+
 int main() {
-    // Create Pipes
-    int pipeF10ToVis[2];      // Pipe 1: F10 -> Parent (Data)
-    int pipeF11ToVis[2];      // Pipe 2: F11 -> Parent (Data)
-    int pipeCoordF10ToF11[2]; // Pipe 3: F10 -> F11 (Coordination/Emergency)
-    int pipeCmdToF10[2];      // Pipe 4: Parent -> F10 (Commands)
-    int pipeCmdToF11[2];      // Pipe 5: Parent -> F11 (Commands)
-
-    if (pipe(pipeF10ToVis) == -1 || pipe(pipeF11ToVis) == -1 ||
-        pipe(pipeCoordF10ToF11) == -1 || pipe(pipeCmdToF10) == -1 ||
-        pipe(pipeCmdToF11) == -1) {
-        perror("Pipe creation failed");
+    // Load the road network and map the light board and the migration
+    // mailboxes before forking so every process shares them
+    roadNetwork();
+    roadLights();
+    roadMailboxes();
+    vector<IntersectionConfig> configs = defaultIntersections();
+    int count = configs.size();
+    // One controller per junction: a region of several would have two
+    // controllers draining its mailbox (bench_regions runs regions headless)
+    if (regionCount() != 0 && regionCount() != count) {
+        cerr << "TRAFFIC_REGIONS must be unset or " << count << " here, one per controller" << endl;
         return 1;
     }
+    long long lockstepRun = lockstepTicks();
+    Lockstep* lockstep = lockstepRun > 0 ? mapLockstep(count) : nullptr;
+
+    // Create Pipes
+    vector<int> allFds;
+    vector<IntersectionPipes> childPipes(count);
+    vector<int> dataReadFds(count), cmdWriteFds(count);
+
+    for (int i = 0; i < count; ++i) {
+        int dataPipe[2], cmdPipe[2];
+        if (pipe(dataPipe) == -1 || pipe(cmdPipe) == -1) {
+            perror("Pipe creation failed");
+            return 1;
+        }
+        childPipes[i].writePipeFd = dataPipe[1];
+        childPipes[i].cmdPipeFd = cmdPipe[0];
+        dataReadFds[i] = dataPipe[0];
+        cmdWriteFds[i] = cmdPipe[1];
+        allFds.insert(allFds.end(), {dataPipe[0], dataPipe[1], cmdPipe[0], cmdPipe[1]});
+    }
+
+    // Coordination pipes, one per (intersection -> emergency neighbour)
+    for (int i = 0; i < count; ++i) {
+        for (int neighbourId : configs[i].emergencyNeighbours) {
+            for (int j = 0; j < count; ++j) {
+                if (configs[j].id != neighbourId) continue;
+                int coordPipe[2];
+                if (pipe(coordPipe) == -1) {
+                    perror("Pipe creation failed");
+                    return 1;
+                }
+                childPipes[i].coordWriteFds.push_back(make_pair(neighbourId, coordPipe[1]));
+                childPipes[j].coordReadFds.push_back(coordPipe[0]);
+                allFds.insert(allFds.end(), {coordPipe[0], coordPipe[1]});
+            }
+        }
+    }
 
     cout << "=== Traffic Simulation Started ===" << endl;
     cout << "Click scenario buttons to trigger events" << endl;
@@ -55,49 +123,47 @@ int main() {
     cout << "  3. Chaos Mode    - Gridlock from all directions" << endl;
     cout << endl;
 
-    pid_t pidF10 = fork();
-    if (pidF10 == 0) {
-        // Child F10 Process
-        close(pipeF10ToVis[0]);
-        close(pipeF11ToVis[0]);
-        close(pipeF11ToVis[1]);
-        close(pipeCoordF10ToF11[0]);
-        close(pipeCmdToF10[1]);
-        close(pipeCmdToF11[0]);
-        close(pipeCmdToF11[1]);
-
-        trafficControllerF10(pipeF10ToVis[1], -1, pipeCoordF10ToF11[1], pipeCmdToF10[0]);
-        return 0;
-    }
+    for (int i = 0; i < count; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // Child controller process keeps only its own pipe ends
+            const IntersectionPipes& own = childPipes[i];
+            vector<int> keep = {own.writePipeFd, own.cmdPipeFd};
+            keep.insert(keep.end(), own.coordReadFds.begin(), own.coordReadFds.end());
+            for (const auto& neighbour : own.coordWriteFds) keep.push_back(neighbour.second);
+            closeAllExcept(allFds, keep);
 
-    pid_t pidF11 = fork();
-    if (pidF11 == 0) {
-        // Child F11 Process
-        close(pipeF11ToVis[0]);
-        close(pipeF10ToVis[0]);
-        close(pipeF10ToVis[1]);
-        close(pipeCoordF10ToF11[1]);
-        close(pipeCmdToF11[1]);
-        close(pipeCmdToF10[0]);
-        close(pipeCmdToF10[1]);
-
-        trafficControllerF11(pipeF11ToVis[1], pipeCoordF10ToF11[0], -1, pipeCmdToF11[0]);
-        return 0;
+            string role = configs[i].name;
+            for (char& c : role) c = tolower(c);
+            traceInit(role.c_str());
+            metricsStartExporter(role.c_str());
+
+            // In lockstep a controller steps its vehicles itself, so it
+            // gets a core of its own; free-running, its vehicle threads
+            // would inherit the pin
+            if (lockstep != nullptr && !pinToCore(i)) perror("Pinning a controller failed");
+
+            IntersectionController controller(configs[i], own);
+            if (lockstep != nullptr) controller.runLockstep(lockstep, lockstepRun);
+            else controller.run();
+            return 0;
+        }
     }
 
     // Parent Process (Visualizer)
-    close(pipeF10ToVis[1]);
-    close(pipeF11ToVis[1]);
-    close(pipeCoordF10ToF11[0]);
-    close(pipeCoordF10ToF11[1]);
-    close(pipeCmdToF10[0]);
-    close(pipeCmdToF11[0]);
+    vector<int> parentFds = dataReadFds;
+    parentFds.insert(parentFds.end(), cmdWriteFds.begin(), cmdWriteFds.end());
+    closeAllExcept(allFds, parentFds);
 
-    visualizerProcess(pipeF10ToVis[0], pipeF11ToVis[0], pipeCmdToF10[1], pipeCmdToF11[1]);
+    traceInit("visualizer");
+    metricsStartExporter("visualizer");
+    visualizerProcess(dataReadFds, cmdWriteFds);
 
     // Cleanup
-    wait(NULL);
-    wait(NULL);
+    traceShutdown();
+    for (int i = 0; i < count; ++i) {
+        wait(NULL);
+    }
 
     cout << "=== Traffic Simulation Ended ===" << endl;
 
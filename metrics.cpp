@@ -0,0 +1,213 @@
+/**
+ * metrics.cpp
+ * 
+ * Metric shard registry, aggregation and the Prometheus exporter thread.
+ */
+
+#include "metrics.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace std;
+
+struct MetricInfo {
+    const char* name;
+    const char* help;
+    bool isGauge;
+};
+
+// Indexed by Metric
+static const MetricInfo metricInfo[METRIC_COUNT] = {
+    {"traffic_vehicles_spawned_total", "Vehicles spawned", false},
+    {"traffic_vehicles_active", "Vehicles currently on their trip", true},
+    {"traffic_vehicles_completed_total", "Vehicles that finished their trip", false},
+    {"traffic_vehicles_rerouted_total", "Routes repaired around congested edges", false},
+    {"traffic_vehicles_handed_off_total", "Vehicles sent to another domain's controller", false},
+    {"traffic_vehicles_adopted_total", "Vehicles received from another domain's controller", false},
+    {"traffic_handoffs_deferred_total", "Hand-offs put off a step by a full mailbox", false},
+    {"traffic_light_phase_changes_total", "Traffic light state changes", false},
+    {"traffic_signal_gap_outs_total", "Actuated greens ended by an idle stop-line detector", false},
+    {"traffic_signal_max_outs_total", "Actuated greens ended at their maximum length", false},
+    {"traffic_stop_line_arrivals_total", "Vehicles reaching a signal's stop line", false},
+    {"traffic_arrivals_on_green_total", "Stop line arrivals while the light was GREEN for them", false},
+    {"traffic_platoon_trips_total", "Drives from an upstream light's release to the next stop line", false},
+    {"traffic_platoon_travel_ms_total", "Simulated milliseconds of those drives", false},
+    {"traffic_emergency_preemptions_total", "Lights forced GREEN for an emergency vehicle", false},
+    {"traffic_reservations_granted_total", "Junction crossings granted by the reservation table", false},
+    {"traffic_reservations_rejected_total", "Junction crossing requests rejected for a taken tile", false},
+    {"traffic_parking_enters_total", "Vehicles admitted to a parking queue", false},
+    {"traffic_parking_leaves_total", "Vehicles that left a parking spot", false},
+    {"traffic_parking_rejects_total", "Vehicles turned away from a full parking queue", false},
+    {"traffic_pipe_messages_sent_total", "Telemetry messages written", false},
+    {"traffic_pipe_bytes_sent_total", "Telemetry bytes written", false},
+    {"traffic_pipe_messages_received_total", "Telemetry messages read", false},
+    {"traffic_pipe_bytes_received_total", "Telemetry bytes read", false},
+    {"traffic_pipe_messages_dropped_total", "Telemetry messages lost to failed writes or bad reads", false},
+    {"traffic_commands_handled_total", "Controller commands carried out", false},
+    {"traffic_commands_rejected_total", "Controller commands malformed, unknown or not applicable", false},
+};
+
+const int EXPORT_INTERVAL_MS = 1000;
+
+static pthread_mutex_t shardLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<MetricShard*> shards;      // Of live threads
+static vector<MetricShard*> spareShards; // Of exited threads, zeroed
+static int64_t retiredTotals[METRIC_COUNT]; // Folded in from exited threads
+
+static void retireShard(MetricShard* shard);
+
+// Retires the thread's shard when the thread exits, so a process that
+// starts a thread per vehicle keeps as many shards as it has threads
+struct MetricThread {
+    MetricShard* shard = nullptr;
+    ~MetricThread() {
+        if (shard != nullptr) retireShard(shard);
+    }
+};
+
+static thread_local MetricThread localThread;
+
+MetricShard* metricRegisterThread() {
+    pthread_mutex_lock(&shardLock);
+    MetricShard* shard;
+    if (!spareShards.empty()) {
+        shard = spareShards.back();
+        spareShards.pop_back();
+    } else {
+        shard = new MetricShard();
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            shard->values[i].store(0, memory_order_relaxed);
+        }
+    }
+    shards.push_back(shard);
+    pthread_mutex_unlock(&shardLock);
+    localThread.shard = shard;
+    return shard;
+}
+
+// Fold an exiting thread's counts into the retired totals, so counts of
+// finished vehicles still add up, and keep the shard for the next thread
+static void retireShard(MetricShard* shard) {
+    pthread_mutex_lock(&shardLock);
+    for (int i = 0; i < METRIC_COUNT; i++) {
+        retiredTotals[i] += shard->values[i].load(memory_order_relaxed);
+        shard->values[i].store(0, memory_order_relaxed);
+    }
+    for (size_t i = 0; i < shards.size(); ++i) {
+        if (shards[i] != shard) continue;
+        shards[i] = shards.back();
+        shards.pop_back();
+        break;
+    }
+    spareShards.push_back(shard);
+    pthread_mutex_unlock(&shardLock);
+}
+
+int64_t metricValue(Metric metric) {
+    pthread_mutex_lock(&shardLock);
+    int64_t total = retiredTotals[(int)metric];
+    for (MetricShard* shard : shards) {
+        total += shard->values[(int)metric].load(memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shardLock);
+    return total;
+}
+
+void metricsFormat(char* buf, int size, const char* role) {
+    int64_t totals[METRIC_COUNT];
+    pthread_mutex_lock(&shardLock);
+    for (int i = 0; i < METRIC_COUNT; i++) totals[i] = retiredTotals[i];
+    for (MetricShard* shard : shards) {
+        for (int i = 0; i < METRIC_COUNT; i++) {
+            totals[i] += shard->values[i].load(memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&shardLock);
+
+    int len = 0;
+    for (int i = 0; i < METRIC_COUNT && len < size; i++) {
+        const MetricInfo& m = metricInfo[i];
+        len += snprintf(buf + len, size - len,
+                        "# HELP %s %s\n# TYPE %s %s\n%s{role=\"%s\"} %lld\n",
+                        m.name, m.help, m.name, m.isGauge ? "gauge" : "counter",
+                        m.name, role, (long long)totals[i]);
+    }
+}
+
+struct ExporterArgs {
+    string role;
+    string path;
+    bool unixSocket;
+};
+
+static void writeMetricsFile(const ExporterArgs* args, char* buf, int size) {
+    metricsFormat(buf, size, args->role.c_str());
+
+    // Write then rename so scrapers never see a half-written file
+    string tmp = args->path + ".tmp";
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == nullptr) return;
+    fputs(buf, f);
+    fclose(f);
+    rename(tmp.c_str(), args->path.c_str());
+}
+
+static void* exporterThreadFunc(void* arg) {
+    ExporterArgs* args = (ExporterArgs*)arg;
+    static char buf[16384];
+
+    if (!args->unixSocket) {
+        while (true) {
+            writeMetricsFile(args, buf, sizeof(buf));
+            usleep(EXPORT_INTERVAL_MS * 1000);
+        }
+    }
+
+    // Socket mode: every connection gets the current exposition
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, args->path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(args->path.c_str());
+    if (listenFd == -1 || bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(listenFd, 4) == -1) {
+        perror("Metrics socket setup failed");
+        return nullptr;
+    }
+
+    while (true) {
+        int clientFd = accept(listenFd, nullptr, nullptr);
+        if (clientFd == -1) continue;
+        metricsFormat(buf, sizeof(buf), args->role.c_str());
+        write(clientFd, buf, strlen(buf));
+        close(clientFd);
+    }
+    return nullptr;
+}
+
+void metricsStartExporter(const char* role) {
+    const char* target = getenv("TRAFFIC_METRICS");
+    if (target == nullptr || target[0] == '\0') return;
+
+    ExporterArgs* args = new ExporterArgs();
+    args->role = role;
+    args->unixSocket = strncmp(target, "unix:", 5) == 0;
+    if (args->unixSocket) {
+        args->path = string(target + 5) + "." + role + ".sock";
+    } else {
+        args->path = string(target) + "." + role + ".prom";
+    }
+
+    pthread_t tid;
+    pthread_create(&tid, nullptr, exporterThreadFunc, args);
+    pthread_detach(tid);
+}
@@ -0,0 +1,80 @@
+/**
+ * metrics.h
+ * 
+ * Operational counters and gauges with per-thread shards, exported
+ * periodically in Prometheus text format. Set TRAFFIC_METRICS=<prefix> to
+ * write <prefix>.<role>.prom every second, or TRAFFIC_METRICS=unix:<prefix>
+ * to serve the same text on the Unix socket <prefix>.<role>.sock.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+
+enum class Metric {
+    VEHICLES_SPAWNED,
+    VEHICLES_ACTIVE,          // Gauge: vehicles this process is driving
+    VEHICLES_COMPLETED,
+    VEHICLES_REROUTED,        // Route ahead repaired around congestion
+    VEHICLES_HANDED_OFF,      // Sent to another domain's controller (migration.h)
+    VEHICLES_ADOPTED,         // Received from one
+    HANDOFFS_DEFERRED,        // Kept a step longer: the mailbox was full
+    LIGHT_PHASE_CHANGES,
+    SIGNAL_GAP_OUTS,          // Actuated greens ended by an idle detector
+    SIGNAL_MAX_OUTS,          // Actuated greens ended at their maximum
+    STOP_LINE_ARRIVALS,       // Vehicles reaching a signal's stop line
+    ARRIVALS_ON_GREEN,        // ... while it showed GREEN for them
+    PLATOON_TRIPS,            // Drives from an upstream light to the next stop line
+    PLATOON_TRAVEL_MS,        // Their summed simulated time
+    EMERGENCY_PREEMPTIONS,
+    RESERVATIONS_GRANTED,     // Junction crossings admitted by the tile table
+    RESERVATIONS_REJECTED,
+    PARKING_ENTERS,           // enterQueue() handed out a queue slot
+    PARKING_LEAVES,
+    PARKING_REJECTS,          // enterQueue() returned -1
+    PIPE_MESSAGES_SENT,
+    PIPE_BYTES_SENT,
+    PIPE_MESSAGES_RECEIVED,
+    PIPE_BYTES_RECEIVED,
+    PIPE_MESSAGES_DROPPED,    // Failed or short writes, invalid reads
+    COMMANDS_HANDLED,
+    COMMANDS_REJECTED,        // Malformed, unknown or not applicable
+    COUNT
+};
+
+const int METRIC_COUNT = (int)Metric::COUNT;
+
+// One thread's values, on cache lines of its own. Only the owning thread
+// writes, so an update is a relaxed load and store (no locked RMW).
+struct alignas(64) MetricShard {
+    std::atomic<int64_t> values[METRIC_COUNT];
+};
+
+// Slow path: register a shard for the calling thread. When the thread
+// exits its counts fold into the process totals and the shard is reused.
+MetricShard* metricRegisterThread();
+
+inline MetricShard* metricLocalShard() {
+    static thread_local MetricShard* shard = nullptr;
+    if (__builtin_expect(shard == nullptr, 0)) shard = metricRegisterThread();
+    return shard;
+}
+
+// Add to a counter or gauge (negative deltas are for gauges only)
+inline void metricAdd(Metric metric, int64_t delta = 1) {
+    std::atomic<int64_t>& v = metricLocalShard()->values[(int)metric];
+    v.store(v.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// Sum of a metric over every thread of this process
+int64_t metricValue(Metric metric);
+
+// Prometheus text exposition of all metrics, labelled role="<role>"
+void metricsFormat(char* buf, int size, const char* role);
+
+// Start the background exporter if TRAFFIC_METRICS is set
+void metricsStartExporter(const char* role);
+
+#endif // METRICS_H
@@ -0,0 +1,215 @@
+/**
+ * migration.cpp
+ *
+ * Domains of the road graph, the shared mailboxes and the vehicle records
+ * that travel through them.
+ */
+
+#include "migration.h"
+#include "roadnet.h"
+#include "roadgraph.h"
+#include "routing.h"
+#include "lanes.h"
+#include "trace.h"
+#include "metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+const uint32_t MIGRATION_MASK = MIGRATION_SLOTS - 1;
+static_assert((MIGRATION_SLOTS & MIGRATION_MASK) == 0, "MIGRATION_SLOTS must be a power of two");
+
+MigrationMailbox* mapMailboxes() {
+    size_t count = roadPartition().regions;
+    void* p = mmap(nullptr, count * sizeof(MigrationMailbox), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("Migration mailbox mmap failed");
+        exit(1);
+    }
+    MigrationMailbox* boxes = (MigrationMailbox*)p;
+    for (size_t d = 0; d < count; ++d) {
+        MigrationMailbox& box = boxes[d];
+        new (&box.tail) atomic<uint32_t>(0);
+        new (&box.head) atomic<uint32_t>(0);
+        new (&box.open) atomic<bool>(false);
+        new (&box.rung) atomic<bool>(false);
+        for (uint32_t i = 0; i < MIGRATION_SLOTS; ++i) new (&box.slots[i].sequence) atomic<uint32_t>(i);
+
+        int fds[2];
+        if (pipe(fds) == -1) {
+            perror("Migration doorbell pipe failed");
+            exit(1);
+        }
+        // Producers never wait on a doorbell, nor the controller on draining it
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+        box.doorbellRead = fds[0];
+        box.doorbellWrite = fds[1];
+    }
+    return boxes;
+}
+
+bool mailboxPush(MigrationMailbox& box, const MigrationRecord& record) {
+    uint32_t pos = box.tail.load(memory_order_relaxed);
+    MigrationSlot* slot;
+    while (true) {
+        slot = &box.slots[pos & MIGRATION_MASK];
+        int32_t lap = (int32_t)(slot->sequence.load(memory_order_acquire) - pos);
+        if (lap == 0) {
+            // Free for this lap: claim it, unless another producer just did
+            if (box.tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+        } else if (lap < 0) {
+            return false; // Still holds the record of the last lap
+        } else {
+            pos = box.tail.load(memory_order_relaxed);
+        }
+    }
+    slot->record = record;
+    slot->sequence.store(pos + 1, memory_order_release);
+    return true;
+}
+
+bool mailboxPop(MigrationMailbox& box, MigrationRecord& record) {
+    uint32_t pos = box.head.load(memory_order_relaxed);
+    MigrationSlot& slot = box.slots[pos & MIGRATION_MASK];
+    if ((int32_t)(slot.sequence.load(memory_order_acquire) - (pos + 1)) < 0) return false;
+    record = slot.record;
+    // Ready for the producers' next lap
+    slot.sequence.store(pos + MIGRATION_SLOTS, memory_order_release);
+    box.head.store(pos + 1, memory_order_relaxed);
+    return true;
+}
+
+int domainOf(const Vehicle* v) {
+    const Partition& p = roadPartition();
+    return p.regionOfNode(v->edge != -1 ? roadGraph().edgeTo[v->edge] : v->node);
+}
+
+// Lot phases use the parking lot of the process they started in
+static bool inLot(VehiclePhase phase) {
+    switch (phase) {
+        case VehiclePhase::TO_QUEUE:
+        case VehiclePhase::TO_QUEUE_BOX:
+        case VehiclePhase::WAIT_SPOT:
+        case VehiclePhase::TO_SPOT:
+        case VehiclePhase::PARKED:
+        case VehiclePhase::EXIT_LOT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool handOffVehicle(ThreadArgs* args) {
+    Vehicle* v = args->vehicle;
+    if (args->domain < 0 || v->phase == VehiclePhase::DONE || inLot(v->phase)) return false;
+    int to = domainOf(v);
+    if (to == args->domain) return false;
+    MigrationMailbox& box = roadMailboxes()[to];
+    if (!box.open.load(memory_order_acquire)) return false;
+
+    MigrationRecord r;
+    r.id = v->id;
+    r.spawn = args->plan.spawn;
+    r.intersectionId = v->intersectionId;
+    r.node = v->node;
+    r.edge = v->edge;
+    r.lane = v->lane;
+    r.offset = v->offset;
+    r.velocity = v->velocity;
+    r.clockMs = v->clockMs;
+    r.timedSinceMs = v->timedSinceMs;
+    r.releasedMs = v->releasedMs;
+    r.timedEdge = v->timedEdge;
+    r.type = (uint8_t)v->type;
+    r.phase = (uint8_t)v->phase;
+    r.isLeftParking = v->isLeftParking;
+    if (!mailboxPush(box, r)) {
+        metricAdd(Metric::HANDOFFS_DEFERRED);
+        return false;
+    }
+    // One byte wakes the controller however many records wait; it clears
+    // the flag before draining the mailbox
+    if (!box.rung.exchange(true)) {
+        char bell = 1;
+        if (write(box.doorbellWrite, &bell, 1) != 1) box.rung.store(false);
+    }
+
+    roadLanes().leave(v);
+    traceAsyncEnd(phaseSpanName(v->phase), "vehicle", v->id);
+    metricAdd(Metric::VEHICLES_HANDED_OFF);
+    return true;
+}
+
+// Trip plans by network spawn, compiled on first use. Only the
+// controller's main loop adopts vehicles, so this needs no lock.
+static const TripPlan& spawnPlan(int spawn) {
+    static vector<TripPlan> plans;
+    static vector<bool> compiled;
+    const RoadNetwork& net = roadNetwork();
+    if (plans.empty()) {
+        plans.resize(net.spawns.size());
+        compiled.assign(net.spawns.size(), false);
+    }
+    if (!compiled[spawn]) {
+        plans[spawn] = compileTripPlan(net, roadGraph(), net.spawns[spawn]);
+        compiled[spawn] = true;
+    }
+    return plans[spawn];
+}
+
+ThreadArgs* adoptVehicle(const MigrationRecord& r, int domain, int pipeFd, ParkingLot* lot) {
+    const RoadGraph& g = roadGraph();
+    ThreadArgs* args = new ThreadArgs();
+    args->plan = spawnPlan(r.spawn);
+    args->reservations = nullptr;
+    args->domain = domain;
+
+    bool ownsLot = roadPartition().regionOfNode(args->plan.stopNode) == domain;
+    Vehicle* v = new Vehicle(r.id, (VehicleType)r.type, pipeFd, ownsLot ? lot : nullptr);
+    args->vehicle = v;
+    v->intersectionId = r.intersectionId;
+    v->isLeftParking = r.isLeftParking;
+    v->phase = (VehiclePhase)r.phase;
+    v->node = r.node;
+    v->edge = r.edge;
+    v->offset = r.offset;
+    v->velocity = r.velocity;
+    v->clockMs = r.clockMs;
+    v->timedEdge = r.timedEdge;
+    v->timedSinceMs = r.timedSinceMs;
+    v->releasedMs = r.releasedMs;
+
+    if (v->edge == -1) {
+        v->x = g.nodeX[v->node];
+        v->y = g.nodeY[v->node];
+        if (r.lane != -1) roadLanes().enter(v, r.lane);
+    } else {
+        // The rest of the leg, from the end of the edge it is on
+        v->route.assign(1, v->edge);
+        v->routePos = 0;
+        int from = g.edgeTo[v->edge];
+        int target = legTarget(args->plan, v);
+        vector<int> rest;
+        if (target != -1 && from != target) {
+            if (!roadRouter().route(from, target, rest)) {
+                cerr << "Road graph has no way from node " << from << " to " << target << endl;
+                exit(1);
+            }
+            v->route.insert(v->route.end(), rest.begin(), rest.end());
+        }
+        v->x = g.edgeFromX[v->edge] + g.edgeDirX[v->edge] * v->offset;
+        v->y = g.edgeFromY[v->edge] + g.edgeDirY[v->edge] * v->offset;
+        roadLanes().enter(v, v->edge);
+    }
+    roadLanes().update(v);
+    metricAdd(Metric::VEHICLES_ADOPTED);
+    return args;
+}
@@ -0,0 +1,96 @@
+/**
+ * migration.h
+ *
+ * Handing vehicles between controller processes. Every road graph node
+ * belongs to one domain, its region of roadPartition() (by default the
+ * junction whose centre is nearest), and a vehicle is driven by the
+ * controller of the domain it is in; a lane belongs to the domain its end
+ * node is in, so a stop line's queue is always in one process. A vehicle
+ * that crosses into another domain is packed into a MigrationRecord and
+ * pushed into that domain's mailbox, a bounded lock-free queue in shared
+ * memory; its controller unpacks it, puts it on its own lanes and drives
+ * it under its own signals.
+ */
+
+#ifndef MIGRATION_H
+#define MIGRATION_H
+
+#include "vehicle.h"
+#include "partition.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+const int MIGRATION_SLOTS = 256; // Per mailbox; a power of two
+
+// What a vehicle's new controller needs to carry on with its trip. The
+// route of its leg is not sent: the receiver plans it again from the
+// vehicle's edge, with its own travel times.
+struct MigrationRecord {
+    int32_t id;
+    int32_t spawn;          // Trip plan: index into roadNetwork().spawns
+    int32_t intersectionId; // Controller that spawned it
+    int32_t node;
+    int32_t edge;
+    int32_t lane;           // Held while waiting at `node`
+    float offset;
+    float velocity;
+    int64_t clockMs;
+    int64_t timedSinceMs;
+    int64_t releasedMs;
+    int32_t timedEdge;
+    uint8_t type;           // VehicleType
+    uint8_t phase;          // VehiclePhase
+    uint8_t isLeftParking;
+};
+
+struct MigrationSlot {
+    std::atomic<uint32_t> sequence; // Lap the slot is ready for (see push/pop)
+    MigrationRecord record;
+};
+
+// One domain's inbox: a bounded multi-producer queue (Vyukov) drained by
+// the domain's controller alone. Producers claim a slot by advancing
+// `tail`; a slot's sequence tells them whether its last record was
+// taken, and the consumer whether the new one is written.
+struct MigrationMailbox {
+    alignas(64) std::atomic<uint32_t> tail; // Next slot to fill
+    alignas(64) std::atomic<uint32_t> head; // Next slot to drain
+    std::atomic<bool> open;                 // A controller serves the domain
+    std::atomic<bool> rung;                 // Doorbell byte written, not yet drained
+    int doorbellRead;                       // Pipe that wakes the controller
+    int doorbellWrite;
+    alignas(64) MigrationSlot slots[MIGRATION_SLOTS];
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Mailboxes are shared between processes");
+
+// The mailboxes, one per domain. Mapped on first use: call it before
+// forking to share it (and its doorbell pipes).
+MigrationMailbox* mapMailboxes();
+inline MigrationMailbox* roadMailboxes() {
+    static MigrationMailbox* boxes = mapMailboxes();
+    return boxes;
+}
+
+// False if the mailbox is full
+bool mailboxPush(MigrationMailbox& box, const MigrationRecord& record);
+// Consumer only; false if the mailbox is empty
+bool mailboxPop(MigrationMailbox& box, MigrationRecord& record);
+
+// Domain v is in: the region of its edge's end node on an edge, else of
+// its node
+int domainOf(const Vehicle* v);
+
+// Hand `args`'s vehicle to the controller of the domain it is in, if that
+// isn't args->domain: pushes its record, rings the doorbell and takes it
+// off this process's lanes. Vehicles in a lot stay with the lot's
+// controller. False if it stays here (same domain, nobody serves the
+// other one, or its mailbox is full: it tries again after its next step).
+bool handOffVehicle(ThreadArgs* args);
+
+// Rebuild a handed-off vehicle for domain `domain`: telemetry to `pipeFd`,
+// parking in `lot` if its trip's stop line is in `domain`, on this
+// process's lanes and with its leg's route planned from where it is
+ThreadArgs* adoptVehicle(const MigrationRecord& record, int domain, int pipeFd, ParkingLot* lot);
+
+#endif // MIGRATION_H
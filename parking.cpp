@@ -5,6 +5,7 @@
  */
 
 #include "parking.h"
+#include "metrics.h"
 
 ParkingLot::ParkingLot() {
     sem_init(&spots, 0, PARKING_CAPACITY);
@@ -12,6 +13,8 @@ ParkingLot::ParkingLot() {
     pthread_mutex_init(&lock, nullptr);
     occupiedSpots = 0;
     waitingCount = 0;
+    capacity = PARKING_CAPACITY;
+    owedSpots = 0;
     for (int i = 0; i < PARKING_CAPACITY; i++) spotOccupied[i] = false;
     for (int i = 0; i < PARKING_QUEUE_SIZE; i++) queueSlotOccupied[i] = false;
 }
@@ -25,8 +28,10 @@ ParkingLot::~ParkingLot() {
 int ParkingLot::enterQueue() {
     // Try to enter queue (non-blocking)
     if (sem_trywait(&queue) != 0) {
+        metricAdd(Metric::PARKING_REJECTS);
         return -1; // Queue full, skip parking
     }
+    metricAdd(Metric::PARKING_ENTERS);
 
     pthread_mutex_lock(&lock);
     waitingCount++;
@@ -45,7 +50,18 @@ int ParkingLot::enterQueue() {
 int ParkingLot::waitForSpot(int queueIndex) {
     // Wait for spot (Blocking)
     sem_wait(&spots);
+    return takeSpot(queueIndex);
+}
+
+int ParkingLot::tryWaitForSpot(int queueIndex) {
+    // Claim a spot only if one is free right now
+    if (sem_trywait(&spots) != 0) {
+        return -1;
+    }
+    return takeSpot(queueIndex);
+}
 
+int ParkingLot::takeSpot(int queueIndex) {
     // Leaving queue, entering spot
     sem_post(&queue);
 
@@ -71,13 +87,32 @@ int ParkingLot::waitForSpot(int queueIndex) {
 }
 
 void ParkingLot::leave(int spotIndex) {
+    metricAdd(Metric::PARKING_LEAVES);
     pthread_mutex_lock(&lock);
     if (spotIndex >= 0 && spotIndex < PARKING_CAPACITY) {
         spotOccupied[spotIndex] = false;
     }
     occupiedSpots--;
+    bool owed = owedSpots > 0;
+    if (owed) owedSpots--;
+    pthread_mutex_unlock(&lock);
+    if (!owed) sem_post(&spots);
+}
+
+void ParkingLot::setCapacity(int count) {
+    count = count < 0 ? 0 : count > PARKING_CAPACITY ? PARKING_CAPACITY : count;
+    pthread_mutex_lock(&lock);
+    int change = count - capacity;
+    capacity = count;
+    // Growing first cancels spots still owed, then frees new ones;
+    // shrinking takes free spots now and the occupied ones as they empty
+    int cancelled = change > 0 ? (change < owedSpots ? change : owedSpots) : 0;
+    owedSpots -= cancelled;
+    for (int i = cancelled; i < change; i++) sem_post(&spots);
+    for (int i = 0; i < -change; i++) {
+        if (sem_trywait(&spots) != 0) owedSpots++;
+    }
     pthread_mutex_unlock(&lock);
-    sem_post(&spots);
 }
 
 int ParkingLot::getOccupiedCount() {
@@ -88,6 +123,14 @@ int ParkingLot::getOccupiedCount() {
     return count;
 }
 
+int ParkingLot::getCapacity() {
+    int count;
+    pthread_mutex_lock(&lock);
+    count = capacity;
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
 int ParkingLot::getWaitingCount() {
     int count;
     pthread_mutex_lock(&lock);
@@ -18,9 +18,15 @@ private:
     pthread_mutex_t lock;
     int occupiedSpots;
     int waitingCount;
+    int capacity;   // Spots in use, at most PARKING_CAPACITY
+    int owedSpots;  // Taken away by setCapacity() while occupied: leave()
+                    // keeps that many instead of handing them back
     bool spotOccupied[PARKING_CAPACITY];
     bool queueSlotOccupied[PARKING_QUEUE_SIZE];
 
+    // Move a queued vehicle into the first free spot after acquiring `spots`
+    int takeSpot(int queueIndex);
+
 public:
     ParkingLot();
     ~ParkingLot();
@@ -31,12 +37,20 @@ public:
     // Wait for a parking spot (blocking). Returns spot index (0-9)
     int waitForSpot(int queueIndex);
 
+    // Take a parking spot if one is free. Returns spot index (0-9) or -1
+    int tryWaitForSpot(int queueIndex);
+
     // Leave a parking spot
     void leave(int spotIndex);
 
+    // Use `count` spots of the lot (clamped to 0..PARKING_CAPACITY). Spots
+    // taken away while occupied go once their vehicles leave.
+    void setCapacity(int count);
+
     // Getters
     int getOccupiedCount();
     int getWaitingCount();
+    int getCapacity();
 };
 
 #endif // PARKING_H
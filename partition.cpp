@@ -0,0 +1,194 @@
+/**
+ * partition.cpp
+ *
+ * Junction weights, the recursive coordinate bisection and the process-wide
+ * partition.
+ */
+
+#include "partition.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_map>
+
+using namespace std;
+
+// Nearest junction of every node (ties go to the lower index, so every
+// process agrees)
+static vector<int> nearestJunctions(const RoadNetwork& net, const RoadGraph& graph) {
+    vector<int> nearest(graph.nodeCount(), 0);
+    for (int n = 0; n < graph.nodeCount(); ++n) {
+        float best = -1;
+        for (size_t j = 0; j < net.intersections.size(); ++j) {
+            float dx = graph.nodeX[n] - net.intersections[j].centerX;
+            float dy = graph.nodeY[n] - net.intersections[j].centerY;
+            float d2 = dx * dx + dy * dy;
+            if (best < 0 || d2 < best) {
+                best = d2;
+                nearest[n] = (int)j;
+            }
+        }
+    }
+    return nearest;
+}
+
+// Mean arrivals a second of a demand record over its profile
+static double meanRate(const RoadNetwork& net, const NetDemand& d) {
+    if (d.periodMs == 0) return net.demandStepRate[d.firstStep + d.stepCount - 1];
+    double mass = 0;
+    for (int k = 0; k < d.stepCount; ++k) {
+        int from = net.demandStepMs[d.firstStep + k];
+        int to = k + 1 < d.stepCount ? net.demandStepMs[d.firstStep + k + 1] : d.periodMs;
+        mass += net.demandStepRate[d.firstStep + k] * (double)(to - from);
+    }
+    return mass / d.periodMs;
+}
+
+// Each junction's share of the lane length of the edges ending nearest to
+// it, plus its share of the demand queueing at its stop lines
+static vector<double> junctionWeights(const RoadNetwork& net, const RoadGraph& graph,
+                                      const vector<int>& nodeJunction) {
+    unordered_map<int, int> linkLanes;
+    for (const NetLink& link : net.links) linkLanes[link.id] = link.lanes;
+
+    size_t count = net.intersections.size();
+    vector<double> laneLength(count, 0.0), demand(count, 0.0);
+    double totalLength = 0, totalDemand = 0;
+    for (int e = 0; e < graph.edgeCount(); ++e) {
+        auto lanes = linkLanes.find(graph.edgeLink[e]);
+        double length = graph.edgeLength[e] * (lanes != linkLanes.end() ? lanes->second : 1);
+        laneLength[nodeJunction[graph.edgeTo[e]]] += length;
+        totalLength += length;
+    }
+    for (const NetDemand& d : net.demands) {
+        double rate = meanRate(net, d);
+        demand[net.intersectionIndex[net.spawns[d.spawn].intersectionId]] += rate;
+        totalDemand += rate;
+    }
+
+    vector<double> weight(count, 0.0);
+    for (size_t j = 0; j < count; ++j) {
+        if (totalLength > 0) weight[j] += laneLength[j] / totalLength;
+        if (totalDemand > 0) weight[j] += demand[j] / totalDemand;
+    }
+    return weight;
+}
+
+// Split order[begin, end) into `regions` regions numbered from
+// firstRegion
+static void bisect(const RoadNetwork& net, const vector<double>& weight, vector<int>& order,
+                   int begin, int end, int firstRegion, int regions, vector<int>& junctionRegion) {
+    if (regions == 1) {
+        for (int i = begin; i < end; ++i) junctionRegion[order[i]] = firstRegion;
+        return;
+    }
+
+    float minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+    double total = 0;
+    for (int i = begin; i < end; ++i) {
+        const NetIntersection& in = net.intersections[order[i]];
+        minX = min(minX, in.centerX);
+        maxX = max(maxX, in.centerX);
+        minY = min(minY, in.centerY);
+        maxY = max(maxY, in.centerY);
+        total += weight[order[i]];
+    }
+    bool alongX = maxX - minX >= maxY - minY;
+    sort(order.begin() + begin, order.begin() + end, [&](int a, int b) {
+        float ka = alongX ? net.intersections[a].centerX : net.intersections[a].centerY;
+        float kb = alongX ? net.intersections[b].centerX : net.intersections[b].centerY;
+        return ka < kb || (ka == kb && a < b);
+    });
+
+    // Cut where the first side's weight comes closest to its regions'
+    // share, leaving every region at least one junction
+    int firstRegions = regions / 2;
+    double target = total * firstRegions / regions;
+    int lo = begin + firstRegions;
+    int hi = end - (regions - firstRegions);
+    double acc = 0;
+    for (int i = begin; i < lo; ++i) acc += weight[order[i]];
+    int cut = lo;
+    double best = fabs(acc - target);
+    for (int c = lo + 1; c <= hi; ++c) {
+        acc += weight[order[c - 1]];
+        if (fabs(acc - target) < best) {
+            best = fabs(acc - target);
+            cut = c;
+        }
+    }
+    bisect(net, weight, order, begin, cut, firstRegion, firstRegions, junctionRegion);
+    bisect(net, weight, order, cut, end, firstRegion + firstRegions, regions - firstRegions,
+           junctionRegion);
+}
+
+// Region weights and boundary lanes of p's junction regions
+static void summarize(const RoadGraph& graph, Partition& p) {
+    p.regionWeight.assign(p.regions, 0.0);
+    for (size_t j = 0; j < p.junctionRegion.size(); ++j) {
+        p.regionWeight[p.junctionRegion[j]] += p.junctionWeight[j];
+    }
+    p.boundaryLanes = 0;
+    for (int n = 0; n < graph.nodeCount(); ++n) {
+        for (int e = graph.rowStart[n]; e < graph.rowStart[n + 1]; ++e) {
+            if (p.regionOfNode(n) != p.regionOfNode(graph.edgeTo[e])) p.boundaryLanes++;
+        }
+    }
+}
+
+Partition partitionNetwork(const RoadNetwork& net, const RoadGraph& graph, int regions) {
+    int junctions = (int)net.intersections.size();
+    if (regions < 1 || regions > junctions) {
+        cerr << "Can't cut a network of " << junctions << " junctions into " << regions
+             << " regions" << endl;
+        exit(1);
+    }
+    Partition p;
+    p.regions = regions;
+    p.nodeJunction = nearestJunctions(net, graph);
+    p.junctionWeight = junctionWeights(net, graph, p.nodeJunction);
+    p.junctionRegion.assign(junctions, 0);
+    vector<int> order(junctions);
+    for (int j = 0; j < junctions; ++j) order[j] = j;
+    bisect(net, p.junctionWeight, order, 0, junctions, 0, regions, p.junctionRegion);
+    summarize(graph, p);
+    return p;
+}
+
+Partition junctionPartition(const RoadNetwork& net, const RoadGraph& graph) {
+    Partition p;
+    p.regions = max(1, (int)net.intersections.size());
+    p.nodeJunction = nearestJunctions(net, graph);
+    p.junctionWeight = junctionWeights(net, graph, p.nodeJunction);
+    p.junctionRegion.resize(net.intersections.size());
+    for (size_t j = 0; j < net.intersections.size(); ++j) p.junctionRegion[j] = (int)j;
+    if (p.junctionRegion.empty()) {
+        // No junctions: every node is in the one region
+        p.junctionRegion.push_back(0);
+        p.junctionWeight.push_back(0);
+    }
+    summarize(graph, p);
+    return p;
+}
+
+int regionCount() {
+    const char* text = getenv("TRAFFIC_REGIONS");
+    if (text == nullptr) return 0;
+    char* end;
+    long regions = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || regions <= 0) {
+        cerr << "Bad TRAFFIC_REGIONS '" << text << "' (want a region count)" << endl;
+        exit(1);
+    }
+    return (int)regions;
+}
+
+const Partition& roadPartition() {
+    static Partition partition = [] {
+        int regions = regionCount();
+        if (regions == 0) return junctionPartition(roadNetwork(), roadGraph());
+        return partitionNetwork(roadNetwork(), roadGraph(), regions);
+    }();
+    return partition;
+}
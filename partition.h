@@ -0,0 +1,44 @@
+/**
+ * partition.h
+ *
+ * Spatial decomposition of the road network into regions, each driven by
+ * one process. A junction weighs its share of the network's lane length
+ * plus its share of the expected demand. Recursive coordinate bisection
+ * cuts the junctions across the longer side of their bounding box where
+ * the weight on each side matches the regions it gets, until there are K
+ * regions of nearly equal weight. Every road graph node belongs to the
+ * region of its nearest junction.
+ */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "roadnet.h"
+#include "roadgraph.h"
+#include <vector>
+
+struct Partition {
+    int regions;
+    std::vector<int> junctionRegion;    // Indexed like RoadNetwork::intersections
+    std::vector<int> nodeJunction;      // Nearest junction of each road graph node
+    std::vector<double> junctionWeight; // Lane length share plus demand share
+    std::vector<double> regionWeight;
+    int boundaryLanes;                  // Edges from one region into another
+
+    int regionOfNode(int node) const { return junctionRegion[nodeJunction[node]]; }
+};
+
+// Cut `net` into `regions` regions. Exits if it has fewer junctions.
+Partition partitionNetwork(const RoadNetwork& net, const RoadGraph& graph, int regions);
+
+// One region per junction, numbered like the junctions
+Partition junctionPartition(const RoadNetwork& net, const RoadGraph& graph);
+
+// Regions to cut roadNetwork() into, from $TRAFFIC_REGIONS (0 when unset:
+// one per junction). Exits if it isn't a positive number.
+int regionCount();
+
+// The partition of roadNetwork() every process uses
+const Partition& roadPartition();
+
+#endif // PARTITION_H
@@ -0,0 +1,154 @@
+/**
+ * preemption.cpp
+ *
+ * Building emergency preemption requests from a trip's route, and the
+ * per-junction schedule that carries them out.
+ */
+
+#include "preemption.h"
+#include "routing.h"
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+const unsigned ACROSS_X = (1u << (int)Direction::WEST_EAST) | (1u << (int)Direction::EAST_WEST);
+const unsigned ACROSS_Y = (1u << (int)Direction::NORTH_SOUTH) | (1u << (int)Direction::SOUTH_NORTH);
+
+// Approaches that may be GREEN together with `directions`
+static unsigned compatible(unsigned directions) {
+    return (directions & ACROSS_X) ? ACROSS_X : ACROSS_Y;
+}
+
+// Per road graph node: the junction whose stop line it is, or -1, and
+// which of its approaches stop there
+struct StopLineTable {
+    vector<int> junction;
+    vector<unsigned> approaches;
+};
+
+static const StopLineTable& stopLines() {
+    static StopLineTable table = [] {
+        const RoadNetwork& net = roadNetwork();
+        const RoadGraph& g = roadGraph();
+        StopLineTable t;
+        t.junction.assign(g.nodeCount(), -1);
+        t.approaches.assign(g.nodeCount(), 0);
+        for (int j = 0; j < (int)net.intersections.size(); ++j) {
+            const NetIntersection& in = net.intersections[j];
+            for (int d = 0; d < DIRECTION_COUNT; ++d) {
+                if (!(in.approaches & directionBit((Direction)d))) continue;
+                float x, y;
+                stopLinePoint(in, (Direction)d, x, y);
+                int node = g.findNode(x, y);
+                if (node == -1) continue;
+                t.junction[node] = j;
+                t.approaches[node] |= directionBit((Direction)d);
+            }
+        }
+        return t;
+    }();
+    return table;
+}
+
+bool makePreemptRequest(const TripPlan& plan, int vehicleId, float speed, int sourceIntersection,
+                        uint64_t nowNs, CoordinationMessage& msg) {
+    const RoadNetwork& net = roadNetwork();
+    const RoadGraph& g = roadGraph();
+    const StopLineTable& lines = stopLines();
+
+    msg = CoordinationMessage();
+    msg.type = CoordinationMessage::EMERGENCY_APPROACHING;
+    msg.sourceIntersection = sourceIntersection;
+    msg.vehicleId = vehicleId;
+    msg.hop = 0;
+    msg.hopCount = 0;
+    msg.requestNs = nowNs;
+
+    vector<int> route;
+    if (speed <= 0 || !roadRouter().route(plan.startNode, plan.endNode, route)) return false;
+
+    // Free flow: the vehicle arrives at full speed and keeps it
+    float distance = 0;
+    for (int e : route) {
+        distance += g.edgeLength[e];
+        int node = g.edgeTo[e];
+        if (lines.junction[node] == -1 || msg.hopCount == PREEMPT_MAX_HOPS) continue;
+        for (int d = 0; d < DIRECTION_COUNT; ++d) {
+            if (!(lines.approaches[node] & directionBit((Direction)d)) ||
+                alongDirection(g, e, (Direction)d) < 0.5f) {
+                continue;
+            }
+            PreemptHop& hop = msg.hops[msg.hopCount++];
+            hop.intersectionId = net.intersections[lines.junction[node]].id;
+            hop.direction = (Direction)d;
+            hop.arrivalNs = nowNs + (uint64_t)(distance / speed * VEHICLE_SPEED_MS) * 1000000ull;
+            break;
+        }
+    }
+    return msg.hopCount > 0;
+}
+
+EmergencyPreemptor::EmergencyPreemptor(LatencyHistogram* latencyByHop)
+    : forcedDirections(0), latencyByHop(latencyByHop), lastUpdateNs(0), lastHop(-1),
+      lastLatencyNs(0), startedCount(0) {}
+
+void EmergencyPreemptor::accept(const CoordinationMessage& msg) {
+    const PreemptHop& hop = msg.hops[msg.hop];
+    uint64_t leadNs = (uint64_t)PREEMPT_LEAD_MS * 1000000ull;
+    Preemption p;
+    p.hop = msg.hop;
+    p.direction = directionBit(hop.direction);
+    p.requestNs = msg.requestNs;
+    p.startNs = hop.arrivalNs > leadNs ? hop.arrivalNs - leadNs : 0;
+    p.endNs = hop.arrivalNs + (uint64_t)PREEMPT_CLEARANCE_MS * 1000000ull;
+    p.started = false;
+    pending.push_back(p);
+}
+
+bool EmergencyPreemptor::update(uint64_t nowNs, SignalPlan& plan) {
+    lastUpdateNs = nowNs;
+    pending.erase(remove_if(pending.begin(), pending.end(),
+                            [nowNs](const Preemption& p) { return p.endNs <= nowNs; }),
+                  pending.end());
+
+    // Keep serving the approaches already GREEN; otherwise the oldest due
+    // request picks them
+    unsigned allowed = forcedDirections != 0 ? compatible(forcedDirections) : 0;
+    unsigned want = 0;
+    for (int pass = 0; pass < 2 && want == 0; ++pass) {
+        for (Preemption& p : pending) {
+            if (p.startNs > nowNs) continue;
+            if (allowed == 0) allowed = compatible(p.direction);
+            if (p.direction & allowed) want |= p.direction;
+        }
+        allowed = 0;
+    }
+
+    for (Preemption& p : pending) {
+        if (p.started || !(p.direction & want) || p.startNs > nowNs) continue;
+        p.started = true;
+        lastHop = p.hop;
+        // From the origin's send, across every relay, to this green
+        lastLatencyNs = nowNs > p.requestNs ? nowNs - p.requestNs : 0;
+        startedCount++;
+        if (latencyByHop != nullptr) latencyByHop[p.hop].record(lastLatencyNs);
+        metricAdd(Metric::EMERGENCY_PREEMPTIONS);
+    }
+
+    if (want == forcedDirections) return false;
+    forcedDirections = want;
+    if (want == 0) plan.release();
+    else plan.force(want);
+    return true;
+}
+
+uint64_t EmergencyPreemptor::nextEventNs() const {
+    uint64_t next = UINT64_MAX;
+    for (const Preemption& p : pending) {
+        // One due but held back by a conflicting one waits for an end
+        bool waiting = p.started || p.startNs <= lastUpdateNs;
+        next = min(next, waiting ? p.endNs : p.startNs);
+    }
+    return next;
+}
@@ -0,0 +1,79 @@
+/**
+ * preemption.h
+ *
+ * Emergency preemption along a vehicle's route. When an ambulance or a
+ * firetruck sets off, its intersection works out which junctions the route
+ * crosses and when the vehicle should reach each stop line, and sends one
+ * request that neighbouring controllers relay hop by hop. Each junction
+ * turns the vehicle's approach GREEN PREEMPT_LEAD_MS before the expected
+ * arrival and hands the lights back to its plan PREEMPT_CLEARANCE_MS
+ * after it. Nothing blocks in between: the owner calls update() from its
+ * loop and sleeps no longer than nextEventNs().
+ *
+ * Times are nanoseconds on the shared signal clock (CLOCK_MONOTONIC for
+ * the controllers, simulated time for SimEngine).
+ */
+
+#ifndef PREEMPTION_H
+#define PREEMPTION_H
+
+#include "simulation_types.h"
+#include "vehicle.h"
+#include "signals.h"
+#include "histogram.h"
+#include <vector>
+
+const int PREEMPT_LEAD_MS = 2000;      // GREEN this long before the expected arrival
+const int PREEMPT_CLEARANCE_MS = 3000; // and kept this long after it
+
+// Request for a vehicle driving at `speed` per VEHICLE_SPEED_MS step that
+// starts `plan` at `nowNs`: every junction its route crosses (at most
+// PREEMPT_MAX_HOPS) with the free-flow arrival there. Returns false if the
+// route crosses none.
+bool makePreemptRequest(const TripPlan& plan, int vehicleId, float speed, int sourceIntersection,
+                        uint64_t nowNs, CoordinationMessage& msg);
+
+class EmergencyPreemptor {
+private:
+    struct Preemption {
+        int hop;
+        unsigned direction;  // directionBit()
+        uint64_t requestNs;
+        uint64_t startNs, endNs;
+        bool started;
+    };
+    std::vector<Preemption> pending; // Accepted and not yet over
+    unsigned forcedDirections;       // 0 while the plan runs freely
+    LatencyHistogram* latencyByHop;  // PREEMPT_MAX_HOPS of them, or nullptr
+    uint64_t lastUpdateNs;
+
+public:
+    // Request-to-green latencies are recorded into latencyByHop[hop]
+    explicit EmergencyPreemptor(LatencyHistogram* latencyByHop = nullptr);
+
+    // Take this junction's hop of a request
+    void accept(const CoordinationMessage& msg);
+
+    // Force `plan` GREEN for the preemptions due at `nowNs` and release it
+    // once none is left. Conflicting approaches wait for the current ones
+    // to end. Returns true if the lights changed.
+    bool update(uint64_t nowNs, SignalPlan& plan);
+
+    // When update() next has something to do, or UINT64_MAX
+    uint64_t nextEventNs() const;
+
+    bool isForced() const { return forcedDirections != 0; }
+
+    // The latest preemption to turn GREEN: its hop and how long after the
+    // vehicle's own intersection sent the request
+    int lastHop;
+    uint64_t lastLatencyNs;
+    long long startedCount;
+};
+
+// Whether `type` asks for preemption
+inline bool isEmergency(VehicleType type) {
+    return type == VehicleType::AMBULANCE || type == VehicleType::FIRETRUCK;
+}
+
+#endif // PREEMPTION_H
@@ -0,0 +1,273 @@
+/**
+ * region.cpp
+ *
+ * The region workers, their ghost zones and the process pool that runs
+ * them.
+ */
+
+#include "region.h"
+#include "roadnet.h"
+#include "roadgraph.h"
+#include "routing.h"
+#include "lanes.h"
+#include "partition.h"
+#include "rng.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+GhostZones mapGhostZones() {
+    const RoadGraph& g = roadGraph();
+    const Partition& p = roadPartition();
+    GhostZones zones;
+    for (int n = 0; n < g.nodeCount(); ++n) {
+        for (int e = g.rowStart[n]; e < g.rowStart[n + 1]; ++e) {
+            int from = p.regionOfNode(n);
+            int to = p.regionOfNode(g.edgeTo[e]);
+            if (from == to) continue;
+            zones.edges.push_back(e);
+            zones.fromRegion.push_back(from);
+            zones.toRegion.push_back(to);
+        }
+    }
+    size_t count = max((size_t)1, zones.edges.size());
+    void* mem = mmap(nullptr, count * sizeof(GhostLane), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("Ghost zone mmap failed");
+        exit(1);
+    }
+    zones.slots = (GhostLane*)mem;
+    for (size_t i = 0; i < count; ++i) zones.slots[i] = {-1.0f, 0.0f};
+    return zones;
+}
+
+// Network spawns whose start node is in `region`
+static vector<int> regionSpawns(int region) {
+    const RoadNetwork& net = roadNetwork();
+    const RoadGraph& g = roadGraph();
+    vector<int> spawns;
+    for (size_t s = 0; s < net.spawns.size(); ++s) {
+        int node = g.findNode(net.spawns[s].x, net.spawns[s].y);
+        if (roadPartition().regionOfNode(node) == region) spawns.push_back((int)s);
+    }
+    return spawns;
+}
+
+RegionWorker::RegionWorker(int region, Lockstep* board, const GhostZones& ghosts, double demandScale)
+    : region(region), board(board), ghosts(ghosts), spawns(regionSpawns(region)),
+      // Keyed by network spawn, not by region, so every cut of the network
+      // gets the same arrivals
+      demand(roadNetwork(), spawns, simSeed(), 0, demandScale), tick(0), measuring(false),
+      stats(RegionStats()) {
+    const RoadNetwork& net = roadNetwork();
+    const Partition& p = roadPartition();
+    telemetryFd = open("/dev/null", O_WRONLY);
+    for (size_t j = 0; j < net.intersections.size(); ++j) {
+        if (p.junctionRegion[j] != region) continue;
+        junctions.push_back((int)j);
+        signals.push_back(signalPlanFor(net.intersections[j].id));
+    }
+    spawnCounts.assign(spawns.size(), 0);
+    for (size_t i = 0; i < ghosts.edges.size(); ++i) {
+        if (ghosts.toRegion[i] == region) publishSlots.push_back((int)i);
+        if (ghosts.fromRegion[i] == region) readSlots.push_back((int)i);
+    }
+    stats.junctions = (int)junctions.size();
+    stats.weight = p.regionWeight[region];
+}
+
+RegionWorker::~RegionWorker() {
+    for (SteppedVehicle& sv : vehicles) {
+        roadLanes().leave(sv.args->vehicle);
+        delete sv.args->vehicle;
+        delete sv.args;
+    }
+    if (telemetryFd != -1) close(telemetryFd);
+}
+
+void RegionWorker::adoptArrivals() {
+    MigrationMailbox& box = roadMailboxes()[region];
+    // The doorbell only wakes free-running controllers; lockstep polls
+    if (box.rung.exchange(false)) {
+        char bells[64];
+        while (read(box.doorbellRead, bells, sizeof(bells)) > 0) {}
+    }
+    MigrationRecord record;
+    arrivals.clear();
+    while (mailboxPop(box, record)) arrivals.push_back(record);
+    sort(arrivals.begin(), arrivals.end(),
+         [](const MigrationRecord& a, const MigrationRecord& b) { return a.id < b.id; });
+    for (const MigrationRecord& r : arrivals) {
+        vehicles.push_back({adoptVehicle(r, region, telemetryFd, nullptr), tick});
+    }
+    if (measuring) stats.adopted += arrivals.size();
+}
+
+void RegionWorker::spawnDue(uint64_t nowNs) {
+    int spawnCount = (int)roadNetwork().spawns.size();
+    Arrival arrival;
+    while (demand.pop(nowNs, arrival)) {
+        int spawn = spawns[arrival.origin];
+        // Unique across regions, and the same however the network is cut
+        int id = spawnCounts[arrival.origin]++ * spawnCount + spawn;
+        ThreadArgs* args = new ThreadArgs();
+        args->plan = compileTripPlan(roadNetwork(), roadGraph(), roadNetwork().spawns[spawn]);
+        args->reservations = nullptr;
+        args->domain = region;
+        args->vehicle = new Vehicle(id, arrival.type, telemetryFd, nullptr);
+        placeAtStart(args->vehicle, args->plan);
+        args->vehicle->intersectionId = roadNetwork().spawns[spawn].intersectionId;
+        vehicles.push_back({args, tick});
+        if (measuring) stats.spawned++;
+    }
+}
+
+void RegionWorker::advanceSignals(long long clockMs, bool force) {
+    for (size_t k = 0; k < junctions.size(); ++k) {
+        if (signals[k].advanceTo(clockMs) || force) storeLights(junctions[k], signals[k].now().states);
+    }
+}
+
+void RegionWorker::publishGhosts() {
+    LaneTable& lanes = roadLanes();
+    for (int i : publishSlots) {
+        GhostLane& slot = ghosts.slots[i];
+        if (!lanes.tail(ghosts.edges[i], slot.position, slot.velocity)) slot.position = -1.0f;
+    }
+}
+
+void RegionWorker::readGhosts() {
+    LaneTable& lanes = roadLanes();
+    for (int i : readSlots) {
+        lanes.setGhost(ghosts.edges[i], ghosts.slots[i].position, ghosts.slots[i].velocity);
+    }
+}
+
+void RegionWorker::stepVehicles() {
+    roadTravelTimes().grantReroutes(REROUTE_BUDGET_PER_TICK);
+    roadLanes().updateAll();
+
+    for (size_t i = 0; i < vehicles.size();) {
+        SteppedVehicle& sv = vehicles[i];
+        if (sv.nextTick > tick) {
+            ++i;
+            continue;
+        }
+
+        int waitMs = 0;
+        bool gone = handOffVehicle(sv.args);
+        if (!gone) {
+            waitMs = stepVehicle(sv.args, false);
+            if (measuring) stats.vehicleSteps++;
+            if (waitMs < 0) {
+                if (measuring) stats.completed++;
+            } else {
+                gone = handOffVehicle(sv.args);
+            }
+        }
+        if (gone && measuring) stats.handedOff++;
+
+        if (gone || waitMs < 0) {
+            delete sv.args->vehicle;
+            delete sv.args;
+            vehicles[i] = vehicles.back();
+            vehicles.pop_back();
+            continue;
+        }
+        sv.nextTick = tick + (waitMs + VEHICLE_SPEED_MS - 1) / VEHICLE_SPEED_MS;
+        ++i;
+    }
+}
+
+RegionStats RegionWorker::run(long long ticks, long long warmupTicks) {
+    roadLanes().batched = true;
+    // Before the first barrier, so every worker sees it open by the time
+    // it first hands off
+    roadMailboxes()[region].open.store(true, memory_order_release);
+    demand.start(0);
+    advanceSignals(0, true);
+
+    chrono::steady_clock::time_point start;
+    while (true) {
+        // Phase A: hand-offs of the last tick, spawns, lights, ghost zones
+        lockstepWait(board, false);
+        tick = board->tick.load(memory_order_acquire);
+        if (tick >= ticks) break;
+        if (tick == warmupTicks) {
+            measuring = true;
+            start = chrono::steady_clock::now();
+        }
+        uint64_t nowNs = (uint64_t)tick * VEHICLE_SPEED_MS * 1000000ull;
+        adoptArrivals();
+        spawnDue(nowNs);
+        advanceSignals(nowNs / 1000000, false);
+        publishGhosts();
+
+        // Phase B: the neighbours' ghost zones, then the vehicles
+        lockstepWait(board, true);
+        readGhosts();
+        stepVehicles();
+    }
+
+    if (measuring) {
+        stats.loopMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    stats.active = (long long)vehicles.size();
+    roadMailboxes()[region].open.store(false, memory_order_release);
+    return stats;
+}
+
+bool pinToCore(int core) {
+    long cores = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+vector<RegionStats> runRegions(long long ticks, long long warmupTicks, double demandScale) {
+    // Everything the workers share, mapped before forking
+    int regions = roadPartition().regions;
+    roadLights();
+    roadMailboxes();
+    GhostZones ghosts = mapGhostZones();
+    Lockstep* board = mapLockstep(regions);
+    void* mem = mmap(nullptr, regions * sizeof(RegionStats), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        perror("Region stats mmap failed");
+        exit(1);
+    }
+    RegionStats* shared = (RegionStats*)mem;
+
+    vector<pid_t> pids;
+    for (int r = 0; r < regions; ++r) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("Fork failed");
+            exit(1);
+        }
+        if (pid == 0) {
+            if (!pinToCore(r)) perror("Pinning a region worker failed");
+            RegionWorker worker(r, board, ghosts, demandScale);
+            shared[r] = worker.run(ticks, warmupTicks);
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (pid_t pid : pids) waitpid(pid, nullptr, 0);
+
+    vector<RegionStats> stats(shared, shared + regions);
+    munmap(mem, regions * sizeof(RegionStats));
+    return stats;
+}
@@ -0,0 +1,110 @@
+/**
+ * region.h
+ *
+ * Headless region workers: roadNetwork() cut into roadPartition()'s
+ * regions, one process per region pinned to a core, each driving the
+ * signals and vehicles of its region tick by tick in lockstep with the
+ * others (lockstep.h). A vehicle crossing into another region is handed
+ * to it through its mailbox (migration.h). Every tick each worker also
+ * publishes the last vehicle on every lane that enters its region from
+ * another: the ghost zone the vehicles about to cross follow, as they
+ * would the lane's tail in one process.
+ *
+ *   barrier A  adopt last tick's hand-offs, spawn, run the signal plans,
+ *              publish the lights and the ghost zones
+ *   barrier B  read the neighbours' ghost zones, step the vehicles and
+ *              hand off those that left the region
+ */
+
+#ifndef REGION_H
+#define REGION_H
+
+#include "vehicle.h"
+#include "signals.h"
+#include "demand.h"
+#include "lockstep.h"
+#include "migration.h"
+#include <vector>
+
+// Last vehicle on a boundary lane, as its region published it
+struct GhostLane {
+    float position; // < 0: the lane is empty
+    float velocity;
+};
+
+// Lanes from one region of roadPartition() into another, and their slots
+// in shared memory: written by the region the lane ends in during phase
+// A, read by the region it starts in during phase B
+struct GhostZones {
+    std::vector<int> edges;
+    std::vector<int> fromRegion;
+    std::vector<int> toRegion;
+    GhostLane* slots;
+};
+
+// Find the boundary lanes and map their slots; call before forking
+GhostZones mapGhostZones();
+
+// What one worker did in the measured ticks of a run
+struct RegionStats {
+    int junctions;
+    double weight;          // Its share of the partition's weight
+    long long spawned;
+    long long completed;
+    long long handedOff;
+    long long adopted;
+    long long active;       // Vehicles still driving at the end
+    long long vehicleSteps;
+    double loopMs;          // Wall time of the measured ticks
+};
+
+class RegionWorker {
+private:
+    struct SteppedVehicle {
+        ThreadArgs* args;
+        long long nextTick; // Tick at which it steps again
+    };
+
+    int region;
+    Lockstep* board;
+    const GhostZones& ghosts;
+    int telemetryFd;                 // /dev/null: nobody draws a region worker
+    std::vector<int> junctions;      // Indices into roadNetwork().intersections
+    std::vector<SignalPlan> signals; // Indexed like junctions
+    std::vector<int> spawns;         // Network spawns starting in the region
+    std::vector<int> spawnCounts;    // Vehicles from each so far, for their ids
+    DemandGenerator demand;
+    std::vector<SteppedVehicle> vehicles;
+    std::vector<MigrationRecord> arrivals;
+    std::vector<int> publishSlots;   // Ghost slots of lanes ending here
+    std::vector<int> readSlots;      // ... and of lanes starting here
+    long long tick;
+    bool measuring;
+    RegionStats stats;
+
+    void adoptArrivals();
+    void spawnDue(uint64_t nowNs);
+    void advanceSignals(long long clockMs, bool force);
+    void publishGhosts();
+    void readGhosts();
+    void stepVehicles();
+
+public:
+    RegionWorker(int region, Lockstep* board, const GhostZones& ghosts, double demandScale);
+    ~RegionWorker();
+
+    // `ticks` ticks in step with the other regions' workers, timing and
+    // counting from tick `warmupTicks` on
+    RegionStats run(long long ticks, long long warmupTicks);
+};
+
+// Pin the calling process to core `core` (modulo the cores online); false
+// if the kernel refuses
+bool pinToCore(int core);
+
+// Run roadNetwork() as roadPartition().regions worker processes, region r
+// pinned to core r, for `ticks` lockstep ticks with demand scaled by
+// `demandScale`. Returns each region's stats, measured from `warmupTicks`.
+std::vector<RegionStats> runRegions(long long ticks, long long warmupTicks, double demandScale);
+
+#endif // REGION_H
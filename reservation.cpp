@@ -0,0 +1,144 @@
+/**
+ * reservation.cpp
+ *
+ * Implementation of the lock-free space-time tile table.
+ */
+
+#include "reservation.h"
+#include "lanes.h"
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+static const int TILES_PER_BOX = RESERVATION_TILES_PER_SIDE * RESERVATION_TILES_PER_SIDE;
+// Points sampled along the vehicle's body, front to rear, and across it
+static const float BODY_SAMPLE_STEP = 10.0f;
+static const float BODY_SIDES[] = {RESERVATION_LANE_OFFSET - VEHICLE_WIDTH / 2, RESERVATION_LANE_OFFSET,
+                                   RESERVATION_LANE_OFFSET + VEHICLE_WIDTH / 2};
+
+IntersectionManager::IntersectionManager(const RoadNetwork& net, const RoadGraph& graph)
+    : net(net), graph(graph),
+      table(net.intersections.size() * RESERVATION_HORIZON_STEPS * TILES_PER_BOX), clock(0) {
+    for (auto& word : table) word.store(0, memory_order_relaxed);
+}
+
+void IntersectionManager::advanceTo(long long step) {
+    long long current = clock.load(memory_order_relaxed);
+    while (step > current && !clock.compare_exchange_weak(current, step, memory_order_release)) {
+    }
+}
+
+atomic<uint64_t>& IntersectionManager::slot(int junction, long long step, int tile) {
+    size_t ring = (size_t)(step % RESERVATION_HORIZON_STEPS);
+    return table[((size_t)junction * RESERVATION_HORIZON_STEPS + ring) * TILES_PER_BOX + tile];
+}
+
+int IntersectionManager::tileAt(int junction, float x, float y) const {
+    const NetIntersection& in = net.intersections[junction];
+    float tileSize = in.size / RESERVATION_TILES_PER_SIDE;
+    int col = (int)floor((x - (in.centerX - in.size / 2)) / tileSize);
+    int row = (int)floor((y - (in.centerY - in.size / 2)) / tileSize);
+    if (col < 0 || col >= RESERVATION_TILES_PER_SIDE || row < 0 || row >= RESERVATION_TILES_PER_SIDE) {
+        return -1;
+    }
+    return row * RESERVATION_TILES_PER_SIDE + col;
+}
+
+bool IntersectionManager::claim(atomic<uint64_t>& word, uint64_t want, bool& claimed) {
+    claimed = false;
+    uint64_t current = word.load(memory_order_acquire);
+    while (true) {
+        bool held = (current >> 32) == (want >> 32) && (uint32_t)current != 0;
+        if (held) return current == want;
+        if (word.compare_exchange_weak(current, want, memory_order_acq_rel, memory_order_acquire)) {
+            claimed = true;
+            return true;
+        }
+    }
+}
+
+// Point `s` pixels along `path` (negative: before its start) and the
+// direction of the edge it lies on
+static void pointOnPath(const RoadGraph& g, const vector<int>& path, float s,
+                        float& x, float& y, float& dirX, float& dirY) {
+    size_t i = 0;
+    while (i + 1 < path.size() && s > g.edgeLength[path[i]]) {
+        s -= g.edgeLength[path[i]];
+        ++i;
+    }
+    int e = path[i];
+    dirX = g.edgeDirX[e];
+    dirY = g.edgeDirY[e];
+    x = g.edgeFromX[e] + dirX * s;
+    y = g.edgeFromY[e] + dirY * s;
+}
+
+bool IntersectionManager::request(int junction, int vehicleId, const vector<int>& path,
+                                  float velocity, float desired) {
+    if (path.empty()) return true;
+    float pathLength = 0;
+    for (int e : path) pathLength += graph.edgeLength[e];
+
+    // Words taken by this request, to hand back on a conflict
+    static thread_local vector<pair<atomic<uint64_t>*, uint64_t>> taken;
+    taken.clear();
+
+    long long start = now();
+    float s = 0;
+    bool entered = false;
+    bool granted = true;
+    for (int k = 0;; ++k) {
+        // Same kinematics as advanceLeg() on an empty road
+        velocity = idmFreeVelocity(velocity, desired);
+        s += velocity;
+        if (k + 2 * RESERVATION_MARGIN_STEPS >= RESERVATION_HORIZON_STEPS) {
+            granted = false; // Would still be in the box past the horizon
+            break;
+        }
+
+        bool inBox = false;
+        for (float back = 0; back <= VEHICLE_LENGTH; back += BODY_SAMPLE_STEP) {
+            float x, y, dirX, dirY;
+            pointOnPath(graph, path, min(s, pathLength) - back, x, y, dirX, dirY);
+            for (float side : BODY_SIDES) {
+                // Right-hand traffic: lanes lie right of the direction of travel
+                int tile = tileAt(junction, x - dirY * side, y + dirX * side);
+                if (tile == -1) continue;
+                inBox = true;
+                for (int m = -RESERVATION_MARGIN_STEPS; m <= RESERVATION_MARGIN_STEPS; ++m) {
+                    long long step = start + k + m;
+                    if (step < start) continue;
+                    uint64_t want = ((uint64_t)(uint32_t)step << 32) | (uint32_t)(vehicleId + 1);
+                    atomic<uint64_t>& word = slot(junction, step, tile);
+                    bool claimed;
+                    if (!claim(word, want, claimed)) {
+                        granted = false;
+                        break;
+                    }
+                    if (claimed) taken.push_back(make_pair(&word, want));
+                }
+                if (!granted) break;
+            }
+            if (!granted) break;
+        }
+        if (!granted) break;
+
+        if (inBox) entered = true;
+        else if (entered) break;   // Rear has left the box
+        if (s >= pathLength) break; // Stops at the end of the leg
+    }
+
+    if (!granted) {
+        for (auto& t : taken) {
+            uint64_t mine = t.second;
+            t.first->compare_exchange_strong(mine, 0, memory_order_acq_rel);
+        }
+    }
+    return granted;
+}
+
+IntersectionManager& roadReservations() {
+    static IntersectionManager manager(roadNetwork(), roadGraph());
+    return manager;
+}
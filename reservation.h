@@ -0,0 +1,60 @@
+/**
+ * reservation.h
+ *
+ * Reservation-based intersection control. Each junction box is divided
+ * into square tiles, and time into VEHICLE_SPEED_MS steps. A vehicle at the
+ * stop line asks for every tile its body will sweep while crossing, each
+ * at the step it will be there, and is let through only if it gets all of
+ * them. The tile table is a ring of atomic words claimed with
+ * compare-and-swap, so requests never take a lock.
+ */
+
+#ifndef RESERVATION_H
+#define RESERVATION_H
+
+#include "roadnet.h"
+#include "roadgraph.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+const int RESERVATION_TILES_PER_SIDE = 8;  // 12.5 px tiles on a 100 px box
+const int RESERVATION_HORIZON_STEPS = 256; // How far ahead the ring reaches
+const int RESERVATION_MARGIN_STEPS = 2;    // Tiles are held this long either side
+const float RESERVATION_LANE_OFFSET = 25.0f; // Lane centre right of the link's centre line
+
+class IntersectionManager {
+private:
+    const RoadNetwork& net;
+    const RoadGraph& graph;
+    // [junction][step % HORIZON][tile]: (step << 32) | (vehicle id + 1).
+    // A word whose step is not the one asked for is stale and free.
+    std::vector<std::atomic<uint64_t>> table;
+    std::atomic<long long> clock;
+
+    std::atomic<uint64_t>& slot(int junction, long long step, int tile);
+    // Tile of the junction's box under (x, y), or -1 outside it
+    int tileAt(int junction, float x, float y) const;
+    // Claim one tile-step; false if another vehicle holds it. `claimed`
+    // says whether the word was taken now rather than already ours.
+    bool claim(std::atomic<uint64_t>& word, uint64_t want, bool& claimed);
+
+public:
+    IntersectionManager(const RoadNetwork& net, const RoadGraph& graph);
+
+    // Current step, advanced by whoever drives the simulation
+    long long now() const { return clock.load(std::memory_order_acquire); }
+    void advanceTo(long long step);
+
+    // Reserve the tiles `vehicleId` sweeps driving `path` (edges from the
+    // stop line of `junction`), starting now at `velocity` and speeding up
+    // towards `desired` as on an empty road. All or nothing: on a conflict
+    // the tiles claimed so far are given back and false is returned.
+    bool request(int junction, int vehicleId, const std::vector<int>& path,
+                 float velocity, float desired);
+};
+
+// The process-wide manager of roadNetwork()'s junctions
+IntersectionManager& roadReservations();
+
+#endif // RESERVATION_H
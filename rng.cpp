@@ -0,0 +1,75 @@
+/**
+ * rng.cpp
+ *
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * 3"): ten rounds of two 32x32->64 multiplies keyed by the seed, over a
+ * 128-bit counter made of the draw's block, stream id, kind and
+ * controller.
+ */
+
+#include "rng.h"
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+const uint32_t PHILOX_M0 = 0xD2511F53;
+const uint32_t PHILOX_M1 = 0xCD9E8D57;
+const uint32_t PHILOX_W0 = 0x9E3779B9; // Key schedule increments
+const uint32_t PHILOX_W1 = 0xBB67AE85;
+const int PHILOX_ROUNDS = 10;
+
+static void philox4x32(uint32_t ctr[4], uint32_t k0, uint32_t k1) {
+    for (int r = 0; r < PHILOX_ROUNDS; ++r) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * ctr[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * ctr[2];
+        uint32_t c1 = ctr[1];
+        uint32_t c3 = ctr[3];
+        ctr[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        ctr[1] = (uint32_t)p1;
+        ctr[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        ctr[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+// Both draws of block `block` of the stream `key`
+static void randomBlock(const RandomKey& key, uint32_t block, uint64_t out[2]) {
+    uint32_t ctr[4] = {block, key.id, (uint32_t)key.kind, key.controller};
+    philox4x32(ctr, (uint32_t)key.seed, (uint32_t)(key.seed >> 32));
+    out[0] = (uint64_t)ctr[0] << 32 | ctr[1];
+    out[1] = (uint64_t)ctr[2] << 32 | ctr[3];
+}
+
+uint64_t randomBits(const RandomKey& key, uint32_t index) {
+    uint64_t out[2];
+    randomBlock(key, index >> 1, out);
+    return out[index & 1];
+}
+
+RandomStream::RandomStream(const RandomKey& key) : key(key), index(0), spare(0) {}
+
+uint64_t RandomStream::next() {
+    if (index & 1) {
+        index++;
+        return spare;
+    }
+    uint64_t out[2];
+    randomBlock(key, index >> 1, out);
+    spare = out[1];
+    index++;
+    return out[0];
+}
+
+uint64_t simSeed() {
+    const char* text = getenv("TRAFFIC_SEED");
+    if (text == nullptr) return 1;
+    char* end;
+    uint64_t seed = strtoull(text, &end, 0);
+    if (end == text || *end != '\0') {
+        cerr << "Bad TRAFFIC_SEED '" << text << "'" << endl;
+        exit(1);
+    }
+    return seed;
+}
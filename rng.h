@@ -0,0 +1,59 @@
+/**
+ * rng.h
+ *
+ * Counter-based random numbers (Philox4x32-10). A draw is a pure function
+ * of the seed, the controller, the stream it belongs to and its index in
+ * that stream, so every random decision comes out the same whichever
+ * thread or process makes it and in whatever order. Streams share no
+ * state and take no lock.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// What a stream's draws decide; keeps the streams of different users
+// apart when their ids coincide
+enum class RandomKind : uint32_t {
+    VEHICLE,      // Per vehicle id; draw 0 is its type
+    SPAWN_JITTER, // Per injected spawn command
+    DEMAND        // Per road network spawn point
+};
+
+struct RandomKey {
+    uint64_t seed;
+    uint32_t controller; // Intersection id
+    RandomKind kind;
+    uint32_t id;
+};
+
+// Draw `index` of the stream `key`: 64 random bits
+uint64_t randomBits(const RandomKey& key, uint32_t index);
+
+// Uniform in (0, 1] from 64 random bits
+inline double unitInterval(uint64_t bits) {
+    return 1.0 - (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// The draws of one stream in order. Each Philox block gives two draws,
+// so a stream runs the cipher on every other draw.
+class RandomStream {
+private:
+    RandomKey key;
+    uint32_t index;    // Next draw
+    uint64_t spare;    // Second half of the last block, for an odd index
+
+public:
+    RandomStream(const RandomKey& key);
+
+    uint64_t next();
+    double uniform() { return unitInterval(next()); }
+    uint32_t drawIndex() const { return index; }
+};
+
+// Seed of every stream, from $TRAFFIC_SEED (default 1); the same seed
+// gives the same traffic. Exits if it isn't a number.
+uint64_t simSeed();
+
+#endif // RNG_H
@@ -0,0 +1,250 @@
+/**
+ * roadgraph.cpp
+ *
+ * CSR construction and the conversion of a RoadNetwork into a graph.
+ */
+
+#include "roadgraph.h"
+#include "simulation_types.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <utility>
+
+using namespace std;
+
+// A waypoint lies on a link if it is this close to the link's centre line
+const float ON_LINK_TOLERANCE = 0.5f;
+
+int RoadGraph::findEdge(int from, int to) const {
+    for (int e = rowStart[from]; e < rowStart[from + 1]; ++e) {
+        if (edgeTo[e] == to) return e;
+    }
+    return -1;
+}
+
+int RoadGraph::findNode(float x, float y) const {
+    for (int n = 0; n < nodeCount(); ++n) {
+        if (nodeX[n] == x && nodeY[n] == y) return n;
+    }
+    return -1;
+}
+
+void buildRoadGraph(const vector<float>& nodeX, const vector<float>& nodeY,
+                    const vector<GraphEdgeSpec>& edges, RoadGraph& g) {
+    int nodes = (int)nodeX.size();
+    int count = (int)edges.size();
+    g.nodeX = nodeX;
+    g.nodeY = nodeY;
+
+    // Counting sort of the edges by source node
+    g.rowStart.assign(nodes + 1, 0);
+    for (const GraphEdgeSpec& e : edges) g.rowStart[e.from + 1]++;
+    for (int n = 0; n < nodes; ++n) g.rowStart[n + 1] += g.rowStart[n];
+
+    g.edgeTo.resize(count);
+    g.edgeLink.resize(count);
+    g.edgeFromX.resize(count);
+    g.edgeFromY.resize(count);
+    g.edgeDirX.resize(count);
+    g.edgeDirY.resize(count);
+    g.edgeLength.resize(count);
+    g.edgeArcStart.resize(count);
+
+    vector<int> fill(g.rowStart.begin(), g.rowStart.end() - 1);
+    for (const GraphEdgeSpec& spec : edges) {
+        int e = fill[spec.from]++;
+        float dx = nodeX[spec.to] - nodeX[spec.from];
+        float dy = nodeY[spec.to] - nodeY[spec.from];
+        float length = sqrt(dx * dx + dy * dy);
+        g.edgeTo[e] = spec.to;
+        g.edgeLink[e] = spec.link;
+        g.edgeFromX[e] = nodeX[spec.from];
+        g.edgeFromY[e] = nodeY[spec.from];
+        g.edgeDirX[e] = length > 0 ? dx / length : 0.0f;
+        g.edgeDirY[e] = length > 0 ? dy / length : 0.0f;
+        g.edgeLength[e] = length;
+        g.edgeArcStart[e] = spec.arcStart;
+    }
+}
+
+// Unit direction of travel of each Direction, y growing downwards
+static const float TRAVEL_X[DIRECTION_COUNT] = {0, -1, 1, 0};
+static const float TRAVEL_Y[DIRECTION_COUNT] = {1, 0, 0, -1};
+
+float alongDirection(const RoadGraph& graph, int edge, Direction direction) {
+    return graph.edgeDirX[edge] * TRAVEL_X[(int)direction] + graph.edgeDirY[edge] * TRAVEL_Y[(int)direction];
+}
+
+// Collects waypoints, merging ones at identical coordinates
+struct NodeTable {
+    vector<float> x, y;
+    map<pair<float, float>, int> index;
+
+    int add(float px, float py) {
+        auto it = index.find(make_pair(px, py));
+        if (it != index.end()) return it->second;
+        int id = (int)x.size();
+        x.push_back(px);
+        y.push_back(py);
+        index[make_pair(px, py)] = id;
+        return id;
+    }
+};
+
+void buildNetworkGraph(const RoadNetwork& net, RoadGraph& graph) {
+    NodeTable nodes;
+
+    // Waypoints of every trip, in the order a vehicle visits them
+    struct TripNodes {
+        int start, hold, stop, end;
+        int lot;
+    };
+    vector<TripNodes> trips;
+    for (const NetSpawn& s : net.spawns) {
+        const NetIntersection* in = net.findIntersection(s.intersectionId);
+        TripNodes t;
+        float x, y;
+        t.start = nodes.add(s.x, s.y);
+        t.hold = -1;
+        if (s.holdIntersectionId != -1) {
+            stopLinePoint(*net.findIntersection(s.holdIntersectionId), s, x, y);
+            t.hold = nodes.add(x, y);
+        }
+        stopLinePoint(*in, s, x, y);
+        t.stop = nodes.add(x, y);
+        t.end = nodes.add(s.endX, s.endY);
+        t.lot = in->lot;
+        trips.push_back(t);
+    }
+
+    // Every stop line, also those no spawn drives to (signal detectors
+    // and corridors look for them)
+    for (const NetIntersection& in : net.intersections) {
+        for (int d = 0; d < DIRECTION_COUNT; ++d) {
+            if (!(in.approaches & directionBit((Direction)d))) continue;
+            float x, y;
+            stopLinePoint(in, (Direction)d, x, y);
+            nodes.add(x, y);
+        }
+    }
+
+    vector<int> lotQueue, lotExit, lotFirstBox, lotFirstSpot;
+    vector<int> boxNodes, spotNodes;
+    for (const NetLot& lot : net.lots) {
+        lotQueue.push_back(nodes.add(lot.queueX, lot.queueY));
+        lotExit.push_back(nodes.add(lot.exitX, lot.exitY));
+        lotFirstBox.push_back((int)boxNodes.size());
+        for (int q = 0; q < PARKING_QUEUE_SIZE; ++q) {
+            boxNodes.push_back(nodes.add(net.queueBoxX[lot.firstQueueBox + q], lot.queueBoxY));
+        }
+        lotFirstSpot.push_back((int)spotNodes.size());
+        for (int s = 0; s < lot.columns * lot.rows; ++s) {
+            spotNodes.push_back(nodes.add(net.spotX[lot.firstSpot + s], net.spotY[lot.firstSpot + s]));
+        }
+    }
+
+    // Split every link at the waypoints on it, in both directions
+    vector<GraphEdgeSpec> edges;
+    vector<bool> onRoad;
+    for (const NetLink& link : net.links) {
+        int from = nodes.add(link.fromX, link.fromY);
+        int to = nodes.add(link.toX, link.toY);
+        float dx = link.toX - link.fromX;
+        float dy = link.toY - link.fromY;
+        float length = sqrt(dx * dx + dy * dy);
+        if (length == 0) continue;
+        float ux = dx / length, uy = dy / length;
+
+        vector<pair<float, int>> along = {{0.0f, from}, {length, to}};
+        for (int n = 0; n < (int)nodes.x.size(); ++n) {
+            float px = nodes.x[n] - link.fromX;
+            float py = nodes.y[n] - link.fromY;
+            float t = px * ux + py * uy;
+            float off = fabs(px * uy - py * ux);
+            if (n != from && n != to && t > 0 && t < length && off <= ON_LINK_TOLERANCE) {
+                along.push_back(make_pair(t, n));
+            }
+        }
+        sort(along.begin(), along.end());
+
+        if (onRoad.size() < nodes.x.size()) onRoad.resize(nodes.x.size(), false);
+        for (size_t i = 0; i < along.size(); ++i) {
+            onRoad[along[i].second] = true;
+            if (i + 1 == along.size()) break;
+            edges.push_back({along[i].second, along[i + 1].second, link.id, along[i].first});
+            edges.push_back({along[i + 1].second, along[i].second, link.id, length - along[i + 1].first});
+        }
+    }
+    onRoad.resize(nodes.x.size(), false);
+
+    // Direct edges wherever a trip leaves the road
+    set<pair<int, int>> direct;
+    auto connect = [&](int a, int b) {
+        if (a == -1 || b == -1 || a == b) return;
+        if (onRoad[a] && onRoad[b]) return; // Driven along the road edges
+        direct.insert(make_pair(a, b));
+    };
+    for (const TripNodes& t : trips) {
+        if (t.hold != -1) {
+            connect(t.start, t.hold);
+            connect(t.hold, t.stop);
+        } else {
+            connect(t.start, t.stop);
+        }
+        connect(t.stop, t.end);
+        if (t.lot < 0) continue;
+
+        int queue = lotQueue[t.lot];
+        int exit = lotExit[t.lot];
+        connect(t.stop, queue);
+        connect(queue, t.end); // Queue full
+        connect(exit, t.end);
+        for (int q = 0; q < PARKING_QUEUE_SIZE; ++q) {
+            int box = boxNodes[lotFirstBox[t.lot] + q];
+            connect(queue, box);
+            for (int s = 0; s < PARKING_CAPACITY; ++s) {
+                connect(box, spotNodes[lotFirstSpot[t.lot] + s]);
+            }
+        }
+        for (int s = 0; s < PARKING_CAPACITY; ++s) {
+            connect(spotNodes[lotFirstSpot[t.lot] + s], exit);
+        }
+    }
+    for (const auto& d : direct) {
+        edges.push_back({d.first, d.second, -1, 0.0f});
+    }
+
+    buildRoadGraph(nodes.x, nodes.y, edges, graph);
+}
+
+void makeGridGraph(int rows, int cols, float spacing, RoadGraph& graph) {
+    vector<float> nodeX, nodeY;
+    vector<GraphEdgeSpec> edges;
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            int n = r * cols + c;
+            nodeX.push_back(c * spacing);
+            nodeY.push_back(r * spacing);
+            if (c + 1 < cols) {
+                edges.push_back({n, n + 1, r, c * spacing});
+                edges.push_back({n + 1, n, r, (cols - 2 - c) * spacing});
+            }
+            if (r + 1 < rows) {
+                edges.push_back({n, n + cols, rows + c, r * spacing});
+                edges.push_back({n + cols, n, rows + c, (rows - 2 - r) * spacing});
+            }
+        }
+    }
+    buildRoadGraph(nodeX, nodeY, edges, graph);
+}
+
+const RoadGraph& roadGraph() {
+    static RoadGraph graph = [] {
+        RoadGraph built;
+        buildNetworkGraph(roadNetwork(), built);
+        return built;
+    }();
+    return graph;
+}
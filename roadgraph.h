@@ -0,0 +1,67 @@
+/**
+ * roadgraph.h
+ *
+ * Road network as a compressed-sparse-row directed graph. Every edge is a
+ * straight segment with its unit direction, length and arc-length offset
+ * precomputed, so a vehicle's position is (edge, offset) and advancing it
+ * is an add and a compare.
+ */
+
+#ifndef ROADGRAPH_H
+#define ROADGRAPH_H
+
+#include "roadnet.h"
+#include <vector>
+
+// Edge as given to buildRoadGraph
+struct GraphEdgeSpec {
+    int from, to;
+    int link;       // Network link the edge lies on, or -1 (lot manoeuvres)
+    float arcStart; // Distance along the link where the edge starts
+};
+
+// All per-node and per-edge data lives in flat arrays. The out-edges of
+// node n are edges rowStart[n] .. rowStart[n + 1] - 1.
+struct RoadGraph {
+    std::vector<float> nodeX, nodeY;
+    std::vector<int> rowStart;   // nodeCount() + 1 entries
+
+    std::vector<int> edgeTo;
+    std::vector<int> edgeLink;
+    std::vector<float> edgeFromX, edgeFromY;
+    std::vector<float> edgeDirX, edgeDirY;  // Unit direction
+    std::vector<float> edgeLength;
+    std::vector<float> edgeArcStart;
+
+    int nodeCount() const { return (int)nodeX.size(); }
+    int edgeCount() const { return (int)edgeTo.size(); }
+
+    // Edge from -> to, or -1
+    int findEdge(int from, int to) const;
+
+    // Node at exactly (x, y), or -1
+    int findNode(float x, float y) const;
+};
+
+// Cosine between `edge` and travel in `direction`: 1 along it, -1 against
+float alongDirection(const RoadGraph& graph, int edge, Direction direction);
+
+// Build the CSR arrays from node coordinates and an unordered edge list.
+// Direction and length come from the node coordinates.
+void buildRoadGraph(const std::vector<float>& nodeX, const std::vector<float>& nodeY,
+                    const std::vector<GraphEdgeSpec>& edges, RoadGraph& graph);
+
+// Graph of a road network: links split at every stop line, spawn, end and
+// lot entry/exit point lying on them (both directions), plus direct edges
+// for the lot manoeuvres (stop line -> queue -> box -> spot -> exit) and
+// for leaving a full queue.
+void buildNetworkGraph(const RoadNetwork& net, RoadGraph& graph);
+
+// Synthetic rows x cols grid of two-way streets `spacing` apart. Row r is
+// link r, column c is link rows + c.
+void makeGridGraph(int rows, int cols, float spacing, RoadGraph& graph);
+
+// The process-wide graph of roadNetwork(), built on first use
+const RoadGraph& roadGraph();
+
+#endif // ROADGRAPH_H
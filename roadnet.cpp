@@ -0,0 +1,519 @@
+/**
+ * roadnet.cpp
+ *
+ * Road network file parser and table compiler.
+ *
+ * File format: one record per line, fields separated by spaces, '#' starts
+ * a comment. Records may appear in any order.
+ *
+ *   intersection <id> <name> <centerX> <centerY> <size> <lightX> <lightY>
+ *   link <id> <fromX> <fromY> <toX> <toY> <width> <lanes>
+ *   stopline <intersectionId> <W|E|N|S> <x or y>
+ *   phase <intersectionId> <approaches> <greenMs> <yellowMs> <allRedMs>
+ *   corridor <W|E|N|S> <intersectionId> <intersectionId> [...]
+ *   lot <intersectionId> <x> <y> <width> <height> <columns> <rows>
+ *       <spotX> <spotY> <spotStepX> <spotStepY> <queueX> <queueY>
+ *       <queueBoxX> <queueBoxY> <queueBoxStep> <exitX> <exitY>
+ *   spawn <name> <intersectionId> <x> <y> <endX> <endY> <W|E|N|S>
+ *         <holdIntersectionId|-> <reportWhileWaiting 0|1>
+ *   demand <spawnName> <periodS> <w,w,w,w,w,w> <startS>:<vehPerHour> [...]
+ *
+ * W, E, N and S name the side traffic arrives from, so W is
+ * Direction::WEST_EAST. A W or E stop line is given by its x, an N or S one
+ * by its y. A phase's approaches are a run of those letters (e.g. "WE"), and
+ * an intersection's phases cycle in file order. A corridor lists the
+ * intersections traffic in one direction passes, in order; their plans must
+ * have the same cycle length and a first phase that serves that direction.
+ * A demand gives one spawn point's vehicle type weights, in VehicleType
+ * order, and its arrival rate as steps from 0 up to the period, after which
+ * the profile repeats (a period of 0 holds the last step for good).
+ */
+
+#include "roadnet.h"
+#include "simulation_types.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+const int MAX_INTERSECTION_ID = 1 << 20;
+
+const NetIntersection* RoadNetwork::findIntersection(int id) const {
+    if (id < 0 || id >= (int)intersectionIndex.size() || intersectionIndex[id] < 0) {
+        return nullptr;
+    }
+    return &intersections[intersectionIndex[id]];
+}
+
+const NetLot* RoadNetwork::findLot(int intersectionId) const {
+    const NetIntersection* in = findIntersection(intersectionId);
+    if (in == nullptr || in->lot < 0) return nullptr;
+    return &lots[in->lot];
+}
+
+const NetSpawn* RoadNetwork::findSpawn(const char* name) const {
+    for (const NetSpawn& s : spawns) {
+        if (strcmp(s.name, name) == 0) return &s;
+    }
+    return nullptr;
+}
+
+// Cursor over one line of the file
+struct LineCursor {
+    const char* p;
+    const char* end;
+};
+
+static bool nextToken(LineCursor& c, const char*& tok, size_t& len) {
+    while (c.p < c.end && (*c.p == ' ' || *c.p == '\t' || *c.p == '\r')) c.p++;
+    if (c.p == c.end || *c.p == '#') return false;
+    tok = c.p;
+    while (c.p < c.end && *c.p != ' ' && *c.p != '\t' && *c.p != '\r' && *c.p != '#') c.p++;
+    len = c.p - tok;
+    return true;
+}
+
+static bool tokenIs(const char* tok, size_t len, const char* word) {
+    return strlen(word) == len && memcmp(tok, word, len) == 0;
+}
+
+// Numbers are parsed from a bounded copy so strtof cannot run past the line
+static bool readFloat(LineCursor& c, float& out) {
+    const char* tok;
+    size_t len;
+    if (!nextToken(c, tok, len) || len >= 32) return false;
+    char buf[32];
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    char* endPtr;
+    out = strtof(buf, &endPtr);
+    return *endPtr == '\0';
+}
+
+static bool readInt(LineCursor& c, int& out) {
+    const char* tok;
+    size_t len;
+    if (!nextToken(c, tok, len) || len >= 32) return false;
+    char buf[32];
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    char* endPtr;
+    out = (int)strtol(buf, &endPtr, 10);
+    return *endPtr == '\0';
+}
+
+static bool readName(LineCursor& c, char* out, size_t size) {
+    const char* tok;
+    size_t len;
+    if (!nextToken(c, tok, len) || len >= size) return false;
+    memcpy(out, tok, len);
+    out[len] = '\0';
+    return true;
+}
+
+static bool directionFromLetter(char letter, Direction& out) {
+    switch (letter) {
+        case 'W': out = Direction::WEST_EAST; return true;
+        case 'E': out = Direction::EAST_WEST; return true;
+        case 'N': out = Direction::NORTH_SOUTH; return true;
+        case 'S': out = Direction::SOUTH_NORTH; return true;
+    }
+    return false;
+}
+
+static bool readDirection(LineCursor& c, Direction& out) {
+    const char* tok;
+    size_t len;
+    return nextToken(c, tok, len) && len == 1 && directionFromLetter(tok[0], out);
+}
+
+// A set of directions, e.g. "WE"
+static bool readDirections(LineCursor& c, unsigned& out) {
+    const char* tok;
+    size_t len;
+    if (!nextToken(c, tok, len)) return false;
+    out = 0;
+    for (size_t i = 0; i < len; ++i) {
+        Direction d;
+        if (!directionFromLetter(tok[i], d)) return false;
+        out |= directionBit(d);
+    }
+    return true;
+}
+
+// One token of `count` numbers separated by `separator`, e.g. "1,2,3"
+static bool readFloats(LineCursor& c, char separator, float* out, int count) {
+    const char* tok;
+    size_t len;
+    if (!nextToken(c, tok, len) || len >= 128) return false;
+    char buf[128];
+    memcpy(buf, tok, len);
+    buf[len] = '\0';
+    char* p = buf;
+    for (int i = 0; i < count; ++i) {
+        char* endPtr;
+        out[i] = strtof(p, &endPtr);
+        if (endPtr == p || *endPtr != (i + 1 < count ? separator : '\0')) return false;
+        p = endPtr + 1;
+    }
+    return true;
+}
+
+struct StopLineRecord {
+    int intersectionId;
+    Direction direction;
+    float position;
+    int line;
+};
+
+struct PhaseRecord {
+    int intersectionId;
+    NetPhase phase;
+    int line;
+};
+
+struct CorridorRecord {
+    Direction direction;
+    vector<int> intersectionIds;
+    int line;
+};
+
+struct DemandRecord {
+    char spawnName[32];
+    NetDemand demand;
+    vector<float> stepStartS, stepPerHour;
+    int line;
+};
+
+static bool fail(string& error, int line, const string& reason) {
+    error = "line " + to_string(line) + ": " + reason;
+    return false;
+}
+
+bool parseRoadNetwork(const char* text, size_t length, RoadNetwork& net, string& error) {
+    net = RoadNetwork();
+    vector<StopLineRecord> stopLines;
+    vector<PhaseRecord> phases;
+    vector<CorridorRecord> corridors;
+    vector<DemandRecord> demands;
+    vector<int> lotLines, spawnLines;
+
+    const char* p = text;
+    const char* end = text + length;
+    int line = 0;
+    while (p < end) {
+        line++;
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (eol == nullptr) eol = end;
+        LineCursor c = {p, eol};
+        p = eol + 1;
+
+        const char* kind;
+        size_t kindLen;
+        if (!nextToken(c, kind, kindLen)) continue; // Blank or comment
+
+        bool ok;
+        if (tokenIs(kind, kindLen, "link")) {
+            NetLink l;
+            ok = readInt(c, l.id) && readFloat(c, l.fromX) && readFloat(c, l.fromY) &&
+                 readFloat(c, l.toX) && readFloat(c, l.toY) && readFloat(c, l.width) &&
+                 readInt(c, l.lanes);
+            if (ok) net.links.push_back(l);
+        } else if (tokenIs(kind, kindLen, "intersection")) {
+            NetIntersection in;
+            ok = readInt(c, in.id) && readName(c, in.name, sizeof(in.name)) &&
+                 readFloat(c, in.centerX) && readFloat(c, in.centerY) && readFloat(c, in.size) &&
+                 readFloat(c, in.lightX) && readFloat(c, in.lightY);
+            if (ok && (in.id < 0 || in.id >= MAX_INTERSECTION_ID)) {
+                return fail(error, line, "intersection id out of range");
+            }
+            in.stopLine[(int)Direction::WEST_EAST] = in.stopLine[(int)Direction::EAST_WEST] = in.centerX;
+            in.stopLine[(int)Direction::NORTH_SOUTH] = in.stopLine[(int)Direction::SOUTH_NORTH] = in.centerY;
+            in.approaches = 0;
+            in.lot = -1;
+            in.firstPhase = 0;
+            in.phaseCount = 0;
+            if (ok) net.intersections.push_back(in);
+        } else if (tokenIs(kind, kindLen, "stopline")) {
+            StopLineRecord s;
+            ok = readInt(c, s.intersectionId) && readDirection(c, s.direction) && readFloat(c, s.position);
+            s.line = line;
+            if (ok) stopLines.push_back(s);
+        } else if (tokenIs(kind, kindLen, "phase")) {
+            PhaseRecord r;
+            ok = readInt(c, r.intersectionId) && readDirections(c, r.phase.greenDirections) &&
+                 readInt(c, r.phase.greenMs) && readInt(c, r.phase.yellowMs) && readInt(c, r.phase.allRedMs);
+            if (ok && (r.phase.greenMs <= 0 || r.phase.yellowMs < 0 || r.phase.allRedMs < 0)) {
+                return fail(error, line, "phase needs a positive green and no negative clearance");
+            }
+            r.line = line;
+            if (ok) phases.push_back(r);
+        } else if (tokenIs(kind, kindLen, "corridor")) {
+            CorridorRecord r;
+            ok = readDirection(c, r.direction);
+            int id;
+            LineCursor rest = c;
+            while (ok && readInt(rest, id)) {
+                r.intersectionIds.push_back(id);
+                c = rest;
+            }
+            if (ok && r.intersectionIds.size() < 2) {
+                return fail(error, line, "corridor needs at least two intersections");
+            }
+            r.line = line;
+            if (ok) corridors.push_back(r);
+        } else if (tokenIs(kind, kindLen, "lot")) {
+            NetLot lot;
+            ok = readInt(c, lot.intersectionId) && readFloat(c, lot.x) && readFloat(c, lot.y) &&
+                 readFloat(c, lot.width) && readFloat(c, lot.height) &&
+                 readInt(c, lot.columns) && readInt(c, lot.rows) &&
+                 readFloat(c, lot.spotX) && readFloat(c, lot.spotY) &&
+                 readFloat(c, lot.spotStepX) && readFloat(c, lot.spotStepY) &&
+                 readFloat(c, lot.queueX) && readFloat(c, lot.queueY) &&
+                 readFloat(c, lot.queueBoxX) && readFloat(c, lot.queueBoxY) &&
+                 readFloat(c, lot.queueBoxStep) && readFloat(c, lot.exitX) && readFloat(c, lot.exitY);
+            if (ok && lot.columns * lot.rows != PARKING_CAPACITY) {
+                return fail(error, line, "lot must have " + to_string(PARKING_CAPACITY) + " spots");
+            }
+            if (ok) {
+                net.lots.push_back(lot);
+                lotLines.push_back(line);
+            }
+        } else if (tokenIs(kind, kindLen, "spawn")) {
+            NetSpawn s;
+            const char* tok;
+            size_t len;
+            int report = 0;
+            ok = readName(c, s.name, sizeof(s.name)) && readInt(c, s.intersectionId) &&
+                 readFloat(c, s.x) && readFloat(c, s.y) && readFloat(c, s.endX) && readFloat(c, s.endY) &&
+                 readDirection(c, s.direction) && nextToken(c, tok, len);
+            if (ok) {
+                if (tokenIs(tok, len, "-")) {
+                    s.holdIntersectionId = -1;
+                } else {
+                    LineCursor holdCursor = {tok, tok + len};
+                    ok = readInt(holdCursor, s.holdIntersectionId);
+                }
+            }
+            ok = ok && readInt(c, report);
+            s.reportWhileWaiting = report != 0;
+            if (ok) {
+                net.spawns.push_back(s);
+                spawnLines.push_back(line);
+            }
+        } else if (tokenIs(kind, kindLen, "demand")) {
+            DemandRecord r;
+            int periodS = 0;
+            ok = readName(c, r.spawnName, sizeof(r.spawnName)) && readInt(c, periodS) &&
+                 readFloats(c, ',', r.demand.typeWeights, VEHICLE_TYPE_COUNT);
+            float step[2];
+            LineCursor rest = c;
+            while (ok && readFloats(rest, ':', step, 2)) {
+                r.stepStartS.push_back(step[0]);
+                r.stepPerHour.push_back(step[1]);
+                c = rest;
+            }
+            if (ok && periodS < 0) return fail(error, line, "demand period must not be negative");
+            if (ok && (r.stepStartS.empty() || r.stepStartS[0] != 0)) {
+                return fail(error, line, "demand profile must start at 0");
+            }
+            float weightSum = 0;
+            for (int t = 0; ok && t < VEHICLE_TYPE_COUNT; ++t) {
+                if (r.demand.typeWeights[t] < 0) return fail(error, line, "negative type weight");
+                weightSum += r.demand.typeWeights[t];
+            }
+            if (ok && weightSum <= 0) return fail(error, line, "demand needs a vehicle type");
+            for (size_t k = 0; ok && k < r.stepStartS.size(); ++k) {
+                if (r.stepPerHour[k] < 0 || (k > 0 && r.stepStartS[k] <= r.stepStartS[k - 1]) ||
+                    (periodS > 0 && r.stepStartS[k] >= periodS)) {
+                    return fail(error, line, "demand steps must rise within the period at rates of 0 or more");
+                }
+            }
+            r.demand.periodMs = periodS * 1000;
+            r.line = line;
+            if (ok) demands.push_back(r);
+        } else {
+            return fail(error, line, "unknown record '" + string(kind, kindLen) + "'");
+        }
+
+        const char* extra;
+        size_t extraLen;
+        if (!ok) {
+            return fail(error, line, "malformed " + string(kind, kindLen) + " record");
+        }
+        if (nextToken(c, extra, extraLen)) {
+            return fail(error, line, "unexpected field '" + string(extra, extraLen) + "'");
+        }
+    }
+
+    // Id -> index table
+    int maxId = -1;
+    for (const NetIntersection& in : net.intersections) maxId = max(maxId, in.id);
+    net.intersectionIndex.assign(maxId + 1, -1);
+    for (size_t i = 0; i < net.intersections.size(); ++i) {
+        int id = net.intersections[i].id;
+        if (net.intersectionIndex[id] != -1) {
+            return fail(error, 0, "duplicate intersection " + to_string(id));
+        }
+        net.intersectionIndex[id] = (int)i;
+    }
+
+    for (const StopLineRecord& s : stopLines) {
+        if (net.findIntersection(s.intersectionId) == nullptr) {
+            return fail(error, s.line, "unknown intersection " + to_string(s.intersectionId));
+        }
+        NetIntersection& in = net.intersections[net.intersectionIndex[s.intersectionId]];
+        in.stopLine[(int)s.direction] = s.position;
+        in.approaches |= directionBit(s.direction);
+    }
+
+    // Phases: grouped by intersection, keeping each plan's file order
+    stable_sort(phases.begin(), phases.end(), [&](const PhaseRecord& a, const PhaseRecord& b) {
+        return a.intersectionId < b.intersectionId;
+    });
+    for (const PhaseRecord& r : phases) {
+        if (net.findIntersection(r.intersectionId) == nullptr) {
+            return fail(error, r.line, "unknown intersection " + to_string(r.intersectionId));
+        }
+        NetIntersection& in = net.intersections[net.intersectionIndex[r.intersectionId]];
+        if (in.phaseCount == 0) in.firstPhase = (int)net.phases.size();
+        in.phaseCount++;
+        net.phases.push_back(r.phase);
+    }
+
+    vector<bool> onCorridor(net.intersections.size(), false);
+    for (const CorridorRecord& r : corridors) {
+        NetCorridor corridor;
+        corridor.direction = r.direction;
+        corridor.firstJunction = (int)net.corridorJunctions.size();
+        corridor.junctionCount = (int)r.intersectionIds.size();
+        corridor.cycleMs = 0;
+        for (int id : r.intersectionIds) {
+            const NetIntersection* in = net.findIntersection(id);
+            if (in == nullptr) return fail(error, r.line, "unknown intersection " + to_string(id));
+            int junction = net.intersectionIndex[id];
+            if (onCorridor[junction]) {
+                return fail(error, r.line, "intersection " + to_string(id) + " is on two corridors");
+            }
+            onCorridor[junction] = true;
+            if (in->phaseCount == 0 || !(net.phases[in->firstPhase].greenDirections & directionBit(r.direction))) {
+                return fail(error, r.line, "first phase of " + to_string(id) + " does not serve the corridor");
+            }
+            int cycleMs = 0;
+            for (int p = in->firstPhase; p < in->firstPhase + in->phaseCount; ++p) {
+                cycleMs += net.phases[p].greenMs + net.phases[p].yellowMs + net.phases[p].allRedMs;
+            }
+            if (corridor.cycleMs != 0 && cycleMs != corridor.cycleMs) {
+                return fail(error, r.line, "cycle of " + to_string(id) + " differs from the corridor's");
+            }
+            corridor.cycleMs = cycleMs;
+            net.corridorJunctions.push_back(junction);
+        }
+        net.corridors.push_back(corridor);
+    }
+
+    // Lots: attach to their intersection and expand spot and queue box centres
+    for (size_t i = 0; i < net.lots.size(); ++i) {
+        NetLot& lot = net.lots[i];
+        if (net.findIntersection(lot.intersectionId) == nullptr) {
+            return fail(error, lotLines[i], "unknown intersection " + to_string(lot.intersectionId));
+        }
+        net.intersections[net.intersectionIndex[lot.intersectionId]].lot = (int)i;
+
+        lot.firstSpot = (int)net.spotX.size();
+        for (int s = 0; s < lot.columns * lot.rows; ++s) {
+            net.spotX.push_back(lot.spotX + (s % lot.columns) * lot.spotStepX);
+            net.spotY.push_back(lot.spotY + (s / lot.columns) * lot.spotStepY);
+        }
+        lot.firstQueueBox = (int)net.queueBoxX.size();
+        for (int q = 0; q < PARKING_QUEUE_SIZE; ++q) {
+            net.queueBoxX.push_back(lot.queueBoxX + q * lot.queueBoxStep);
+        }
+    }
+
+    for (size_t i = 0; i < net.spawns.size(); ++i) {
+        const NetSpawn& s = net.spawns[i];
+        if (net.findIntersection(s.intersectionId) == nullptr ||
+            (s.holdIntersectionId != -1 && net.findIntersection(s.holdIntersectionId) == nullptr)) {
+            return fail(error, spawnLines[i], "spawn references an unknown intersection");
+        }
+    }
+
+    vector<bool> hasDemand(net.spawns.size(), false);
+    for (DemandRecord& r : demands) {
+        const NetSpawn* spawn = net.findSpawn(r.spawnName);
+        if (spawn == nullptr) return fail(error, r.line, string("unknown spawn ") + r.spawnName);
+        r.demand.spawn = (int)(spawn - net.spawns.data());
+        if (hasDemand[r.demand.spawn]) return fail(error, r.line, string("second demand for ") + r.spawnName);
+        hasDemand[r.demand.spawn] = true;
+        r.demand.firstStep = (int)net.demandStepMs.size();
+        r.demand.stepCount = (int)r.stepStartS.size();
+        for (size_t k = 0; k < r.stepStartS.size(); ++k) {
+            net.demandStepMs.push_back((int)(r.stepStartS[k] * 1000));
+            net.demandStepRate.push_back(r.stepPerHour[k] / 3600.0f);
+        }
+        net.demands.push_back(r.demand);
+    }
+
+    return true;
+}
+
+void stopLinePoint(const NetIntersection& in, const NetSpawn& spawn, float& x, float& y) {
+    float position = in.stopLine[(int)spawn.direction];
+    if (spawn.direction == Direction::WEST_EAST || spawn.direction == Direction::EAST_WEST) {
+        x = position;
+        y = spawn.y;
+    } else {
+        x = spawn.x;
+        y = position;
+    }
+}
+
+void stopLinePoint(const NetIntersection& in, Direction direction, float& x, float& y) {
+    float position = in.stopLine[(int)direction];
+    if (direction == Direction::WEST_EAST || direction == Direction::EAST_WEST) {
+        x = position;
+        y = in.centerY;
+    } else {
+        x = in.centerX;
+        y = position;
+    }
+}
+
+bool loadRoadNetwork(const char* path, RoadNetwork& net, string& error) {
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) {
+        error = string("cannot open ") + path;
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    string text(size > 0 ? size : 0, '\0');
+    size_t got = size > 0 ? fread(&text[0], 1, size, f) : 0;
+    fclose(f);
+
+    if (parseRoadNetwork(text.data(), got, net, error)) {
+        return true;
+    }
+    error = string(path) + ": " + error;
+    return false;
+}
+
+const RoadNetwork& roadNetwork() {
+    static RoadNetwork net = [] {
+        RoadNetwork loaded;
+        const char* path = getenv("TRAFFIC_NETWORK");
+        string error;
+        if (!loadRoadNetwork(path != nullptr ? path : "road_network.txt", loaded, error)) {
+            cerr << "Road network load failed: " << error << endl;
+            exit(1);
+        }
+        return loaded;
+    }();
+    return net;
+}
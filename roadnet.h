@@ -0,0 +1,144 @@
+/**
+ * roadnet.h
+ *
+ * Road network description: intersections, links, stop lines, signal
+ * plans, parking lots, spawn points and their demand, loaded from a text
+ * file and compiled into flat tables shared by the vehicles and the
+ * visualizer.
+ */
+
+#ifndef ROADNET_H
+#define ROADNET_H
+
+#include "simulation_types.h"
+#include <string>
+#include <vector>
+
+// Bit of a direction in a set of directions
+inline unsigned directionBit(Direction d) { return 1u << (int)d; }
+
+// One phase of an intersection's signal plan: GREEN for a set of
+// directions, then YELLOW, then ALL-RED before the next phase
+struct NetPhase {
+    unsigned greenDirections; // directionBit()s
+    int greenMs;
+    int yellowMs;
+    int allRedMs;
+};
+
+// Intersections whose plans are offset so that traffic in `direction`
+// meets one green after another. Their junction indices, in the order that
+// traffic reaches them, are corridorJunctions[firstJunction ..
+// firstJunction + junctionCount - 1].
+struct NetCorridor {
+    Direction direction;
+    int firstJunction;
+    int junctionCount;
+    int cycleMs; // Shared by every plan on the corridor
+};
+
+struct NetIntersection {
+    int id;
+    char name[8];
+    float centerX, centerY;
+    float size;             // Side of the square box
+    float lightX, lightY;   // Where the light is drawn
+    // Indexed by Direction: x for WEST_EAST and EAST_WEST, y for the others
+    float stopLine[DIRECTION_COUNT];
+    unsigned approaches;    // directionBit()s of the directions with a stop line
+    int lot;                // Index into lots, or -1
+    int firstPhase;         // Signal plan: phases[firstPhase .. + phaseCount - 1]
+    int phaseCount;
+};
+
+// Straight road segment
+struct NetLink {
+    int id;
+    float fromX, fromY;
+    float toX, toY;
+    float width;
+    int lanes;
+};
+
+// Parking lot with a columns x rows grid of spots and a row of
+// PARKING_QUEUE_SIZE queue boxes. Spot and box centres live in the
+// network's spotX/spotY/queueBoxX tables starting at firstSpot/firstQueueBox.
+struct NetLot {
+    int intersectionId;
+    float x, y, width, height;
+    int columns, rows;
+    float spotX, spotY;         // Centre of spot 0
+    float spotStepX, spotStepY; // Column and row pitch (negative mirrors)
+    float queueX, queueY;       // Where vehicles ask for a queue slot
+    float queueBoxX, queueBoxY; // Centre of queue box 0
+    float queueBoxStep;
+    float exitX, exitY;         // Where vehicles rejoin the road
+    int firstSpot;
+    int firstQueueBox;
+};
+
+struct NetSpawn {
+    char name[32];
+    int intersectionId;
+    float x, y;
+    float endX, endY;
+    Direction direction;     // Stop line the vehicle obeys
+    int holdIntersectionId;  // Obey this intersection's light first, or -1
+    bool reportWhileWaiting;
+};
+
+// Arrivals at one spawn point: a Poisson process whose rate follows a
+// piecewise-constant profile. Step k starts demandStepMs[firstStep + k]
+// into the profile and runs at demandStepRate[firstStep + k] vehicles a
+// second until the next; the profile repeats every periodMs (0: the last
+// rate holds for good).
+struct NetDemand {
+    int spawn;   // Index into spawns
+    int periodMs;
+    int firstStep;
+    int stepCount;
+    float typeWeights[VEHICLE_TYPE_COUNT]; // Indexed by VehicleType
+};
+
+struct RoadNetwork {
+    std::vector<NetIntersection> intersections;
+    std::vector<NetLink> links;
+    std::vector<NetLot> lots;
+    std::vector<NetSpawn> spawns;
+    std::vector<NetDemand> demands;
+    std::vector<int> demandStepMs;
+    std::vector<float> demandStepRate;
+    std::vector<NetPhase> phases; // Grouped by intersection, in file order
+    std::vector<NetCorridor> corridors;
+    std::vector<int> corridorJunctions;
+
+    // Precomputed centres, indexed from NetLot::firstSpot / firstQueueBox
+    std::vector<float> spotX, spotY;
+    std::vector<float> queueBoxX;
+
+    // Intersection id -> index into intersections, -1 if unused
+    std::vector<int> intersectionIndex;
+
+    const NetIntersection* findIntersection(int id) const;
+    const NetLot* findLot(int intersectionId) const;
+    const NetSpawn* findSpawn(const char* name) const;
+};
+
+// Where a vehicle from `spawn`, keeping to its line of travel, meets the
+// stop line of `in` for the spawn's direction
+void stopLinePoint(const NetIntersection& in, const NetSpawn& spawn, float& x, float& y);
+// The stop line of `in` for `direction` on the junction's centre lines
+void stopLinePoint(const NetIntersection& in, Direction direction, float& x, float& y);
+
+// Parse a network description. On failure returns false and sets `error`
+// to "line N: reason".
+bool parseRoadNetwork(const char* text, size_t length, RoadNetwork& net, std::string& error);
+
+// Read and parse a network file
+bool loadRoadNetwork(const char* path, RoadNetwork& net, std::string& error);
+
+// The process-wide network, loaded on first use from $TRAFFIC_NETWORK or
+// road_network.txt. Exits if the file cannot be loaded.
+const RoadNetwork& roadNetwork();
+
+#endif // ROADNET_H
@@ -0,0 +1,715 @@
+/**
+ * routing.cpp
+ *
+ * Implementation of the Router searches, the contraction hierarchy and the
+ * route cache.
+ */
+
+#include "routing.h"
+#include "simulation_types.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
+using namespace std;
+
+const float INF_DIST = numeric_limits<float>::infinity();
+
+// Witness searches during contraction give up after settling this many
+// nodes. A missed witness costs an unnecessary shortcut, and on a grid's
+// many equal-length paths those pile up at the top of the hierarchy.
+const int WITNESS_SETTLE_LIMIT = 10000;
+
+// Route repairs give up after settling this many nodes
+const int REPAIR_SETTLE_LIMIT = 4096;
+
+// Free-flow speed of the shared estimates: a car's step
+const float ROAD_FREE_FLOW_SPEED = 2.0f;
+
+typedef pair<float, int> HeapItem;
+typedef greater<HeapItem> HeapOrder;
+
+// Per-thread search state, sized to the largest graph searched so far.
+// Entries touched by a query are reset afterwards, so queries cost
+// O(settled nodes) rather than O(graph size).
+struct SearchSpace {
+    vector<float> distF, distB;
+    vector<int> parentF, parentB;
+    vector<int> touched;
+    vector<HeapItem> heapF, heapB;
+
+    void prepare(int n) {
+        if ((int)distF.size() < n) {
+            distF.resize(n, INF_DIST);
+            distB.resize(n, INF_DIST);
+            parentF.resize(n, -1);
+            parentB.resize(n, -1);
+        }
+    }
+
+    void touch(int node) {
+        if (distF[node] == INF_DIST && distB[node] == INF_DIST) touched.push_back(node);
+    }
+
+    void reset() {
+        for (int node : touched) {
+            distF[node] = INF_DIST;
+            distB[node] = INF_DIST;
+            parentF[node] = -1;
+            parentB[node] = -1;
+        }
+        touched.clear();
+        heapF.clear();
+        heapB.clear();
+    }
+};
+
+static thread_local SearchSpace searchSpace;
+
+static void heapPush(vector<HeapItem>& heap, float key, int node) {
+    heap.push_back(make_pair(key, node));
+    push_heap(heap.begin(), heap.end(), HeapOrder());
+}
+
+static HeapItem heapPop(vector<HeapItem>& heap) {
+    pop_heap(heap.begin(), heap.end(), HeapOrder());
+    HeapItem top = heap.back();
+    heap.pop_back();
+    return top;
+}
+
+Router::Router(const RoadGraph& graph, int cacheCapacity)
+    : graph(graph), cacheCapacity(cacheCapacity), cacheHits(0), cacheMisses(0) {
+    pthread_mutex_init(&cacheMutex, nullptr);
+
+    int n = graph.nodeCount();
+    int m = graph.edgeCount();
+    edgeFrom.resize(m);
+    for (int u = 0; u < n; ++u) {
+        for (int e = graph.rowStart[u]; e < graph.rowStart[u + 1]; ++e) edgeFrom[e] = u;
+    }
+
+    // Reverse CSR by counting sort on the edge heads
+    inRowStart.assign(n + 1, 0);
+    for (int e = 0; e < m; ++e) inRowStart[graph.edgeTo[e] + 1]++;
+    for (int v = 0; v < n; ++v) inRowStart[v + 1] += inRowStart[v];
+    inEdges.resize(m);
+    vector<int> fill(inRowStart.begin(), inRowStart.end() - 1);
+    for (int e = 0; e < m; ++e) inEdges[fill[graph.edgeTo[e]]++] = e;
+}
+
+Router::~Router() {
+    pthread_mutex_destroy(&cacheMutex);
+}
+
+// Route of a plain bidirectional search meeting at `meet`
+bool Router::reconstruct(int from, int to, int meet, vector<int>& edges) {
+    SearchSpace& s = searchSpace;
+    edges.clear();
+    if (meet == -1) return false;
+    for (int node = meet; node != from; node = edgeFrom[s.parentF[node]]) {
+        edges.push_back(s.parentF[node]);
+    }
+    reverse(edges.begin(), edges.end());
+    for (int node = meet; node != to; node = graph.edgeTo[s.parentB[node]]) {
+        edges.push_back(s.parentB[node]);
+    }
+    return true;
+}
+
+bool Router::bidirectionalDijkstra(int from, int to, vector<int>& edges) {
+    SearchSpace& s = searchSpace;
+    s.prepare(graph.nodeCount());
+    s.touch(from);
+    s.distF[from] = 0;
+    s.touch(to);
+    s.distB[to] = 0;
+    heapPush(s.heapF, 0, from);
+    heapPush(s.heapB, 0, to);
+
+    float best = from == to ? 0 : INF_DIST;
+    int meet = from == to ? from : -1;
+
+    while (!s.heapF.empty() || !s.heapB.empty()) {
+        float minF = s.heapF.empty() ? INF_DIST : s.heapF.front().first;
+        float minB = s.heapB.empty() ? INF_DIST : s.heapB.front().first;
+        if (minF + minB >= best) break;
+
+        if (minF <= minB) {
+            HeapItem top = heapPop(s.heapF);
+            int u = top.second;
+            if (top.first > s.distF[u]) continue;
+            for (int e = graph.rowStart[u]; e < graph.rowStart[u + 1]; ++e) {
+                int v = graph.edgeTo[e];
+                float d = top.first + graph.edgeLength[e];
+                if (d < s.distF[v]) {
+                    s.touch(v);
+                    s.distF[v] = d;
+                    s.parentF[v] = e;
+                    heapPush(s.heapF, d, v);
+                    if (d + s.distB[v] < best) {
+                        best = d + s.distB[v];
+                        meet = v;
+                    }
+                }
+            }
+        } else {
+            HeapItem top = heapPop(s.heapB);
+            int u = top.second;
+            if (top.first > s.distB[u]) continue;
+            for (int i = inRowStart[u]; i < inRowStart[u + 1]; ++i) {
+                int e = inEdges[i];
+                int v = edgeFrom[e];
+                float d = top.first + graph.edgeLength[e];
+                if (d < s.distB[v]) {
+                    s.touch(v);
+                    s.distB[v] = d;
+                    s.parentB[v] = e;
+                    heapPush(s.heapB, d, v);
+                    if (d + s.distF[v] < best) {
+                        best = d + s.distF[v];
+                        meet = v;
+                    }
+                }
+            }
+        }
+    }
+
+    bool found = reconstruct(from, to, meet, edges);
+    s.reset();
+    return found;
+}
+
+bool Router::aStar(int from, int to, vector<int>& edges) {
+    SearchSpace& s = searchSpace;
+    s.prepare(graph.nodeCount());
+    float tx = graph.nodeX[to], ty = graph.nodeY[to];
+    // Edge lengths are Euclidean, so straight-line distance never overestimates
+    auto heuristic = [&](int node) {
+        float dx = graph.nodeX[node] - tx, dy = graph.nodeY[node] - ty;
+        return sqrt(dx * dx + dy * dy);
+    };
+
+    s.touch(from);
+    s.distF[from] = 0;
+    heapPush(s.heapF, heuristic(from), from);
+
+    bool found = false;
+    while (!s.heapF.empty()) {
+        HeapItem top = heapPop(s.heapF);
+        int u = top.second;
+        if (u == to) {
+            found = true;
+            break;
+        }
+        float du = s.distF[u];
+        if (top.first > du + heuristic(u)) continue; // Stale entry
+        for (int e = graph.rowStart[u]; e < graph.rowStart[u + 1]; ++e) {
+            int v = graph.edgeTo[e];
+            float d = du + graph.edgeLength[e];
+            if (d < s.distF[v]) {
+                s.touch(v);
+                s.distF[v] = d;
+                s.parentF[v] = e;
+                heapPush(s.heapF, d + heuristic(v), v);
+            }
+        }
+    }
+
+    edges.clear();
+    if (found) {
+        for (int node = to; node != from; node = edgeFrom[s.parentF[node]]) {
+            edges.push_back(s.parentF[node]);
+        }
+        reverse(edges.begin(), edges.end());
+    }
+    s.reset();
+    return found;
+}
+
+// ==========================================
+// Contraction hierarchy
+// ==========================================
+
+// Overlay graph used while contracting
+struct ChBuilder {
+    vector<ChArc>& arcs;
+    vector<bool> alive;
+    vector<vector<int>> outArcs, inArcs; // Uncontracted nodes only
+
+    // Witness search state
+    vector<float> dist;
+    vector<bool> isTarget;
+    vector<int> touched;
+    vector<HeapItem> heap;
+
+    ChBuilder(vector<ChArc>& arcs, int n)
+        : arcs(arcs), outArcs(n), inArcs(n), dist(n, INF_DIST), isTarget(n, false) {}
+
+    static void eraseArc(vector<int>& list, int arc) {
+        for (size_t i = 0; i < list.size(); ++i) {
+            if (list[i] == arc) {
+                list[i] = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+    }
+
+    // Add u -> w unless an arc at least as cheap exists; a dearer one is
+    // retired from the overlay but kept for unpacking older shortcuts
+    void addArc(int u, int w, float weight, int edge, int first, int second) {
+        for (int a : outArcs[u]) {
+            if (arcs[a].to != w) continue;
+            if (arcs[a].weight <= weight) return;
+            alive[a] = false;
+            eraseArc(outArcs[u], a);
+            eraseArc(inArcs[w], a);
+            break;
+        }
+        int id = (int)arcs.size();
+        arcs.push_back({u, w, weight, edge, first, second});
+        alive.push_back(true);
+        outArcs[u].push_back(id);
+        inArcs[w].push_back(id);
+    }
+
+    // Shortest distances from `source` avoiding `skip`, up to `limit` or
+    // until `targets` nodes marked in isTarget are settled
+    void witnessSearch(int source, int skip, float limit, int targets) {
+        for (int node : touched) dist[node] = INF_DIST;
+        touched.clear();
+        heap.clear();
+
+        dist[source] = 0;
+        touched.push_back(source);
+        heapPush(heap, 0, source);
+        int settled = 0;
+        while (!heap.empty() && settled < WITNESS_SETTLE_LIMIT && targets > 0) {
+            HeapItem top = heapPop(heap);
+            int u = top.second;
+            if (top.first > dist[u]) continue;
+            if (top.first > limit) break;
+            settled++;
+            if (isTarget[u]) targets--;
+            for (int a : outArcs[u]) {
+                int v = arcs[a].to;
+                if (v == skip) continue;
+                float d = top.first + arcs[a].weight;
+                if (d < dist[v]) {
+                    if (dist[v] == INF_DIST) touched.push_back(v);
+                    dist[v] = d;
+                    heapPush(heap, d, v);
+                }
+            }
+        }
+    }
+
+    // Add the shortcuts contracting v needs
+    void contract(int v) {
+        vector<int> ins = inArcs[v];
+        vector<int> outs = outArcs[v];
+        float maxOut = 0;
+        for (int aOut : outs) {
+            maxOut = max(maxOut, arcs[aOut].weight);
+            isTarget[arcs[aOut].to] = true;
+        }
+        for (int aIn : ins) {
+            int u = arcs[aIn].from;
+            witnessSearch(u, v, arcs[aIn].weight + maxOut, (int)outs.size());
+
+            for (int aOut : outs) {
+                int w = arcs[aOut].to;
+                if (w == u) continue;
+                float via = arcs[aIn].weight + arcs[aOut].weight;
+                if (dist[w] <= via) continue; // Witness path exists
+                addArc(u, w, via, -1, aIn, aOut);
+            }
+        }
+        for (int aOut : outs) isTarget[arcs[aOut].to] = false;
+    }
+
+    // Take a contracted node out of the overlay. Its arcs stay alive for
+    // the final hierarchy.
+    void remove(int v) {
+        for (int a : outArcs[v]) eraseArc(inArcs[arcs[a].to], a);
+        for (int a : inArcs[v]) eraseArc(outArcs[arcs[a].from], a);
+    }
+};
+
+// Split `nodes` (all labelled `label` in part) in two at the median of
+// their longer axis, then take the nodes of the upper half with an
+// arc across as the separator. Halves go before the separator in
+// `order`, and the separator itself is dissected the same way so a
+// straight one is contracted from its ends in.
+void Router::dissect(vector<int>& nodes, int label, vector<int>& part, int& nextLabel,
+                     vector<int>& order) const {
+    if (nodes.size() <= 1) {
+        order.insert(order.end(), nodes.begin(), nodes.end());
+        return;
+    }
+    float minX = INF_DIST, maxX = -INF_DIST, minY = INF_DIST, maxY = -INF_DIST;
+    for (int v : nodes) {
+        minX = min(minX, graph.nodeX[v]);
+        maxX = max(maxX, graph.nodeX[v]);
+        minY = min(minY, graph.nodeY[v]);
+        maxY = max(maxY, graph.nodeY[v]);
+    }
+    const vector<float>& axis = maxX - minX >= maxY - minY ? graph.nodeX : graph.nodeY;
+    size_t mid = nodes.size() / 2;
+    nth_element(nodes.begin(), nodes.begin() + mid, nodes.end(),
+                [&axis](int a, int b) { return axis[a] < axis[b]; });
+    // Cut between coordinates, not through a row of equal ones: below the
+    // median's, or if nothing is, up to it
+    float cut = axis[nodes[mid]];
+    bool inclusive = none_of(nodes.begin(), nodes.end(), [&](int v) { return axis[v] < cut; });
+    int low = nextLabel++, high = nextLabel++;
+    vector<int> lower, upper;
+    for (int v : nodes) {
+        if (axis[v] < cut || (inclusive && axis[v] == cut)) {
+            lower.push_back(v);
+            part[v] = low;
+        } else {
+            upper.push_back(v);
+            part[v] = high;
+        }
+    }
+    if (upper.empty()) {
+        // Every node on one point: nothing to cut
+        order.insert(order.end(), nodes.begin(), nodes.end());
+        for (int v : nodes) part[v] = label;
+        return;
+    }
+
+    int sep = nextLabel++;
+    vector<int> rest, separator;
+    for (int v : upper) {
+        bool crosses = false;
+        for (int e = graph.rowStart[v]; e < graph.rowStart[v + 1] && !crosses; ++e) {
+            crosses = part[graph.edgeTo[e]] == low;
+        }
+        for (int i = inRowStart[v]; i < inRowStart[v + 1] && !crosses; ++i) {
+            crosses = part[edgeFrom[inEdges[i]]] == low;
+        }
+        (crosses ? separator : rest).push_back(v);
+    }
+    for (int v : separator) part[v] = sep;
+    for (int v : rest) part[v] = high;
+
+    dissect(lower, low, part, nextLabel, order);
+    dissect(rest, high, part, nextLabel, order);
+    dissect(separator, sep, part, nextLabel, order);
+}
+
+vector<int> Router::dissectionOrder() const {
+    int n = graph.nodeCount();
+    vector<int> nodes(n), part(n, 0), order;
+    for (int v = 0; v < n; ++v) nodes[v] = v;
+    order.reserve(n);
+    int nextLabel = 1;
+    dissect(nodes, 0, part, nextLabel, order);
+    return order;
+}
+
+void Router::buildContractionHierarchy() {
+    int n = graph.nodeCount();
+    chArcs.clear();
+    ChBuilder b(chArcs, n);
+
+    for (int e = 0; e < graph.edgeCount(); ++e) {
+        if (edgeFrom[e] != graph.edgeTo[e]) {
+            b.addArc(edgeFrom[e], graph.edgeTo[e], graph.edgeLength[e], e, -1, -1);
+        }
+    }
+
+    // Contract in nested dissection order: each half of a region before
+    // the separator between them, so a query only climbs separators
+    vector<int> order = dissectionOrder();
+    rank.assign(n, -1);
+    for (int i = 0; i < n; ++i) {
+        int v = order[i];
+        b.contract(v);
+        rank[v] = i;
+        b.remove(v);
+    }
+
+    // Upward arcs by tail for the forward search, downward arcs by head
+    // for the backward search, both indexed by rank: the top of the
+    // hierarchy, which every query reaches, is then one block of memory
+    upRowStart.assign(n + 1, 0);
+    downRowStart.assign(n + 1, 0);
+    for (size_t a = 0; a < chArcs.size(); ++a) {
+        if (!b.alive[a]) continue;
+        int from = rank[chArcs[a].from], to = rank[chArcs[a].to];
+        if (from < to) upRowStart[from + 1]++;
+        else downRowStart[to + 1]++;
+    }
+    for (int r = 0; r < n; ++r) {
+        upRowStart[r + 1] += upRowStart[r];
+        downRowStart[r + 1] += downRowStart[r];
+    }
+    upArcs.resize(upRowStart[n]);
+    downArcs.resize(downRowStart[n]);
+    vector<int> upFill(upRowStart.begin(), upRowStart.end() - 1);
+    vector<int> downFill(downRowStart.begin(), downRowStart.end() - 1);
+    for (size_t a = 0; a < chArcs.size(); ++a) {
+        if (!b.alive[a]) continue;
+        int from = rank[chArcs[a].from], to = rank[chArcs[a].to];
+        float weight = chArcs[a].weight;
+        if (from < to) upArcs[upFill[from]++] = {to, weight, (int)a};
+        else downArcs[downFill[to]++] = {from, weight, (int)a};
+    }
+}
+
+int Router::getShortcutCount() const {
+    int count = 0;
+    for (const ChArc& arc : chArcs) if (arc.edge == -1) count++;
+    return count;
+}
+
+void Router::unpackArc(int arc, vector<int>& edges) const {
+    // Explicit stack: shortcut nesting can be deep on large graphs
+    vector<int> stack = {arc};
+    while (!stack.empty()) {
+        int a = stack.back();
+        stack.pop_back();
+        if (chArcs[a].edge != -1) {
+            edges.push_back(chArcs[a].edge);
+        } else {
+            stack.push_back(chArcs[a].second);
+            stack.push_back(chArcs[a].first);
+        }
+    }
+}
+
+// Stall-on-demand: u need not be expanded if a higher-ranked node the
+// search has already reached offers a shorter way to it. `arcs` are the
+// hierarchy arcs between u and its higher-ranked neighbours: into u for
+// the forward search and out of u for the backward one.
+bool Router::stalled(const vector<int>& rowStart, const vector<ChLink>& arcs, int u, float du,
+                     const vector<float>& dist) const {
+    for (int i = rowStart[u]; i < rowStart[u + 1]; ++i) {
+        if (dist[arcs[i].node] + arcs[i].weight < du) return true;
+    }
+    return false;
+}
+
+bool Router::chQuery(int from, int to, vector<int>& edges) {
+    if (!hasContractionHierarchy()) return bidirectionalDijkstra(from, to, edges);
+
+    // The searches run on ranks, not node ids
+    int source = rank[from], target = rank[to];
+    SearchSpace& s = searchSpace;
+    s.prepare(graph.nodeCount());
+    s.touch(source);
+    s.distF[source] = 0;
+    s.touch(target);
+    s.distB[target] = 0;
+    heapPush(s.heapF, 0, source);
+    heapPush(s.heapB, 0, target);
+
+    float best = from == to ? 0 : INF_DIST;
+    int meet = from == to ? source : -1;
+
+    // Both searches only climb, so each runs until its queue passes `best`
+    while (true) {
+        bool forward = !s.heapF.empty() && s.heapF.front().first < best;
+        bool backward = !s.heapB.empty() && s.heapB.front().first < best;
+        if (!forward && !backward) break;
+        if (forward && backward) forward = s.heapF.front().first <= s.heapB.front().first;
+
+        if (forward) {
+            HeapItem top = heapPop(s.heapF);
+            int u = top.second;
+            if (top.first > s.distF[u]) continue;
+            if (top.first + s.distB[u] < best) {
+                best = top.first + s.distB[u];
+                meet = u;
+            }
+            if (stalled(downRowStart, downArcs, u, top.first, s.distF)) continue;
+            for (int i = upRowStart[u]; i < upRowStart[u + 1]; ++i) {
+                const ChLink& link = upArcs[i];
+                float d = top.first + link.weight;
+                if (d < s.distF[link.node]) {
+                    s.touch(link.node);
+                    s.distF[link.node] = d;
+                    s.parentF[link.node] = link.arc;
+                    heapPush(s.heapF, d, link.node);
+                }
+            }
+        } else {
+            HeapItem top = heapPop(s.heapB);
+            int u = top.second;
+            if (top.first > s.distB[u]) continue;
+            if (top.first + s.distF[u] < best) {
+                best = top.first + s.distF[u];
+                meet = u;
+            }
+            if (stalled(upRowStart, upArcs, u, top.first, s.distB)) continue;
+            for (int i = downRowStart[u]; i < downRowStart[u + 1]; ++i) {
+                const ChLink& link = downArcs[i];
+                float d = top.first + link.weight;
+                if (d < s.distB[link.node]) {
+                    s.touch(link.node);
+                    s.distB[link.node] = d;
+                    s.parentB[link.node] = link.arc;
+                    heapPush(s.heapB, d, link.node);
+                }
+            }
+        }
+    }
+
+    edges.clear();
+    bool found = meet != -1;
+    if (found) {
+        vector<int> up;
+        for (int r = meet; r != source; r = rank[chArcs[s.parentF[r]].from]) {
+            up.push_back(s.parentF[r]);
+        }
+        for (int i = (int)up.size() - 1; i >= 0; --i) unpackArc(up[i], edges);
+        for (int r = meet; r != target; r = rank[chArcs[s.parentB[r]].to]) {
+            unpackArc(s.parentB[r], edges);
+        }
+    }
+    s.reset();
+    return found;
+}
+
+// ==========================================
+// Route cache
+// ==========================================
+
+bool Router::route(int from, int to, vector<int>& edges) {
+    uint64_t key = ((uint64_t)(uint32_t)from << 32) | (uint32_t)to;
+
+    pthread_mutex_lock(&cacheMutex);
+    auto it = cacheIndex.find(key);
+    if (it != cacheIndex.end()) {
+        cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second);
+        edges = it->second->second;
+        cacheHits++;
+        pthread_mutex_unlock(&cacheMutex);
+        return true;
+    }
+    cacheMisses++;
+    pthread_mutex_unlock(&cacheMutex);
+
+    bool found = hasContractionHierarchy() ? chQuery(from, to, edges)
+                                           : bidirectionalDijkstra(from, to, edges);
+    if (!found) return false;
+
+    pthread_mutex_lock(&cacheMutex);
+    if (cacheIndex.find(key) == cacheIndex.end()) {
+        cacheOrder.push_front(make_pair(key, edges));
+        cacheIndex[key] = cacheOrder.begin();
+        if ((int)cacheOrder.size() > cacheCapacity) {
+            cacheIndex.erase(cacheOrder.back().first);
+            cacheOrder.pop_back();
+        }
+    }
+    pthread_mutex_unlock(&cacheMutex);
+    return true;
+}
+
+// ==========================================
+// Travel times and route repair
+// ==========================================
+
+TravelTimes::TravelTimes(const RoadGraph& graph, float freeFlowSpeed)
+    : graph(graph), freeFlowMs(graph.edgeCount()), estimateMs(graph.edgeCount()),
+      rerouteTokens(REROUTE_BUDGET_PER_TICK), alpha(TRAVEL_TIME_ALPHA),
+      rerouteThresholdMs(REROUTE_DELAY_THRESHOLD_MS) {
+    for (int e = 0; e < graph.edgeCount(); ++e) {
+        freeFlowMs[e] = graph.edgeLength[e] / freeFlowSpeed * VEHICLE_SPEED_MS;
+        estimateMs[e].store(freeFlowMs[e], memory_order_relaxed);
+    }
+}
+
+void TravelTimes::record(int edge, float ms) {
+    if (graph.edgeLink[edge] < 0) return; // Parking and queueing are not travel
+    // Load and store rather than a CAS loop: a sample lost to a race only
+    // slows the average down a little
+    float old = estimateMs[edge].load(memory_order_relaxed);
+    estimateMs[edge].store(old + alpha * (ms - old), memory_order_relaxed);
+}
+
+float TravelTimes::delayAhead(const vector<int>& route, int first, int count) const {
+    float delay = 0;
+    int end = min(first + count, (int)route.size());
+    for (int i = first; i < end; ++i) delay += estimate(route[i]) - freeFlowMs[route[i]];
+    return delay;
+}
+
+bool TravelTimes::takeReroute() {
+    int tokens = rerouteTokens.load(memory_order_relaxed);
+    while (tokens > 0) {
+        if (rerouteTokens.compare_exchange_weak(tokens, tokens - 1, memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+bool Router::repairRoute(vector<int>& route, int pos, int horizon, const TravelTimes& times) {
+    int last = min(pos + horizon, (int)route.size() - 1);
+    if (last <= pos) return false;
+    int from = graph.edgeTo[route[pos]];
+    int to = graph.edgeTo[route[last]];
+    float current = 0;
+    for (int i = pos + 1; i <= last; ++i) current += times.estimate(route[i]);
+
+    // Dijkstra on estimated times, abandoned once nothing left in the queue
+    // can beat the section it would replace
+    SearchSpace& s = searchSpace;
+    s.prepare(graph.nodeCount());
+    s.touch(from);
+    s.distF[from] = 0;
+    heapPush(s.heapF, 0, from);
+    bool found = false;
+    int settled = 0;
+    while (!s.heapF.empty() && settled < REPAIR_SETTLE_LIMIT) {
+        HeapItem top = heapPop(s.heapF);
+        int u = top.second;
+        if (top.first > s.distF[u]) continue;
+        if (top.first >= current) break;
+        if (u == to) {
+            found = true;
+            break;
+        }
+        settled++;
+        for (int e = graph.rowStart[u]; e < graph.rowStart[u + 1]; ++e) {
+            if (graph.edgeLink[e] < 0) continue; // No detours through parking lots
+            int v = graph.edgeTo[e];
+            float d = top.first + times.estimate(e);
+            if (d < s.distF[v]) {
+                s.touch(v);
+                s.distF[v] = d;
+                s.parentF[v] = e;
+                heapPush(s.heapF, d, v);
+            }
+        }
+    }
+
+    // Only switch for a real saving, not a tie in a different order
+    bool changed = found && s.distF[to] < current * 0.99f;
+    if (changed) {
+        vector<int> detour;
+        for (int node = to; node != from; node = edgeFrom[s.parentF[node]]) {
+            detour.push_back(s.parentF[node]);
+        }
+        reverse(detour.begin(), detour.end());
+        route.erase(route.begin() + pos + 1, route.begin() + last + 1);
+        route.insert(route.begin() + pos + 1, detour.begin(), detour.end());
+    }
+    s.reset();
+    return changed;
+}
+
+Router& roadRouter() {
+    static Router router(roadGraph());
+    return router;
+}
+
+TravelTimes& roadTravelTimes() {
+    static TravelTimes times(roadGraph(), ROAD_FREE_FLOW_SPEED);
+    return times;
+}
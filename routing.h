@@ -0,0 +1,150 @@
+/**
+ * routing.h
+ *
+ * Shortest-path routing over the RoadGraph: bidirectional Dijkstra, A*,
+ * an optional contraction hierarchy, and an LRU cache of
+ * origin-destination routes in front of them. Congestion is handled by
+ * per-edge travel time estimates and local repair of routes ahead.
+ */
+
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#include "roadgraph.h"
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <pthread.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+const int ROUTE_CACHE_CAPACITY = 4096;
+
+// Congestion-aware rerouting defaults
+const float TRAVEL_TIME_ALPHA = 0.2f;          // EWMA weight of a new sample
+const float REROUTE_DELAY_THRESHOLD_MS = 3000; // Expected delay ahead that triggers a repair
+const int REROUTE_HORIZON_EDGES = 16;          // Route edges a repair may replace
+const int REROUTE_BUDGET_PER_TICK = 8;         // Repairs allowed per VEHICLE_SPEED_MS
+
+// Contraction-hierarchy arc: an original edge or a shortcut over two arcs
+struct ChArc {
+    int from, to;
+    float weight;
+    int edge;           // Graph edge id, or -1 for a shortcut
+    int first, second;  // Arcs a shortcut replaces
+};
+
+// A hierarchy arc as a search scans it: the node at its other end, so a
+// node's arcs are read in one sweep without touching the ChArc table
+struct ChLink {
+    int node;
+    float weight;
+    int arc;
+};
+
+// Per-edge travel time estimates in simulated milliseconds, kept as an
+// exponentially weighted moving average of what vehicles report as they
+// leave each road edge. Also holds the rerouting threshold and the budget
+// of repairs the owner hands out each tick. Thread safe; concurrent
+// records to one edge may drop a sample.
+class TravelTimes {
+private:
+    const RoadGraph& graph;
+    std::vector<float> freeFlowMs;
+    std::vector<std::atomic<float>> estimateMs;
+    std::atomic<int> rerouteTokens;
+
+public:
+    float alpha;
+    float rerouteThresholdMs;
+
+    // Free-flow times are for a vehicle covering `freeFlowSpeed` per
+    // VEHICLE_SPEED_MS step
+    TravelTimes(const RoadGraph& graph, float freeFlowSpeed);
+
+    // Fold a traversal of `edge` taking `ms` into its estimate. Lot
+    // manoeuvres (edges off the road) are ignored.
+    void record(int edge, float ms);
+    float estimate(int edge) const { return estimateMs[edge].load(std::memory_order_relaxed); }
+    float freeFlow(int edge) const { return freeFlowMs[edge]; }
+
+    // Sum of estimate - free flow over route[first .. first + count - 1]
+    float delayAhead(const std::vector<int>& route, int first, int count) const;
+
+    // Reroute budget: grantReroutes() sets how many repairs may run until
+    // the next grant, takeReroute() claims one
+    void grantReroutes(int count) { rerouteTokens.store(count, std::memory_order_relaxed); }
+    bool takeReroute();
+};
+
+class Router {
+private:
+    const RoadGraph& graph;
+
+    // Reverse adjacency for backward searches: the edges into node n are
+    // inEdges[inRowStart[n] .. inRowStart[n + 1] - 1]
+    std::vector<int> inRowStart;
+    std::vector<int> inEdges;
+    std::vector<int> edgeFrom;
+
+    // Contraction hierarchy, empty until buildContractionHierarchy()
+    std::vector<int> rank;
+    std::vector<ChArc> chArcs;
+    std::vector<int> upRowStart, downRowStart;
+    std::vector<ChLink> upArcs;   // Arcs to higher-ranked nodes, by tail
+    std::vector<ChLink> downArcs; // Arcs from higher-ranked nodes, by head
+
+    // LRU cache: most recently used at the front
+    typedef std::pair<uint64_t, std::vector<int>> CacheEntry;
+    int cacheCapacity;
+    std::list<CacheEntry> cacheOrder;
+    std::unordered_map<uint64_t, std::list<CacheEntry>::iterator> cacheIndex;
+    pthread_mutex_t cacheMutex;
+    long long cacheHits;
+    long long cacheMisses;
+
+    bool reconstruct(int from, int to, int meet, std::vector<int>& edges);
+    void dissect(std::vector<int>& nodes, int label, std::vector<int>& part, int& nextLabel,
+                 std::vector<int>& order) const;
+    std::vector<int> dissectionOrder() const;
+    void unpackArc(int arc, std::vector<int>& edges) const;
+    bool stalled(const std::vector<int>& rowStart, const std::vector<ChLink>& arcs, int u, float du,
+                 const std::vector<float>& dist) const;
+
+public:
+    explicit Router(const RoadGraph& graph, int cacheCapacity = ROUTE_CACHE_CAPACITY);
+    ~Router();
+
+    // Uncached searches. Each fills `edges` with the graph edge ids of a
+    // shortest route from -> to and returns false if `to` is unreachable.
+    bool bidirectionalDijkstra(int from, int to, std::vector<int>& edges);
+    bool aStar(int from, int to, std::vector<int>& edges);
+    bool chQuery(int from, int to, std::vector<int>& edges);
+
+    // Contract the graph so chQuery() works and route() uses it
+    void buildContractionHierarchy();
+    bool hasContractionHierarchy() const { return !rank.empty(); }
+    int getShortcutCount() const;
+
+    // Cached route, computed by chQuery() if the hierarchy is built and by
+    // bidirectionalDijkstra() otherwise. Thread safe.
+    bool route(int from, int to, std::vector<int>& edges);
+
+    // Incremental reroute: replace route[pos + 1 .. pos + horizon] with the
+    // fastest path between the same two nodes under the current travel
+    // time estimates, searching at most REPAIR_SETTLE_LIMIT nodes. The rest
+    // of the route is kept. Returns true if the route changed.
+    bool repairRoute(std::vector<int>& route, int pos, int horizon, const TravelTimes& times);
+
+    long long getCacheHits() const { return cacheHits; }
+    long long getCacheMisses() const { return cacheMisses; }
+};
+
+// The process-wide router over roadGraph()
+Router& roadRouter();
+
+// The process-wide travel time estimates of roadGraph()
+TravelTimes& roadTravelTimes();
+
+#endif // ROUTING_H
@@ -0,0 +1,336 @@
+/**
+ * signals.cpp
+ *
+ * Compilation of signal plans into interval tables, the detectors of the
+ * adaptive policies, and the phase engine.
+ */
+
+#include "signals.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+
+using namespace std;
+
+// Interval lighting `green` GREEN, `yellow` YELLOW and the rest RED
+static SignalInterval makeInterval(int durationMs, const char* name, unsigned green, unsigned yellow) {
+    SignalInterval in;
+    in.durationMs = durationMs;
+    in.name = name;
+    for (int d = 0; d < DIRECTION_COUNT; ++d) {
+        unsigned bit = 1u << d;
+        in.states[d] = (green & bit)    ? TrafficLightState::GREEN
+                     : (yellow & bit)   ? TrafficLightState::YELLOW
+                                        : TrafficLightState::RED;
+    }
+    return in;
+}
+
+SignalPlan::SignalPlan(const RoadNetwork& net, const RoadGraph& graph, LaneTable& lanes,
+                       const NetIntersection& in)
+    : lanes(lanes), policy(SignalPolicy::FIXED), current(0), elapsedMs(0), quietMs(0),
+      nextPhase(-1), forced(false), clockMs(-1), cycleMs(0), offsetMs(-1) {
+    for (int p = in.firstPhase; p < in.firstPhase + in.phaseCount; ++p) {
+        const NetPhase& phase = net.phases[p];
+        int index = (int)phaseFirst.size();
+        phaseFirst.push_back((int)intervals.size());
+        phaseGreen.push_back(phase.greenDirections);
+        intervals.push_back(makeInterval(phase.greenMs, "GREEN", phase.greenDirections, 0));
+        // Clearance intervals of zero length are left out of the table
+        if (phase.yellowMs > 0) {
+            intervals.push_back(makeInterval(phase.yellowMs, "YELLOW", 0, phase.greenDirections));
+        }
+        if (phase.allRedMs > 0) {
+            intervals.push_back(makeInterval(phase.allRedMs, "ALL_RED", 0, 0));
+        }
+        intervalPhase.resize(intervals.size(), index);
+    }
+    if (intervals.empty()) {
+        phaseFirst.push_back(0);
+        phaseGreen.push_back(in.approaches);
+        intervals.push_back(makeInterval(1 << 30, "GREEN", in.approaches, 0));
+        intervalPhase.push_back(0);
+    }
+    for (const SignalInterval& interval : intervals) cycleMs += interval.durationMs;
+    remainingMs = intervals[0].durationMs;
+    forcedInterval = intervals[0];
+    findDetectors(graph, in);
+}
+
+void SignalPlan::findDetectors(const RoadGraph& graph, const NetIntersection& in) {
+    for (int d = 0; d < DIRECTION_COUNT; ++d) {
+        approachEdge[d] = -1;
+        exitEdge[d] = -1;
+        queueIn[d] = 0;
+        queueOut[d] = 0;
+        if (!(in.approaches & (1u << d))) continue;
+
+        // The stop line's arm is left against the direction its approach
+        // arrives in
+        float x, y;
+        stopLinePoint(in, (Direction)d, x, y);
+        int node = graph.findNode(x, y);
+        if (node == -1) continue;
+        for (int e = 0; e < graph.edgeCount(); ++e) {
+            if (graph.edgeLink[e] < 0) continue;
+            float along = alongDirection(graph, e, (Direction)d);
+            if (graph.edgeTo[e] == node && along > 0.5f) approachEdge[d] = e;
+        }
+        for (int e = graph.rowStart[node]; e < graph.rowStart[node + 1]; ++e) {
+            if (graph.edgeLink[e] < 0) continue;
+            float along = alongDirection(graph, e, (Direction)d);
+            if (along < -0.5f) exitEdge[d] = e;
+        }
+    }
+
+    for (int from = 0; from < DIRECTION_COUNT; ++from) {
+        for (int to = 0; to < DIRECTION_COUNT; ++to) {
+            if (to == from || approachEdge[from] == -1 || exitEdge[to] == -1) continue;
+            movementFrom.push_back(from);
+            movementTo.push_back(to);
+        }
+    }
+    for (size_t p = 0; p < phaseGreen.size(); ++p) {
+        phaseMovementStart.push_back((int)phaseMovements.size());
+        for (int m = 0; m < (int)movementFrom.size(); ++m) {
+            if (phaseGreen[p] & (1u << movementFrom[m])) phaseMovements.push_back(m);
+        }
+    }
+    phaseMovementStart.push_back((int)phaseMovements.size());
+}
+
+void SignalPlan::readQueues() {
+    for (int d = 0; d < DIRECTION_COUNT; ++d) {
+        queueIn[d] = approachEdge[d] == -1 ? 0 : lanes.getLaneSize(approachEdge[d]);
+        queueOut[d] = exitEdge[d] == -1 ? 0 : lanes.getLaneSize(exitEdge[d]);
+    }
+}
+
+bool SignalPlan::hasCall(int phase) const {
+    for (int d = 0; d < DIRECTION_COUNT; ++d) {
+        if ((phaseGreen[phase] & (1u << d)) && queueIn[d] > 0) return true;
+    }
+    return false;
+}
+
+int SignalPlan::pressure(int phase) const {
+    int sum = 0;
+    for (int i = phaseMovementStart[phase]; i < phaseMovementStart[phase + 1]; ++i) {
+        int m = phaseMovements[i];
+        sum += queueIn[movementFrom[m]] - queueOut[movementTo[m]];
+    }
+    return sum;
+}
+
+bool SignalPlan::endGreen(int phase, int ms) {
+    readQueues();
+    int phaseCount = (int)phaseFirst.size();
+
+    if (policy == SignalPolicy::ACTUATED) {
+        bool occupied = false;
+        for (int d = 0; d < DIRECTION_COUNT; ++d) {
+            if ((phaseGreen[phase] & (1u << d)) && approachEdge[d] != -1 &&
+                lanes.countNearEnd(approachEdge[d], SIGNAL_DETECTOR_LENGTH) > 0) {
+                occupied = true;
+            }
+        }
+        quietMs = occupied ? 0 : quietMs + ms;
+
+        bool conflicting = false;
+        for (int p = 0; p < phaseCount; ++p) {
+            if (p != phase && hasCall(p)) conflicting = true;
+        }
+        if (!conflicting) {
+            remainingMs += ms; // Rest in green; the max-out timer waits for a call
+            return false;
+        }
+        if (remainingMs <= 0) {
+            metricAdd(Metric::SIGNAL_MAX_OUTS);
+            return true;
+        }
+        if (elapsedMs >= SIGNAL_MIN_GREEN_MS && quietMs >= SIGNAL_GAP_MS) {
+            metricAdd(Metric::SIGNAL_GAP_OUTS);
+            return true;
+        }
+        return false;
+    }
+
+    // Max-pressure: no maximum, the queues decide
+    remainingMs += ms;
+    if (elapsedMs < SIGNAL_MIN_GREEN_MS) return false;
+    int best = phase;
+    int bestPressure = pressure(phase);
+    for (int p = 0; p < phaseCount; ++p) {
+        int w = pressure(p);
+        if (w > bestPressure) {
+            best = p;
+            bestPressure = w;
+        }
+    }
+    if (best == phase) return false;
+    nextPhase = best;
+    return true;
+}
+
+int SignalPlan::following() {
+    int phase = intervalPhase[current];
+    if (current + 1 < (int)intervals.size() && intervalPhase[current + 1] == phase) {
+        return current + 1; // This phase's clearance
+    }
+
+    int phaseCount = (int)phaseFirst.size();
+    int next = (phase + 1) % phaseCount;
+    if (policy == SignalPolicy::MAX_PRESSURE && nextPhase != -1) {
+        next = nextPhase;
+    } else if (policy == SignalPolicy::ACTUATED) {
+        // Skip to the first phase somebody waits for
+        readQueues();
+        for (int k = 1; k <= phaseCount; ++k) {
+            int p = (phase + k) % phaseCount;
+            if (hasCall(p)) {
+                next = p;
+                break;
+            }
+        }
+    }
+    nextPhase = -1;
+    return phaseFirst[next];
+}
+
+int SignalPlan::offsetGreen(int durationMs) {
+    if (offsetMs < 0 || clockMs < 0 || current != phaseFirst[0]) return durationMs;
+    // How late this green starts against the offset, within half a cycle
+    long long start = clockMs + remainingMs;
+    int late = (int)(((start - offsetMs) % cycleMs + cycleMs) % cycleMs);
+    if (late > cycleMs / 2) late -= cycleMs;
+    int step = max(-SIGNAL_MAX_OFFSET_STEP_MS, min(SIGNAL_MAX_OFFSET_STEP_MS, late));
+    return max(min(durationMs, SIGNAL_MIN_GREEN_MS), durationMs - step);
+}
+
+bool SignalPlan::advance(int ms) {
+    if (clockMs >= 0) clockMs += ms;
+    if (forced) return false;
+    remainingMs -= ms;
+    elapsedMs += ms;
+    if (policy != SignalPolicy::FIXED && inGreen() && endGreen(intervalPhase[current], ms)) {
+        remainingMs = 0;
+    }
+
+    bool changed = false;
+    while (remainingMs <= 0) {
+        current = following();
+        int duration = intervals[current].durationMs;
+        if (policy == SignalPolicy::ACTUATED && inGreen()) duration *= SIGNAL_MAX_GREEN_SCALE;
+        if (policy == SignalPolicy::FIXED) duration = offsetGreen(duration);
+        remainingMs += duration;
+        elapsedMs = 0;
+        quietMs = 0;
+        changed = true;
+    }
+    return changed;
+}
+
+bool SignalPlan::advanceTo(long long clockMs) {
+    if (this->clockMs < 0) {
+        this->clockMs = clockMs;
+        return false;
+    }
+    return advance((int)(clockMs - this->clockMs));
+}
+
+bool SignalPlan::setTiming(int phase, int greenMs, int yellowMs, int allRedMs) {
+    if (phase < 0 || phase >= (int)phaseFirst.size() || greenMs == 0 || greenMs < -1 ||
+        yellowMs < -1 || allRedMs < -1) {
+        return false;
+    }
+    int yellow = -1, allRed = -1;
+    for (int i = phaseFirst[phase] + 1; i < (int)intervals.size() && intervalPhase[i] == phase; ++i) {
+        if (strcmp(intervals[i].name, "ALL_RED") == 0) allRed = i;
+        else yellow = i;
+    }
+    if ((yellow == -1 && yellowMs > 0) || (allRed == -1 && allRedMs > 0)) return false;
+
+    if (greenMs > 0) intervals[phaseFirst[phase]].durationMs = greenMs;
+    if (yellow != -1 && yellowMs >= 0) intervals[yellow].durationMs = yellowMs;
+    if (allRed != -1 && allRedMs >= 0) intervals[allRed].durationMs = allRedMs;
+    cycleMs = 0;
+    for (const SignalInterval& interval : intervals) cycleMs += interval.durationMs;
+    return true;
+}
+
+void SignalPlan::force(unsigned greenDirections) {
+    forced = true;
+    forcedInterval = makeInterval(0, "GREEN", greenDirections, 0);
+}
+
+void SignalPlan::release() {
+    forced = false;
+}
+
+PublishedLights* mapLightBoard() {
+    size_t count = max((size_t)1, roadNetwork().intersections.size());
+    void* p = mmap(nullptr, count * sizeof(PublishedLights), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("Light board mmap failed");
+        exit(1);
+    }
+    // Page aligned, so each entry starts a cache line
+    PublishedLights* board = (PublishedLights*)p;
+    uint64_t red = 0;
+    for (int d = 0; d < DIRECTION_COUNT; ++d) red |= (uint64_t)TrafficLightState::RED << (8 * d);
+    for (size_t j = 0; j < count; ++j) new (&board[j].word) atomic<uint64_t>(red);
+    return board;
+}
+
+void storeLights(int junction, const TrafficLightState* states) {
+    atomic<uint64_t>& word = roadLights()[junction].word;
+    // The junction's controller is the only writer, so the count can be
+    // read back and bumped without a read-modify-write
+    uint64_t lights = (uint64_t)(lightSequence(word.load(memory_order_relaxed)) + 1) << 32;
+    for (int d = 0; d < DIRECTION_COUNT; ++d) lights |= (uint64_t)states[d] << (8 * d);
+    word.store(lights, memory_order_release);
+}
+
+bool parseSignalPolicy(const char* name, SignalPolicy& policy) {
+    if (strcmp(name, "fixed") == 0) policy = SignalPolicy::FIXED;
+    else if (strcmp(name, "actuated") == 0) policy = SignalPolicy::ACTUATED;
+    else if (strcmp(name, "max-pressure") == 0) policy = SignalPolicy::MAX_PRESSURE;
+    else return false;
+    return true;
+}
+
+const char* signalPolicyName(SignalPolicy policy) {
+    switch (policy) {
+        case SignalPolicy::FIXED:        return "fixed";
+        case SignalPolicy::ACTUATED:     return "actuated";
+        case SignalPolicy::MAX_PRESSURE: return "max-pressure";
+    }
+    return "fixed";
+}
+
+SignalPlan signalPlanFor(int intersectionId) {
+    const RoadNetwork& net = roadNetwork();
+    const NetIntersection* in = net.findIntersection(intersectionId);
+    if (in == nullptr) {
+        cerr << "Road network has no intersection " << intersectionId << endl;
+        exit(1);
+    }
+    SignalPlan plan(net, roadGraph(), roadLanes(), *in);
+
+    const char* name = getenv("TRAFFIC_SIGNAL_POLICY");
+    SignalPolicy policy;
+    if (name != nullptr) {
+        if (!parseSignalPolicy(name, policy)) {
+            cerr << "Unknown TRAFFIC_SIGNAL_POLICY '" << name << "'" << endl;
+            exit(1);
+        }
+        plan.setPolicy(policy);
+    }
+    return plan;
+}
@@ -0,0 +1,179 @@
+/**
+ * signals.h
+ *
+ * Table-driven signal timing. An intersection's plan (its phases in the
+ * road network) is compiled once into a flat table of intervals, each
+ * holding its duration and every direction's light: a phase's GREEN, then
+ * its YELLOW, then ALL-RED. Running the plan is a countdown and an index
+ * into the table.
+ *
+ * A policy decides how long each GREEN runs and which phase comes next:
+ * the fixed plan, actuation by stop-line detectors, or max-pressure. The
+ * adaptive ones read queue lengths from the lane table.
+ *
+ * Plans run on a clock shared by every junction, so a fixed plan given an
+ * offset can start its first phase's green at that point of its cycle.
+ * Every junction's lights are published on a lock-free board in shared
+ * memory, where vehicles of any controller read them.
+ */
+
+#ifndef SIGNALS_H
+#define SIGNALS_H
+
+#include "simulation_types.h"
+#include "roadnet.h"
+#include "roadgraph.h"
+#include "lanes.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+enum class SignalPolicy {
+    FIXED,        // Every phase in turn, for its planned green
+    ACTUATED,     // A green ends once its detectors go quiet (gap-out) or at
+                  // its maximum (max-out); phases nobody waits for are skipped
+    MAX_PRESSURE  // After the minimum green, switch to the phase whose
+                  // movements have the largest upstream-minus-downstream queue
+};
+
+const int SIGNAL_MIN_GREEN_MS = 1000;
+const int SIGNAL_GAP_MS = 1000;             // Detector quiet this long: gap-out
+const int SIGNAL_MAX_GREEN_SCALE = 2;       // Actuated max-out, in planned greens
+const float SIGNAL_DETECTOR_LENGTH = 80.0f; // Stop-line detectors, two vehicles long
+const int SIGNAL_MAX_OFFSET_STEP_MS = 500;  // Most a green moves per cycle towards its offset
+
+struct SignalInterval {
+    int durationMs;
+    const char* name; // "GREEN", "YELLOW" or "ALL_RED", for traces
+    TrafficLightState states[DIRECTION_COUNT];
+};
+
+class SignalPlan {
+private:
+    LaneTable& lanes;
+    SignalPolicy policy;
+    std::vector<SignalInterval> intervals;
+    std::vector<int> intervalPhase;   // Phase each interval belongs to
+    std::vector<int> phaseFirst;      // Index of each phase's GREEN interval
+    std::vector<unsigned> phaseGreen; // Directions each phase lets through
+    int current;
+    int remainingMs;
+    int elapsedMs;  // Into the current interval
+    int quietMs;    // Since a detector of the current green last saw a vehicle
+    int nextPhase;  // Chosen by max-pressure when it ends a green, else -1
+    bool forced;
+    SignalInterval forcedInterval;
+    long long clockMs; // Shared clock, -1 until advanceTo() starts it
+    int cycleMs;
+    int offsetMs;      // Where in the cycle phase 0's green starts, or -1
+
+    // Lanes ending at each approach's stop line and leaving the junction
+    // on each arm (-1: none). A movement goes from one approach to the exit
+    // of another arm; phaseMovements[phaseMovementStart[p] ..
+    // phaseMovementStart[p + 1] - 1] are those phase p serves.
+    int approachEdge[DIRECTION_COUNT];
+    int exitEdge[DIRECTION_COUNT];
+    std::vector<int> movementFrom, movementTo; // Approach, and arm left by
+    std::vector<int> phaseMovementStart, phaseMovements;
+    int queueIn[DIRECTION_COUNT], queueOut[DIRECTION_COUNT];
+
+    void findDetectors(const RoadGraph& graph, const NetIntersection& in);
+    // Snapshot of every approach and exit lane's length
+    void readQueues();
+    bool hasCall(int phase) const;
+    int pressure(int phase) const;
+    // Whether the adaptive policy ends the current green now
+    bool endGreen(int phase, int ms);
+    // Interval that follows the current one
+    int following();
+    // Length of the green just entered: the planned one, moved towards the
+    // offset by at most SIGNAL_MAX_OFFSET_STEP_MS
+    int offsetGreen(int durationMs);
+
+public:
+    // Compile the phases of `in`, reading detectors from `lanes` on
+    // `graph`. Without phases every direction with a stop line stays GREEN.
+    SignalPlan(const RoadNetwork& net, const RoadGraph& graph, LaneTable& lanes,
+               const NetIntersection& in);
+
+    void setPolicy(SignalPolicy p) { policy = p; }
+    SignalPolicy getPolicy() const { return policy; }
+
+    // Let `ms` pass. Returns true if the lights changed. The plan stands
+    // still while forced. Adaptive policies decide here, in O(movements).
+    bool advance(int ms);
+    // Advance to `clockMs` on the shared clock; the first call sets the
+    // plan's start
+    bool advanceTo(long long clockMs);
+
+    // New durations for phase `phase` (-1 keeps one), from the next time
+    // each interval starts. A clearance the plan was compiled without
+    // can't be added. Returns false, changing nothing, if they don't fit.
+    bool setTiming(int phase, int greenMs, int yellowMs, int allRedMs);
+    int getPhaseCount() const { return (int)phaseFirst.size(); }
+
+    // Coordinate the fixed plan: start phase 0's green `ms` into the cycle
+    // of the shared clock (-1: free running)
+    void setOffset(int ms) { offsetMs = ms; }
+    int getCycleMs() const { return cycleMs; }
+
+    // Time until the current interval ends at the latest (an adaptive
+    // green may end sooner)
+    int getRemainingMs() const { return remainingMs; }
+    // True while a phase's GREEN is running
+    bool inGreen() const { return current == phaseFirst[intervalPhase[current]]; }
+
+    // The lights now
+    const SignalInterval& now() const { return forced ? forcedInterval : intervals[current]; }
+
+    // Hold `greenDirections` GREEN and the rest RED until release(), then
+    // carry on where the plan was
+    void force(unsigned greenDirections);
+    void release();
+};
+
+const int LIGHT_BOARD_ALIGN = 64; // Cache line
+
+// Lights of one junction on the board, as its controller last published
+// them: one word holding a byte per direction in its low half and, in its
+// high half, how many times they were published. Only the junction's
+// controller writes it, so readers never lock. Each junction has its own
+// cache line, so publishing one doesn't slow readers of the next.
+struct alignas(LIGHT_BOARD_ALIGN) PublishedLights {
+    std::atomic<uint64_t> word;
+};
+static_assert(DIRECTION_COUNT <= 4, "A light board word holds four lights");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Readers in other processes must not lock");
+
+// The board, one entry per junction of roadNetwork() (all RED until
+// published). Mapped on first use: call it before forking to share it.
+PublishedLights* mapLightBoard();
+inline PublishedLights* roadLights() {
+    static PublishedLights* board = mapLightBoard();
+    return board;
+}
+void storeLights(int junction, const TrafficLightState* states);
+
+// The junction's lights: a single load
+inline uint64_t loadLights(int junction) {
+    return roadLights()[junction].word.load(std::memory_order_acquire);
+}
+inline TrafficLightState lightOf(uint64_t lights, Direction direction) {
+    return (TrafficLightState)((lights >> (8 * (int)direction)) & 0xff);
+}
+// Times published, to tell whether the lights changed since a load
+inline uint32_t lightSequence(uint64_t lights) { return (uint32_t)(lights >> 32); }
+inline TrafficLightState loadLight(int junction, Direction direction) {
+    return lightOf(loadLights(junction), direction);
+}
+
+// "fixed", "actuated" or "max-pressure"; false for anything else
+bool parseSignalPolicy(const char* name, SignalPolicy& policy);
+const char* signalPolicyName(SignalPolicy policy);
+
+// Plan of intersection `intersectionId` in roadNetwork(), under the policy
+// named by $TRAFFIC_SIGNAL_POLICY (fixed if unset); exits if the network
+// has no such intersection
+SignalPlan signalPlanFor(int intersectionId);
+
+#endif // SIGNALS_H
@@ -0,0 +1,138 @@
+/**
+ * simclock.cpp
+ *
+ * Simulated time as a linear function of CLOCK_MONOTONIC, rebased on
+ * every change.
+ */
+
+#include "simclock.h"
+#include "simulation_types.h"
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+SimClock::SimClock() : factor(1.0), paused(false), driven(false), adjusted(false) {
+    pthread_mutex_init(&mutex, nullptr);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&changed, &attr);
+    pthread_condattr_destroy(&attr);
+    baseRealNs = monotonicNs();
+    baseSimNs = baseRealNs;
+}
+
+SimClock::~SimClock() {
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+}
+
+uint64_t SimClock::nowLocked(uint64_t realNs) const {
+    if (paused || driven || realNs <= baseRealNs) return baseSimNs;
+    return baseSimNs + (uint64_t)((realNs - baseRealNs) * factor);
+}
+
+void SimClock::rebase() {
+    uint64_t realNs = monotonicNs();
+    baseSimNs = nowLocked(realNs);
+    baseRealNs = realNs;
+    adjusted.store(true, memory_order_release);
+}
+
+uint64_t SimClock::nowNs() {
+    if (!adjusted.load(memory_order_acquire)) return monotonicNs();
+    pthread_mutex_lock(&mutex);
+    uint64_t now = nowLocked(monotonicNs());
+    pthread_mutex_unlock(&mutex);
+    return now;
+}
+
+bool SimClock::isPaused() {
+    pthread_mutex_lock(&mutex);
+    bool p = paused;
+    pthread_mutex_unlock(&mutex);
+    return p;
+}
+
+void SimClock::setSpeed(double f) {
+    pthread_mutex_lock(&mutex);
+    rebase();
+    factor = max(SIM_MIN_SPEED, min(SIM_MAX_SPEED, f));
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimClock::pause() {
+    pthread_mutex_lock(&mutex);
+    rebase();
+    paused = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimClock::resume() {
+    pthread_mutex_lock(&mutex);
+    rebase();
+    paused = false;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+}
+
+bool SimClock::step(int ms) {
+    pthread_mutex_lock(&mutex);
+    bool ok = paused && ms > 0;
+    if (ok) {
+        baseSimNs += (uint64_t)ms * 1000000ull;
+        pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&mutex);
+    return ok;
+}
+
+int SimClock::realMsFor(int simMs, int pausedMs) {
+    if (!adjusted.load(memory_order_acquire)) return simMs;
+    pthread_mutex_lock(&mutex);
+    int ms = paused ? pausedMs : (int)ceil(simMs / factor);
+    pthread_mutex_unlock(&mutex);
+    return ms;
+}
+
+void SimClock::sleepMs(int simMs) {
+    if (!adjusted.load(memory_order_acquire)) {
+        usleep(simMs * 1000);
+        return;
+    }
+
+    pthread_mutex_lock(&mutex);
+    uint64_t targetNs = nowLocked(monotonicNs()) + (uint64_t)simMs * 1000000ull;
+    while (nowLocked(monotonicNs()) < targetNs) {
+        if (paused) {
+            pthread_cond_wait(&changed, &mutex);
+            continue;
+        }
+        // Real time at which the target comes, unless the clock changes
+        uint64_t wakeNs = baseRealNs + (uint64_t)((targetNs - baseSimNs) / factor);
+        struct timespec ts;
+        ts.tv_sec = wakeNs / 1000000000ull;
+        ts.tv_nsec = wakeNs % 1000000000ull;
+        pthread_cond_timedwait(&changed, &mutex, &ts);
+    }
+    pthread_mutex_unlock(&mutex);
+}
+
+void SimClock::drive(uint64_t simNs) {
+    pthread_mutex_lock(&mutex);
+    driven = true;
+    baseSimNs = simNs;
+    adjusted.store(true, memory_order_release);
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+}
+
+SimClock& simClock() {
+    static SimClock clock;
+    return clock;
+}
@@ -0,0 +1,67 @@
+/**
+ * simclock.h
+ *
+ * The controller process's simulated clock. It reads the same as
+ * monotonicNs() until a command pauses it, steps it or changes its speed,
+ * and every process gets the same commands, so it stays the corridors'
+ * shared clock. Vehicle threads sleep on it, so a pause stops them at
+ * their next step.
+ */
+
+#ifndef SIMCLOCK_H
+#define SIMCLOCK_H
+
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+const double SIM_MIN_SPEED = 0.01;
+const double SIM_MAX_SPEED = 100.0;
+
+class SimClock {
+private:
+    pthread_mutex_t mutex;
+    pthread_cond_t changed; // On CLOCK_MONOTONIC
+    uint64_t baseRealNs;    // Simulated time was baseSimNs then
+    uint64_t baseSimNs;
+    double factor;
+    bool paused;
+    bool driven;            // Reads baseSimNs only, as set by drive()
+    // Until the first command the clock is real time, and sleeping on it
+    // needs no lock
+    std::atomic<bool> adjusted;
+
+    uint64_t nowLocked(uint64_t realNs) const;
+    // Move the base to now before changing factor or paused
+    void rebase();
+
+public:
+    SimClock();
+    ~SimClock();
+
+    uint64_t nowNs();
+    bool isPaused();
+
+    // Simulated seconds per real second, within [SIM_MIN_SPEED, SIM_MAX_SPEED]
+    void setSpeed(double factor);
+    void pause();
+    void resume();
+    // While paused, let `ms` of simulated time pass at once; false if not paused
+    bool step(int ms);
+
+    // Real milliseconds until `simMs` from now have passed, for poll()
+    // timeouts; `pausedMs` while paused
+    int realMsFor(int simMs, int pausedMs);
+
+    // Sleep for `simMs` of simulated time, waiting out any pause
+    void sleepMs(int simMs);
+
+    // Stop following CLOCK_MONOTONIC and read `simNs` until the next
+    // call; a lockstep controller sets it to each tick
+    void drive(uint64_t simNs);
+};
+
+// The process's clock
+SimClock& simClock();
+
+#endif // SIMCLOCK_H
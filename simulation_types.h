@@ -43,17 +43,25 @@ enum class VehicleType {
     TRACTOR     // Low Priority - Grey
 };
 
+const int VEHICLE_TYPE_COUNT = 6;
+
 enum class TrafficLightState {
     RED,
-    GREEN
+    GREEN,
+    YELLOW  // Clearing: vehicles at the stop line wait
 };
 
+// Direction of travel through a junction. Each has its own signal, and a
+// trip enters its junction in one of them.
 enum class Direction {
-    NORTH_SOUTH,
-    EAST_WEST,
-    WEST_EAST
+    NORTH_SOUTH, // Towards +y (arriving from the north)
+    EAST_WEST,   // Towards -x
+    WEST_EAST,   // Towards +x
+    SOUTH_NORTH  // Towards -y
 };
 
+const int DIRECTION_COUNT = 4;
+
 enum class ScenarioCommand {
     NONE = 0,
     GREEN_WAVE = 1,      // Scenario A: Spawn ambulance, signal F11
@@ -61,6 +69,8 @@ enum class ScenarioCommand {
     GRIDLOCK = 3         // Scenario C: Spawn cars from all directions
 };
 
+const int SCENARIO_COUNT = 4;
+
 // ==========================================
 // Data Structures for IPC
 // ==========================================
@@ -82,7 +92,7 @@ struct VehicleState {
 // Structure for Traffic Light updates
 struct TrafficLightUpdate {
     int intersectionId; // 10 for F10, 11 for F11
-    TrafficLightState state;
+    TrafficLightState states[DIRECTION_COUNT]; // Indexed by Direction
 };
 
 // Parking update structure
@@ -95,6 +105,7 @@ struct ParkingUpdate {
 struct PipeMessage {
     uint32_t magic;
     enum Type { VEHICLE_UPDATE, LIGHT_UPDATE, PARKING_UPDATE } type;
+    uint64_t timestampNs; // monotonicNs() when the producer wrote it
     
     union {
         VehicleState vehicle;
@@ -103,27 +114,135 @@ struct PipeMessage {
     } data;
 };
 
-// Coordination message between F10 <-> F11
+// Junctions an emergency preemption request can reach
+const int PREEMPT_MAX_HOPS = 8;
+
+// One junction on an emergency vehicle's route
+struct PreemptHop {
+    int intersectionId;
+    Direction direction; // Approach the vehicle arrives on
+    uint64_t arrivalNs;  // Expected at the stop line, on the shared clock
+};
+
+// Coordination message between neighbouring controllers: a preemption
+// request relayed along the vehicle's route, hops[hop] being the
+// receiver's. Small enough for one atomic pipe write.
 struct CoordinationMessage {
     enum Type { EMERGENCY_APPROACHING, CLEAR_INTERSECTION } type;
-    int sourceIntersection;
+    int sourceIntersection; // Sender of this hop
+    int vehicleId;
+    int hop;
+    int hopCount;
+    uint64_t requestNs;     // When the vehicle's own intersection sent it
+    PreemptHop hops[PREEMPT_MAX_HOPS];
 };
 
-// Command message from Parent to Controllers
-struct CommandMessage {
-    uint32_t magic;
-    ScenarioCommand command;
+// Commands to the controllers (protocol v2). Each is a CommandHeader
+// followed by `length` bytes of the parameters of its type. A receiver
+// zero-fills parameters a shorter (older) payload lacks, ignores bytes
+// past the ones it knows, and skips types and versions it doesn't know.
+const uint16_t CMD_PROTOCOL_VERSION = 2;
+const int CMD_ALL_INTERSECTIONS = -1;
+const uint32_t CMD_MAX_PAYLOAD = 64;
+
+enum class CommandType : uint16_t {
+    SCENARIO = 1,         // ScenarioParams
+    SPAWN,                // SpawnParams
+    SET_SIGNAL_TIMING,    // SignalTimingParams
+    SET_PARKING_CAPACITY, // ParkingCapacityParams
+    PAUSE,                // No parameters
+    STEP,                 // StepParams; only while paused
+    RESUME,               // No parameters
+    SET_SPEED             // SpeedParams
+};
+
+struct CommandHeader {
+    uint32_t magic;    // CMD_MAGIC
+    uint16_t version;  // Sender's CMD_PROTOCOL_VERSION
+    uint16_t type;     // CommandType
+    int32_t targetId;  // Intersection id, or CMD_ALL_INTERSECTIONS
+    uint32_t length;   // Parameter bytes that follow, at most CMD_MAX_PAYLOAD
+};
+
+struct ScenarioParams {
+    int32_t scenario;  // ScenarioCommand
+};
+
+// `count` vehicles, `ratePerSecond` of them a second (0: as fast as the
+// controller starts them)
+struct SpawnParams {
+    int32_t spawnPoint; // Index into the controller's spawn points, or -1 for all in turn
+    uint32_t count;
+    int32_t mix;        // TypeMix
+    float ratePerSecond;
+};
+
+// Durations of one phase of the signal plan; -1 keeps one
+struct SignalTimingParams {
+    int32_t phase;
+    int32_t greenMs;
+    int32_t yellowMs;
+    int32_t allRedMs;
+};
+
+// Parking spots in use, at most PARKING_CAPACITY
+struct ParkingCapacityParams {
+    int32_t capacity;
+};
+
+struct StepParams {
+    int32_t ms; // Simulated time to run before pausing again
+};
+
+struct SpeedParams {
+    float factor; // Simulated seconds per real second
+};
+
+// One decoded command
+struct Command {
+    CommandHeader header;
+    union {
+        ScenarioParams scenario;
+        SpawnParams spawn;
+        SignalTimingParams timing;
+        ParkingCapacityParams parking;
+        StepParams step;
+        SpeedParams speed;
+        unsigned char bytes[CMD_MAX_PAYLOAD];
+    } params;
 };
 
 // ==========================================
 // Utility Functions
 // ==========================================
 
+#include "metrics.h"
 #include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 inline void setNonBlocking(int fd) {
     int flags = fcntl(fd, F_GETFL, 0);
     fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
+// CLOCK_MONOTONIC in nanoseconds; comparable across processes on one host
+inline uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Stamp and write one telemetry message, counting what was sent or lost
+inline void sendPipeMessage(int fd, PipeMessage& msg) {
+    msg.timestampNs = monotonicNs();
+    ssize_t n = write(fd, &msg, sizeof(msg));
+    if (n == (ssize_t)sizeof(msg)) {
+        metricAdd(Metric::PIPE_MESSAGES_SENT);
+        metricAdd(Metric::PIPE_BYTES_SENT, n);
+    } else {
+        metricAdd(Metric::PIPE_MESSAGES_DROPPED);
+    }
+}
+
 #endif // SIMULATION_TYPES_H
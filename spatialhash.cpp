@@ -0,0 +1,56 @@
+/**
+ * spatialhash.cpp
+ *
+ * Counting-sort rebuild and nearest-point query of SpatialHash.
+ */
+
+#include "spatialhash.h"
+#include <algorithm>
+
+using namespace std;
+
+SpatialHash::SpatialHash(float minX, float minY, float maxX, float maxY, float cellSize)
+    : originX(minX), originY(minY), cellSize(cellSize) {
+    cols = max(1, (int)ceil((maxX - minX) / cellSize));
+    rows = max(1, (int)ceil((maxY - minY) / cellSize));
+    cellStart.assign(cols * rows + 1, 0);
+}
+
+int SpatialHash::column(float x) const {
+    return min(max((int)floor((x - originX) / cellSize), 0), cols - 1);
+}
+
+int SpatialHash::row(float y) const {
+    return min(max((int)floor((y - originY) / cellSize), 0), rows - 1);
+}
+
+void SpatialHash::rebuild(const float* x, const float* y, int count) {
+    // Histogram of cell sizes, prefix sum, then scatter
+    pointCell.resize(count);
+    entries.resize(count);
+    fill(cellStart.begin(), cellStart.end(), 0);
+    for (int i = 0; i < count; ++i) {
+        pointCell[i] = row(y[i]) * cols + column(x[i]);
+        cellStart[pointCell[i] + 1]++;
+    }
+    for (int c = 0; c < cols * rows; ++c) cellStart[c + 1] += cellStart[c];
+
+    // cellStart[c] doubles as the fill cursor and is shifted back afterwards
+    for (int i = 0; i < count; ++i) entries[cellStart[pointCell[i]]++] = i;
+    for (int c = cols * rows; c > 0; --c) cellStart[c] = cellStart[c - 1];
+    cellStart[0] = 0;
+}
+
+int SpatialHash::nearest(const float* x, const float* y, float px, float py, float radius) const {
+    int best = -1;
+    float bestD2 = radius * radius;
+    forEachNear(px, py, radius, [&](int i) {
+        float dx = x[i] - px, dy = y[i] - py;
+        float d2 = dx * dx + dy * dy;
+        if (d2 <= bestD2) {
+            bestD2 = d2;
+            best = i;
+        }
+    });
+    return best;
+}
@@ -0,0 +1,98 @@
+/**
+ * spatialhash.h
+ *
+ * Uniform-grid spatial hash over a set of points, rebuilt from scratch by a
+ * counting sort on the cell index. Neighbour and all-pairs proximity
+ * queries then only look at adjacent cells, so they cost O(N) for evenly
+ * spread points instead of O(N^2).
+ */
+
+#ifndef SPATIALHASH_H
+#define SPATIALHASH_H
+
+#include <cmath>
+#include <vector>
+
+class SpatialHash {
+private:
+    float originX, originY;
+    float cellSize;
+    int cols, rows;
+    std::vector<int> cellStart; // cols * rows + 1 entries
+    std::vector<int> entries;   // Point indices grouped by cell
+    std::vector<int> pointCell;
+
+    // Points outside the bounds go to the nearest border cell
+    int column(float x) const;
+    int row(float y) const;
+
+public:
+    // Grid over [minX, maxX] x [minY, maxY] with square cells
+    SpatialHash(float minX, float minY, float maxX, float maxY, float cellSize);
+
+    // Index points 0 .. count - 1
+    void rebuild(const float* x, const float* y, int count);
+
+    // Call visit(i) for every point i in the cells within `radius` of
+    // (px, py). Candidates only: the caller checks the actual distance.
+    template <typename Visit>
+    void forEachNear(float px, float py, float radius, Visit visit) const;
+
+    // Call visit(i, j) once for every pair of points closer than `radius`,
+    // which must not exceed the cell size
+    template <typename Visit>
+    void forEachPair(const float* x, const float* y, float radius, Visit visit) const;
+
+    // Point nearest to (px, py) within `radius`, or -1
+    int nearest(const float* x, const float* y, float px, float py, float radius) const;
+};
+
+template <typename Visit>
+void SpatialHash::forEachNear(float px, float py, float radius, Visit visit) const {
+    int c0 = column(px - radius), c1 = column(px + radius);
+    int r0 = row(py - radius), r1 = row(py + radius);
+    for (int r = r0; r <= r1; ++r) {
+        for (int c = c0; c <= c1; ++c) {
+            int cell = r * cols + c;
+            for (int k = cellStart[cell]; k < cellStart[cell + 1]; ++k) visit(entries[k]);
+        }
+    }
+}
+
+template <typename Visit>
+void SpatialHash::forEachPair(const float* x, const float* y, float radius, Visit visit) const {
+    float r2 = radius * radius;
+    // Each cell is paired with itself and its E, SW, S and SE neighbours,
+    // so every adjacent pair of cells is looked at exactly once
+    static const int OFFSETS[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            int cell = r * cols + c;
+            int begin = cellStart[cell], end = cellStart[cell + 1];
+            for (int a = begin; a < end; ++a) {
+                int i = entries[a];
+                for (int b = a + 1; b < end; ++b) {
+                    int j = entries[b];
+                    float dx = x[j] - x[i], dy = y[j] - y[i];
+                    if (dx * dx + dy * dy < r2) visit(i, j);
+                }
+            }
+            if (begin == end) continue;
+            for (const auto& o : OFFSETS) {
+                int nc = c + o[0], nr = r + o[1];
+                if (nc < 0 || nc >= cols || nr >= rows) continue;
+                int other = nr * cols + nc;
+                for (int a = begin; a < end; ++a) {
+                    int i = entries[a];
+                    for (int b = cellStart[other]; b < cellStart[other + 1]; ++b) {
+                        int j = entries[b];
+                        float dx = x[j] - x[i], dy = y[j] - y[i];
+                        if (dx * dx + dy * dy < r2) visit(i, j);
+                    }
+                }
+            }
+        }
+    }
+}
+
+#endif // SPATIALHASH_H
@@ -0,0 +1,75 @@
+/**
+ * spawner.cpp
+ *
+ * The spawn scheduler's heap of batch cursors.
+ */
+
+#include "spawner.h"
+#include <algorithm>
+
+using namespace std;
+
+VehicleType pickType(TypeMix mix, uint64_t bits) {
+    switch (mix) {
+        case TypeMix::ANY:          return (VehicleType)(bits % VEHICLE_TYPE_COUNT);
+        case TypeMix::CAR_OR_BIKE:  return (bits % 2 == 0) ? VehicleType::CAR : VehicleType::BIKE;
+        case TypeMix::NO_EMERGENCY: return (VehicleType)(bits % 4 + 2);
+        case TypeMix::CAR:          return VehicleType::CAR;
+        case TypeMix::AMBULANCE:    return VehicleType::AMBULANCE;
+    }
+    return VehicleType::CAR;
+}
+
+SpawnScheduler::SpawnScheduler(uint64_t seed, int controller)
+    : pendingCount(0), seed(seed), controller(controller), injected(0) {}
+
+bool SpawnScheduler::nextBatch(Stream& s) {
+    while (s.batch < (int)s.batches.size() && s.batches[s.batch].count <= 0) s.batch++;
+    if (s.batch == (int)s.batches.size()) return false;
+    s.left = s.batches[s.batch].count;
+    return true;
+}
+
+void SpawnScheduler::inject(const vector<SpawnBatch>& batches, uint64_t nowNs) {
+    Stream s;
+    s.batches = batches;
+    s.batch = 0;
+    s.dueNs = nowNs;
+    s.id = injected++;
+    s.draws = 0;
+    if (!nextBatch(s)) return;
+    for (const SpawnBatch& b : batches) pendingCount += max(b.count, 0);
+    streams.push_back(move(s));
+    push_heap(streams.begin(), streams.end(), laterDue);
+}
+
+bool SpawnScheduler::pop(uint64_t nowNs, SpawnEvent& event) {
+    if (streams.empty() || streams.front().dueNs > nowNs) return false;
+
+    pop_heap(streams.begin(), streams.end(), laterDue);
+    Stream& s = streams.back();
+    const SpawnBatch& b = s.batches[s.batch];
+    event.spawnPoint = b.spawnPoint;
+    event.mix = b.mix;
+    pendingCount--;
+
+    int delayMs = b.intervalMs;
+    if (b.jitterMs > 0) {
+        RandomKey key = {seed, (uint32_t)controller, RandomKind::SPAWN_JITTER, s.id};
+        delayMs += (int)(randomBits(key, s.draws++) % b.jitterMs);
+    }
+    s.dueNs += (uint64_t)delayMs * 1000000ull;
+    if (--s.left == 0) {
+        s.batch++;
+        if (!nextBatch(s)) {
+            streams.pop_back();
+            return true;
+        }
+    }
+    push_heap(streams.begin(), streams.end(), laterDue);
+    return true;
+}
+
+uint64_t SpawnScheduler::nextEventNs() const {
+    return streams.empty() ? UINT64_MAX : streams.front().dueNs;
+}
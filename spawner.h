@@ -0,0 +1,92 @@
+/**
+ * spawner.h
+ *
+ * Timed vehicle injection. A scenario's spawn batches are queued with the
+ * time they were asked for, and the controller loop takes whatever is due
+ * between light updates, so injecting vehicles never holds up the signal
+ * timing. A queued command costs the same however many vehicles it
+ * brings: each batch is a cursor that yields its vehicles one by one.
+ */
+
+#ifndef SPAWNER_H
+#define SPAWNER_H
+
+#include "simulation_types.h"
+#include "rng.h"
+#include <cstdint>
+#include <vector>
+
+// Vehicle types a spawn batch draws from
+enum class TypeMix {
+    ANY,          // Any of the six types
+    CAR_OR_BIKE,  // Parking candidates only
+    NO_EMERGENCY, // BUS, CAR, BIKE or TRACTOR
+    CAR,
+    AMBULANCE
+};
+
+// `count` vehicles from one spawn point, intervalMs apart plus up to
+// jitterMs of random extra delay
+struct SpawnBatch {
+    int spawnPoint;
+    int count;
+    TypeMix mix;
+    int intervalMs;
+    int jitterMs;
+};
+
+// One vehicle due to enter
+struct SpawnEvent {
+    int spawnPoint;
+    TypeMix mix;
+};
+
+// Most vehicles a controller starts per pass of its loop; the rest wait
+// for the next pass, which comes at once
+const int SPAWN_DRAIN_MAX = 64;
+
+// A type from `mix`, chosen by 64 random bits
+VehicleType pickType(TypeMix mix, uint64_t bits);
+
+class SpawnScheduler {
+private:
+    // The batches of one command, played one after the other
+    struct Stream {
+        std::vector<SpawnBatch> batches;
+        int batch;      // Current batch
+        int left;       // Vehicles it still has to spawn
+        uint64_t dueNs; // When the next one enters
+        uint32_t id;    // Injection number, keying its jitter draws
+        uint32_t draws;
+    };
+    std::vector<Stream> streams; // Min-heap on dueNs
+    long long pendingCount;
+    uint64_t seed;
+    int controller;
+    uint32_t injected;
+
+    // Skip to the next batch that has vehicles; false if none is left
+    static bool nextBatch(Stream& s);
+    // Orders the heap so the earliest stream is on top
+    static bool laterDue(const Stream& a, const Stream& b) { return a.dueNs > b.dueNs; }
+
+public:
+    // Jitter is drawn from streams keyed by `seed`, `controller` and the
+    // order of injection, so the same commands give the same timing
+    SpawnScheduler(uint64_t seed, int controller);
+
+    // Queue `batches` to start at `nowNs`, each after the previous one's
+    // last vehicle and its interval. Constant time in the vehicle count.
+    void inject(const std::vector<SpawnBatch>& batches, uint64_t nowNs);
+
+    // The earliest vehicle due at `nowNs`; false if none is
+    bool pop(uint64_t nowNs, SpawnEvent& event);
+
+    // When the next vehicle is due, or UINT64_MAX
+    uint64_t nextEventNs() const;
+
+    // Vehicles queued and not yet popped
+    long long pending() const { return pendingCount; }
+};
+
+#endif // SPAWNER_H
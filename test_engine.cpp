@@ -0,0 +1,105 @@
+/**
+ * test_engine.cpp
+ *
+ * Checks that SimWorld runs the process-wide car following once a tick,
+ * however many engines it steps: a vehicle's speed must not depend on how
+ * many other engines share its world. Also checks that the lanes are
+ * batched only while a world lives. Exits non-zero on failure.
+ *
+ * Usage: ./test_engine   (from the directory holding road_network.txt)
+ */
+
+#include "engine.h"
+#include "lanes.h"
+
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+
+using namespace std;
+
+const int TEST_TICKS = 300;
+const int TEST_CARS = 6;
+
+// Summed speed of a platoon of cars from F10's local spawn after each
+// tick, in a world of F10 alone or of F10 and an idle F11. The followers'
+// speeds come from car following, which a second update in a tick
+// changes. Each run gets its own process, so the lanes, lights and
+// corridors start afresh.
+static vector<float> platoonSpeeds(bool withNeighbour) {
+    vector<float> velocities(TEST_TICKS, -1.0f);
+    int resultPipe[2];
+    if (pipe(resultPipe) == -1) {
+        perror("Pipe creation failed");
+        return velocities;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(resultPipe[0]);
+        int sink = open("/dev/null", O_WRONLY);
+        SimEngine f10(10, sink, 0);
+        SimEngine f11(11, sink, 1000);
+        SimWorld world;
+        world.add(&f10);
+        if (withNeighbour) world.add(&f11);
+
+        TripPlan plan = tripPlanFor("f10_local");
+        for (int i = 0; i < TEST_CARS; ++i) f10.spawn(VehicleType::CAR, plan, false);
+        vector<float> out(TEST_TICKS);
+        for (int t = 0; t < TEST_TICKS; ++t) {
+            world.tick();
+            out[t] = 0;
+            for (int i = 0; i < f10.getActiveCount(); ++i) out[t] += f10.getVehicle(i)->velocity;
+        }
+        write(resultPipe[1], out.data(), out.size() * sizeof(float));
+        close(resultPipe[1]);
+        _exit(0);
+    }
+
+    close(resultPipe[1]);
+    read(resultPipe[0], velocities.data(), velocities.size() * sizeof(float));
+    close(resultPipe[0]);
+    waitpid(pid, nullptr, 0);
+    return velocities;
+}
+
+// Batched lanes skip follow()'s lock, so only a world may set them, and
+// only until it goes: a threaded controller in the same process must not
+// find them batched
+static bool batchedOnlyWhileWorldLives() {
+    int sink = open("/dev/null", O_WRONLY);
+    SimEngine f10(10, sink, 0);
+    bool ok = !roadLanes().batched;
+    {
+        SimWorld world;
+        world.add(&f10);
+        world.tick();
+        ok = ok && roadLanes().batched;
+    }
+    ok = ok && !roadLanes().batched;
+    close(sink);
+    return ok;
+}
+
+int main() {
+    vector<float> alone = platoonSpeeds(false);
+    vector<float> shared = platoonSpeeds(true);
+
+    int failures = 0;
+    for (int t = 0; t < TEST_TICKS; ++t) {
+        if (alone[t] != shared[t]) {
+            printf("FAIL tick %d: platoon speed %.3f alone, %.3f beside a second engine\n", t, alone[t], shared[t]);
+            failures++;
+            break;
+        }
+    }
+    printf("%s: one car following update per tick with 1 and 2 engines\n", failures == 0 ? "PASS" : "FAIL");
+
+    bool batched = batchedOnlyWhileWorldLives();
+    printf("%s: lanes batched only while a world steps them\n", batched ? "PASS" : "FAIL");
+    if (!batched) failures++;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+/**
+ * trace.cpp
+ * 
+ * Per-thread trace buffers and Chrome trace JSON output.
+ */
+
+#include "trace.h"
+#include "simulation_types.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+bool traceEnabled = false;
+
+struct TraceEvent {
+    uint64_t timestampNs;
+    const char* name;
+    const char* category;
+    int id;
+    char phase;
+};
+
+const int TRACE_CHUNK_EVENTS = 256;
+
+// Fixed-size block of events. Only the owning thread writes; the flusher
+// reads up to `count`, which the owner publishes with a release store.
+struct TraceChunk {
+    TraceEvent events[TRACE_CHUNK_EVENTS];
+    atomic<int> count;
+    atomic<TraceChunk*> next;
+
+    TraceChunk() : count(0), next(nullptr) {}
+};
+
+struct TraceBuffer {
+    int tid;
+    TraceChunk* tail;     // Owner's write position
+    TraceChunk* head;     // Flusher's read position
+    int headFlushed;      // Events of `head` already written out
+};
+
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static vector<TraceBuffer*> registry;
+static vector<TraceBuffer*> spareBuffers; // Of exited threads, drained
+static FILE* traceFile = nullptr;
+static bool firstEvent = true;
+static int processId = 0;
+
+static void retireThread(TraceBuffer* buf);
+
+// Hands the thread's buffer back when the thread exits, so a process that
+// starts a thread per vehicle keeps as many buffers as it has threads
+struct TraceThread {
+    TraceBuffer* buffer = nullptr;
+    ~TraceThread() {
+        if (buffer != nullptr) retireThread(buffer);
+    }
+};
+
+static thread_local TraceThread localThread;
+
+static TraceBuffer* registerThread() {
+    pthread_mutex_lock(&registryLock);
+    TraceBuffer* buf;
+    if (!spareBuffers.empty()) {
+        buf = spareBuffers.back();
+        spareBuffers.pop_back();
+    } else {
+        buf = new TraceBuffer();
+        buf->tail = new TraceChunk();
+        buf->head = buf->tail;
+        buf->headFlushed = 0;
+    }
+    buf->tid = (int)syscall(SYS_gettid);
+    registry.push_back(buf);
+    pthread_mutex_unlock(&registryLock);
+    return buf;
+}
+
+void traceRecord(char phase, const char* name, const char* category, int id) {
+    TraceBuffer* buf = localThread.buffer;
+    if (buf == nullptr) {
+        buf = localThread.buffer = registerThread();
+    }
+
+    TraceChunk* chunk = buf->tail;
+    int n = chunk->count.load(memory_order_relaxed);
+    if (n == TRACE_CHUNK_EVENTS) {
+        TraceChunk* fresh = new TraceChunk();
+        chunk->next.store(fresh, memory_order_release);
+        buf->tail = chunk = fresh;
+        n = 0;
+    }
+
+    TraceEvent& ev = chunk->events[n];
+    ev.timestampNs = monotonicNs();
+    ev.name = name;
+    ev.category = category;
+    ev.id = id;
+    ev.phase = phase;
+    chunk->count.store(n + 1, memory_order_release);
+}
+
+void traceInit(const char* role) {
+    const char* prefix = getenv("TRAFFIC_TRACE");
+    if (prefix == nullptr || prefix[0] == '\0') return;
+
+    string path = string(prefix) + "." + role + ".json";
+    traceFile = fopen(path.c_str(), "w");
+    if (traceFile == nullptr) {
+        perror("Trace file open failed");
+        return;
+    }
+    processId = (int)getpid();
+    // JSON array format: the closing ']' is optional, so a process killed
+    // between flushes still leaves a loadable trace
+    fprintf(traceFile, "[\n");
+    fprintf(traceFile,
+            "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"%s\"}}",
+            processId, role);
+    firstEvent = false;
+    traceEnabled = true;
+}
+
+static void writeEvent(const TraceEvent& ev, int tid) {
+    fprintf(traceFile, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, "
+            "\"pid\": %d, \"tid\": %d",
+            firstEvent ? "" : ",\n", ev.name, ev.category, ev.phase,
+            ev.timestampNs / 1000.0, processId, tid);
+    if (ev.phase == 'b' || ev.phase == 'e') {
+        fprintf(traceFile, ", \"id\": %d", ev.id);
+    } else if (ev.phase == 'i') {
+        fprintf(traceFile, ", \"s\": \"p\", \"args\": {\"id\": %d}", ev.id);
+    }
+    fprintf(traceFile, "}");
+    firstEvent = false;
+}
+
+// Write out (if a trace is open) and free what `buf` holds up to the
+// owner's last published event. Registry lock held.
+static void drainBuffer(TraceBuffer* buf) {
+    while (true) {
+        TraceChunk* chunk = buf->head;
+        int n = chunk->count.load(memory_order_acquire);
+        if (traceFile != nullptr) {
+            for (int i = buf->headFlushed; i < n; ++i) {
+                writeEvent(chunk->events[i], buf->tid);
+            }
+        }
+        buf->headFlushed = n;
+
+        // The owner has moved past a full chunk once `next` is set
+        TraceChunk* next = chunk->next.load(memory_order_acquire);
+        if (n < TRACE_CHUNK_EVENTS || next == nullptr) break;
+        buf->head = next;
+        buf->headFlushed = 0;
+        delete chunk;
+    }
+}
+
+// Drain an exiting thread's buffer and keep it, emptied, for the next
+// thread to register
+static void retireThread(TraceBuffer* buf) {
+    pthread_mutex_lock(&registryLock);
+    drainBuffer(buf);
+    TraceChunk* chunk = buf->head;
+    chunk->count.store(0, memory_order_relaxed);
+    chunk->next.store(nullptr, memory_order_relaxed);
+    buf->tail = chunk;
+    buf->headFlushed = 0;
+    for (size_t i = 0; i < registry.size(); ++i) {
+        if (registry[i] != buf) continue;
+        registry[i] = registry.back();
+        registry.pop_back();
+        break;
+    }
+    spareBuffers.push_back(buf);
+    pthread_mutex_unlock(&registryLock);
+}
+
+void traceFlush() {
+    if (traceFile == nullptr) return;
+
+    pthread_mutex_lock(&registryLock);
+    for (TraceBuffer* buf : registry) drainBuffer(buf);
+    pthread_mutex_unlock(&registryLock);
+    fflush(traceFile);
+}
+
+void traceShutdown() {
+    if (traceFile == nullptr) return;
+    traceFlush();
+    fprintf(traceFile, "\n]\n");
+    fclose(traceFile);
+    traceFile = nullptr;
+    traceEnabled = false;
+}
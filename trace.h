@@ -0,0 +1,67 @@
+/**
+ * trace.h
+ * 
+ * Chrome/Perfetto trace-event recording. Events go into per-thread
+ * lock-free buffers and are appended to a JSON trace file by traceFlush(),
+ * or when their thread exits and its buffer goes back for reuse.
+ * Set TRAFFIC_TRACE=<prefix> to write <prefix>.<role>.json per process.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "simulation_types.h"
+#include <cstdint>
+
+// True once traceInit() opened a trace file. Every recording call checks
+// this first, so tracing costs a single predictable branch when disabled.
+extern bool traceEnabled;
+
+// Slow path, only reached when tracing is enabled
+void traceRecord(char phase, const char* name, const char* category, int id);
+
+// Open the trace file for this process if TRAFFIC_TRACE is set
+void traceInit(const char* role);
+
+// Append everything recorded since the last flush to the trace file
+void traceFlush();
+
+// Final flush; closes the JSON array and the file
+void traceShutdown();
+
+// Names and categories must be string literals: only the pointer is stored.
+
+// Begin/end of a span on the calling thread's track (nests per thread)
+inline void traceBegin(const char* name, const char* category) {
+    if (__builtin_expect(traceEnabled, 0)) traceRecord('B', name, category, 0);
+}
+
+inline void traceEnd(const char* name, const char* category) {
+    if (__builtin_expect(traceEnabled, 0)) traceRecord('E', name, category, 0);
+}
+
+// Begin/end of a span keyed by id, e.g. a vehicle or intersection, which
+// may begin and end on different threads or interleave on one thread
+inline void traceAsyncBegin(const char* name, const char* category, int id) {
+    if (__builtin_expect(traceEnabled, 0)) traceRecord('b', name, category, id);
+}
+
+inline void traceAsyncEnd(const char* name, const char* category, int id) {
+    if (__builtin_expect(traceEnabled, 0)) traceRecord('e', name, category, id);
+}
+
+// Point-in-time event
+inline void traceInstant(const char* name, const char* category, int id) {
+    if (__builtin_expect(traceEnabled, 0)) traceRecord('i', name, category, id);
+}
+
+// A light change ends the span of the old interval and begins the new one
+// (names are static strings such as "GREEN" or "ALL_RED")
+inline void traceLightChange(int intersectionId, const char* from, const char* to) {
+    if (__builtin_expect(traceEnabled, 0)) {
+        traceRecord('e', from, "light", intersectionId);
+        traceRecord('b', to, "light", intersectionId);
+    }
+}
+
+#endif // TRACE_H
@@ -0,0 +1,140 @@
+/**
+ * traffic_cmd.cpp
+ *
+ * Writes one controller command frame (protocol v2) to stdout, for load
+ * tests to drive a running simulation through its $TRAFFIC_COMMANDS FIFO:
+ *
+ *   mkfifo /tmp/traffic.fifo
+ *   TRAFFIC_COMMANDS=/tmp/traffic.fifo ./traffic_sim &
+ *   ./traffic_cmd spawn 20000 --rate 500 > /tmp/traffic.fifo
+ *
+ * Usage: ./traffic_cmd [--to ID] COMMAND
+ *   scenario green-wave|parking-full|gridlock
+ *   spawn COUNT [--point N] [--mix any|car-or-bike|no-emergency|car|ambulance]
+ *               [--rate PER_SECOND]
+ *   timing PHASE GREEN_MS YELLOW_MS ALL_RED_MS   (-1 keeps one)
+ *   parking CAPACITY                             (0 to PARKING_CAPACITY)
+ *   pause | resume | step MS | speed FACTOR
+ *
+ * Without --to a command goes to every controller. A spawn's COUNT and
+ * rate are then the totals, split between the controllers; --point, an
+ * index into one controller's spawn points, needs --to.
+ */
+
+#include "simulation_types.h"
+#include "command.h"
+#include "spawner.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+static bool parseScenario(const string& name, int& scenario) {
+    if (name == "green-wave") scenario = (int)ScenarioCommand::GREEN_WAVE;
+    else if (name == "parking-full") scenario = (int)ScenarioCommand::PARKING_FULL;
+    else if (name == "gridlock") scenario = (int)ScenarioCommand::GRIDLOCK;
+    else return false;
+    return true;
+}
+
+static bool parseMix(const string& name, int& mix) {
+    if (name == "any") mix = (int)TypeMix::ANY;
+    else if (name == "car-or-bike") mix = (int)TypeMix::CAR_OR_BIKE;
+    else if (name == "no-emergency") mix = (int)TypeMix::NO_EMERGENCY;
+    else if (name == "car") mix = (int)TypeMix::CAR;
+    else if (name == "ambulance") mix = (int)TypeMix::AMBULANCE;
+    else return false;
+    return true;
+}
+
+// Build the command in argv[i..]; false on anything unexpected
+static bool parseCommand(int argc, char** argv, int i, int targetId, Command& cmd) {
+    if (i >= argc) return false;
+    string name = argv[i++];
+    int left = argc - i;
+
+    if (name == "scenario" && left == 1) {
+        cmd = makeCommand(CommandType::SCENARIO, targetId);
+        return parseScenario(argv[i], cmd.params.scenario.scenario);
+    }
+    if (name == "spawn" && left >= 1) {
+        cmd = makeCommand(CommandType::SPAWN, targetId);
+        SpawnParams& p = cmd.params.spawn;
+        long count = atol(argv[i++]);
+        if (count <= 0) return false;
+        p.count = (uint32_t)count;
+        p.spawnPoint = -1;
+        p.mix = (int)TypeMix::NO_EMERGENCY;
+        p.ratePerSecond = 0;
+        for (; i + 1 < argc; i += 2) {
+            string option = argv[i];
+            if (option == "--point") p.spawnPoint = atoi(argv[i + 1]);
+            else if (option == "--rate") p.ratePerSecond = atof(argv[i + 1]);
+            else if (option != "--mix" || !parseMix(argv[i + 1], p.mix)) return false;
+        }
+        return i == argc && (p.spawnPoint == -1 || targetId != CMD_ALL_INTERSECTIONS);
+    }
+    if (name == "timing" && left == 4) {
+        cmd = makeCommand(CommandType::SET_SIGNAL_TIMING, targetId);
+        cmd.params.timing.phase = atoi(argv[i]);
+        cmd.params.timing.greenMs = atoi(argv[i + 1]);
+        cmd.params.timing.yellowMs = atoi(argv[i + 2]);
+        cmd.params.timing.allRedMs = atoi(argv[i + 3]);
+        return true;
+    }
+    if (name == "parking" && left == 1) {
+        cmd = makeCommand(CommandType::SET_PARKING_CAPACITY, targetId);
+        cmd.params.parking.capacity = atoi(argv[i]);
+        return true;
+    }
+    if (name == "pause" && left == 0) {
+        cmd = makeCommand(CommandType::PAUSE, targetId);
+        return true;
+    }
+    if (name == "resume" && left == 0) {
+        cmd = makeCommand(CommandType::RESUME, targetId);
+        return true;
+    }
+    if (name == "step" && left == 1) {
+        cmd = makeCommand(CommandType::STEP, targetId);
+        cmd.params.step.ms = atoi(argv[i]);
+        return cmd.params.step.ms > 0;
+    }
+    if (name == "speed" && left == 1) {
+        cmd = makeCommand(CommandType::SET_SPEED, targetId);
+        cmd.params.speed.factor = atof(argv[i]);
+        return cmd.params.speed.factor > 0;
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    int i = 1;
+    int targetId = CMD_ALL_INTERSECTIONS;
+    if (i + 1 < argc && string(argv[i]) == "--to") {
+        targetId = atoi(argv[i + 1]);
+        i += 2;
+    }
+
+    Command cmd;
+    if (!parseCommand(argc, argv, i, targetId, cmd)) {
+        cerr << "Usage: " << argv[0] << " [--to ID] COMMAND" << endl
+             << "  scenario green-wave|parking-full|gridlock" << endl
+             << "  spawn COUNT [--point N] [--mix any|car-or-bike|no-emergency|car|ambulance]"
+             << " [--rate PER_SECOND]" << endl
+             << "  timing PHASE GREEN_MS YELLOW_MS ALL_RED_MS" << endl
+             << "  parking CAPACITY" << endl
+             << "  pause | resume | step MS | speed FACTOR" << endl
+             << "Without --to, spawn's COUNT and rate are split between the controllers"
+             << " and --point is refused" << endl;
+        return 1;
+    }
+    if (!sendCommand(STDOUT_FILENO, cmd)) {
+        perror("Command write failed");
+        return 1;
+    }
+    return 0;
+}
@@ -5,19 +5,32 @@
  */
 
 #include "vehicle.h"
+#include "trace.h"
+#include "metrics.h"
+#include "routing.h"
+#include "lanes.h"
+#include "signals.h"
+#include "simclock.h"
+#include "migration.h"
 #include <unistd.h>
 #include <cmath>
 #include <cstdlib>
+#include <iostream>
+
+using namespace std;
 
 Vehicle::Vehicle(int id, VehicleType type, int pipeFd, ParkingLot* lot)
     : id(id), type(type), pipeFd(pipeFd), parkingLot(lot), active(true),
-      isInQueue(false), queueIndex(-1), isLeftParking(false) {
+      isInQueue(false), queueIndex(-1), isLeftParking(false), intersectionId(10),
+      phase(VehiclePhase::APPROACH_HOLD), spotIndex(-1), node(-1), edge(-1), offset(0), routePos(0),
+      clockMs(0), timedEdge(-1), timedSinceMs(0), releasedMs(-1), lane(-1), laneIndex(-1) {
     speed = 2.0f;
     if (type == VehicleType::AMBULANCE || type == VehicleType::FIRETRUCK) {
         speed = 4.0f;
     } else if (type == VehicleType::TRACTOR) {
         speed = 1.0f;
     }
+    velocity = speed; // Arrives from off the map at full speed
     x = 0;
     y = 0;
 }
@@ -53,16 +66,16 @@ void Vehicle::sendUpdate(bool parked) {
     msg.data.vehicle.colorG = g;
     msg.data.vehicle.colorB = b;
 
-    write(pipeFd, &msg, sizeof(msg));
+    sendPipeMessage(pipeFd, msg);
 
     // Also send parking queue update if this vehicle has a parking lot reference
     if (parkingLot != nullptr) {
         PipeMessage pMsg;
         pMsg.magic = MSG_MAGIC;
         pMsg.type = PipeMessage::PARKING_UPDATE;
-        pMsg.data.parking.intersectionId = isLeftParking ? 11 : 10;
+        pMsg.data.parking.intersectionId = intersectionId;
         pMsg.data.parking.waitingCount = parkingLot->getWaitingCount();
-        write(pipeFd, &pMsg, sizeof(pMsg));
+        sendPipeMessage(pipeFd, pMsg);
     }
 }
 
@@ -83,402 +96,385 @@ bool moveTowards(float& currX, float& currY, float targetX, float targetY, float
     return false;
 }
 
-// Thread function for commuter vehicles (start at F11, want to park at F10)
-void* commuterThreadFunc(void* arg) {
-    ThreadArgs* args = (ThreadArgs*)arg;
-    Vehicle* v = args->vehicle;
-
-    float f11StopLine = 960.0f;
-    float f10StopLine = 360.0f;
-
-    // Phase 1: Drive to F11 stop line
-    while (!moveTowards(v->x, v->y, f11StopLine, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+// Light polling interval while held at a stop line
+const int LIGHT_POLL_MS = 100;
+
+TripPlan compileTripPlan(const RoadNetwork& net, const RoadGraph& graph, const NetSpawn& spawn) {
+    const NetIntersection* in = net.findIntersection(spawn.intersectionId);
+    const NetLot* lot = net.findLot(spawn.intersectionId);
+
+    TripPlan p = TripPlan();
+    float x, y;
+    p.spawn = (int)(&spawn - net.spawns.data());
+    p.startNode = graph.findNode(spawn.x, spawn.y);
+    p.holdNode = -1;
+    p.holdJunction = -1;
+    if (spawn.holdIntersectionId != -1) {
+        stopLinePoint(*net.findIntersection(spawn.holdIntersectionId), spawn, x, y);
+        p.holdNode = graph.findNode(x, y);
+        p.holdJunction = net.intersectionIndex[spawn.holdIntersectionId];
     }
-
-    // Phase 2: Brief pause at F11
-    usleep(500000);
-
-    // Phase 3: Cross F11 and drive to F10
-    while (!moveTowards(v->x, v->y, f10StopLine, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
-    }
-
-    // Phase 4: Wait for F10's green light
-    while (true) {
-        pthread_mutex_lock(args->lightMutex);
-        TrafficLightState state = *(args->lightState);
-        pthread_mutex_unlock(args->lightMutex);
-
-        if (state == TrafficLightState::GREEN || 
-            v->type == VehicleType::AMBULANCE || 
-            v->type == VehicleType::FIRETRUCK) {
-            break;
-        }
-        v->sendUpdate();
-        usleep(100000);
-    }
-
-    // Phase 5: Try to park
-    bool willPark = (v->parkingLot != nullptr) && 
-                    (v->type == VehicleType::CAR || v->type == VehicleType::BIKE);
-
-    if (willPark) {
-        float queueX = 300.0f;
-        float queueY = 320.0f;
-        while (!moveTowards(v->x, v->y, queueX, queueY, v->speed)) {
-            v->sendUpdate();
-            usleep(VEHICLE_SPEED_MS * 1000);
+    stopLinePoint(*in, spawn, x, y);
+    p.stopNode = graph.findNode(x, y);
+    p.junction = net.intersectionIndex[spawn.intersectionId];
+    p.direction = spawn.direction;
+    p.endNode = graph.findNode(spawn.endX, spawn.endY);
+    p.reportWhileWaiting = spawn.reportWhileWaiting;
+
+    p.queueNode = -1;
+    p.exitNode = -1;
+    if (lot != nullptr) {
+        p.queueNode = graph.findNode(lot->queueX, lot->queueY);
+        p.exitNode = graph.findNode(lot->exitX, lot->exitY);
+        for (int q = 0; q < PARKING_QUEUE_SIZE; ++q) {
+            p.boxNodes[q] = graph.findNode(net.queueBoxX[lot->firstQueueBox + q], lot->queueBoxY);
         }
-
-        int queueIdx = v->parkingLot->enterQueue();
-
-        if (queueIdx != -1) {
-            v->isInQueue = true;
-            v->queueIndex = queueIdx;
-
-            float queueBoxX = 425.0f + queueIdx * 40.0f;
-            float queueBoxY = 325.0f;
-
-            while (!moveTowards(v->x, v->y, queueBoxX, queueBoxY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-            v->sendUpdate();
-
-            int spotIndex = v->parkingLot->waitForSpot(queueIdx);
-
-            v->isInQueue = false;
-            v->queueIndex = -1;
-
-            int row = spotIndex / 5;
-            int col = spotIndex % 5;
-            float parkX = 230.0f + col * 40.0f;
-            float parkY = 185.0f + row * 60.0f;
-
-            while (!moveTowards(v->x, v->y, parkX, parkY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-
-            v->sendUpdate(true);
-            sleep(PARKING_DURATION_SECONDS);
-
-            v->parkingLot->leave(spotIndex);
-
-            while (!moveTowards(v->x, v->y, 300.0f, 400.0f, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
+        for (int s = 0; s < PARKING_CAPACITY; ++s) {
+            p.spotNodes[s] = graph.findNode(net.spotX[lot->firstSpot + s], net.spotY[lot->firstSpot + s]);
         }
     }
+    return p;
+}
 
-    // Phase 6: Exit to the left
-    while (!moveTowards(v->x, v->y, 0.0f, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+TripPlan tripPlanFor(const char* spawnName) {
+    const RoadNetwork& net = roadNetwork();
+    const NetSpawn* spawn = net.findSpawn(spawnName);
+    if (spawn == nullptr) {
+        cerr << "Road network has no spawn point '" << spawnName << "'" << endl;
+        exit(1);
     }
-
-    v->active = false;
-    v->sendUpdate();
-
-    delete args;
-    return nullptr;
+    return compileTripPlan(net, roadGraph(), *spawn);
 }
 
-void* vehicleThreadFunc(void* arg) {
-    ThreadArgs* args = (ThreadArgs*)arg;
-    Vehicle* v = args->vehicle;
+int legTarget(const TripPlan& plan, const Vehicle* v) {
+    switch (v->phase) {
+        case VehiclePhase::APPROACH_HOLD: return plan.holdNode;
+        case VehiclePhase::APPROACH:      return plan.stopNode;
+        case VehiclePhase::TO_QUEUE:      return plan.queueNode;
+        case VehiclePhase::TO_QUEUE_BOX:  return plan.boxNodes[v->queueIndex];
+        case VehiclePhase::TO_SPOT:       return plan.spotNodes[v->spotIndex];
+        case VehiclePhase::EXIT_LOT:      return plan.exitNode;
+        case VehiclePhase::TO_END:        return plan.endNode;
+        default:                          return -1;
+    }
+}
 
-    float targetX = v->endX;
-    float targetY = v->endY;
-    float stopLineX = args->stopLineX;
+void placeAtStart(Vehicle* v, const TripPlan& plan) {
+    const RoadGraph& g = roadGraph();
+    v->node = plan.startNode;
+    v->edge = -1;
+    v->offset = 0;
+    v->x = g.nodeX[plan.startNode];
+    v->y = g.nodeY[plan.startNode];
+}
 
-    // Phase 1: Move to Stop Line
-    while (!moveTowards(v->x, v->y, stopLineX, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+// Close the timing of the previous edge. Time spent at its end node (a red
+// light) counts towards it.
+static void finishTimedEdge(Vehicle* v) {
+    if (v->timedEdge != -1) {
+        roadTravelTimes().record(v->timedEdge, (float)(v->clockMs - v->timedSinceMs));
     }
+    v->timedEdge = -1;
+}
 
-    // Phase 2: Check Light
-    while (true) {
-        pthread_mutex_lock(args->lightMutex);
-        TrafficLightState state = *(args->lightState);
-        pthread_mutex_unlock(args->lightMutex);
+// v has just moved onto route[routePos]
+static void enterEdge(Vehicle* v) {
+    roadLanes().enter(v, v->edge);
+    finishTimedEdge(v);
+    v->timedEdge = v->edge;
+    v->timedSinceMs = v->clockMs;
+
+    TravelTimes& times = roadTravelTimes();
+    if (times.delayAhead(v->route, v->routePos + 1, REROUTE_HORIZON_EDGES) > times.rerouteThresholdMs &&
+        times.takeReroute() &&
+        roadRouter().repairRoute(v->route, v->routePos, REROUTE_HORIZON_EDGES, times)) {
+        metricAdd(Metric::VEHICLES_REROUTED);
+    }
+}
 
-        if (state == TrafficLightState::GREEN || 
-            v->type == VehicleType::AMBULANCE || 
-            v->type == VehicleType::FIRETRUCK) {
-            break;
+bool advanceLeg(Vehicle* v, int target) {
+    const RoadGraph& g = roadGraph();
+    LaneTable& lanes = roadLanes();
+    if (v->edge == -1) {
+        if (v->node == target) return true;
+        if (!roadRouter().route(v->node, target, v->route)) {
+            cerr << "Road graph has no way from node " << v->node << " to " << target << endl;
+            exit(1);
         }
-        usleep(100000);
+        v->routePos = 0;
+        v->edge = v->route[0];
+        v->offset = 0;
+        enterEdge(v);
+        lanes.follow(v); // New lane, new leader
+    } else if (!lanes.batched) {
+        lanes.follow(v);
     }
 
-    // Phase 3: Cross Intersection or Park
-    bool willPark = (v->parkingLot != nullptr) && 
-                    (v->type == VehicleType::CAR || v->type == VehicleType::BIKE);
-
-    if (willPark) {
-        float queueX = 300.0f;
-        float queueY = 320.0f;
-        while (!moveTowards(v->x, v->y, queueX, queueY, v->speed)) {
-            v->sendUpdate();
-            usleep(VEHICLE_SPEED_MS * 1000);
+    float floor = v->offset; // Never move backwards on a lane
+    float next = v->offset + v->velocity;
+    while (next > g.edgeLength[v->edge]) {
+        // Crossed the end of the edge: arrive, or carry on along the next one
+        v->node = g.edgeTo[v->edge];
+        if (v->node == target) {
+            v->edge = -1;
+            v->offset = 0;
+            v->x = g.nodeX[target];
+            v->y = g.nodeY[target];
+            lanes.update(v);
+            return true;
         }
+        next -= g.edgeLength[v->edge];
+        v->edge = v->route[++v->routePos];
+        v->offset = next;
+        floor = 0;
+        enterEdge(v);
+    }
 
-        int queueIdx = v->parkingLot->enterQueue();
-
-        if (queueIdx != -1) {
-            v->isInQueue = true;
-            v->queueIndex = queueIdx;
-
-            float queueBoxX = 425.0f + queueIdx * 40.0f;
-            float queueBoxY = 325.0f;
-
-            while (!moveTowards(v->x, v->y, queueBoxX, queueBoxY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-            v->sendUpdate();
-
-            int spotIndex = v->parkingLot->waitForSpot(queueIdx);
-
-            v->isInQueue = false;
-            v->queueIndex = -1;
+    // Someone may have entered the lane ahead since the speed was set
+    float limit = lanes.maxOffset(v);
+    if (next > limit) next = max(limit, floor);
 
-            int row = spotIndex / 5;
-            int col = spotIndex % 5;
-            float parkX = 230.0f + col * 40.0f;
-            float parkY = 185.0f + row * 60.0f;
+    int e = v->edge;
+    v->offset = next;
+    v->x = g.edgeFromX[e] + g.edgeDirX[e] * next;
+    v->y = g.edgeFromY[e] + g.edgeDirY[e] * next;
+    lanes.update(v);
+    return false;
+}
 
-            while (!moveTowards(v->x, v->y, parkX, parkY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
+// v waits where it is; followers see it stopped
+static void holdStill(Vehicle* v) {
+    v->velocity = 0;
+    roadLanes().update(v);
+}
 
-            v->sendUpdate(true);
-            sleep(PARKING_DURATION_SECONDS);
+// Whether the vehicle at the stop line of `junction` may drive on towards
+// `next`: emergency vehicles always may, others need a GREEN light for
+// their direction or, under reservation control, the tiles of their whole
+// crossing
+static bool mayCross(ThreadArgs* args, int junction, int next) {
+    Vehicle* v = args->vehicle;
+    if (v->type == VehicleType::AMBULANCE || v->type == VehicleType::FIRETRUCK) return true;
+
+    if (args->reservations != nullptr) {
+        // The leg's route, as advanceLeg() will take it from the cache
+        if (!roadRouter().route(v->node, next, v->route)) return true;
+        bool granted = args->reservations->request(junction, v->id, v->route,
+                                                   v->velocity, v->speed);
+        metricAdd(granted ? Metric::RESERVATIONS_GRANTED : Metric::RESERVATIONS_REJECTED);
+        return granted;
+    }
 
-            v->parkingLot->leave(spotIndex);
+    return loadLight(junction, args->plan.direction) == TrafficLightState::GREEN;
+}
 
-            while (!moveTowards(v->x, v->y, 300.0f, 400.0f, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-        }
+// Count an arrival at the stop line of `junction`, and whether the light
+// was GREEN for it
+static void recordArrival(ThreadArgs* args, int junction) {
+    metricAdd(Metric::STOP_LINE_ARRIVALS);
+    if (loadLight(junction, args->plan.direction) == TrafficLightState::GREEN) {
+        metricAdd(Metric::ARRIVALS_ON_GREEN);
     }
+}
 
-    // Phase 4: Move to End
-    while (!moveTowards(v->x, v->y, targetX, targetY, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+// Trace span a phase belongs to: approach, wait_light, queue, park or exit
+const char* phaseSpanName(VehiclePhase phase) {
+    switch (phase) {
+        case VehiclePhase::APPROACH_HOLD:
+        case VehiclePhase::HOLD:
+        case VehiclePhase::APPROACH:     return "approach";
+        case VehiclePhase::WAIT_LIGHT:   return "wait_light";
+        case VehiclePhase::TO_QUEUE:
+        case VehiclePhase::TO_QUEUE_BOX:
+        case VehiclePhase::WAIT_SPOT:    return "queue";
+        case VehiclePhase::TO_SPOT:
+        case VehiclePhase::PARKED:       return "park";
+        case VehiclePhase::EXIT_LOT:
+        case VehiclePhase::TO_END:       return "exit";
+        case VehiclePhase::DONE:         return nullptr;
     }
-
-    v->active = false;
-    v->sendUpdate();
-
-    delete args;
     return nullptr;
 }
 
-// Thread function for F11 vehicles (start at right, can use left parking lot)
-void* f11VehicleThreadFunc(void* arg) {
-    ThreadArgs* args = (ThreadArgs*)arg;
-    Vehicle* v = args->vehicle;
+static int advanceTrip(ThreadArgs* args, bool blockForSpot);
 
-    float stopLineX = args->stopLineX; // F11 stop line at 960
-    float targetX = v->endX;
-    float targetY = v->endY;
-
-    // Phase 1: Move to Stop Line
-    while (!moveTowards(v->x, v->y, stopLineX, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+int stepVehicle(ThreadArgs* args, bool blockForSpot) {
+    Vehicle* v = args->vehicle;
+    if (!traceEnabled) {
+        int waitMs = advanceTrip(args, blockForSpot);
+        v->clockMs += waitMs;
+        return waitMs;
     }
 
-    // Phase 2: Check Light
-    while (true) {
-        pthread_mutex_lock(args->lightMutex);
-        TrafficLightState state = *(args->lightState);
-        pthread_mutex_unlock(args->lightMutex);
-
-        if (state == TrafficLightState::GREEN || 
-            v->type == VehicleType::AMBULANCE || 
-            v->type == VehicleType::FIRETRUCK) {
-            break;
-        }
-        usleep(100000);
+    const char* before = phaseSpanName(v->phase);
+    int waitMs = advanceTrip(args, blockForSpot);
+    v->clockMs += waitMs;
+    const char* after = phaseSpanName(v->phase);
+    if (after != before) {
+        if (before != nullptr) traceAsyncEnd(before, "vehicle", v->id);
+        if (after != nullptr) traceAsyncBegin(after, "vehicle", v->id);
     }
+    return waitMs;
+}
 
-    // Phase 3: Cross Intersection or Park at left parking lot
-    bool willPark = (v->parkingLot != nullptr) && 
-                    (v->type == VehicleType::CAR || v->type == VehicleType::BIKE);
-
-    if (willPark) {
-        // Move towards left parking queue area
-        float queueX = 900.0f;
-        float queueY = 320.0f;
-        while (!moveTowards(v->x, v->y, queueX, queueY, v->speed)) {
-            v->sendUpdate();
-            usleep(VEHICLE_SPEED_MS * 1000);
-        }
-
-        int queueIdx = v->parkingLot->enterQueue();
-
-        if (queueIdx != -1) {
-            v->isInQueue = true;
-            v->queueIndex = queueIdx;
-
-            // Left parking queue position (mirrored from right)
-            float queueBoxX = 775.0f - queueIdx * 40.0f;
-            float queueBoxY = 325.0f;
+static int advanceTrip(ThreadArgs* args, bool blockForSpot) {
+    Vehicle* v = args->vehicle;
+    const TripPlan& plan = args->plan;
 
-            while (!moveTowards(v->x, v->y, queueBoxX, queueBoxY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
+    while (true) {
+        switch (v->phase) {
+            case VehiclePhase::APPROACH_HOLD:
+                if (plan.holdNode < 0) {
+                    v->phase = VehiclePhase::APPROACH;
+                    break;
+                }
+                if (!advanceLeg(v, plan.holdNode)) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                recordArrival(args, plan.holdJunction);
+                v->phase = VehiclePhase::HOLD;
+                break;
+
+            case VehiclePhase::HOLD:
+                if (!mayCross(args, plan.holdJunction, plan.stopNode)) {
+                    if (v->velocity != 0) holdStill(v);
+                    return args->reservations != nullptr ? VEHICLE_SPEED_MS : LIGHT_POLL_MS;
+                }
+                v->releasedMs = v->clockMs;
+                v->phase = VehiclePhase::APPROACH;
+                break;
+
+            case VehiclePhase::APPROACH:
+                if (!advanceLeg(v, plan.stopNode)) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                recordArrival(args, plan.junction);
+                if (v->releasedMs >= 0) {
+                    metricAdd(Metric::PLATOON_TRIPS);
+                    metricAdd(Metric::PLATOON_TRAVEL_MS, v->clockMs - v->releasedMs);
+                }
+                v->phase = VehiclePhase::WAIT_LIGHT;
+                break;
+
+            case VehiclePhase::WAIT_LIGHT: {
+                bool willPark = (v->parkingLot != nullptr) && plan.queueNode != -1 &&
+                                (v->type == VehicleType::CAR || v->type == VehicleType::BIKE);
+                if (!mayCross(args, plan.junction, willPark ? plan.queueNode : plan.endNode)) {
+                    if (v->velocity != 0) holdStill(v);
+                    if (plan.reportWhileWaiting) v->sendUpdate();
+                    // A rejected request is retried at the next step
+                    return args->reservations != nullptr ? VEHICLE_SPEED_MS : LIGHT_POLL_MS;
+                }
+                v->phase = willPark ? VehiclePhase::TO_QUEUE : VehiclePhase::TO_END;
+                break;
             }
-            v->sendUpdate();
-
-            int spotIndex = v->parkingLot->waitForSpot(queueIdx);
-
-            v->isInQueue = false;
-            v->queueIndex = -1;
 
-            // Left parking lot spot positions (mirrored)
-            int row = spotIndex / 5;
-            int col = spotIndex % 5;
-            float parkX = 970.0f - col * 40.0f;
-            float parkY = 185.0f + row * 60.0f;
+            case VehiclePhase::TO_QUEUE: {
+                if (!advanceLeg(v, plan.queueNode)) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                int queueIdx = v->parkingLot->enterQueue();
+                if (queueIdx == -1) {
+                    v->phase = VehiclePhase::TO_END; // Queue full, skip parking
+                    break;
+                }
+                v->isInQueue = true;
+                v->queueIndex = queueIdx;
+                v->phase = VehiclePhase::TO_QUEUE_BOX;
+                break;
+            }
 
-            while (!moveTowards(v->x, v->y, parkX, parkY, v->speed)) {
+            case VehiclePhase::TO_QUEUE_BOX: {
+                if (!advanceLeg(v, plan.boxNodes[v->queueIndex])) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
                 v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
+                v->phase = VehiclePhase::WAIT_SPOT;
+                break;
             }
 
-            v->sendUpdate(true);
-            sleep(PARKING_DURATION_SECONDS);
+            case VehiclePhase::WAIT_SPOT: {
+                int spotIndex = blockForSpot ? v->parkingLot->waitForSpot(v->queueIndex)
+                                             : v->parkingLot->tryWaitForSpot(v->queueIndex);
+                if (spotIndex == -1) {
+                    if (v->velocity != 0) holdStill(v);
+                    return VEHICLE_SPEED_MS;
+                }
+                v->isInQueue = false;
+                v->queueIndex = -1;
+                v->spotIndex = spotIndex;
+                v->phase = VehiclePhase::TO_SPOT;
+                break;
+            }
 
-            v->parkingLot->leave(spotIndex);
+            case VehiclePhase::TO_SPOT: {
+                if (!advanceLeg(v, plan.spotNodes[v->spotIndex])) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                v->sendUpdate(true);
+                holdStill(v);
+                v->phase = VehiclePhase::PARKED;
+                return PARKING_DURATION_SECONDS * 1000;
+            }
 
-            // Exit from parking back to road
-            while (!moveTowards(v->x, v->y, 900.0f, 400.0f, v->speed)) {
+            case VehiclePhase::PARKED:
+                v->parkingLot->leave(v->spotIndex);
+                v->spotIndex = -1;
+                v->phase = VehiclePhase::EXIT_LOT;
+                break;
+
+            case VehiclePhase::EXIT_LOT:
+                if (!advanceLeg(v, plan.exitNode)) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                v->phase = VehiclePhase::TO_END;
+                break;
+
+            case VehiclePhase::TO_END:
+                if (!advanceLeg(v, plan.endNode)) {
+                    v->sendUpdate();
+                    return VEHICLE_SPEED_MS;
+                }
+                finishTimedEdge(v);
+                roadLanes().leave(v);
+                v->active = false;
                 v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-        }
-    }
+                v->phase = VehiclePhase::DONE;
+                return -1;
 
-    // Phase 4: Move to End (left side)
-    while (!moveTowards(v->x, v->y, targetX, targetY, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
+            case VehiclePhase::DONE:
+                return -1;
+        }
     }
-
-    v->active = false;
-    v->sendUpdate();
-
-    delete args;
-    return nullptr;
 }
 
-// Thread function for F11 local vehicles (start at left, going right, can use left parking lot)
-void* f11LocalVehicleThreadFunc(void* arg) {
+void* vehicleThreadFunc(void* arg) {
     ThreadArgs* args = (ThreadArgs*)arg;
-    Vehicle* v = args->vehicle;
+    traceAsyncBegin(phaseSpanName(args->vehicle->phase), "vehicle", args->vehicle->id);
+    metricAdd(Metric::VEHICLES_ACTIVE);
 
-    float stopLineX = args->stopLineX; // F11 stop line at 840
-    float targetX = v->endX;
-    float targetY = v->endY;
-
-    // Phase 1: Move to Stop Line (before F11 intersection)
-    while (!moveTowards(v->x, v->y, stopLineX, v->y, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
-    }
-
-    // Phase 2: Check Light
     while (true) {
-        pthread_mutex_lock(args->lightMutex);
-        TrafficLightState state = *(args->lightState);
-        pthread_mutex_unlock(args->lightMutex);
-
-        if (state == TrafficLightState::GREEN || 
-            v->type == VehicleType::AMBULANCE || 
-            v->type == VehicleType::FIRETRUCK) {
+        // Between steps the vehicle may have crossed into another domain,
+        // and another process drives it now
+        if (handOffVehicle(args)) break;
+        int waitMs = stepVehicle(args, true);
+        if (waitMs < 0) {
+            metricAdd(Metric::VEHICLES_COMPLETED);
             break;
         }
-        usleep(100000);
+        simClock().sleepMs(waitMs);
     }
 
-    // Phase 3: Cross Intersection or Park at left parking lot
-    bool willPark = (v->parkingLot != nullptr) && 
-                    (v->type == VehicleType::CAR || v->type == VehicleType::BIKE);
-
-    if (willPark) {
-        // Move towards left parking queue area (above F11 intersection)
-        float queueX = 900.0f;
-        float queueY = 320.0f;
-        while (!moveTowards(v->x, v->y, queueX, queueY, v->speed)) {
-            v->sendUpdate();
-            usleep(VEHICLE_SPEED_MS * 1000);
-        }
-
-        int queueIdx = v->parkingLot->enterQueue();
-
-        if (queueIdx != -1) {
-            v->isInQueue = true;
-            v->queueIndex = queueIdx;
-
-            // Left parking queue position
-            float queueBoxX = 775.0f - queueIdx * 40.0f;
-            float queueBoxY = 325.0f;
-
-            while (!moveTowards(v->x, v->y, queueBoxX, queueBoxY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-            v->sendUpdate();
-
-            int spotIndex = v->parkingLot->waitForSpot(queueIdx);
-
-            v->isInQueue = false;
-            v->queueIndex = -1;
-
-            // Left parking lot spot positions
-            int row = spotIndex / 5;
-            int col = spotIndex % 5;
-            float parkX = 970.0f - col * 40.0f;
-            float parkY = 185.0f + row * 60.0f;
-
-            while (!moveTowards(v->x, v->y, parkX, parkY, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-
-            v->sendUpdate(true);
-            sleep(PARKING_DURATION_SECONDS);
-
-            v->parkingLot->leave(spotIndex);
-
-            // Exit from parking back to road
-            while (!moveTowards(v->x, v->y, 900.0f, 400.0f, v->speed)) {
-                v->sendUpdate();
-                usleep(VEHICLE_SPEED_MS * 1000);
-            }
-        }
-    }
-
-    // Phase 4: Move to End (right side)
-    while (!moveTowards(v->x, v->y, targetX, targetY, v->speed)) {
-        v->sendUpdate();
-        usleep(VEHICLE_SPEED_MS * 1000);
-    }
-
-    v->active = false;
-    v->sendUpdate();
-
+    metricAdd(Metric::VEHICLES_ACTIVE, -1);
+    // The thread is detached and the controller keeps no list, so the
+    // vehicle is ours to free, whether its trip ended or it was handed off
+    delete args->vehicle;
     delete args;
     return nullptr;
 }
@@ -9,7 +9,45 @@
 
 #include "simulation_types.h"
 #include "parking.h"
+#include "roadnet.h"
+#include "roadgraph.h"
+#include "reservation.h"
 #include <pthread.h>
+#include <vector>
+
+// Where a vehicle is along its trip through an intersection
+enum class VehiclePhase {
+    APPROACH_HOLD, // Driving to the stop line of an upstream light (commuters pass F11)
+    HOLD,          // Stopped there waiting for GREEN
+    APPROACH,      // Driving to the stop line
+    WAIT_LIGHT,    // Stopped at the stop line waiting for GREEN
+    TO_QUEUE,      // Driving to the parking queue entry
+    TO_QUEUE_BOX,  // Driving into the assigned queue box
+    WAIT_SPOT,     // Waiting in the queue for a free spot
+    TO_SPOT,       // Driving into the assigned spot
+    PARKED,        // Parked for PARKING_DURATION_SECONDS
+    EXIT_LOT,      // Driving from the spot back to the road
+    TO_END,        // Driving to the end of the road
+    DONE
+};
+
+// Route of one kind of trip as road graph nodes, compiled from a
+// NetSpawn. Each leg drives from the current node to the next one.
+struct TripPlan {
+    int spawn;         // Its NetSpawn, as an index into roadNetwork().spawns
+    int startNode;
+    int holdNode;      // Upstream stop line to obey first, or -1 for none
+    int holdJunction;  // Its intersection's index, or -1
+    int stopNode;      // Stop line of the controlling light
+    int junction;      // Its intersection, as an index into roadNetwork().intersections
+    Direction direction; // Direction the trip enters the junction in
+    int endNode;
+    int queueNode;     // Where the vehicle asks the lot for a queue slot
+    int boxNodes[PARKING_QUEUE_SIZE];
+    int spotNodes[PARKING_CAPACITY];
+    int exitNode;      // Where the vehicle rejoins the road after parking
+    bool reportWhileWaiting; // Keep sending updates while held at the light
+};
 
 class Vehicle {
 public:
@@ -25,6 +63,33 @@ public:
     bool isInQueue;
     int queueIndex;
     bool isLeftParking; // true if using left (F11) parking lot
+    int intersectionId; // Controller that spawned the vehicle
+    VehiclePhase phase;
+    int spotIndex;
+
+    // Position in the road graph: at `node` while edge is -1, else
+    // `offset` along `edge`, which is route[routePos]
+    int node;
+    int edge;
+    float offset;
+    std::vector<int> route; // Edges of the current leg
+    int routePos;
+
+    // Simulated time of the trip so far, advanced by stepVehicle(), and
+    // the edge whose traversal is being timed for the travel estimates
+    long long clockMs;
+    int timedEdge;
+    long long timedSinceMs;
+    // When the upstream light let the vehicle go, -1 until then; its
+    // drive to the next stop line is timed as a platoon's
+    long long releasedMs;
+
+    // Car following: current speed in pixels per step (up to `speed`) and
+    // the lane (edge) holding the vehicle, which it keeps while waiting at
+    // the lane's end node
+    float velocity;
+    int lane;
+    int laneIndex;
 
     Vehicle(int id, VehicleType type, int pipeFd, ParkingLot* lot = nullptr);
 
@@ -35,19 +100,49 @@ public:
 // Thread arguments structure
 struct ThreadArgs {
     Vehicle* vehicle;
-    pthread_mutex_t* lightMutex;
-    TrafficLightState* lightState;
-    float stopLineX;
-    bool isCommuter;
+    TripPlan plan;      // Its lights are read from roadLights()
+    // Cross the junction by reservation instead of by the light, or nullptr
+    IntersectionManager* reservations;
+    // Domain whose controller drives the vehicle (see migration.h), or -1
+    // if it never changes hands
+    int domain;
 };
 
-// Movement helper function
+// Trip plan for vehicles entering at `spawn`: its stop line, optional hold
+// point and the lot of its intersection, as nodes of `graph`
+TripPlan compileTripPlan(const RoadNetwork& net, const RoadGraph& graph, const NetSpawn& spawn);
+
+// Trip plan of the named spawn point in roadNetwork(). Exits if unknown.
+TripPlan tripPlanFor(const char* spawnName);
+
+// Node the leg of v's phase drives to, or -1 if v is not driving one
+int legTarget(const TripPlan& plan, const Vehicle* v);
+
+// Put a new vehicle on the start node of its trip
+void placeAtStart(Vehicle* v, const TripPlan& plan);
+
+// Drive `v` one step of v->velocity along the graph towards `target`,
+// never closer to its leader than IDM_MIN_GAP. Returns true once it is
+// there. Each edge left is reported to roadTravelTimes();
+// on entering an edge the vehicle repairs the route ahead if the expected
+// delay there exceeds the reroute threshold and budget is left.
+bool advanceLeg(Vehicle* v, int target);
+
+// Trace span name of a phase ("approach", "wait_light", "queue", "park",
+// "exit"), or nullptr once the trip is DONE
+const char* phaseSpanName(VehiclePhase phase);
+
+// Straight-line movement helper, recomputing direction and length per call
 bool moveTowards(float& currX, float& currY, float targetX, float targetY, float speed);
 
-// Thread functions
+// Advance a vehicle by one step of its trip. Returns how many milliseconds
+// to wait before the next step, or -1 once the trip is over. With
+// blockForSpot the step sleeps on the parking semaphore instead of polling.
+int stepVehicle(ThreadArgs* args, bool blockForSpot);
+
+// Thread function driving a vehicle through its TripPlan, or until it is
+// handed off to another domain's controller. Frees the ThreadArgs and
+// the vehicle when it ends.
 void* vehicleThreadFunc(void* arg);
-void* commuterThreadFunc(void* arg);
-void* f11VehicleThreadFunc(void* arg);      // For F11 vehicles from right, using left parking
-void* f11LocalVehicleThreadFunc(void* arg); // For F11 vehicles from left, using left parking
 
 #endif // VEHICLE_H
@@ -5,7 +5,11 @@
  */
 
 #include "visualizer.h"
+#include "visualizer_state.h"
+#include "roadnet.h"
+#include "trace.h"
 #include "simulation_types.h"
+#include "command.h"
 
 #include <SFML/Graphics.hpp>
 #include <SFML/System.hpp>
@@ -15,22 +19,31 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <fcntl.h>
 #include <unistd.h>
 
 using namespace std;
 
-void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11) {
+// Drawn sizes of parking spots and queue boxes, centred on the network's
+// spot and queue box positions
+const float SPOT_WIDTH = 30.0f;
+const float SPOT_HEIGHT = 50.0f;
+const float QUEUE_BOX_WIDTH = 35.0f;
+const float QUEUE_BOX_HEIGHT = 25.0f;
+
+void visualizerProcess(const std::vector<int>& dataPipes, const std::vector<int>& cmdPipes) {
     sf::RenderWindow window(sf::VideoMode(WINDOW_WIDTH, WINDOW_HEIGHT), WINDOW_TITLE);
     window.setFramerateLimit(60);
 
-    setNonBlocking(pipeF10);
-    setNonBlocking(pipeF11);
+    for (int fd : dataPipes) {
+        setNonBlocking(fd);
+    }
 
-    std::map<int, VehicleState> vehicles;
-    TrafficLightState lightF10 = TrafficLightState::RED;
-    TrafficLightState lightF11 = TrafficLightState::RED;
-    int parkingQueueCountF10 = 0;
-    int parkingQueueCountF11 = 0;
+    VisualizerState state;
+    const RoadNetwork& net = roadNetwork();
 
     // Notification system
     std::string notificationTitle = "";
@@ -48,8 +61,6 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
         sf::RectangleShape shape;
         std::string label;
         ScenarioCommand command;
-        bool sendToF10;
-        bool sendToF11;
     };
 
     std::vector<Button> buttons;
@@ -57,43 +68,56 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
     // Button 1: Green Wave
     Button btn1;
     btn1.shape.setSize(sf::Vector2f(160, 50));
-    btn1.shape.setPosition(150, 520);
+    btn1.shape.setPosition(150, 710);
     btn1.shape.setFillColor(sf::Color(0, 150, 0));
     btn1.shape.setOutlineColor(sf::Color::White);
     btn1.shape.setOutlineThickness(3);
     btn1.label = "1. Green Wave";
     btn1.command = ScenarioCommand::GREEN_WAVE;
-    btn1.sendToF10 = true;
-    btn1.sendToF11 = false;
     buttons.push_back(btn1);
 
     // Button 2: Full Parking
     Button btn2;
     btn2.shape.setSize(sf::Vector2f(160, 50));
-    btn2.shape.setPosition(350, 520);
+    btn2.shape.setPosition(350, 710);
     btn2.shape.setFillColor(sf::Color(180, 180, 0));
     btn2.shape.setOutlineColor(sf::Color::White);
     btn2.shape.setOutlineThickness(3);
     btn2.label = "2. Full Parking";
     btn2.command = ScenarioCommand::PARKING_FULL;
-    btn2.sendToF10 = true;
-    btn2.sendToF11 = true;
     buttons.push_back(btn2);
 
     // Button 3: Chaos Mode
     Button btn3;
     btn3.shape.setSize(sf::Vector2f(160, 50));
-    btn3.shape.setPosition(550, 520);
+    btn3.shape.setPosition(550, 710);
     btn3.shape.setFillColor(sf::Color(180, 0, 0));
     btn3.shape.setOutlineColor(sf::Color::White);
     btn3.shape.setOutlineThickness(3);
     btn3.label = "3. Chaos Mode";
     btn3.command = ScenarioCommand::GRIDLOCK;
-    btn3.sendToF10 = true;
-    btn3.sendToF11 = true;
     buttons.push_back(btn3);
 
+    int frameCount = 0;
+
+    // Headless consumers of the latency numbers read this file
+    const char* statsPath = getenv("TRAFFIC_STATS");
+
+    // Load tests write command frames (see traffic_cmd) into this FIFO;
+    // they go to every controller, which picks those addressed to it
+    const char* commandsPath = getenv("TRAFFIC_COMMANDS");
+    int commandsFd = -1;
+    if (commandsPath != nullptr) {
+        // Opened read-write so the FIFO never reports end of file between
+        // writers
+        commandsFd = open(commandsPath, O_RDWR | O_NONBLOCK);
+        if (commandsFd == -1) perror("Command FIFO open failed");
+    }
+    CommandReader forwarded;
+
     while (window.isOpen()) {
+        traceBegin("frame_build", "visualizer");
+
         sf::Event event;
         while (window.pollEvent(event)) {
             if (event.type == sf::Event::Closed)
@@ -102,20 +126,20 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
             // Handle button clicks
             if (event.type == sf::Event::MouseButtonPressed && event.mouseButton.button == sf::Mouse::Left) {
                 sf::Vector2f mousePos(event.mouseButton.x, event.mouseButton.y);
+                bool onButton = false;
 
                 for (auto& btn : buttons) {
                     if (btn.shape.getGlobalBounds().contains(mousePos)) {
+                        onButton = true;
                         cout << "[UI] Button clicked: " << btn.label << endl;
 
-                        CommandMessage cmdMsg;
-                        cmdMsg.magic = CMD_MAGIC;
-                        cmdMsg.command = btn.command;
+                        Command cmd = makeCommand(CommandType::SCENARIO);
+                        cmd.params.scenario.scenario = (int32_t)btn.command;
 
-                        if (btn.sendToF10) {
-                            write(cmdPipeF10, &cmdMsg, sizeof(cmdMsg));
-                        }
-                        if (btn.sendToF11) {
-                            write(cmdPipeF11, &cmdMsg, sizeof(cmdMsg));
+                        // Every controller gets the command; its config
+                        // decides whether it spawns anything
+                        for (int fd : cmdPipes) {
+                            sendCommand(fd, cmd);
                         }
 
                         // Set notification
@@ -124,18 +148,30 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
 
                         if (btn.command == ScenarioCommand::GREEN_WAVE) {
                             notificationTitle = "Scenario A: The Green Wave";
-                            notificationDesc = "Spawning Ambulance at F10 destined for F11.\nF10 signals F11 via Pipe. F11 preempts light to GREEN.";
+                            notificationDesc = "Spawning Ambulance at F10 destined for F11.\nEach light on its route turns GREEN ahead of it.";
                         } else if (btn.command == ScenarioCommand::PARKING_FULL) {
                             notificationTitle = "Scenario B: Parking Saturation";
                             notificationDesc = "Spawning 16 Cars at F10 & F11 for parking.\nFilling both lots: 10 Spots + 5 Queue each.";
                         } else if (btn.command == ScenarioCommand::GRIDLOCK) {
                             notificationTitle = "Scenario C: Intersection Gridlock";
-                            notificationDesc = "Spawning cars from all directions at F10 & F11.\nMutex locks prevent collisions.";
+                            notificationDesc = "Spawning cars from all directions at F10 & F11.\nCars queue in their lanes while the lights take turns.";
                         }
 
                         btn.shape.setFillColor(sf::Color::White);
                     }
                 }
+
+                // Anywhere else selects the vehicle under the cursor
+                int picked = onButton ? -1 : pickVehicle(state, mousePos.x, mousePos.y);
+                if (picked != -1) {
+                    static const char* const TYPE_NAMES[] = {"Ambulance", "Firetruck", "Bus", "Car", "Bike", "Tractor"};
+                    const VehicleState& v = state.vehicles[picked];
+                    showNotification = true;
+                    notificationClock.restart();
+                    notificationTitle = std::string("Vehicle #") + std::to_string(v.id) + ": " + TYPE_NAMES[(int)v.type];
+                    notificationDesc = std::string("Position (") + std::to_string((int)v.x) + ", " + std::to_string((int)v.y) + ")" +
+                                       (v.isParked ? "\nParked" : v.isInQueue ? "\nWaiting for a parking spot" : "");
+                }
             }
         }
 
@@ -144,146 +180,116 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
         buttons[1].shape.setFillColor(sf::Color(180, 180, 0));
         buttons[2].shape.setFillColor(sf::Color(180, 0, 0));
 
-        // Read from pipes
-        PipeMessage msg;
-        int bytesRead;
-
-        while ((bytesRead = read(pipeF10, &msg, sizeof(msg))) > 0) {
-            if (bytesRead == sizeof(msg) && msg.magic == MSG_MAGIC) {
-                if (msg.type == PipeMessage::VEHICLE_UPDATE) {
-                    vehicles[msg.data.vehicle.id] = msg.data.vehicle;
-                } else if (msg.type == PipeMessage::LIGHT_UPDATE) {
-                    lightF10 = msg.data.light.state;
-                } else if (msg.type == PipeMessage::PARKING_UPDATE) {
-                    if (msg.data.parking.intersectionId == 10) {
-                        parkingQueueCountF10 = msg.data.parking.waitingCount;
-                    }
-                }
+        if (commandsFd != -1) {
+            forwarded.fill(commandsFd);
+            Command cmd;
+            while (forwarded.next(cmd)) {
+                for (int fd : cmdPipes) sendCommand(fd, cmd);
             }
         }
 
-        while ((bytesRead = read(pipeF11, &msg, sizeof(msg))) > 0) {
-            if (bytesRead == sizeof(msg) && msg.magic == MSG_MAGIC) {
-                if (msg.type == PipeMessage::VEHICLE_UPDATE) {
-                    vehicles[msg.data.vehicle.id] = msg.data.vehicle;
-                } else if (msg.type == PipeMessage::LIGHT_UPDATE) {
-                    lightF11 = msg.data.light.state;
-                } else if (msg.type == PipeMessage::PARKING_UPDATE) {
-                    if (msg.data.parking.intersectionId == 11) {
-                        parkingQueueCountF11 = msg.data.parking.waitingCount;
-                    }
-                }
-            }
+        // Read from pipes
+        for (int fd : dataPipes) {
+            drainPipe(fd, state);
         }
+        indexVehicles(state);
+
+        traceEnd("frame_build", "visualizer");
+        traceBegin("frame_draw", "visualizer");
 
         window.clear(sf::Color(50, 50, 50));
 
         // Draw Roads
-        sf::RectangleShape road(sf::Vector2f(WINDOW_WIDTH, 100));
-        road.setPosition(0, 350);
-        road.setFillColor(sf::Color(30, 30, 30));
-        window.draw(road);
-
-        // Draw Intersections
-        sf::RectangleShape intersectionF10(sf::Vector2f(100, 100));
-        intersectionF10.setPosition(250, 350);
-        intersectionF10.setFillColor(sf::Color(20, 20, 20));
-        window.draw(intersectionF10);
-
-        sf::RectangleShape intersectionF11(sf::Vector2f(100, 100));
-        intersectionF11.setPosition(850, 350);
-        intersectionF11.setFillColor(sf::Color(20, 20, 20));
-        window.draw(intersectionF11);
-
-        // Draw Parking Lot (Right - F10)
-        sf::RectangleShape parkingLot(sf::Vector2f(200, 150));
-        parkingLot.setPosition(200, 150);
-        parkingLot.setFillColor(sf::Color(40, 40, 40));
-        parkingLot.setOutlineColor(sf::Color::White);
-        parkingLot.setOutlineThickness(2);
-        window.draw(parkingLot);
-
-        // Draw Parking Spots (Right - F10)
-        for (int i = 0; i < 10; i++) {
-            int row = i / 5;
-            int col = i % 5;
-            sf::RectangleShape spot(sf::Vector2f(30, 50));
-            spot.setPosition(215 + col * 40, 160 + row * 60);
-            spot.setFillColor(sf::Color(60, 60, 60));
-            spot.setOutlineColor(sf::Color::White);
-            spot.setOutlineThickness(1);
-            window.draw(spot);
+        for (const NetLink& link : net.links) {
+            float dx = link.toX - link.fromX;
+            float dy = link.toY - link.fromY;
+            sf::RectangleShape road(sf::Vector2f(std::sqrt(dx * dx + dy * dy), link.width));
+            road.setOrigin(0, link.width / 2);
+            road.setPosition(link.fromX, link.fromY);
+            road.setRotation(std::atan2(dy, dx) * 180.0f / 3.14159265f);
+            road.setFillColor(sf::Color(30, 30, 30));
+            window.draw(road);
         }
 
-        // Draw Waiting Queue (Right - F10)
-        for (int i = 0; i < PARKING_QUEUE_SIZE; i++) {
-            sf::RectangleShape queueSlot(sf::Vector2f(35, 25));
-            queueSlot.setPosition(410 + i * 40, 312);
-            queueSlot.setFillColor(sf::Color(80, 40, 40));
-            queueSlot.setOutlineColor(sf::Color::White);
-            queueSlot.setOutlineThickness(1);
-            window.draw(queueSlot);
+        // Draw Intersections
+        for (const NetIntersection& in : net.intersections) {
+            sf::RectangleShape box(sf::Vector2f(in.size, in.size));
+            box.setPosition(in.centerX - in.size / 2, in.centerY - in.size / 2);
+            box.setFillColor(sf::Color(20, 20, 20));
+            window.draw(box);
         }
 
-        // Draw Queue Label (Right - F10)
-        if (fontLoaded) {
-            sf::Text queueLabel("Queue (" + std::to_string(parkingQueueCountF10) + "/5):", font, 14);
-            queueLabel.setPosition(320, 315);
-            queueLabel.setFillColor(sf::Color::White);
-            window.draw(queueLabel);
-        }
+        // Draw Parking Lots, their spots and waiting queues. Mirrored lots
+        // (negative queue step) get a blue queue and the label on the right.
+        for (const NetLot& lot : net.lots) {
+            bool mirrored = lot.queueBoxStep < 0;
+
+            sf::RectangleShape lotShape(sf::Vector2f(lot.width, lot.height));
+            lotShape.setPosition(lot.x, lot.y);
+            lotShape.setFillColor(sf::Color(40, 40, 40));
+            lotShape.setOutlineColor(sf::Color::White);
+            lotShape.setOutlineThickness(2);
+            window.draw(lotShape);
+
+            for (int i = 0; i < lot.columns * lot.rows; i++) {
+                sf::RectangleShape spot(sf::Vector2f(SPOT_WIDTH, SPOT_HEIGHT));
+                spot.setPosition(net.spotX[lot.firstSpot + i] - SPOT_WIDTH / 2,
+                                 net.spotY[lot.firstSpot + i] - SPOT_HEIGHT / 2);
+                spot.setFillColor(sf::Color(60, 60, 60));
+                spot.setOutlineColor(sf::Color::White);
+                spot.setOutlineThickness(1);
+                window.draw(spot);
+            }
 
-        // Draw Parking Lot (Left - F11)
-        sf::RectangleShape parkingLotLeft(sf::Vector2f(200, 150));
-        parkingLotLeft.setPosition(800, 150);
-        parkingLotLeft.setFillColor(sf::Color(40, 40, 40));
-        parkingLotLeft.setOutlineColor(sf::Color::White);
-        parkingLotLeft.setOutlineThickness(2);
-        window.draw(parkingLotLeft);
-
-        // Draw Parking Spots (Left - F11)
-        for (int i = 0; i < 10; i++) {
-            int row = i / 5;
-            int col = i % 5;
-            sf::RectangleShape spotLeft(sf::Vector2f(30, 50));
-            spotLeft.setPosition(955 - col * 40, 160 + row * 60);
-            spotLeft.setFillColor(sf::Color(60, 60, 60));
-            spotLeft.setOutlineColor(sf::Color::White);
-            spotLeft.setOutlineThickness(1);
-            window.draw(spotLeft);
-        }
+            for (int i = 0; i < PARKING_QUEUE_SIZE; i++) {
+                sf::RectangleShape queueSlot(sf::Vector2f(QUEUE_BOX_WIDTH, QUEUE_BOX_HEIGHT));
+                queueSlot.setPosition(net.queueBoxX[lot.firstQueueBox + i] - QUEUE_BOX_WIDTH / 2,
+                                      lot.queueBoxY - QUEUE_BOX_HEIGHT / 2);
+                queueSlot.setFillColor(mirrored ? sf::Color(40, 40, 80) : sf::Color(80, 40, 40));
+                queueSlot.setOutlineColor(sf::Color::White);
+                queueSlot.setOutlineThickness(1);
+                window.draw(queueSlot);
+            }
 
-        // Draw Waiting Queue (Left - F11)
-        for (int i = 0; i < PARKING_QUEUE_SIZE; i++) {
-            sf::RectangleShape queueSlotLeft(sf::Vector2f(35, 25));
-            queueSlotLeft.setPosition(760 - i * 40, 312);
-            queueSlotLeft.setFillColor(sf::Color(40, 40, 80));
-            queueSlotLeft.setOutlineColor(sf::Color::White);
-            queueSlotLeft.setOutlineThickness(1);
-            window.draw(queueSlotLeft);
+            if (fontLoaded) {
+                std::string count = std::to_string(state.parkingQueueCounts[lot.intersectionId]) +
+                                    "/" + std::to_string(PARKING_QUEUE_SIZE);
+                sf::Text queueLabel(mirrored ? ":(" + count + ") Queue" : "Queue (" + count + "):", font, 14);
+                float labelX = mirrored ? lot.queueBoxX + QUEUE_BOX_WIDTH / 2 + 12
+                                        : lot.queueBoxX - QUEUE_BOX_WIDTH / 2 - 87;
+                queueLabel.setPosition(labelX, lot.queueBoxY - 10);
+                queueLabel.setFillColor(sf::Color::White);
+                window.draw(queueLabel);
+            }
         }
 
-        // Draw Queue Label (Left - F11)
-        if (fontLoaded) {
-            sf::Text queueLabelLeft(":(" + std::to_string(parkingQueueCountF11) + "/5) Queue", font, 14);
-            queueLabelLeft.setPosition(805, 315);
-            queueLabelLeft.setFillColor(sf::Color::White);
-            window.draw(queueLabelLeft);
+        // Draw Traffic Lights: one head per approach, side by side, each
+        // labelled with the side its traffic arrives from
+        static const char* const approachLetters[DIRECTION_COUNT] = {"N", "E", "W", "S"};
+        sf::CircleShape lightShape(8);
+        for (const NetIntersection& in : net.intersections) {
+            const TrafficLightUpdate& lights = state.lights[in.id];
+            float headX = in.lightX;
+            for (int d = 0; d < DIRECTION_COUNT; ++d) {
+                if (!(in.approaches & directionBit((Direction)d))) continue;
+                sf::Color color = sf::Color::Red;
+                if (lights.states[d] == TrafficLightState::GREEN) color = sf::Color::Green;
+                else if (lights.states[d] == TrafficLightState::YELLOW) color = sf::Color::Yellow;
+                lightShape.setPosition(headX, in.lightY);
+                lightShape.setFillColor(color);
+                window.draw(lightShape);
+                if (fontLoaded) {
+                    sf::Text letter(approachLetters[d], font, 10);
+                    letter.setPosition(headX + 4, in.lightY + 17);
+                    letter.setFillColor(sf::Color::White);
+                    window.draw(letter);
+                }
+                headX += 20;
+            }
         }
 
-        // Draw Traffic Lights
-        sf::CircleShape lightShape(15);
-
-        lightShape.setPosition(260, 320);
-        lightShape.setFillColor(lightF10 == TrafficLightState::GREEN ? sf::Color::Green : sf::Color::Red);
-        window.draw(lightShape);
-
-        lightShape.setPosition(860, 320);
-        lightShape.setFillColor(lightF11 == TrafficLightState::GREEN ? sf::Color::Green : sf::Color::Red);
-        window.draw(lightShape);
-
         // Draw Vehicles
-        for (auto& pair : vehicles) {
+        for (auto& pair : state.vehicles) {
             VehicleState& v = pair.second;
             if (!v.isActive) continue;
 
@@ -294,13 +300,8 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
             if (v.isInQueue && v.queueIndex >= 0 && v.queueIndex < PARKING_QUEUE_SIZE) {
                 vehicleShape.setSize(sf::Vector2f(30, 18));
                 vehicleShape.setOrigin(15, 9);
-                if (v.isLeftParking) {
-                    // Left parking queue (F11)
-                    vehicleShape.setPosition(777.0f - v.queueIndex * 40.0f, 325.0f);
-                } else {
-                    // Right parking queue (F10)
-                    vehicleShape.setPosition(427.0f + v.queueIndex * 40.0f, 325.0f);
-                }
+                // Queued vehicles report their queue box centre
+                vehicleShape.setPosition(v.x, v.y);
                 vehicleShape.setRotation(0);
             } else {
                 vehicleShape.setPosition(v.x, v.y);
@@ -405,9 +406,9 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
             showNotification = false;
         }
 
-        // Draw Control Panel
-        sf::RectangleShape panelBg(sf::Vector2f(WINDOW_WIDTH, 100));
-        panelBg.setPosition(0, 500);
+        // Draw Control Panel, below the side streets
+        sf::RectangleShape panelBg(sf::Vector2f(WINDOW_WIDTH, 72));
+        panelBg.setPosition(0, 700);
         panelBg.setFillColor(sf::Color(20, 20, 50));
         panelBg.setOutlineColor(sf::Color::White);
         panelBg.setOutlineThickness(2);
@@ -425,15 +426,42 @@ void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11)
             }
         }
 
+        // Draw Telemetry Latency Overlay
+        if (fontLoaded) {
+            char latencyLine[160];
+            snprintf(latencyLine, sizeof(latencyLine),
+                     "Telemetry latency  produce->ingest p50 %.2f ms  p99 %.2f ms   "
+                     "ingest->present p50 %.2f ms  p99 %.2f ms",
+                     state.producerToIngest.percentile(0.50) / 1e6,
+                     state.producerToIngest.percentile(0.99) / 1e6,
+                     state.ingestToPresent.percentile(0.50) / 1e6,
+                     state.ingestToPresent.percentile(0.99) / 1e6);
+            sf::Text latencyText(latencyLine, font, 14);
+            latencyText.setPosition(30, 778);
+            latencyText.setFillColor(sf::Color(180, 180, 180));
+            window.draw(latencyText);
+        }
+
         // Draw Panel Title
         if (fontLoaded) {
             sf::Text panelTitle("SCENARIOS:", font, 18);
-            panelTitle.setPosition(30, 530);
+            panelTitle.setPosition(30, 722);
             panelTitle.setFillColor(sf::Color::White);
             panelTitle.setStyle(sf::Text::Bold);
             window.draw(panelTitle);
         }
 
         window.display();
+        markPresented(state, monotonicNs());
+        traceEnd("frame_draw", "visualizer");
+
+        // Once a second at 60 FPS
+        if (++frameCount % 60 == 0) {
+            traceFlush();
+            if (statsPath != nullptr) writeLatencyStats(state, statsPath);
+        }
     }
+
+    if (statsPath != nullptr) writeLatencyStats(state, statsPath);
+    if (commandsFd != -1) close(commandsFd);
 }
@@ -7,7 +7,10 @@
 #ifndef VISUALIZER_H
 #define VISUALIZER_H
 
-// Main visualizer process function
-void visualizerProcess(int pipeF10, int pipeF11, int cmdPipeF10, int cmdPipeF11);
+#include <vector>
+
+// Main visualizer process function: reads every controller's data pipe and
+// broadcasts scenario commands to every command pipe
+void visualizerProcess(const std::vector<int>& dataPipes, const std::vector<int>& cmdPipes);
 
 #endif // VISUALIZER_H
@@ -0,0 +1,83 @@
+/**
+ * visualizer_state.cpp
+ * 
+ * Decoding of controller pipe messages into VisualizerState.
+ */
+
+#include "visualizer_state.h"
+#include <cstdio>
+#include <unistd.h>
+
+bool applyPipeMessage(VisualizerState& state, const PipeMessage& msg, uint64_t ingestNs) {
+    if (msg.magic != MSG_MAGIC) {
+        return false;
+    }
+
+    // Clamp in case a producer's stamp is ahead of our clock read
+    uint64_t latency = ingestNs > msg.timestampNs ? ingestNs - msg.timestampNs : 0;
+    state.producerToIngest.record(latency);
+    state.pendingIngestNs.push_back(ingestNs);
+
+    if (msg.type == PipeMessage::VEHICLE_UPDATE) {
+        state.vehicles[msg.data.vehicle.id] = msg.data.vehicle;
+    } else if (msg.type == PipeMessage::LIGHT_UPDATE) {
+        state.lights[msg.data.light.intersectionId] = msg.data.light;
+    } else if (msg.type == PipeMessage::PARKING_UPDATE) {
+        state.parkingQueueCounts[msg.data.parking.intersectionId] = msg.data.parking.waitingCount;
+    }
+    return true;
+}
+
+int drainPipe(int fd, VisualizerState& state) {
+    PipeMessage msg;
+    int bytesRead;
+    int applied = 0;
+
+    while ((bytesRead = read(fd, &msg, sizeof(msg))) > 0) {
+        metricAdd(Metric::PIPE_BYTES_RECEIVED, bytesRead);
+        if (bytesRead == sizeof(msg) && applyPipeMessage(state, msg, monotonicNs())) {
+            metricAdd(Metric::PIPE_MESSAGES_RECEIVED);
+            applied++;
+        } else {
+            metricAdd(Metric::PIPE_MESSAGES_DROPPED);
+        }
+    }
+    return applied;
+}
+
+void indexVehicles(VisualizerState& state) {
+    state.pickIds.clear();
+    state.pickX.clear();
+    state.pickY.clear();
+    for (const auto& pair : state.vehicles) {
+        if (!pair.second.isActive) continue;
+        state.pickIds.push_back(pair.first);
+        state.pickX.push_back(pair.second.x);
+        state.pickY.push_back(pair.second.y);
+    }
+    state.vehicleHash.rebuild(state.pickX.data(), state.pickY.data(), (int)state.pickIds.size());
+}
+
+int pickVehicle(const VisualizerState& state, float x, float y) {
+    int i = state.vehicleHash.nearest(state.pickX.data(), state.pickY.data(), x, y, PICK_RADIUS);
+    return i == -1 ? -1 : state.pickIds[i];
+}
+
+void markPresented(VisualizerState& state, uint64_t presentNs) {
+    for (uint64_t ingestNs : state.pendingIngestNs) {
+        state.ingestToPresent.record(presentNs - ingestNs);
+    }
+    state.pendingIngestNs.clear();
+}
+
+void writeLatencyStats(const VisualizerState& state, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (f == nullptr) {
+        perror("Stats file open failed");
+        return;
+    }
+    fprintf(f, "{\"producer_to_ingest\": %s,\n \"ingest_to_present\": %s}\n",
+            histogramSummaryJson(state.producerToIngest).c_str(),
+            histogramSummaryJson(state.ingestToPresent).c_str());
+    fclose(f);
+}
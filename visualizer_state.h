@@ -0,0 +1,60 @@
+/**
+ * visualizer_state.h
+ * 
+ * Visualizer-side view of the simulation, rebuilt from pipe messages.
+ * Kept free of SFML so it can be benchmarked headlessly.
+ */
+
+#ifndef VISUALIZER_STATE_H
+#define VISUALIZER_STATE_H
+
+#include "simulation_types.h"
+#include "histogram.h"
+#include "spatialhash.h"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// Cell size of the picking index and how far from a vehicle a click counts
+const float PICK_CELL_SIZE = 50.0f;
+const float PICK_RADIUS = 25.0f;
+
+struct VisualizerState {
+    std::map<int, VehicleState> vehicles;
+    // Keyed by intersection id; an unseen intersection reads as all RED / 0
+    std::map<int, TrafficLightUpdate> lights;
+    std::map<int, int> parkingQueueCounts;
+
+    // Telemetry staleness: producer write -> visualizer read, and
+    // visualizer read -> frame on screen
+    LatencyHistogram producerToIngest;
+    LatencyHistogram ingestToPresent;
+    std::vector<uint64_t> pendingIngestNs; // Read but not yet presented
+
+    // Active vehicles by screen position, rebuilt each frame by indexVehicles()
+    SpatialHash vehicleHash{0, 0, WINDOW_WIDTH, WINDOW_HEIGHT, PICK_CELL_SIZE};
+    std::vector<int> pickIds;
+    std::vector<float> pickX, pickY;
+};
+
+// Apply one controller message read at ingestNs. Returns false if it is invalid.
+bool applyPipeMessage(VisualizerState& state, const PipeMessage& msg, uint64_t ingestNs);
+
+// Read and apply every message currently buffered on a non-blocking pipe.
+// Returns the number of messages applied.
+int drainPipe(int fd, VisualizerState& state);
+
+// Record ingest-to-present latency for every message applied since the
+// previous frame, now that a frame containing them is on screen
+void markPresented(VisualizerState& state, uint64_t presentNs);
+
+// Rebuild the picking index from the current vehicle positions
+void indexVehicles(VisualizerState& state);
+
+// Id of the active vehicle nearest to (x, y) within PICK_RADIUS, or -1
+int pickVehicle(const VisualizerState& state, float x, float y);
+
+// Write both latency histograms as JSON to `path`
+void writeLatencyStats(const VisualizerState& state, const char* path);
+
+#endif // VISUALIZER_STATE_H